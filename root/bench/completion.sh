@@ -0,0 +1,60 @@
+#!/bin/sh
+# Tab completion cost, measured through compgen (the same lookup the line
+# editor does): command names over a PATH of many executables, and file
+# names in one very large directory. The first lookup builds the sorted
+# index; the rest reuse it.
+#
+# usage: bench/completion.sh [executables] [files] [lookups]
+#   executables  spread over 4 PATH directories (default 20000)
+#   files        entries in the directory completed in (default 100000)
+#   lookups      completions timed after the first (default 2000)
+#
+# SHELL_BIN picks the binary (default bin/shell).
+
+EXES=${1:-20000}
+FILES=${2:-100000}
+N=${3:-2000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-complete.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+for d in 1 2 3 4; do
+    mkdir "$DIR/bin$d"
+    (cd "$DIR/bin$d" && seq -f "cmd$d-%g" 1 $((EXES / 4)) | xargs touch && chmod +x ./*)
+done
+mkdir "$DIR/big"
+(cd "$DIR/big" && seq -f "file%g" 1 "$FILES" | xargs touch)
+BINS="$DIR/bin1:$DIR/bin2:$DIR/bin3:$DIR/bin4"   # ahead of the usual PATH
+
+now() { date +%s%N; }
+
+# microseconds for the script in $1
+run() {
+    start=$(now)
+    PATH=$BINS:$PATH "$SHELL_BIN" --norc < "$1" > /dev/null 2>&1
+    echo $(( ($(now) - start) / 1000 ))
+}
+
+# $1: compgen arguments, $2: their label. Prints the first lookup and the
+# average of the next N, both in microseconds.
+measure() {
+    echo "true" > "$DIR/empty"
+    echo "compgen $1" > "$DIR/once"
+    echo "compgen $1" > "$DIR/many"
+    echo "for i in \$(seq 1 $N); do compgen $1; done" >> "$DIR/many"
+    echo "compgen $1" > "$DIR/base"
+    echo "for i in \$(seq 1 $N); do true; done" >> "$DIR/base"
+    t_empty=$(run "$DIR/empty")
+    t_once=$(run "$DIR/once")
+    t_many=$(run "$DIR/many")
+    t_base=$(run "$DIR/base")
+    printf '%-26s %12d %14d\n' "compgen $2" $((t_once - t_empty)) \
+        $(( (t_many - t_base) / N ))
+}
+
+printf '%-26s %12s %14s\n' lookup "first (us)" "cached (us)"
+measure "-c cmd3-12" "-c cmd3-12"
+measure "-c cmd" "-c cmd"
+measure "-f $DIR/big/file4242" "-f big/file4242"
+measure "-f $DIR/big/file9" "-f big/file9"
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Benchmark recursive "**" expansion: parallel walker vs a single-threaded walk.
+#
+# usage: bench/glob_walk.sh [entries] [dir]
+#   entries  approximate number of files to create (default 1000000)
+#   dir      scratch directory for the tree (default /tmp/shell-glob-bench)
+#
+# The tree is 100 top-level dirs x 10 subdirs with the files spread evenly;
+# one file in ten ends in .gz and the pattern matches ~1%. It is reused between runs when it already exists.
+
+set -e
+
+ENTRIES=${1:-1000000}
+DIR=${2:-/tmp/shell-glob-bench}
+SHELL_BIN=$(cd "$(dirname "$0")/.." && pwd)/bin/shell
+PER_DIR=$((ENTRIES / 1000))
+
+if [ ! -d "$DIR" ]; then
+    echo "creating $ENTRIES entries under $DIR ..."
+    mkdir -p "$DIR"
+    i=0
+    while [ $i -lt 100 ]; do
+        j=0
+        while [ $j -lt 10 ]; do
+            d="$DIR/logs/d$i/s$j"
+            mkdir -p "$d"
+            (cd "$d" && seq 1 $PER_DIR | awk '{ print ($1 % 10 == 0) ? $1 ".gz" : $1 ".log" }' | xargs touch)
+            j=$((j + 1))
+        done
+        i=$((i + 1))
+    done
+fi
+
+run() {
+    printf 'GLOB_THREADS=%s\necho logs/**/*00.gz | wc -w\nexit\n' "$1" > /tmp/shell-glob-bench.in
+    # warm the dentry cache first so both runs measure the same thing
+    "$SHELL_BIN" < /tmp/shell-glob-bench.in > /dev/null
+    start=$(date +%s%N)
+    "$SHELL_BIN" < /tmp/shell-glob-bench.in > /dev/null
+    end=$(date +%s%N)
+    echo "threads=$1: $(( (end - start) / 1000000 )) ms"
+}
+
+cd "$DIR"
+echo "cpus: $(nproc)"
+run 1
+run 0   # 0 = default (online CPUs, capped at 8)
+rm -f /tmp/shell-glob-bench.in
@@ -0,0 +1,24 @@
+#!/bin/sh
+# libshell: cost per call of running a command line from C through system()
+# and popen() (a /bin/sh -c process each time) against shell_ctx_run() on one
+# long-lived context of the library build.
+#
+# usage: bench/libshell.sh [iterations]
+#   iterations  calls per command and method (default 2000)
+
+N=${1:-2000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+DIR=$(mktemp -d /tmp/shell-lib.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+make -s -C "$ROOT" lib > /dev/null || exit 1
+gcc -O2 -I"$ROOT/include" "$ROOT/bench/libshell_run.c" "$ROOT/bin/libshell.a" \
+    -lpthread -o "$DIR/libshell_run" || exit 1
+printf 'a b c\nd e f\n' > "$DIR/data"
+cd "$DIR" || exit 1
+
+printf '%-34s %10s %10s %12s\n' "command (us per call)" system popen shell_ctx_run
+"$DIR/libshell_run" "$N" "echo hello"
+"$DIR/libshell_run" "$N" "basename /a/b/c"
+"$DIR/libshell_run" "$N" "cut -d ' ' -f 2 data"
+"$DIR/libshell_run" "$N" "cat data | wc -l"
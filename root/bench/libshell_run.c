@@ -0,0 +1,58 @@
+/* Runs a command line N times through system() (popen() for the captured
+ * case) and through shell_ctx_run(), and prints microseconds per call.
+ * Built and run by bench/libshell.sh.
+ *
+ * usage: libshell_run N COMMAND
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libshell.h"
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: libshell_run N COMMAND\n");
+        return 2;
+    }
+    int n = atoi(argv[1]);
+    const char *cmd = argv[2];
+    char quiet[4096];
+    snprintf(quiet, sizeof(quiet), "%s > /dev/null", cmd);
+
+    double t = now_us();
+    for (int i = 0; i < n; ++i) system(quiet);
+    double t_system = (now_us() - t) / n;
+
+    char buf[4096];
+    t = now_us();
+    for (int i = 0; i < n; ++i) {
+        FILE *p = popen(cmd, "r");
+        while (p && fread(buf, 1, sizeof(buf), p) > 0)
+            ;
+        if (p) pclose(p);
+    }
+    double t_popen = (now_us() - t) / n;
+
+    shell_ctx *ctx = shell_ctx_new();
+    if (!ctx) return 1;
+    shell_result res;
+    t = now_us();
+    for (int i = 0; i < n; ++i) {
+        shell_ctx_run(ctx, cmd, &res);
+        shell_result_free(&res);
+    }
+    double t_run = (now_us() - t) / n;
+    shell_ctx_free(ctx);
+
+    printf("%-34s %10.1f %10.1f %12.1f\n", cmd, t_system, t_popen, t_run);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# A compiled for loop against the same commands as one line each (lexed and
+# expanded every time), and against bash running the same loop.
+#
+# usage: bench/loops.sh [iterations]
+#   iterations  loop count (default 100000)
+#
+# The builtin case runs "echo $i", the external case "basename $i" (a PATH
+# lookup plus fork/exec each time). SHELL_BIN picks the binary (default
+# bin/shell).
+
+N=${1:-100000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-loops.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+for cmd in echo basename; do
+    echo "for i in \$(seq 1 $N); do $cmd \$i; done" > "$DIR/$cmd.loop"
+    seq 1 "$N" | sed "s/^/$cmd /" > "$DIR/$cmd.lines"
+done
+
+now() { date +%s%N; }
+
+# milliseconds for: $1 < $2
+run() {
+    start=$(now)
+    "$1" < "$2" > /dev/null 2>&1
+    echo $(( ($(now) - start) / 1000000 ))
+}
+
+printf '%-10s %14s %14s %14s\n' command "loop ms" "lines ms" "bash loop ms"
+for cmd in echo basename; do
+    t_loop=$(run "$SHELL_BIN" "$DIR/$cmd.loop")
+    t_lines=$(run "$SHELL_BIN" "$DIR/$cmd.lines")
+    t_bash=$(run bash "$DIR/$cmd.loop")
+    printf '%-10s %14d %14d %14d\n' "$cmd" "$t_loop" "$t_lines" "$t_bash"
+done
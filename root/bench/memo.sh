@@ -0,0 +1,49 @@
+#!/bin/sh
+# memo: an expensive command (sha256sum of a large file) run plainly, through
+# memo on a miss, and through memo on a hit; then a cheap command in a loop,
+# spawned each time against replayed from the cache.
+#
+# usage: bench/memo.sh [MiB] [iterations]
+#   MiB         size of the hashed file (default 512)
+#   iterations  loop count for the cheap command (default 2000)
+#
+# SHELL_BIN picks the binary (default bin/shell).
+
+MIB=${1:-512}
+N=${2:-2000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-memo.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+head -c $((MIB * 1024 * 1024)) /dev/urandom > "$DIR/big"
+cat > "$DIR/setup" <<EOF
+MEMO_DIR=$DIR/cache
+MEMO_MAX=1g
+EOF
+
+now() { date +%s%N; }
+
+# milliseconds for the commands in $1, after the setup lines
+run() {
+    cat "$DIR/setup" "$1" > "$DIR/script"
+    start=$(now)
+    "$SHELL_BIN" --norc < "$DIR/script" > /dev/null 2>&1
+    echo $(( ($(now) - start) / 1000000 ))
+}
+
+echo "sha256sum $DIR/big" > "$DIR/plain"
+echo "memo --inputs $DIR/big sha256sum $DIR/big" > "$DIR/memo"
+echo "memo --inputs $DIR/big --content sha256sum $DIR/big" > "$DIR/content"
+echo "for i in \$(seq 1 $N); do basename $DIR/big; done" > "$DIR/loop"
+echo "for i in \$(seq 1 $N); do memo basename $DIR/big; done" > "$DIR/loop-memo"
+
+printf '%-40s %10s\n' case ms
+printf '%-40s %10d\n' "sha256sum ${MIB} MiB" "$(run "$DIR/plain")"
+printf '%-40s %10d\n' "memo, miss" "$(run "$DIR/memo")"
+printf '%-40s %10d\n' "memo, hit (stat key)" "$(run "$DIR/memo")"
+run "$DIR/content" > /dev/null
+printf '%-40s %10d\n' "memo --content, hit (hashes the input)" "$(run "$DIR/content")"
+printf '%-40s %10d\n' "$N x basename" "$(run "$DIR/loop")"
+run "$DIR/loop-memo" > /dev/null
+printf '%-40s %10d\n' "$N x memo basename, hits" "$(run "$DIR/loop-memo")"
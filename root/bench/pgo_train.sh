@@ -0,0 +1,57 @@
+#!/bin/sh
+# Training run for "make pgo": drives an instrumented shell through the
+# interactive paths that matter at scale -- startup, per-line parsing and
+# expansion, builtins, external spawns, pipelines, redirections, command
+# substitution, globbing -- then replays server-mode traffic with
+# bench/serve.py when python3 is available.
+#
+# usage: bench/pgo_train.sh SHELL_BINARY
+
+set -e
+
+SHELL_BIN=${1:?usage: bench/pgo_train.sh SHELL_BINARY}
+HERE=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d /tmp/shell-pgo.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/d/a/b"
+for f in 1 2 3 4 5 6 7 8 9; do
+    : > "$WORK/d/f$f.log"
+    : > "$WORK/d/a/b/g$f.gz"
+done
+seq 1 20000 > "$WORK/nums"
+
+# many short shells: startup and exit
+i=0
+while [ $i -lt 200 ]; do
+    echo "echo start $i" | "$SHELL_BIN" > /dev/null
+    i=$((i + 1))
+done
+
+# one long session: the per-line paths
+{
+    echo "cd $WORK"
+    i=0
+    while [ $i -lt 400 ]; do
+        echo "N=$i"
+        echo "echo \$N ~ \$HOME \$USER"
+        echo "printf %s-%05d\\n x \$N"
+        echo "test \$N -gt 10"
+        echo "[ -f nums ]"
+        echo "true"
+        echo "/bin/true"
+        echo "ls d > out.txt"
+        echo "cat < nums | grep 7 | wc -l"
+        echo "echo \$(echo nested \$(pwd))"
+        echo "X=\$(< nums)"
+        echo "echo d/*.log d/**/*.gz"
+        echo "export N"
+        i=$((i + 1))
+    done
+    echo "jobs"
+    echo "exit"
+} | "$SHELL_BIN" > /dev/null 2>&1
+
+if command -v python3 > /dev/null 2>&1; then
+    SHELL_BIN="$SHELL_BIN" python3 "$HERE/serve.py" 2000 8 64 > /dev/null
+fi
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Pipeline rewrites (pipe_plan.c): the same pipelines run N times with
+# "set +o pipeopt" (the default) and with "set -o pipeopt".
+#
+# usage: bench/pipe_plan.sh [iterations] [lines]
+#   iterations  runs of each pipeline (default 500)
+#   lines       lines of the input file (default 200000)
+#
+# SHELL_BIN picks the binary (default bin/shell).
+
+N=${1:-500}
+LINES=${2:-200000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-pipeplan.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+seq -f "line %g of the input" 1 "$LINES" > "$DIR/data"
+cd "$DIR" || exit 1
+
+now() { date +%s%N; }
+
+# milliseconds for N runs of pipeline $2 with "set $1 pipeopt"
+run() {
+    printf 'set %s pipeopt\nfor i in $(seq 1 %d); do %s; done\n' "$1" "$N" "$2" > "$DIR/script"
+    start=$(now)
+    "$SHELL_BIN" --norc < "$DIR/script" > /dev/null 2>&1
+    echo $(( ($(now) - start) / 1000000 ))
+}
+
+measure() {
+    printf '%-52s %8d %8d\n' "$1" "$(run +o "$1")" "$(run -o "$1")"
+}
+
+printf '%-52s %8s %8s\n' "pipeline (ms for $N runs)" off on
+measure "cat data | wc -l"
+measure "cat data | grep 7 | head -n 5"
+measure "cat data | tail -n 100 | tail -n 3"
+measure "head -n 5000 data | cat | sort | sort | uniq | uniq"
@@ -0,0 +1,63 @@
+#!/bin/sh
+# Startup with an rc file: not read (--norc), run on every start
+# (--no-snapshot), and applied from its snapshot. Also times a script of
+# PATH-searched commands, which the snapshot's PATH index answers without
+# walking PATH.
+#
+# usage: bench/rc_startup.sh [starts] [rc lines] [spawns]
+#   starts    shells started one after another, each running "exit" (default 2000)
+#   rc lines  NAME=value / export lines in the generated rc file (default 200)
+#   spawns    "true"-like external commands run by one shell (default 2000)
+#
+# SHELL_BIN picks the binary (default bin/shell).
+
+STARTS=${1:-2000}
+LINES=${2:-200}
+SPAWNS=${3:-2000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-rc.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+awk -v n="$LINES" 'BEGIN {
+    print "# generated by bench/rc_startup.sh";
+    for (i = 0; i < n; i++)
+        print (i % 4 ? "VAR" i "=value" i "_$HOME" : "export EXPORTED" i "=x" i);
+    print "PS1=bench$";
+    print "set -o pipestats";
+}' > "$DIR/rc"
+# a command late on PATH, so an unindexed lookup tries every directory first
+i=0
+while [ $i -lt "$SPAWNS" ]; do
+    echo "basename x"
+    i=$((i + 1))
+done > "$DIR/spawns"
+
+now() { date +%s%N; }
+
+starts() {
+    start=$(now)
+    i=0
+    while [ $i -lt "$STARTS" ]; do
+        echo exit | SHELLRC="$DIR/rc" "$SHELL_BIN" "$@" > /dev/null
+        i=$((i + 1))
+    done
+    echo $(( ($(now) - start) / STARTS / 1000 ))
+}
+
+spawns() {
+    start=$(now)
+    SHELLRC="$DIR/rc" "$SHELL_BIN" "$@" < "$DIR/spawns" > /dev/null
+    echo $(( SPAWNS * 1000000000 / ($(now) - start) ))
+}
+
+rm -f "$DIR/rc.snap"
+echo exit | SHELLRC="$DIR/rc" "$SHELL_BIN" > /dev/null       # writes the snapshot
+printf '%-14s %14s %10s  %s\n' mode "startup (us)" "spawns/s" "rc phase (--startup-profile)"
+for mode in --norc --no-snapshot snapshot; do
+    flag=$mode
+    [ "$mode" = snapshot ] && flag=
+    phase=$(echo exit | SHELLRC="$DIR/rc" "$SHELL_BIN" $flag --startup-profile 2>&1 >/dev/null |
+            awk '/^  rc file/ { print $3 " ms" }')
+    printf '%-14s %14d %10d  %s\n' "$mode" "$(starts $flag)" "$(spawns $flag)" "$phase"
+done
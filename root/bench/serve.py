@@ -0,0 +1,117 @@
+#!/usr/bin/env python3
+"""Benchmark --serve against starting one bin/shell per request.
+
+usage: bench/serve.py [requests] [connections] [idle]
+
+  requests     command lines to run (default 2000)
+  connections  concurrent client connections sending them (default 16)
+  idle         extra connections kept open and idle the whole time (default 2000)
+
+Every request is "echo hello" with stdout/stderr capture on; replies are
+checked. Frame format is documented at the top of src/serve.c.
+$SHELL_BIN picks another binary (default bin/shell).
+"""
+
+import os
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SHELL = os.environ.get("SHELL_BIN", os.path.join(ROOT, "bin", "shell"))
+
+
+def request(sock, line, capture=True):
+    body = bytes([1 if capture else 0]) + line.encode()
+    sock.sendall(struct.pack(">I", len(body)) + body)
+    hdr = recv_exact(sock, 4)
+    (length,) = struct.unpack(">I", hdr)
+    payload = recv_exact(sock, length)
+    status, hi, lo, out_len, err_len = struct.unpack(">IIIII", payload[:20])
+    out = payload[20:20 + out_len]
+    err = payload[20 + out_len:20 + out_len + err_len]
+    return status, (hi << 32) | lo, out, err
+
+
+def recv_exact(sock, n):
+    buf = b""
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise EOFError("server closed the connection")
+        buf += chunk
+    return buf
+
+
+def bench_server(path, total, conns):
+    per = total // conns
+    errors = []
+
+    def client():
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        s.connect(path)
+        for _ in range(per):
+            status, _, out, _ = request(s, "echo hello")
+            if status != 0 or out != b"hello\n":
+                errors.append((status, out))
+        s.close()
+
+    threads = [threading.Thread(target=client) for _ in range(conns)]
+    t0 = time.perf_counter()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - t0
+    if errors:
+        sys.exit("bad replies: %r" % errors[:3])
+    return per * conns, elapsed
+
+
+def bench_spawn(total):
+    t0 = time.perf_counter()
+    for _ in range(total):
+        r = subprocess.run([SHELL], input=b"echo hello\n", capture_output=True)
+        if b"hello" not in r.stdout:
+            sys.exit("spawned shell did not answer")
+    return total, time.perf_counter() - t0
+
+
+def main():
+    total = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    conns = int(sys.argv[2]) if len(sys.argv) > 2 else 16
+    idle = int(sys.argv[3]) if len(sys.argv) > 3 else 2000
+
+    path = os.path.join(tempfile.mkdtemp(), "shell.sock")
+    server = subprocess.Popen([SHELL, "--serve", path], stderr=subprocess.DEVNULL)
+    try:
+        while not os.path.exists(path):
+            time.sleep(0.01)
+
+        idle_socks = []
+        for _ in range(idle):
+            s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            s.connect(path)
+            idle_socks.append(s)
+
+        n, secs = bench_server(path, total, conns)
+        print("serve: %d requests over %d connections (%d idle): %.2fs, %.0f req/s"
+              % (n, conns, idle, secs, n / secs))
+
+        spawn_n = max(1, total // 4)
+        n, secs = bench_spawn(spawn_n)
+        print("spawn: %d requests, one bin/shell each:            %.2fs, %.0f req/s"
+              % (n, secs, n / secs))
+        for s in idle_socks:
+            s.close()
+    finally:
+        server.terminate()
+        server.wait()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Startup time and command spawn rate for each shell build that exists:
+# bin/shell (make), bin/shell-release (make release), bin/shell-pgo
+# (make pgo), bin/shell-static (make static).
+#
+# usage: bench/startup.sh [starts] [spawns] [lines]
+#   starts  shells started one after another, each running "exit" (default 2000)
+#   spawns  "/bin/true" lines run by one shell (default 5000)
+#   lines   builtin-only lines ("X=$N" / "echo $X ~ *") run by one shell,
+#           the per-line cost without a fork (default 100000)
+
+STARTS=${1:-2000}
+SPAWNS=${2:-5000}
+LINES=${3:-100000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+IN=$(mktemp /tmp/shell-startup.XXXXXX)
+LINES_IN=$(mktemp /tmp/shell-lines.XXXXXX)
+trap 'rm -f "$IN" "$LINES_IN"' EXIT
+
+i=0
+while [ $i -lt "$SPAWNS" ]; do
+    echo /bin/true
+    i=$((i + 1))
+done > "$IN"
+awk -v n="$LINES" 'BEGIN { for (i = 0; i < n / 2; i++) print "X=" i "\necho $X ~ *" }' > "$LINES_IN"
+
+now() { date +%s%N; }
+
+printf '%-16s %14s %10s %10s %10s\n' binary "startup (us)" "starts/s" "spawns/s" "lines/s"
+for name in shell shell-release shell-pgo shell-static; do
+    bin="$ROOT/bin/$name"
+    [ -x "$bin" ] || continue
+    echo exit | "$bin" > /dev/null          # warm the page cache
+
+    start=$(now)
+    i=0
+    while [ $i -lt "$STARTS" ]; do
+        echo exit | "$bin" > /dev/null
+        i=$((i + 1))
+    done
+    t_start=$(( $(now) - start ))
+
+    start=$(now)
+    "$bin" < "$IN" > /dev/null
+    t_spawn=$(( $(now) - start ))
+
+    start=$(now)
+    (cd /tmp && "$bin" < "$LINES_IN" > /dev/null)
+    t_lines=$(( $(now) - start ))
+
+    printf '%-16s %14d %10d %10d %10d\n' "$name" \
+        $((t_start / STARTS / 1000)) \
+        $((STARTS * 1000000000 / t_start)) \
+        $((SPAWNS * 1000000000 / t_spawn)) \
+        $((LINES * 1000000000 / t_lines))
+done
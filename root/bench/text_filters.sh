@@ -0,0 +1,55 @@
+#!/bin/sh
+# Builtin wc/grep/head/cut against the coreutils programs on a large file.
+# Each command runs once through the shell as a builtin and once through
+# /usr/bin/<cmd> (the path skips the builtin); the file is read once first so
+# both runs see it in the page cache. Output goes to a file: GNU grep stops
+# at the first match when stdout is /dev/null.
+#
+# SHELL_BIN picks the binary (default bin/shell-release, from make release).
+#
+# usage: bench/text_filters.sh [megabytes] [file]
+#   megabytes  size of the generated CSV input (default 2048)
+#   file       where to put it (default /tmp/shell-filters.csv, kept for reruns)
+
+MB=${1:-2048}
+DATA=${2:-/tmp/shell-filters.csv}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell-release}
+SCRIPT=$(mktemp /tmp/shell-filters.XXXXXX)
+OUT=$(mktemp /tmp/shell-filters-out.XXXXXX)
+trap 'rm -f "$SCRIPT" "$OUT"' EXIT
+
+if [ ! -f "$DATA" ] || [ "$(($(wc -c < "$DATA") / 1048576))" -ne "$MB" ]; then
+    echo "generating $MB MB in $DATA" >&2
+    awk -v mb="$MB" 'BEGIN {
+        srand(1);
+        while (n < mb * 1048576) {
+            line = int(rand() * 1000000) ",user" int(rand() * 5000) ",GET,/index/" int(rand() * 100) ",200," int(rand() * 65536);
+            print line;
+            n += length(line) + 1;
+        }
+    }' | head -c $((MB * 1048576)) > "$DATA"
+fi
+cat "$DATA" > /dev/null
+
+now() { date +%s%N; }
+
+# time one shell line, output to $OUT
+run() {
+    echo "$1 > $OUT" > "$SCRIPT"
+    start=$(now)
+    "$SHELL_BIN" < "$SCRIPT" > /dev/null 2>&1
+    echo $(( ($(now) - start) / 1000000 ))
+}
+
+printf '%-28s %12s %12s %8s\n' command "builtin ms" "coreutils ms" speedup
+for cmd in "wc -l" "wc -c" "wc -lc" "grep -F user4242" "grep -c GET" "grep -v -c /index/9" \
+           "grep -F -e user1, -e user2," "head -n 1000000" "cut -d, -f2" "cut -d, -f1,4-"; do
+    name=${cmd%% *}
+    rest=${cmd#* }
+    t_in=$(run "$cmd $DATA")
+    t_ext=$(run "/usr/bin/$name $rest $DATA")
+    [ "$t_in" -gt 0 ] || t_in=1
+    x=$((t_ext * 10 / t_in))
+    printf '%-28s %12d %12d %6d.%dx\n' "$cmd" "$t_in" "$t_ext" $((x / 10)) $((x % 10))
+done
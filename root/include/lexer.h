@@ -9,6 +9,7 @@ typedef struct {
 } tokenlist;
 
 char * get_input(void);
+void set_input_source(const char *text, size_t len);
 tokenlist * get_tokens(char *input);
 tokenlist * new_tokenlist(void);
 void add_token(tokenlist *tokens, char *item);
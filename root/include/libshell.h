@@ -0,0 +1,64 @@
+//libshell: the shell core as a library (make lib -> bin/libshell.a, bin/libshell.so)
+
+#ifndef LIBSHELL_H
+#define LIBSHELL_H
+
+#include <stddef.h>
+
+/* One shell instance: variables, job table, history, $?, working directory.
+ * Any number can exist; calls on them are serialized by one process-wide
+ * lock, so they may come from any thread.
+ */
+typedef struct shell_ctx shell_ctx;
+
+typedef struct {
+    int status;                 /* $? after the run: exit code, or 128 + signal number */
+    char *out;                  /* captured stdout, NUL-terminated */
+    size_t out_len;
+    char *err;                  /* captured stderr, NUL-terminated */
+    size_t err_len;
+} shell_result;
+
+/* A context that starts from the process environment and working directory.
+ * NULL on allocation failure.
+ */
+shell_ctx *shell_ctx_new(void);
+
+/* Terminates the context's remaining background jobs (SIGTERM), reaps them
+ * and frees everything it owns.
+ */
+void shell_ctx_free(shell_ctx *ctx);
+
+/* Runs text (one or more lines, here-documents included) as if typed at the
+ * prompt, in the context's working directory. stdout and stderr are captured
+ * into *res (free with shell_result_free); res may be NULL to let the output
+ * through to the host's fds 1 and 2. Neither the process's working directory
+ * nor its fds are changed, only those of the children the run forks.
+ * Background jobs inherit the capture, so what they write after the run
+ * returns is lost: "set -o capture" keeps it for "jobs -o N". stdin is the
+ * host's. "exit" ends the run, not the process.
+ * Returns the exit status.
+ */
+int shell_ctx_run(shell_ctx *ctx, const char *text, shell_result *res);
+
+void shell_result_free(shell_result *res);
+
+/* $? of the last run */
+int shell_ctx_status(shell_ctx *ctx);
+
+/* Reaps finished background jobs and enforces their deadlines. Returns how
+ * many are still running.
+ */
+int shell_ctx_poll(shell_ctx *ctx);
+
+/* Read end of a non-blocking pipe carrying the context's job events, one JSON
+ * object per line (the --events format). Created on first call; events that
+ * do not fit because the host is not reading are dropped.
+ */
+int shell_ctx_event_fd(shell_ctx *ctx);
+
+/* Shell variables of the context; get returns a copy to free, or NULL. */
+int shell_ctx_var_set(shell_ctx *ctx, const char *name, const char *value);
+char *shell_ctx_var_get(shell_ctx *ctx, const char *name);
+
+#endif // LIBSHELL_H
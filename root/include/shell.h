@@ -10,19 +10,25 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <time.h>
 #include "lexer.h"
+#include "libshell.h"
 
 //CONSTANTS
 #define MAX_ACTIVE_JOBS 10
 #define MAX_JOB_HISTORY 1024 /* capacity for job records (job numbers monotonic) */
-#define MAX_PROCS_PER_JOB 3  /* supports up to 3 commands per job (2 pipes => 3 procs) */
-#define HISTORY_DEPTH 3
+#define MAX_PROCS_PER_JOB 16 /* stages of one background pipeline job */
+#define HISTORY_DEPTH 3      /* commands listed by exit */
+#define HISTORY_MAX 500      /* commands kept, for the line editor's Up/Down */
 
 
 
 
 //DATA STRUCTS
+typedef struct job_capture job_capture; // Defined in job_capture.c
+
 typedef struct job {
     int active;                 /* 1 if active, 0 if finished */
     int jobno;                  /* monotonic job number */
@@ -31,11 +37,64 @@ typedef struct job {
     pid_t leader_pid;           /* pid printed at start (last pid in pipeline) */
     int remaining;              /* how many procs still running */
     char* cmdline;              /* strdup'd command line for messages */
+    char* coproc_name;          /* NAME for "coproc NAME cmd", else NULL */
+    int coproc_fds[2];          /* shell's read/write ends, closed when reaped */
+    struct timespec started;    /* CLOCK_MONOTONIC at registration */
+    int last_status;            /* wait status of the last stage */
+    int stage_status[MAX_PROCS_PER_JOB]; /* wait status of each stage once reaped */
+    pid_t pgid;                 /* process group signalled at the deadline, 0: leader only */
+    long long deadline_ms;      /* CLOCK_MONOTONIC ms, 0 if none */
+    int timeout_sig;            /* sent at the deadline */
+    long long kill_after_ms;    /* then SIGKILL this much later, 0: never */
+    int timed_out;              /* the deadline fired */
+    job_capture *capture;       /* captured stdout/stderr ("set -o capture"), else NULL */
+    unsigned reaped;            /* bit i: pids[i] has been waited for */
 } job_t;
 
+typedef struct shell_var shell_var; // Defined in variables.c
+
+typedef struct {
+    shell_var **buckets;
+    size_t nbuckets;
+    size_t nvars;
+    char **envp_cache;          /* var_envp(), rebuilt when envp_dirty */
+    int envp_dirty;
+} var_store;
+
+/* Everything one shell instance owns. The standalone shell has one; each
+ * libshell context (libshell.c) is another, made current for the length of
+ * a call. */
+struct shell_ctx {
+    job_t job_table[MAX_JOB_HISTORY];
+    int next_job_index;         /* next slot to use (keeps history) */
+    int next_job_number;        /* monotonic job number */
+    int active_job_count;
+    char *history[HISTORY_MAX];
+    int history_count;
+    int history_held;
+    int last_exit_status;       /* $?: exit code, or 128 + signal number */
+    var_store vars;
+    unsigned long path_generation;
+    tokenlist *script_pending;  /* lines of an unfinished for/while/if */
+    int capture_on;             /* set -o capture */
+    int pipe_stats_on;          /* set -o pipestats */
+    int pipe_rewrite_on;        /* set -o pipeopt (pipe_plan.c) */
+    int explain_on;             /* set -o explain */
+    pid_t fg_pgid;              /* "pipeline --timeout" in the foreground: its group, */
+    long long fg_deadline_ms;   /* deadline (CLOCK_MONOTONIC ms, 0 if none) */
+    int fg_timed_out;           /* and whether it fired */
+    int events_fd;              /* job events (job_events.c), -1: off */
+    int embedded;               /* libshell: exit ends the run, not the process */
+    int subshell;               /* a forked child: so does exit, quietly */
+    int exited;
+    char *cwd;                  /* libshell: working directory, kept by cd */
+    int dir_fd;                 /* its fd for the *at() calls, AT_FDCWD: the process's */
+    int fd_out, fd_err;         /* where the shell's own output goes: 1 and 2, or a run's capture */
+    int event_read;             /* libshell: read end of the events pipe */
+};
+
 //Global Variables
-extern job_t job_table[]; // Defined in background_proc.c
-extern int next_job_index;
+extern shell_ctx *sh; // Defined in libshell.c: the current context
 
 
 //------------Function Prototypes----------------\\
@@ -43,13 +102,81 @@ extern int next_job_index;
 
 //Tokenization Prototypes
 
+int shell_run_line(char *input);
+int shell_feed_line(char *input);
+void process_command(tokenlist *tokens);
+char **expand_argv(char **words, int count);
+
+//Script Prototypes
+
+int script_needed(tokenlist *tokens);
+void script_run(tokenlist *tokens, int more_ok);
+int script_pending(void);
+void script_discard(void);
+
 
 //Prompt Prototypes
 
+void prompt_init(void);
 void print_prompt(void);
+void prompt_set_cwd(const char *cwd);
+int prompt_set_format(const char *fmt);
+void print_continuation_prompt(void);
+const char *prompt_shown(size_t *len);
+int prompt_wants_timing(void);
+void prompt_note_elapsed(long elapsed_ms);
+
+//Builtin Prototypes
+
+typedef struct spsc_ring spsc_ring; // Defined in spsc_ring.c
+
+typedef struct builtin_io {
+    int in, out, err;           /* fds the builtin reads and writes */
+    spsc_ring *rin, *rout;      /* threaded pipeline stage: rings instead of in/out */
+} builtin_io;
+
+typedef int (*builtin_fn)(char **argv, builtin_io *io);
+
+#define BUILTIN_SPECIAL        0x1  /* changes shell state, never forked on its own */
+#define BUILTIN_HISTORY_IF_OK  0x2  /* only recorded in history when it succeeds */
+#define BUILTIN_THREADED       0x4  /* only touches its io: may run as a pipeline thread */
+#define BUILTIN_RAW_ARGV       0x8  /* redirections belong to the command it runs: left in argv */
+
+typedef struct {
+    const char *name;
+    builtin_fn fn;
+    int flags;
+    int (*accepts)(char **argv);    /* NULL, or 0 if the real program should run instead */
+} builtin_t;
+
+const builtin_t *builtin_lookup(const char *name);
+const builtin_t *builtin_find(char **argv);
+const char *builtin_name(int i);
+int run_builtin(const builtin_t *b, char **argv, int out_fd);
+pid_t run_builtin_background(const builtin_t *b, char **argv);
+const char *shell_option_name(int i);
+int shell_option_get(int i);
+void shell_option_set(int i, int on);
 
 //Environment Variable Prototypes
 
+void vars_init(void);
+const char *var_get(const char *name);
+const char *var_getn(const char *name, size_t len);
+int var_set(const char *name, const char *value);
+int var_export(const char *name);
+void var_unset(const char *name);
+int var_assign(const char *word);
+char **var_envp(void);
+void vars_free(void);
+void var_foreach(void (*fn)(const char *entry, size_t name_len, int exported, void *arg), void *arg);
+int var_name_valid(const char *name, size_t len);
+size_t var_assignment_len(const char *tok);
+int builtin_export(char **args, builtin_io *io);
+int builtin_unset(char **args, builtin_io *io);
+
+char *expand_word(const char *tok);
+char *command_subst(const char *cmd, size_t len, size_t *out_len);
 void free_argv(char **argv);
 char **expand_env_vars_dup(char **argv);
 int expand_env_vars_inplace(char **argv);
@@ -59,9 +186,48 @@ int expand_env_vars_inplace(char **argv);
 char* expand_tilde(char *token);
 
 
+//Globbing Prototypes
+
+typedef enum { GOP_LIT, GOP_ANY, GOP_STAR, GOP_CLASS } glob_op_kind;
+
+typedef struct {
+    glob_op_kind kind;
+    size_t off;                 /* GOP_LIT: offset into matcher text */
+    size_t len;                 /* GOP_LIT: length */
+    unsigned char set[32];      /* GOP_CLASS: bitmap of accepted bytes */
+} glob_op;
+
+typedef struct {
+    glob_op *ops;
+    size_t nops;
+    char *text;                 /* unescaped literal characters */
+    size_t text_len;
+    size_t prefix_len;          /* literal prefix is text[0, prefix_len) */
+    size_t suffix_off;          /* literal suffix is text[suffix_off, +suffix_len) */
+    size_t suffix_len;
+    size_t min_len;
+    int has_star;
+    int is_literal;             /* no metacharacters at all */
+    int is_globstar;            /* the component is exactly "**" */
+    int dir_only;               /* last component of a pattern ending in '/' */
+    int leading_dot;
+} glob_matcher;
+
+typedef void (*glob_dent_fn)(const char *name, size_t len, unsigned char d_type, void *arg);
+
+int glob_has_magic(const char *word);
+int glob_compile(glob_matcher *m, const char *pat, size_t len);
+void glob_matcher_free(glob_matcher *m);
+int glob_match(const glob_matcher *m, const char *s, size_t n);
+int glob_scan_dir(int fd, glob_dent_fn fn, void *arg);
+int glob_scan_dir_buf(int fd, char *buf, size_t bufsize, glob_dent_fn fn, void *arg);
+int glob_expand_argv(char ***argvp);
+int glob_walk(const char *base, const glob_matcher *comps, size_t ncomps,
+              char ***out, size_t *nout);
+
 //$Path Search Prototypes
 
-void execute_search(char *command, char **argv);
+void execute_search(char *command, char **argv, char **envp);
 
 //External Command Execution Prototypes
 
@@ -70,25 +236,154 @@ pid_t execute_command(char **argv, char *fullpath, int background);
 
 //IO Redirection Prototypes
 
-void handle_io_redirection(char **args);
+typedef struct {
+    int fd[3];                  /* fd the command should use as 0, 1, 2; 0-2 mean its own, -1 closed */
+    int opened[3];              /* fds opened by redirect_open, -1 if unused */
+} redir_fds;
+
+int redirect_width(const char *tok);
+int redirect_open(char **args, redir_fds *r);
+int redirect_fd(const redir_fds *r, int n, const int base[3]);
+int redirect_apply(const redir_fds *r);
+void redirect_close(redir_fds *r);
+int prepare_heredocs(char ***argvp);
+void close_heredocs(void);
 
 
 //Piping Protypes
 
-void execute_pipeline(char ***cmds, int num_cmds);
+void execute_pipeline(char ***cmds, int num_cmds, int stats, double timeout);
+int tee_stage(char **argv, builtin_io *io);
+
+//Text Filter Prototypes
+
+int builtin_wc(char **argv, builtin_io *io);
+int builtin_grep(char **argv, builtin_io *io);
+int builtin_head(char **argv, builtin_io *io);
+int builtin_cut(char **argv, builtin_io *io);
+int wc_accepts(char **argv);
+int grep_accepts(char **argv);
+int head_accepts(char **argv);
+int cut_accepts(char **argv);
+
+//SPSC Ring Prototypes
+
+spsc_ring *spsc_ring_new(size_t cap);
+void spsc_ring_free(spsc_ring *r);
+ssize_t spsc_ring_read(spsc_ring *r, void *buf, size_t n);
+int spsc_ring_write(spsc_ring *r, const void *buf, size_t n);
+void spsc_ring_close_write(spsc_ring *r);
+void spsc_ring_close_read(spsc_ring *r);
+ssize_t bio_read(builtin_io *io, void *buf, size_t n);
+int bio_write(builtin_io *io, const void *buf, size_t n);
+
+//Pipeline Stats Prototypes
+
+typedef struct pipe_stats pipe_stats;
+int pipe_stats_enabled(void);
+void pipe_stats_set(int on);
+pipe_stats *pipe_stats_new(int num_cmds);
+int pipe_stats_link(pipe_stats *st, int i, int fds[2]);
+void pipe_stats_child(pipe_stats *st);
+void pipe_stats_start(pipe_stats *st);
+void pipe_stats_finish(pipe_stats *st, char ***cmds);
+void pipe_stats_free(pipe_stats *st);
+
+//Pipeline Planner Prototypes
+
+int pipe_rewrite_enabled(void);
+void pipe_rewrite_set(int on);
+int pipe_explain_enabled(void);
+void pipe_explain_set(int on);
+int pipe_rewrite(char ***cmds, int *n);
+void pipe_explain(char **text, char ***cmds, const builtin_t **builtin, const int *threaded,
+                  int nstages, int background);
 
 //Background Processing Prototypes
 
 void part_eight_init(void);
 int part_eight_add_job(const char *cmdline, pid_t *pids, int nprocs, pid_t leader_pid);
 void part_eight_check_jobs(void);
-void part_eight_jobs_builtin(void);
+void part_eight_jobs_builtin(int out_fd);
 void part_eight_shutdown(void);
+int part_eight_active_jobs(void);
+int part_eight_add_coproc(const char *cmdline, const char *name, pid_t pid, int rfd, int wfd);
+int part_eight_find_coproc(const char *name);
+int part_eight_set_deadline(int jobno, pid_t pgid, long long ms, int sig, long long kill_after_ms);
+void part_eight_enforce_deadlines(void);
+void part_eight_set_fg_deadline(pid_t pgid, long long ms);
+int part_eight_fg_timed_out(void);
+void part_eight_wait_input(int fd);
+pid_t part_eight_wait_pid(pid_t pid, int *status);
+int part_eight_jobs_output(int jobno, int follow, int out_fd);
+
+//Timeout Prototypes
+
+int builtin_timeout(char **argv, builtin_io *io);
+int timeout_start_job(char **argv, const char *cmdline);
+void timeout_signal(pid_t pid, int group, int sig);
+int pidfd_for(pid_t pid);
+int parse_signal(const char *s);
+double parse_duration(const char *s);
+
+//Memo Prototypes
+
+int builtin_memo(char **argv, builtin_io *io);
+
+//Job Event Prototypes
+
+int job_events_open(const char *path);
+int job_events_set_fd(int fd);
+int job_events_enabled(void);
+void job_event_start(const job_t *job);
+void job_event_exit(const job_t *job, pid_t pid, int wstatus, const struct rusage *ru);
+void job_event_done(const job_t *job);
+
+//Line Editor Prototypes
+
+int line_edit_enabled(void);
+char *line_edit_read(void);
+int builtin_compgen(char **argv, builtin_io *io);
+
+//Startup Prototypes
+
+void rc_startup(int use_snapshot);
+const char *rc_report(void);
+const char *path_index_lookup(const char *name);
+
+//Job Capture Prototypes
+
+int job_capture_enabled(void);
+void job_capture_set(int on);
+int job_capture_prepare(void);
+void job_capture_child(void);
+void job_capture_parent(void);
+job_capture *job_capture_claim(void);
+int job_capture_fd(const job_capture *c);
+void job_capture_drain(job_capture *c, int echo_fd);
+void job_capture_dump(const job_capture *c, int out_fd);
+void job_capture_free(job_capture *c);
+
+//Coprocess Prototypes
+
+int builtin_coproc(char **argv, builtin_io *io);
+void coproc_forget(const char *name);
+
+//Server Mode Prototypes
+
+int serve_main(const char *path, int nworkers);
+
+//Context Prototypes
+
+void shell_child_setup(void);
+char *shell_getcwd(char *buf, size_t size);
+void shell_perror(const char *what);
 
 //Internal Command Execution Prototypes
 
 void add_to_history(char *cmd);
-void builtin_exit(void);
+void history_hold(int on);
+void builtin_exit(int status);
 int builtin_cd(char **args);
 
 
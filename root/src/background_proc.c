@@ -11,9 +11,12 @@
 //*              Behavior:                                                                                      *
 //*                - Tracks up to MAX_ACTIVE_JOBS concurrently (default 10).                                    *
 //*                - Job numbers are monotonic and never reused.                                                *
-//*                - Supports jobs consisting of up to 3 processes (2 pipes => 3 procs).                        *
+//*                - A job is a command or a whole pipeline of up to MAX_PROCS_PER_JOB (16)                     *
+//*                  processes; each is reaped by its own pid and keeps its exit status.                        *
 //*                - Prints start message: [jobno] leader_pid                                                   *
 //*                - Prints completion message: [jobno]  + done <cmdline>                                       *
+//*                - With "set -o capture", keeps each job's output (job_capture.c) and                         *
+//*                  drains it while the shell waits; "jobs -o N" shows it.                                     *
 //* Author: Katelyna Pastrana                                                                                   *
 //* Date:        2026-02-07                                                                                     *
 //* References:                                                                                                 *
@@ -24,6 +27,7 @@
 //* Compile:     gcc -std=c11 -Wall -Wextra -O2 -D_POSIX_C_SOURCE=200809L -o background_proc background_proc.c  *
 //***************************************************************************************************************
 
+#define _GNU_SOURCE /* wait4 */
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
@@ -32,6 +36,9 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include "shell.h"
 
 /* Public API (previously in background_proc.h)
@@ -46,7 +53,7 @@
  * void part_eight_check_jobs(void);
  *
  * Built-in 'jobs' command:
- * void part_eight_jobs_builtin(void);
+ * void part_eight_jobs_builtin(int out_fd);
  *
  * Shutdown job system (free resources):
  * void part_eight_shutdown(void);
@@ -56,46 +63,32 @@
 void part_eight_init(void);
 int part_eight_add_job(const char *cmdline, pid_t *pids, int nprocs, pid_t leader_pid);
 void part_eight_check_jobs(void);
-void part_eight_jobs_builtin(void);
+void part_eight_jobs_builtin(int out_fd);
 void part_eight_shutdown(void);
 
 #define MAX_ACTIVE_JOBS 10
 #define MAX_JOB_HISTORY 1024 /* capacity for job records (job numbers monotonic) */
-#define MAX_PROCS_PER_JOB 3  /* supports up to 3 commands per job (2 pipes => 3 procs) */
+#define MAX_PROCS_PER_JOB 16 /* stages of one background pipeline job */
+#define MAX_KEPT_CAPTURES 8  /* finished jobs whose output "jobs -o" can still show */
 
 
-/* Job table / bookkeeping state */
-job_t job_table[MAX_JOB_HISTORY];
-int next_job_index = 0;   /* next slot to use (keeps history) */
-int next_job_number = 1;  /* monotonic job number */
-int active_job_count = 0;
+/* The job table and its counters live in the current context (sh) */
 
 void part_eight_init(void) {
-    memset(job_table, 0, sizeof(job_table));
-    next_job_index = 0;
-    next_job_number = 1;
-    active_job_count = 0;
-}
-
-/* Helper: find job index containing pid, or -1 */
-static int find_job_by_pid(pid_t pid) {
-    for (int i = 0; i < next_job_index; ++i) {
-        if (!job_table[i].active) continue;
-        for (int j = 0; j < job_table[i].nprocs; ++j) {
-            if (job_table[i].pids[j] == pid) return i;
-        }
-    }
-    return -1;
+    memset(sh->job_table, 0, sizeof(sh->job_table));
+    sh->next_job_index = 0;
+    sh->next_job_number = 1;
+    sh->active_job_count = 0;
 }
 
 /* Helper: find index of most recent active job (highest jobno) or -1 */
 static int find_most_recent_active_job_index(void) {
     int best = -1;
     int best_jobno = -1;
-    for (int i = 0; i < next_job_index; ++i) {
-        if (!job_table[i].active) continue;
-        if (job_table[i].jobno > best_jobno) {
-            best_jobno = job_table[i].jobno;
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        if (!sh->job_table[i].active) continue;
+        if (sh->job_table[i].jobno > best_jobno) {
+            best_jobno = sh->job_table[i].jobno;
             best = i;
         }
     }
@@ -107,90 +100,299 @@ int part_eight_add_job(const char *cmdline, pid_t *pids, int nprocs, pid_t leade
         errno = EINVAL;
         return -1;
     }
-    if (active_job_count >= MAX_ACTIVE_JOBS) {
+    if (sh->active_job_count >= MAX_ACTIVE_JOBS) {
         /* too many concurrent background jobs */
         errno = EBUSY;
         return -1;
     }
-    if (next_job_index >= MAX_JOB_HISTORY) {
+    if (sh->next_job_index >= MAX_JOB_HISTORY) {
         /* shouldn't happen for student shell, but guard */
         errno = ENOMEM;
         return -1;
     }
 
-    job_t *job = &job_table[next_job_index];
+    job_t *job = &sh->job_table[sh->next_job_index];
     job->active = 1;
-    job->jobno = next_job_number++;
+    job->jobno = sh->next_job_number++;
     job->nprocs = nprocs;
     job->remaining = nprocs;
     job->leader_pid = leader_pid;
+    job->coproc_name = NULL;
+    job->coproc_fds[0] = job->coproc_fds[1] = -1;
     job->cmdline = strdup(cmdline ? cmdline : "");
     if (!job->cmdline) {
         errno = ENOMEM;
         return -1;
     }
-    for (int i = 0; i < nprocs; ++i) job->pids[i] = pids[i];
+    for (int i = 0; i < nprocs; ++i) {
+        job->pids[i] = pids[i];
+        job->stage_status[i] = 0;
+    }
+    job->reaped = 0;
+    job->last_status = 0;
+    job->pgid = 0;
+    job->deadline_ms = 0;
+    job->timed_out = 0;
+    job->capture = job_capture_claim();
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
 
     /* Print job start message: [jobno] leader_pid */
     /* Use %ld and (long) cast for portability of pid_t */
-    printf("[%d] %ld\n", job->jobno, (long)job->leader_pid);
-    fflush(stdout);
+    dprintf(sh->fd_out, "[%d] %ld\n", job->jobno, (long)job->leader_pid);
+    job_event_start(job);
 
-    ++next_job_index;
-    ++active_job_count;
+    ++sh->next_job_index;
+    ++sh->active_job_count;
     return job->jobno;
 }
 
+/* Track a coprocess as a job; its pipe ends are closed and its NAME
+ * variables unset when it is reaped (see release_job).
+ */
+int part_eight_add_coproc(const char *cmdline, const char *name, pid_t pid, int rfd, int wfd) {
+    char *copy = strdup(name);
+    if (!copy) return -1;
+    int jobno = part_eight_add_job(cmdline, &pid, 1, pid);
+    if (jobno < 0) {
+        free(copy);
+        return -1;
+    }
+    job_t *job = &sh->job_table[sh->next_job_index - 1];
+    job->coproc_name = copy;
+    job->coproc_fds[0] = rfd;
+    job->coproc_fds[1] = wfd;
+    return jobno;
+}
+
+/* Index of the running coprocess called name, or -1 */
+int part_eight_find_coproc(const char *name) {
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        if (sh->job_table[i].active && sh->job_table[i].coproc_name &&
+            strcmp(sh->job_table[i].coproc_name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Give job jobno a deadline ms from now. At the deadline sig goes to pgid
+ * (or to the leader alone when pgid is 0), then SIGKILL kill_after_ms later.
+ */
+int part_eight_set_deadline(int jobno, pid_t pgid, long long ms, int sig, long long kill_after_ms) {
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
+        if (!job->active || job->jobno != jobno) continue;
+        job->pgid = pgid;
+        job->deadline_ms = monotonic_ms() + ms;
+        job->timeout_sig = sig;
+        job->kill_after_ms = kill_after_ms;
+        return 0;
+    }
+    return -1;
+}
+
+/* "pipeline --timeout D" in the foreground: SIGTERM to the process group
+ * pgid ms from now, enforced with the jobs' deadlines while the shell waits
+ * for the stages (part_eight_wait_pid). ms 0 clears it.
+ */
+void part_eight_set_fg_deadline(pid_t pgid, long long ms) {
+    sh->fg_pgid = pgid;
+    sh->fg_deadline_ms = ms > 0 ? monotonic_ms() + ms : 0;
+    sh->fg_timed_out = 0;
+}
+
+int part_eight_fg_timed_out(void) {
+    return sh->fg_timed_out;
+}
+
+/* Milliseconds until the nearest job deadline, or -1 if there is none */
+static int next_deadline_ms(void) {
+    long long best = -1, now = monotonic_ms();
+    if (sh->fg_deadline_ms) best = sh->fg_deadline_ms > now ? sh->fg_deadline_ms - now : 0;
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
+        if (!job->active || !job->deadline_ms) continue;
+        long long left = job->deadline_ms - now;
+        if (left < 0) left = 0;
+        if (best < 0 || left < best) best = left;
+    }
+    return best > 0x7fffffff ? 0x7fffffff : (int)best;
+}
+
+/* Signal every job whose deadline has passed. The first expiry sends the
+ * job's timeout signal and, with a kill-after, re-arms for SIGKILL.
+ */
+void part_eight_enforce_deadlines(void) {
+    long long now = monotonic_ms();
+    if (sh->fg_deadline_ms && sh->fg_deadline_ms <= now) {
+        sh->fg_timed_out = 1;
+        sh->fg_deadline_ms = 0;
+        timeout_signal(sh->fg_pgid, 1, SIGTERM);
+    }
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
+        if (!job->active || !job->deadline_ms || job->deadline_ms > now) continue;
+        pid_t target = job->pgid ? job->pgid : job->leader_pid;
+        if (!job->timed_out) {
+            job->timed_out = 1;
+            timeout_signal(target, job->pgid != 0, job->timeout_sig);
+            job->deadline_ms = job->kill_after_ms ? now + job->kill_after_ms : 0;
+        } else {
+            timeout_signal(target, job->pgid != 0, SIGKILL);
+            job->deadline_ms = 0;
+        }
+    }
+}
+
+/* Read whatever captured jobs have written so far */
+static void drain_captures(void) {
+    for (int i = 0; i < sh->next_job_index; ++i)
+        if (job_capture_fd(sh->job_table[i].capture) >= 0) job_capture_drain(sh->job_table[i].capture, -1);
+}
+
+/* Fill p[first..] with the open capture pipes; returns the new count */
+static int poll_captures(struct pollfd *p, int first, int max) {
+    int n = first;
+    for (int i = 0; i < sh->next_job_index && n < max; ++i) {
+        int fd = job_capture_fd(sh->job_table[i].capture);
+        if (fd < 0) continue;
+        p[n].fd = fd;
+        p[n].events = POLLIN;
+        p[n].revents = 0;
+        ++n;
+    }
+    return n;
+}
+
+/* Sleep in poll(2) until p[0] is ready, enforcing job deadlines and
+ * draining captured output in the meantime. Returns 1 when p[0] is ready
+ * (or poll failed), 0 when there is nothing to wait for but p[0].
+ */
+static int wait_ready(struct pollfd *p0) {
+    struct pollfd p[1 + MAX_JOB_HISTORY];
+    for (;;) {
+        int ms = next_deadline_ms();
+        p[0] = *p0;
+        p[0].revents = 0;
+        int nfds = poll_captures(p, 1, 1 + MAX_JOB_HISTORY);
+        if (ms < 0 && nfds == 1) return 0;
+        int n = poll(p, (nfds_t)nfds, ms);
+        part_eight_enforce_deadlines();
+        if (n < 0 && errno != EINTR) return 1;
+        if (n > 0 && nfds > 1) drain_captures();
+        if (n > 0 && p[0].revents) return 1;
+    }
+}
+
+/* Called by get_input() before it blocks on fd: sleeps in poll(2) until fd
+ * is readable, waking up for job deadlines and captured output meanwhile.
+ */
+void part_eight_wait_input(int fd) {
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    wait_ready(&p); /* 0: nothing to do in the background, let read() block */
+}
+
+/* waitpid(pid, status, 0) for a foreground command that keeps enforcing
+ * background job deadlines and draining captured output while it blocks:
+ * sleeps in poll(2) on a pidfd for pid.
+ */
+pid_t part_eight_wait_pid(pid_t pid, int *status) {
+    int busy = next_deadline_ms() >= 0;
+    for (int i = 0; i < sh->next_job_index && !busy; ++i)
+        busy = job_capture_fd(sh->job_table[i].capture) >= 0;
+    int pfd = busy ? pidfd_for(pid) : -1;
+    if (pfd >= 0) {
+        struct pollfd p = { .fd = pfd, .events = POLLIN };
+        wait_ready(&p);
+        close(pfd);
+    }
+    pid_t w;
+    while ((w = waitpid(pid, status, 0)) == -1 && errno == EINTR)
+        ;
+    return w;
+}
+
+/* Drop a coprocess's fds and variables */
+static void release_coproc(job_t *job) {
+    if (!job->coproc_name) return;
+    for (int k = 0; k < 2; ++k) {
+        if (job->coproc_fds[k] >= 0) close(job->coproc_fds[k]);
+        job->coproc_fds[k] = -1;
+    }
+    coproc_forget(job->coproc_name);
+    free(job->coproc_name);
+    job->coproc_name = NULL;
+}
+
+/* A finished job keeps its captured output for "jobs -o"; beyond
+ * MAX_KEPT_CAPTURES finished jobs the oldest capture is freed.
+ */
+static void retire_capture(job_t *job) {
+    if (!job->capture) return;
+    job_capture_drain(job->capture, -1);
+    int kept = 0;
+    for (int i = sh->next_job_index - 1; i >= 0; --i) {
+        job_t *old = &sh->job_table[i];
+        if (old->active || !old->capture || old == job) continue;
+        if (++kept >= MAX_KEPT_CAPTURES) {
+            job_capture_free(old->capture);
+            old->capture = NULL;
+        }
+    }
+}
+
 /* Called periodically from main loop. Reaps any finished children (non-blocking)
- * and prints completion messages. Uses waitpid(-1, WNOHANG).
+ * and prints completion messages. Waits on each tracked pid with wait4(WNOHANG),
+ * never wait4(-1), so a host process embedding the shell keeps its own children;
+ * wait4 also hands the job event stream each stage's resource usage.
  */
 void part_eight_check_jobs(void) {
     int status;
-    pid_t pid;
-
-    /* Loop until no more reaped children */
-    while (1) {
-        pid = waitpid(-1, &status, WNOHANG);
-        if (pid > 0) {
-            int idx = find_job_by_pid(pid);
-            if (idx == -1) {
-                /* Not one of our tracked background jobs — could be a foreground child
-                 * or something else already reaped. Ignore. */
+    struct rusage ru;
+
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
+        for (int j = 0; job->active && j < job->nprocs; ++j) {
+            if (job->reaped & (1u << j)) continue;
+            pid_t pid = wait4(job->pids[j], &status, WNOHANG, &ru);
+            if (pid == 0) continue;                 /* still running */
+            if (pid < 0 && errno == EINTR) {
+                j--;
                 continue;
             }
-            job_t *job = &job_table[idx];
+            job->reaped |= 1u << j;
             job->remaining -= 1;
-            if (job->remaining <= 0) {
-                /* Job fully finished */
-                /* Print completion message: [jobno]  + done [cmdline] */
-                printf("[%d]  + done %s\n", job->jobno, job->cmdline ? job->cmdline : "");
-                fflush(stdout);
-
-                /* Free resources and mark inactive */
-                free(job->cmdline);
-                job->cmdline = NULL;
-                job->active = 0;
-                job->nprocs = 0;
-                job->remaining = 0;
-                --active_job_count;
-            }
-            /* continue loop to reap any additional exited children */
-            continue;
-        } else if (pid == 0) {
-            /* No (more) children ready */
-            break;
-        } else {
-            /* pid == -1 */
-            if (errno == ECHILD) {
-                /* No child processes */
-                break;
-            } else if (errno == EINTR) {
-                /* Interrupted, retry */
-                continue;
+            if (pid < 0) {
+                /* waited for elsewhere (ECHILD): count it as gone */
+                if (errno != ECHILD) shell_perror("wait4 (part_eight_check_jobs)");
             } else {
-                perror("waitpid (part_eight_check_jobs)");
-                break;
+                job->stage_status[j] = status;
+                if (j == job->nprocs - 1) job->last_status = status;
+                job_event_exit(job, pid, status, &ru);
             }
+            if (job->remaining > 0) continue;
+
+            /* Job fully finished */
+            /* Print completion message: [jobno]  + done [cmdline] */
+            if (!sh->embedded) {
+                dprintf(sh->fd_out, "[%d]  + %s %s\n", job->jobno,
+                        job->timed_out ? "timed out" : "done", job->cmdline ? job->cmdline : "");
+            }
+            job_event_done(job);
+
+            /* Free resources and mark inactive */
+            release_coproc(job);
+            retire_capture(job);
+            free(job->cmdline);
+            job->cmdline = NULL;
+            job->active = 0;
+            job->nprocs = 0;
+            job->remaining = 0;
+            --sh->active_job_count;
         }
     }
 }
@@ -199,32 +401,64 @@ void part_eight_check_jobs(void) {
  * Format per spec: [Job number]+ [CMD's PID] [CMD's command line]
  * We append '+' to the most-recent active job (if any) as a marker.
  */
-void part_eight_jobs_builtin(void) {
+void part_eight_jobs_builtin(int out_fd) {
     int most_recent_idx = find_most_recent_active_job_index();
 
-    for (int i = 0; i < next_job_index; ++i) {
-        job_t *job = &job_table[i];
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
         if (!job->active) continue;
         /* leader pid printed in job listing; add '+' after job number for most recent */
         if (i == most_recent_idx) {
-            printf("[%d]+ %ld %s\n", job->jobno, (long)job->leader_pid, job->cmdline ? job->cmdline : "");
+            dprintf(out_fd, "[%d]+ %ld %s%s\n", job->jobno, (long)job->leader_pid, job->cmdline ? job->cmdline : "",
+                    job->timed_out ? " (timed out)" : "");
         } else {
-            printf("[%d]  %ld %s\n", job->jobno, (long)job->leader_pid, job->cmdline ? job->cmdline : "");
+            dprintf(out_fd, "[%d]  %ld %s%s\n", job->jobno, (long)job->leader_pid, job->cmdline ? job->cmdline : "",
+                    job->timed_out ? " (timed out)" : "");
         }
     }
-    fflush(stdout);
+}
+
+/* "jobs -o N [--follow]": print job N's captured output; with follow,
+ * keep copying new output to out_fd until the job closes it. Returns -1
+ * if job N has no captured output.
+ */
+int part_eight_jobs_output(int jobno, int follow, int out_fd) {
+    job_t *job = NULL;
+    for (int i = 0; i < sh->next_job_index; ++i)
+        if (sh->job_table[i].jobno == jobno) job = &sh->job_table[i];
+    if (!job || !job->capture) return -1;
+    job_capture_drain(job->capture, -1);
+    job_capture_dump(job->capture, out_fd);
+    while (follow && job_capture_fd(job->capture) >= 0) {
+        struct pollfd p = { .fd = job_capture_fd(job->capture), .events = POLLIN };
+        int ms = next_deadline_ms();
+        int n = poll(&p, 1, ms);
+        part_eight_enforce_deadlines();
+        if (n < 0 && errno != EINTR) break;
+        if (n > 0) job_capture_drain(job->capture, out_fd);
+    }
+    part_eight_check_jobs();
+    return 0;
+}
+
+/* Number of background jobs still running (used by the \j prompt segment) */
+int part_eight_active_jobs(void) {
+    return sh->active_job_count;
 }
 
 void part_eight_shutdown(void) {
     /* Free any remaining resources */
-    for (int i = 0; i < next_job_index; ++i) {
-        if (job_table[i].cmdline) {
-            free(job_table[i].cmdline);
-            job_table[i].cmdline = NULL;
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        release_coproc(&sh->job_table[i]);
+        job_capture_free(sh->job_table[i].capture);
+        sh->job_table[i].capture = NULL;
+        if (sh->job_table[i].cmdline) {
+            free(sh->job_table[i].cmdline);
+            sh->job_table[i].cmdline = NULL;
         }
     }
     /* reset counts (optional) */
-    next_job_index = 0;
-    active_job_count = 0;
-    next_job_number = 1;
+    sh->next_job_index = 0;
+    sh->active_job_count = 0;
+    sh->next_job_number = 1;
 }
@@ -0,0 +1,723 @@
+//******************************************************************************************************
+//* Name:        builtins.c                                                                            *
+//* Description: Builtin command table and the in-process utilities.                                   *
+//*              - builtin_lookup() replaces the strcmp chain in process_command() with a              *
+//*                binary search over a sorted table.                                                  *
+//*              - Every builtin gets a builtin_io with the fds it should use, so a simple             *
+//*                command's redirections are opened into that fd set instead of being                 *
+//*                dup2'd over the shell's own stdin/stdout; nothing needs restoring.                  *
+//*              - echo, printf, pwd, true, false, test and [ run without fork/exec;                   *
+//*                output is built in a buffer and written with one write(2).                          *
+//*              - wc, grep, head and cut (text_filters.c) shadow the real programs                    *
+//*                only for the options they implement; builtin_find() checks.                         *
+//*              - Inside pipelines the same table is used by the forked stage in place                *
+//*                of execv (see piping.c).                                                            *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* ---------------- output buffer ---------------- */
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} outbuf;
+
+static int ob_reserve(outbuf *ob, size_t extra) {
+    if (ob->failed) return -1;
+    if (ob->len + extra + 1 <= ob->cap) return 0;
+    size_t cap = ob->cap ? ob->cap : 256;
+    while (cap < ob->len + extra + 1) cap *= 2;
+    char *nb = realloc(ob->buf, cap);
+    if (!nb) {
+        ob->failed = 1;
+        return -1;
+    }
+    ob->buf = nb;
+    ob->cap = cap;
+    return 0;
+}
+
+static void ob_put(outbuf *ob, const char *s, size_t n) {
+    if (ob_reserve(ob, n) != 0) return;
+    memcpy(ob->buf + ob->len, s, n);
+    ob->len += n;
+}
+
+static void ob_putc(outbuf *ob, char c) {
+    ob_put(ob, &c, 1);
+}
+
+static void ob_fmt(outbuf *ob, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || ob_reserve(ob, (size_t)n) != 0) return;
+    va_start(ap, fmt);
+    vsnprintf(ob->buf + ob->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    ob->len += (size_t)n;
+}
+
+/* Write the whole buffer to the builtin's output and release it. Returns
+ * 0 or -1. */
+static int ob_flush(outbuf *ob, builtin_io *io) {
+    int rc = ob->failed ? -1 : 0;
+    if (rc == 0 && ob->len) rc = bio_write(io, ob->buf, ob->len);
+    free(ob->buf);
+    ob->buf = NULL;
+    ob->len = ob->cap = 0;
+    return rc;
+}
+
+/* ---------------- echo / pwd / true / false ---------------- */
+
+static int bi_echo(char **argv, builtin_io *io) {
+    int newline = 1;
+    int i = 1;
+    if (argv[i] && strcmp(argv[i], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    outbuf ob = { 0 };
+    for (int first = i; argv[i]; ++i) {
+        if (i > first) ob_putc(&ob, ' ');
+        ob_put(&ob, argv[i], strlen(argv[i]));
+    }
+    if (newline) ob_putc(&ob, '\n');
+    return ob_flush(&ob, io) == 0 ? 0 : 1;
+}
+
+static int bi_pwd(char **argv, builtin_io *io) {
+    (void)argv;
+    char cwd[PATH_MAX];
+    if (!shell_getcwd(cwd, sizeof(cwd))) {
+        dprintf(io->err, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    outbuf ob = { 0 };
+    ob_put(&ob, cwd, strlen(cwd));
+    ob_putc(&ob, '\n');
+    return ob_flush(&ob, io) == 0 ? 0 : 1;
+}
+
+static int bi_true(char **argv, builtin_io *io) {
+    (void)argv;
+    (void)io;
+    return 0;
+}
+
+static int bi_false(char **argv, builtin_io *io) {
+    (void)argv;
+    (void)io;
+    return 1;
+}
+
+/* ---------------- printf ---------------- */
+
+/* Emit the backslash escape starting at p (p[0] == '\\'); returns the last
+ * character consumed. */
+static const char *put_escape(outbuf *ob, const char *p) {
+    char c = p[1];
+    switch (c) {
+    case 'n': ob_putc(ob, '\n'); return p + 1;
+    case 't': ob_putc(ob, '\t'); return p + 1;
+    case 'r': ob_putc(ob, '\r'); return p + 1;
+    case 'a': ob_putc(ob, '\a'); return p + 1;
+    case 'b': ob_putc(ob, '\b'); return p + 1;
+    case 'f': ob_putc(ob, '\f'); return p + 1;
+    case 'v': ob_putc(ob, '\v'); return p + 1;
+    case '\\': ob_putc(ob, '\\'); return p + 1;
+    case '0': {
+        int v = 0, k = 0;
+        const char *q = p + 2;
+        while (k < 3 && *q >= '0' && *q <= '7') { v = v * 8 + (*q - '0'); q++; k++; }
+        ob_putc(ob, (char)v);
+        return q - 1;
+    }
+    case '\0':
+        ob_putc(ob, '\\');
+        return p;
+    default:
+        ob_putc(ob, '\\');
+        ob_putc(ob, c);
+        return p + 1;
+    }
+}
+
+static int printf_number_ok(const char *arg, const char *end) {
+    return *arg == '\0' || (end && *end == '\0');
+}
+
+static int bi_printf(char **argv, builtin_io *io) {
+    if (!argv[1]) {
+        dprintf(io->err, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    const char *fmt = argv[1];
+    char **args = argv + 2;
+    outbuf ob = { 0 };
+    int status = 0;
+
+    do {
+        int consumed = 0;
+        for (const char *p = fmt; *p; ++p) {
+            if (*p == '\\') {
+                p = put_escape(&ob, p);
+                continue;
+            }
+            if (*p != '%') {
+                ob_putc(&ob, *p);
+                continue;
+            }
+            if (p[1] == '%') {
+                ob_putc(&ob, '%');
+                p++;
+                continue;
+            }
+
+            /* %[flags][width][.precision]conv */
+            char spec[40];
+            size_t sl = 0;
+            const char *q = p + 1;
+            spec[sl++] = '%';
+            while (*q && strchr("-+ #0", *q) && sl < 8) spec[sl++] = *q++;
+            while (isdigit((unsigned char)*q) && sl < 16) spec[sl++] = *q++;
+            if (*q == '.') {
+                spec[sl++] = *q++;
+                while (isdigit((unsigned char)*q) && sl < 24) spec[sl++] = *q++;
+            }
+            char conv = *q;
+            if (conv == '\0') {
+                ob_put(&ob, p, strlen(p));
+                break;
+            }
+
+            const char *arg = *args ? *args : "";
+            if (*args) {
+                args++;
+                consumed = 1;
+            }
+            char *end = NULL;
+            errno = 0;
+
+            switch (conv) {
+            case 's':
+                spec[sl++] = 's'; spec[sl] = '\0';
+                ob_fmt(&ob, spec, arg);
+                break;
+            case 'b': {
+                for (const char *b = arg; *b; ++b) {
+                    if (*b == '\\') b = put_escape(&ob, b);
+                    else ob_putc(&ob, *b);
+                }
+                break;
+            }
+            case 'c':
+                if (*arg) ob_putc(&ob, *arg);
+                break;
+            case 'd': case 'i': {
+                long long v = strtoll(arg, &end, 0);
+                if (!printf_number_ok(arg, end) || errno == ERANGE) {
+                    dprintf(io->err, "printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                memcpy(spec + sl, "lld", 4);
+                ob_fmt(&ob, spec, v);
+                break;
+            }
+            case 'u': case 'x': case 'X': case 'o': {
+                unsigned long long v = strtoull(arg, &end, 0);
+                if (!printf_number_ok(arg, end) || errno == ERANGE) {
+                    dprintf(io->err, "printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                spec[sl++] = 'l'; spec[sl++] = 'l'; spec[sl++] = conv; spec[sl] = '\0';
+                ob_fmt(&ob, spec, v);
+                break;
+            }
+            case 'f': case 'e': case 'E': case 'g': case 'G': {
+                double v = strtod(arg, &end);
+                if (!printf_number_ok(arg, end)) {
+                    dprintf(io->err, "printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                spec[sl++] = conv; spec[sl] = '\0';
+                ob_fmt(&ob, spec, v);
+                break;
+            }
+            default:
+                dprintf(io->err, "printf: %%%c: invalid directive\n", conv);
+                ob_flush(&ob, io);
+                return 1;
+            }
+            p = q;
+        }
+        /* the format is reused while arguments remain */
+        if (!consumed) break;
+    } while (*args);
+
+    if (ob_flush(&ob, io) != 0) status = 1;
+    return status;
+}
+
+/* ---------------- test / [ ---------------- */
+
+typedef struct {
+    char **av;
+    int pos;
+    int n;
+    int err;
+    int errfd;
+} tparser;
+
+static int t_or(tparser *t);
+
+static const char *t_peek(tparser *t, int off) {
+    return (t->pos + off < t->n) ? t->av[t->pos + off] : NULL;
+}
+
+static int t_is_binary(const char *op) {
+    static const char *ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                                 "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+    for (int i = 0; op && ops[i]; ++i)
+        if (strcmp(op, ops[i]) == 0) return 1;
+    return 0;
+}
+
+static int t_is_unary(const char *op) {
+    return op && op[0] == '-' && op[1] && !op[2] && strchr("efdrwxsLhpSbcznt", op[1]);
+}
+
+static long long t_int(tparser *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || errno == ERANGE) {
+        dprintf(t->errfd, "test: %s: integer expression expected\n", s);
+        t->err = 1;
+    }
+    return v;
+}
+
+static int t_binary(tparser *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+    if (op[1] == 'n' || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')) {
+        struct stat sa, sb;
+        int ha = fstatat(sh->dir_fd, a, &sa, 0) == 0, hb = fstatat(sh->dir_fd, b, &sb, 0) == 0;
+        if (strcmp(op, "-ef") == 0)
+            return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (strcmp(op, "-nt") == 0)
+            return ha && (!hb || sa.st_mtime > sb.st_mtime);
+        return hb && (!ha || sa.st_mtime < sb.st_mtime);
+    }
+    long long x = t_int(t, a), y = t_int(t, b);
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static int t_unary(char op, const char *arg) {
+    struct stat st;
+    switch (op) {
+    case 'z': return arg[0] == '\0';
+    case 'n': return arg[0] != '\0';
+    case 't': return isatty(atoi(arg));
+    case 'r': return faccessat(sh->dir_fd, arg, R_OK, 0) == 0;
+    case 'w': return faccessat(sh->dir_fd, arg, W_OK, 0) == 0;
+    case 'x': return faccessat(sh->dir_fd, arg, X_OK, 0) == 0;
+    case 'L':
+    case 'h': return fstatat(sh->dir_fd, arg, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (fstatat(sh->dir_fd, arg, &st, 0) != 0) return 0;
+    switch (op) {
+    case 'e': return 1;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    }
+    return 0;
+}
+
+static int t_primary(tparser *t) {
+    const char *tok = t_peek(t, 0);
+    if (!tok) {
+        t->err = 1;
+        return 0;
+    }
+    if (strcmp(tok, "(") == 0 && t_peek(t, 1)) {
+        t->pos++;
+        int v = t_or(t);
+        const char *close = t_peek(t, 0);
+        if (!close || strcmp(close, ")") != 0) {
+            dprintf(t->errfd, "test: missing ')'\n");
+            t->err = 1;
+            return 0;
+        }
+        t->pos++;
+        return v;
+    }
+    if (t_peek(t, 2) && t_is_binary(t_peek(t, 1))) {
+        const char *a = tok, *op = t_peek(t, 1), *b = t_peek(t, 2);
+        t->pos += 3;
+        return t_binary(t, a, op, b);
+    }
+    if (t_is_unary(tok) && t_peek(t, 1)) {
+        const char *arg = t_peek(t, 1);
+        t->pos += 2;
+        return t_unary(tok[1], arg);
+    }
+    t->pos++;
+    return tok[0] != '\0';
+}
+
+static int t_not(tparser *t) {
+    const char *tok = t_peek(t, 0);
+    if (tok && strcmp(tok, "!") == 0 && t_peek(t, 1)) {
+        t->pos++;
+        return !t_not(t);
+    }
+    return t_primary(t);
+}
+
+static int t_and(tparser *t) {
+    int v = t_not(t);
+    while (!t->err && t_peek(t, 0) && strcmp(t_peek(t, 0), "-a") == 0) {
+        t->pos++;
+        int r = t_not(t);
+        v = v && r;
+    }
+    return v;
+}
+
+static int t_or(tparser *t) {
+    int v = t_and(t);
+    while (!t->err && t_peek(t, 0) && strcmp(t_peek(t, 0), "-o") == 0) {
+        t->pos++;
+        int r = t_and(t);
+        v = v || r;
+    }
+    return v;
+}
+
+static int run_test(char **av, int n, int errfd) {
+    if (n == 0) return 1;
+    tparser t = { av, 0, n, 0, errfd };
+    int v = t_or(&t);
+    if (!t.err && t.pos != n) {
+        dprintf(errfd, "test: %s: unexpected argument\n", av[t.pos]);
+        t.err = 1;
+    }
+    if (t.err) return 2;
+    return v ? 0 : 1;
+}
+
+static int bi_test(char **argv, builtin_io *io) {
+    int n = 0;
+    while (argv[n + 1]) n++;
+    return run_test(argv + 1, n, io->err);
+}
+
+static int bi_bracket(char **argv, builtin_io *io) {
+    int n = 0;
+    while (argv[n + 1]) n++;
+    if (n == 0 || strcmp(argv[n], "]") != 0) {
+        dprintf(io->err, "[: missing ']'\n");
+        return 2;
+    }
+    return run_test(argv + 1, n - 1, io->err);
+}
+
+/* ---------------- shell-state builtins ---------------- */
+
+/* read [-r] NAME...: one line from io->in, split on blanks; the last NAME
+ * gets the rest of the line. Reads a byte at a time so nothing past the
+ * newline is consumed from a shared fd (coproc, here-doc, pipe).
+ */
+static int bi_read(char **argv, builtin_io *io) {
+    int i = 1;
+    if (argv[i] && strcmp(argv[i], "-r") == 0) i++;
+    if (!argv[i]) {
+        dprintf(io->err, "read: usage: read [-r] NAME...\n");
+        return 2;
+    }
+    for (int k = i; argv[k]; ++k) {
+        if (!var_name_valid(argv[k], strlen(argv[k]))) {
+            dprintf(io->err, "read: `%s': not a valid identifier\n", argv[k]);
+            return 1;
+        }
+    }
+
+    outbuf line = { 0 };
+    int got_newline = 0;
+    for (;;) {
+        char c;
+        ssize_t n = read(io->in, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (c == '\n') {
+            got_newline = 1;
+            break;
+        }
+        ob_putc(&line, c);
+    }
+    if (line.failed) {
+        free(line.buf);
+        return 1;
+    }
+    if (!got_newline && line.len == 0) {
+        free(line.buf);
+        return 1;
+    }
+    ob_putc(&line, '\0');
+
+    char *p = line.buf;
+    for (; argv[i]; ++i) {
+        while (*p == ' ' || *p == '\t') p++;
+        char *end = p;
+        if (argv[i + 1]) {
+            while (*end && *end != ' ' && *end != '\t') end++;
+        } else {
+            end = p + strlen(p);
+            while (end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        }
+        char saved = *end;
+        *end = '\0';
+        var_set(argv[i], p);
+        *end = saved;
+        p = saved ? end + 1 : end;
+    }
+    free(line.buf);
+    return got_newline ? 0 : 1;
+}
+
+/* exit [N]: N defaults to $? */
+static int bi_exit(char **argv, builtin_io *io) {
+    int status = sh->last_exit_status;
+    if (argv[1]) {
+        char *end;
+        long v = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0') {
+            dprintf(io->err, "exit: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        } else {
+            status = (int)(v & 0xff);
+        }
+    }
+    builtin_exit(status);
+    return status;
+}
+
+static int bi_cd(char **argv, builtin_io *io) {
+    (void)io;
+    return builtin_cd(argv) ? 0 : 1;
+}
+
+/* jobs [-o N [--follow]] */
+static int bi_jobs(char **argv, builtin_io *io) {
+    if (!argv[1]) {
+        part_eight_jobs_builtin(io->out);
+        return 0;
+    }
+    char *end = NULL;
+    long jobno = 0;
+    int follow = 0;
+    if (strcmp(argv[1], "-o") == 0 && argv[2]) {
+        const char *spec = argv[2][0] == '%' ? argv[2] + 1 : argv[2];
+        jobno = strtol(spec, &end, 10);
+        follow = argv[3] && strcmp(argv[3], "--follow") == 0;
+    }
+    if (!end || *end || jobno <= 0 || (argv[3] && (!follow || argv[4]))) {
+        dprintf(io->err, "jobs: usage: jobs [-o N [--follow]]\n");
+        return 2;
+    }
+    if (part_eight_jobs_output((int)jobno, follow, io->out) != 0) {
+        dprintf(io->err, "jobs: %ld: no captured output%s\n", jobno,
+                job_capture_enabled() ? "" : " (see set -o capture)");
+        return 1;
+    }
+    return 0;
+}
+
+/* Options for "set -o NAME" / "set +o NAME" */
+static const struct {
+    const char *name;
+    int (*get)(void);
+    void (*set)(int on);
+} shell_options[] = {
+    { "capture", job_capture_enabled, job_capture_set },
+    { "explain", pipe_explain_enabled, pipe_explain_set },
+    { "pipeopt", pipe_rewrite_enabled, pipe_rewrite_set },
+    { "pipestats", pipe_stats_enabled, pipe_stats_set },
+};
+
+#define SHELL_OPTION_COUNT (sizeof(shell_options) / sizeof(shell_options[0]))
+
+/* The options by index, for the startup snapshot (rc_snapshot.c).
+ * shell_option_name() is NULL past the last one. */
+const char *shell_option_name(int i) {
+    return i >= 0 && (size_t)i < SHELL_OPTION_COUNT ? shell_options[i].name : NULL;
+}
+
+int shell_option_get(int i) {
+    return shell_options[i].get();
+}
+
+void shell_option_set(int i, int on) {
+    shell_options[i].set(on);
+}
+
+/* set -o | set -o NAME | set +o NAME */
+static int bi_set(char **argv, builtin_io *io) {
+    if (!argv[1] || (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0) ||
+        (argv[2] && argv[3])) {
+        dprintf(io->err, "set: usage: set [-o|+o] [NAME]\n");
+        return 2;
+    }
+    if (!argv[2]) {
+        outbuf ob = { 0 };
+        for (size_t i = 0; i < SHELL_OPTION_COUNT; ++i)
+            ob_fmt(&ob, "%-15s %s\n", shell_options[i].name, shell_options[i].get() ? "on" : "off");
+        return ob_flush(&ob, io) == 0 ? 0 : 1;
+    }
+    for (size_t i = 0; i < SHELL_OPTION_COUNT; ++i) {
+        if (strcmp(argv[2], shell_options[i].name) == 0) {
+            shell_options[i].set(argv[1][0] == '-');
+            return 0;
+        }
+    }
+    dprintf(io->err, "set: %s: invalid option name\n", argv[2]);
+    return 1;
+}
+
+static int bi_tee(char **argv, builtin_io *io) {
+    return tee_stage(argv, io);
+}
+
+/* Sorted by name for bsearch */
+static const builtin_t builtin_table[] = {
+    { "[",       bi_bracket,      BUILTIN_THREADED },
+    { "cd",      bi_cd,           BUILTIN_SPECIAL | BUILTIN_HISTORY_IF_OK },
+    { "compgen", builtin_compgen, BUILTIN_SPECIAL },
+    { "coproc",  builtin_coproc,  BUILTIN_SPECIAL | BUILTIN_RAW_ARGV },
+    { "cut",     builtin_cut,     BUILTIN_THREADED, cut_accepts },
+    { "echo",    bi_echo,         BUILTIN_THREADED },
+    { "exit",    bi_exit,         BUILTIN_SPECIAL },
+    { "export",  builtin_export,  BUILTIN_SPECIAL },
+    { "false",   bi_false,        BUILTIN_THREADED },
+    { "grep",    builtin_grep,    BUILTIN_THREADED, grep_accepts },
+    { "head",    builtin_head,    BUILTIN_THREADED, head_accepts },
+    { "jobs",    bi_jobs,         BUILTIN_SPECIAL },
+    { "memo",    builtin_memo,    0 },
+    { "printf",  bi_printf,       BUILTIN_THREADED },
+    { "pwd",     bi_pwd,          BUILTIN_THREADED },
+    { "read",    bi_read,         BUILTIN_SPECIAL },
+    { "set",     bi_set,          BUILTIN_SPECIAL },
+    { "tee",     bi_tee,          BUILTIN_THREADED },
+    { "test",    bi_test,         BUILTIN_THREADED },
+    { "timeout", builtin_timeout, 0 },
+    { "true",    bi_true,         BUILTIN_THREADED },
+    { "unset",   builtin_unset,   BUILTIN_SPECIAL },
+    { "wc",      builtin_wc,      BUILTIN_THREADED, wc_accepts },
+};
+
+static int cmp_builtin(const void *key, const void *elem) {
+    return strcmp((const char *)key, ((const builtin_t *)elem)->name);
+}
+
+const builtin_t *builtin_lookup(const char *name) {
+    if (!name) return NULL;
+    return bsearch(name, builtin_table, sizeof(builtin_table) / sizeof(builtin_table[0]),
+                   sizeof(builtin_t), cmp_builtin);
+}
+
+/* The builtins by index, for command completion (line_edit.c).
+ * NULL past the last one. */
+const char *builtin_name(int i) {
+    return i >= 0 && (size_t)i < sizeof(builtin_table) / sizeof(builtin_table[0])
+           ? builtin_table[i].name : NULL;
+}
+
+/* The builtin that should run argv, or NULL. Filters that shadow a real
+ * program (wc, grep ...) decline options they don't implement. */
+const builtin_t *builtin_find(char **argv) {
+    const builtin_t *b = argv && argv[0] ? builtin_lookup(argv[0]) : NULL;
+    if (b && b->accepts && !b->accepts(argv)) return NULL;
+    return b;
+}
+
+/* Run a builtin as a simple command in the shell process. Redirections in
+ * argv are opened into the builtin's own fd set; without one, output goes
+ * to out_fd (sh->fd_out, or a capture fd for $(...)).
+ * Returns the exit status.
+ */
+int run_builtin(const builtin_t *b, char **argv, int out_fd) {
+    redir_fds r = { { 0, 1, 2 }, { -1, -1, -1 } };
+    if (!(b->flags & BUILTIN_RAW_ARGV) && redirect_open(argv, &r) != 0) return 1;
+    const int base[3] = { STDIN_FILENO, out_fd, sh->fd_err };
+    builtin_io io = { redirect_fd(&r, 0, base), redirect_fd(&r, 1, base), redirect_fd(&r, 2, base) };
+    fflush(stdout);
+    int status = b->fn(argv, &io);
+    fflush(stdout);
+    redirect_close(&r);
+    return status;
+}
+
+/* "grep -c a f &": a builtin that is not BUILTIN_SPECIAL as a background
+ * job. Forked like an external command: redirections are opened first, and
+ * under "set -o capture" the output goes to the job's capture pipe. The
+ * caller registers the returned pid (part_eight_add_job). Returns -1 with
+ * $? set when no child was made.
+ */
+pid_t run_builtin_background(const builtin_t *b, char **argv) {
+    redir_fds r;
+    if (redirect_open(argv, &r) != 0) {
+        sh->last_exit_status = 1;
+        return -1;
+    }
+    job_capture_prepare();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        shell_child_setup();
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        job_capture_child();
+        if (redirect_apply(&r) != 0) _exit(1);
+        builtin_io io = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        int status = b->fn(argv, &io);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid < 0) {
+        shell_perror("fork");
+        sh->last_exit_status = 1;
+    }
+    job_capture_parent();
+    redirect_close(&r);
+    return pid;
+}
@@ -0,0 +1,213 @@
+//******************************************************************************************************
+//* Name:        command_subst.c                                                                       *
+//* Description: Command substitution for the expansion stage (called from expand_word()).             *
+//*              - $(< file): the file is read straight into the result buffer (one                    *
+//*                read of st_size bytes for regular files); nothing is spawned.                       *
+//*              - $(builtin ...): a simple command whose name is a non-special builtin                *
+//*                (echo, printf, pwd, test ...) runs in-process with its output fd                    *
+//*                pointed at a reused memfd, so no fork and no pipe.                                  *
+//*              - anything else runs in a forked copy of the shell through                            *
+//*                shell_run_line(), its stdout a pipe drained with large reads directly               *
+//*                into a doubling buffer.                                                             *
+//*              Trailing newlines are removed and $? is set from the inner command.                   *
+//*              The result is not field-split, like variable expansion in this shell.                 *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+#define SUBST_READ_CHUNK (64 * 1024)
+
+/* memfd reused by every in-process capture; see capture_builtin() */
+static int capture_fd = -1;
+
+static char *trim_result(char *buf, size_t *len) {
+    while (*len > 0 && buf[*len - 1] == '\n') (*len)--;
+    buf[*len] = '\0';
+    return buf;
+}
+
+/* Read fd to EOF. Each read goes straight into the free tail of the result,
+ * which doubles when full. */
+static char *drain_fd(int fd, size_t hint, size_t *out_len) {
+    size_t cap = hint > SUBST_READ_CHUNK ? hint + 2 : SUBST_READ_CHUNK;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    for (;;) {
+        if (cap - len < 2) {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) {
+                free(buf);
+                return NULL;
+            }
+            buf = nb;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (n == 0) break;
+        len += (size_t)n;
+    }
+    *out_len = len;
+    return trim_result(buf, out_len);
+}
+
+/* $(< file) */
+static char *read_file(const char *spec, size_t *out_len) {
+    while (*spec == ' ') spec++;
+    size_t n = strlen(spec);
+    while (n > 0 && spec[n - 1] == ' ') n--;
+    char *name = strndup(spec, n);
+    if (!name) return NULL;
+
+    char *path = expand_word(name);
+    if (path && path != name) {
+        free(name);
+        name = path;
+    }
+    char *tilde = name ? expand_tilde(name) : NULL;
+    if (tilde && tilde != name) {
+        free(name);
+        name = tilde;
+    }
+    if (!name) return NULL;
+
+    int fd = openat(sh->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        dprintf(sh->fd_err, "Error: %s: %s\n", name, strerror(errno));
+        free(name);
+        sh->last_exit_status = 1;
+        *out_len = 0;
+        return strdup("");
+    }
+    free(name);
+
+    struct stat st;
+    size_t hint = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? (size_t)st.st_size : 0;
+    char *out = drain_fd(fd, hint, out_len);
+    close(fd);
+    sh->last_exit_status = 0;
+    return out;
+}
+
+/* True if the words form one simple command we can run in-process */
+static int simple_builtin_command(tokenlist *tokens) {
+    const builtin_t *b = builtin_find(tokens->items);
+    if (!b || (b->flags & BUILTIN_SPECIAL)) return 0;
+    for (size_t i = 0; i < tokens->size; ++i) {
+        const char *t = tokens->items[i];
+        if (strcmp(t, "|") == 0 || strcmp(t, "&") == 0 || strcmp(t, ";") == 0 ||
+            strncmp(t, "<<", 2) == 0) return 0;
+    }
+    return 1;
+}
+
+static char *capture_fork(char *line, size_t *out_len) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1) {
+        shell_perror("pipe");
+        return NULL;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        shell_child_setup();
+        dup2(p[1], STDOUT_FILENO);
+        close(p[0]);
+        close(p[1]);
+        int status = shell_run_line(line);
+        fflush(stdout);
+        _exit(status & 0xff);
+    }
+    close(p[1]);
+    if (pid < 0) {
+        shell_perror("fork");
+        close(p[0]);
+        return NULL;
+    }
+    char *out = drain_fd(p[0], 0, out_len);
+    close(p[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            status = 0;
+            break;
+        }
+    }
+    if (WIFEXITED(status)) sh->last_exit_status = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status)) sh->last_exit_status = 128 + WTERMSIG(status);
+    return out;
+}
+
+static char *capture_builtin(tokenlist *tokens, char *line, size_t *out_len) {
+    /* nested $(...) in the arguments finish here, before capture_fd is reused */
+    char **argv = expand_argv(tokens->items, (int)tokens->size);
+    if (!argv) return NULL;
+    const builtin_t *b = builtin_find(argv);
+    if (!b) {
+        /* the expanded words need the real program ("wc $OPTS") */
+        free_argv(argv);
+        return capture_fork(line, out_len);
+    }
+
+    if (capture_fd < 0) capture_fd = memfd_create("subst", MFD_CLOEXEC);
+    if (capture_fd < 0 || ftruncate(capture_fd, 0) != 0 || lseek(capture_fd, 0, SEEK_SET) != 0) {
+        free_argv(argv);
+        return NULL;
+    }
+    sh->last_exit_status = run_builtin(b, argv, capture_fd);
+    free_argv(argv);
+
+    struct stat st;
+    size_t size = fstat(capture_fd, &st) == 0 ? (size_t)st.st_size : 0;
+    char *out = malloc(size + 1);
+    if (!out) return NULL;
+    ssize_t n = size ? pread(capture_fd, out, size, 0) : 0;
+    *out_len = n > 0 ? (size_t)n : 0;
+    return trim_result(out, out_len);
+}
+
+/* Output of the command text cmd[0, len), trailing newlines removed.
+ * Returns a malloc'd string (length in *out_len), or NULL on failure.
+ */
+char *command_subst(const char *cmd, size_t len, size_t *out_len) {
+    *out_len = 0;
+    char *line = strndup(cmd, len);
+    if (!line) return NULL;
+
+    char *p = line;
+    while (*p == ' ') p++;
+    if (*p == '<') {
+        char *out = read_file(p + 1, out_len);
+        free(line);
+        return out;
+    }
+
+    char *out = NULL;
+    tokenlist *tokens = get_tokens(p);
+    if (!tokens || tokens->size == 0) {
+        out = strdup("");
+    } else if (simple_builtin_command(tokens)) {
+        out = capture_builtin(tokens, p, out_len);
+    } else {
+        out = capture_fork(p, out_len);
+    }
+    if (tokens) free_tokens(tokens);
+    free(line);
+    return out;
+}
@@ -0,0 +1,157 @@
+//******************************************************************************************************
+//* Name:        coproc.c                                                                              *
+//* Description: "coproc NAME cmd [args...]" builtin.                                                  *
+//*              - Starts cmd once as a long-lived child whose stdin and stdout are pipes              *
+//*                held by the shell, so interpreters, database CLIs etc. pay their                    *
+//*                startup cost once instead of once per command.                                      *
+//*              - The shell's ends are published like bash does:                                      *
+//*                  ${NAME[0]}  read replies   (coproc's stdout)                                      *
+//*                  ${NAME[1]}  send requests  (coproc's stdin)                                       *
+//*                  $NAME_PID   process id                                                            *
+//*                and are used with the fd redirections, e.g.                                         *
+//*                  echo 2+2 >&${BC[1]}     read ANSWER <&${BC[0]}                                    *
+//*              - Both ends are close-on-exec, so other commands never inherit them                   *
+//*                and the coproc sees EOF once the shell closes its write end.                        *
+//*              - Redirections on cmd are its own ("coproc C cat < f"): opened before                 *
+//*                the fork and applied over the pipes in the child.                                   *
+//*              - The coproc is a job in background_proc.c; when it is reaped the                     *
+//*                fds are closed and the NAME variables are unset.                                    *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "shell.h"
+
+/* NAME[0], NAME[1] and NAME_PID for a coproc called name */
+static void coproc_var_name(char *buf, size_t size, const char *name, const char *suffix) {
+    snprintf(buf, size, "%s%s", name, suffix);
+}
+
+static void set_fd_var(const char *name, const char *suffix, long value) {
+    char key[128], num[32];
+    coproc_var_name(key, sizeof(key), name, suffix);
+    snprintf(num, sizeof(num), "%ld", value);
+    var_set(key, num);
+}
+
+/* Remove the variables published for a coproc (called when it is reaped) */
+void coproc_forget(const char *name) {
+    char key[128];
+    coproc_var_name(key, sizeof(key), name, "[0]");
+    var_unset(key);
+    coproc_var_name(key, sizeof(key), name, "[1]");
+    var_unset(key);
+    coproc_var_name(key, sizeof(key), name, "_PID");
+    var_unset(key);
+}
+
+int builtin_coproc(char **argv, builtin_io *io) {
+    if (!argv[1] || !argv[2]) {
+        dprintf(io->err, "coproc: usage: coproc NAME command [args...]\n");
+        return 2;
+    }
+    const char *name = argv[1];
+    size_t nlen = strlen(name);
+    if (!var_name_valid(name, nlen) || nlen > 100) {
+        dprintf(io->err, "coproc: `%s': not a valid identifier\n", name);
+        return 1;
+    }
+    if (part_eight_find_coproc(name) >= 0) {
+        dprintf(io->err, "coproc: %s: already running\n", name);
+        return 1;
+    }
+
+    /* BUILTIN_RAW_ARGV: the redirections are still in argv, and are cmd's */
+    char **cmd = argv + 2;
+    redir_fds r;
+    if (redirect_open(cmd, &r) != 0) return 1;
+    if (!cmd[0]) {
+        dprintf(io->err, "coproc: usage: coproc NAME command [args...]\n");
+        redirect_close(&r);
+        return 2;
+    }
+
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) == -1) {
+        dprintf(io->err, "coproc: pipe: %s\n", strerror(errno));
+        redirect_close(&r);
+        return 1;
+    }
+    if (pipe2(from_child, O_CLOEXEC) == -1) {
+        dprintf(io->err, "coproc: pipe: %s\n", strerror(errno));
+        close(to_child[0]);
+        close(to_child[1]);
+        redirect_close(&r);
+        return 1;
+    }
+
+    fflush(stdout);
+    char **envp = var_envp();
+    pid_t pid = fork();
+    if (pid == 0) {
+        shell_child_setup();
+        /* dup2 clears close-on-exec on 0 and 1; every other pipe end goes at exec */
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        if (redirect_apply(&r) != 0) _exit(1);
+
+        const builtin_t *builtin = builtin_find(cmd);
+        if (builtin) {
+            builtin_io cio = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+            int status = builtin->fn(cmd, &cio);
+            fflush(stdout);
+            _exit(status);
+        }
+        execute_search(cmd[0], cmd, envp);
+        _exit(127);
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+    redirect_close(&r);
+    if (pid < 0) {
+        dprintf(io->err, "coproc: fork: %s\n", strerror(errno));
+        close(to_child[1]);
+        close(from_child[0]);
+        return 1;
+    }
+
+    /* "coproc NAME cmd args" for jobs and the completion message */
+    size_t len = 1;
+    for (int i = 0; argv[i]; ++i) len += strlen(argv[i]) + 1;
+    char *cmdline = malloc(len);
+    if (cmdline) {
+        cmdline[0] = '\0';
+        for (int i = 0; argv[i]; ++i) {
+            if (i) strcat(cmdline, " ");
+            strcat(cmdline, argv[i]);
+        }
+    }
+    int jobno = part_eight_add_coproc(cmdline ? cmdline : name, name, pid, from_child[0], to_child[1]);
+    free(cmdline);
+    if (jobno < 0) {
+        /* an untracked coproc would never be reaped or have its fds closed */
+        dprintf(io->err, "coproc: %s: too many jobs\n", name);
+        close(to_child[1]);
+        close(from_child[0]);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    set_fd_var(name, "[0]", from_child[0]);
+    set_fd_var(name, "[1]", to_child[1]);
+    set_fd_var(name, "_PID", (long)pid);
+    return 0;
+}
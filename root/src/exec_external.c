@@ -36,9 +36,12 @@
 #include <sys/stat.h>
 #include "shell.h"
 
+extern char **environ;
+
+
 /* Finds an executable on PATH.
  * If cmd contains a '/', returns strdup(cmd) (no PATH search).
- * Otherwise searches directories in getenv("PATH") and returns strdup(fullpath)
+ * Otherwise searches directories in $PATH and returns strdup(fullpath)
  * for the first entry where access(fullpath, X_OK) == 0.
  * Returns NULL if not found. Caller must free() returned string.
  */
@@ -49,7 +52,11 @@ char *find_executable(const char *cmd) {
         return strdup(cmd);
     }
 
-    const char *path_env = getenv("PATH");
+    /* the startup snapshot's index of PATH, while PATH is unchanged */
+    const char *indexed = path_index_lookup(cmd);
+    if (indexed && faccessat(sh->dir_fd, indexed, X_OK, 0) == 0) return strdup(indexed);
+
+    const char *path_env = var_get("PATH");
     if (!path_env) path_env = "/bin:/usr/bin";
 
     char *path_dup = strdup(path_env);
@@ -66,7 +73,7 @@ char *find_executable(const char *cmd) {
         }
         snprintf(candidate, len, "%s/%s", dir, cmd);
 
-        if (access(candidate, X_OK) == 0) {
+        if (faccessat(sh->dir_fd, candidate, X_OK, 0) == 0) {
             free(path_dup);
             return candidate; /* caller must free */
         }
@@ -82,17 +89,17 @@ char *find_executable(const char *cmd) {
 /* Print a helpful error for exec failures or missing executable */
 static void print_exec_error(const char *prog, const char *path) {
     if (!path) {
-        fprintf(stderr, "%s: command not found\n", prog);
+        dprintf(sh->fd_err, "%s: command not found\n", prog);
         return;
     }
     struct stat st;
-    if (stat(path, &st) == -1) {
-        fprintf(stderr, "%s: %s: %s\n", prog, path, strerror(errno));
+    if (fstatat(sh->dir_fd, path, &st, 0) == -1) {
+        dprintf(sh->fd_err, "%s: %s: %s\n", prog, path, strerror(errno));
     } else {
         if (! (st.st_mode & S_IXUSR)) {
-            fprintf(stderr, "%s: %s: Permission denied\n", prog, path);
+            dprintf(sh->fd_err, "%s: %s: Permission denied\n", prog, path);
         } else {
-            fprintf(stderr, "%s: %s: Cannot execute\n", prog, path);
+            dprintf(sh->fd_err, "%s: %s: Cannot execute\n", prog, path);
         }
     }
 }
@@ -111,8 +118,9 @@ static void print_exec_error(const char *prog, const char *path) {
  *  - If fullpath is NULL and find_executable() allocates a path, this function
  *    frees it before returning. If you pass a malloc'd fullpath yourself and want
  *    it preserved, pass it and manage freeing yourself.
- *  - Caller must perform redirection/piping FD setup in the child (after fork)
- *    before execv; alternatively, perform setups here before execv if desired.
+ *  - Redirections in argv are opened before fork (a failure returns -1 with
+ *    $? = 1 and no child) and the tokens are removed from argv, which must
+ *    be heap-allocated; the child only dup2()s them into place.
  */
 pid_t execute_command(char **argv, char *fullpath, int background) {
     if (!argv || !argv[0]) {
@@ -120,6 +128,14 @@ pid_t execute_command(char **argv, char *fullpath, int background) {
         return -1;
     }
 
+    /* Redirections are opened here, before fork: a bad path or fd is
+     * reported without creating a process (io_redireciton.c) */
+    redir_fds r;
+    if (redirect_open(argv, &r) != 0) {
+        sh->last_exit_status = 1;
+        return -1;
+    }
+
     int should_free_path = 0;
     char *path_to_exec = fullpath;
 
@@ -130,18 +146,29 @@ pid_t execute_command(char **argv, char *fullpath, int background) {
 
     if (!path_to_exec) {
         print_exec_error(argv[0], NULL);
+        redirect_close(&r);
+        sh->last_exit_status = 127;
         return -1;
     }
 
-    if (access(path_to_exec, X_OK) != 0) {
+    if (faccessat(sh->dir_fd, path_to_exec, X_OK, 0) != 0) {
         print_exec_error(argv[0], path_to_exec);
         if (should_free_path) free(path_to_exec);
+        redirect_close(&r);
+        sh->last_exit_status = 126;
         return -1;
     }
 
+    /* "set -o capture": a background job's output goes to its capture pipe */
+    if (background) job_capture_prepare();
+
+    /* Built in the parent, so the cache stays valid across execs */
+    char **envp = var_envp();
     pid_t pid = fork();
     if (pid < 0) {
-        perror("fork");
+        shell_perror("fork");
+        job_capture_parent();
+        redirect_close(&r);
         if (should_free_path) free(path_to_exec);
         return -1;
     }
@@ -150,21 +177,27 @@ pid_t execute_command(char **argv, char *fullpath, int background) {
         /* Child process: restore default signal handlers so program responds
          * to signals like interactive programs normally do.
          */
+        shell_child_setup();
         signal(SIGINT, SIG_DFL);
         signal(SIGQUIT, SIG_DFL);
         signal(SIGTSTP, SIG_DFL);
 
-		handle_io_redirection((char**)argv);
+        job_capture_child();
+        if (redirect_apply(&r) != 0) _exit(1);
 
-        /* Execute program. execv only, per project restrictions. */
+        /* Execute program. execv only, per project restrictions; the
+         * exported variables reach the child through environ. */
+        environ = envp;
         execv(path_to_exec, (char *const *)argv);
 
         /* If execv returns, an error occurred. Print and exit child. */
-        fprintf(stderr, "%s: failed to execute %s: %s\n", argv[0], path_to_exec, strerror(errno));
+        dprintf(sh->fd_err, "%s: failed to execute %s: %s\n", argv[0], path_to_exec, strerror(errno));
         _exit(127);
     }
 
     /* Parent */
+    job_capture_parent();
+    redirect_close(&r);
     if (should_free_path) free(path_to_exec);
 
     if (background) {
@@ -173,17 +206,19 @@ pid_t execute_command(char **argv, char *fullpath, int background) {
         return pid;
     }
 
-    /* Foreground: wait for child and reap status */
+    /* Foreground: wait for child and reap status (background deadlines
+     * keep being enforced meanwhile) */
     int status;
-    pid_t w = waitpid(pid, &status, 0);
+    pid_t w = part_eight_wait_pid(pid, &status);
     if (w == -1) {
-        perror("waitpid");
+        shell_perror("waitpid");
         return pid;
     }
 
-    /* Optionally use WIFEXITED / WEXITSTATUS / WIFSIGNALED here to update
-     * shell state (e.g., last exit code). */
-    (void)status;
+    if (WIFEXITED(status))
+        sh->last_exit_status = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        sh->last_exit_status = 128 + WTERMSIG(status);
 
     return pid;
 }
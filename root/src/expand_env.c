@@ -7,10 +7,15 @@
 //*                - expand_env_vars_inplace(char **argv): destructive, replaces                       *
 //*                  heap-allocated tokens in-place (caller must ensure ownership).                    *
 //*              Behavior:                                                                             *
-//*                - Expands tokens that are exactly "$NAME" where NAME follows                        *
-//*                  POSIX-like rules (first char alpha or '_', subsequent are                         *
-//*                  alnum or '_').                                                                    *
+//*                - Expands $NAME and ${NAME} anywhere inside a token, plus $? (last                  *
+//*                  exit status) and $$ (shell pid). NAME follows POSIX-like rules                    *
+//*                  (first char alpha or '_', subsequent are alnum or '_').                           *
+//*                - Values come from the shell variable store (variables.c), so                       *
+//*                  shell-local variables expand as well as exported ones.                            *
 //*                - Unset variables are replaced with the empty string ("").                          *
+//*                - $(cmd) and $(< file) are replaced by the output, see command_subst.c.             *
+//*                - ${NAME[N]} reads the variable literally named "NAME[N]" (coproc fds).             *
+//*                - Tokens without a '$' are left untouched (no copy).                                *
 //* Author:      Katelyna Pastrana                                                                     *
 //* Date:        2026-01-24                                                                            *
 //* References:                                                                                        *
@@ -30,18 +35,140 @@
 #include <ctype.h>
 #include "shell.h"
 
-/* Validate environment variable NAME according to POSIX-like rules:
- *  - Non-empty
- *  - First char: alphabetic (A-Z,a-z) or underscore '_'
- *  - Subsequent chars: alphanumeric or underscore
+/* Scratch buffer reused by every expansion; only the final result is
+ * allocated at its exact size. */
+static char *scratch = NULL;
+static size_t scratch_cap = 0;
+
+static int reserve(size_t need) {
+    if (need <= scratch_cap) return 0;
+    size_t cap = scratch_cap ? scratch_cap : 256;
+    while (cap < need) cap *= 2;
+    char *nb = realloc(scratch, cap);
+    if (!nb) return -1;
+    scratch = nb;
+    scratch_cap = cap;
+    return 0;
+}
+
+static int put(size_t *len, const char *src, size_t n) {
+    if (reserve(*len + n + 1) != 0) return -1;
+    memcpy(scratch + *len, src, n);
+    *len += n;
+    return 0;
+}
+
+static size_t name_span(const char *p) {
+    if (!(isalpha((unsigned char)*p) || *p == '_')) return 0;
+    size_t n = 1;
+    while (isalnum((unsigned char)p[n]) || p[n] == '_') n++;
+    return n;
+}
+
+/* NAME[N] inside ${...}: coproc fds are stored as variables named that way */
+static int subscript_valid(const char *s, size_t n) {
+    size_t name = name_span(s);
+    if (!name || name + 2 >= n || s[name] != '[' || s[n - 1] != ']') return 0;
+    for (size_t i = name + 1; i < n - 1; ++i)
+        if (!isdigit((unsigned char)s[i])) return 0;
+    return 1;
+}
+
+/* Matching ')' for the '(' at open, counting nested parentheses, or NULL */
+static const char *subst_end(const char *open) {
+    int depth = 0;
+    for (const char *p = open; *p; ++p) {
+        if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) return p;
+    }
+    return NULL;
+}
+
+/* Expand one token in a single left-to-right pass.
+ * Returns tok itself when it contains nothing to expand, a newly allocated
+ * string otherwise, or NULL on allocation failure.
  */
-static int is_valid_env_name(const char *name) {
-    if (name == NULL || name[0] == '\0') return 0;
-    if (!(isalpha((unsigned char)name[0]) || name[0] == '_')) return 0;
-    for (const char *p = name + 1; *p; ++p) {
-        if (!(isalnum((unsigned char)*p) || *p == '_')) return 0;
+char *expand_word(const char *tok) {
+    const char *dollar = strchr(tok, '$');
+    if (!dollar) return (char *)tok;
+
+    size_t len = 0;
+    const char *p = tok;
+    char num[32];
+
+    while (dollar) {
+        if (put(&len, p, (size_t)(dollar - p)) != 0) return NULL;
+        const char *q = dollar + 1;
+        const char *val = NULL;
+        size_t vlen = 0;
+
+        if (*q == '(') {
+            /* $(cmd) / $(< file): the nested run may expand words itself and
+             * reuse the scratch buffer, so park what we have so far */
+            const char *close = subst_end(q);
+            if (close) {
+                char *saved = malloc(len + 1);
+                if (!saved) return NULL;
+                memcpy(saved, scratch, len);
+                size_t out_len = 0;
+                char *out = command_subst(q + 1, (size_t)(close - (q + 1)), &out_len);
+                int rc = reserve(len + out_len + 1);
+                if (rc == 0) {
+                    memcpy(scratch, saved, len);
+                    if (out) memcpy(scratch + len, out, out_len);
+                    len += out ? out_len : 0;
+                }
+                free(saved);
+                free(out);
+                if (rc != 0) return NULL;
+                p = close + 1;
+                dollar = strchr(p, '$');
+                continue;
+            }
+            val = "$";
+            vlen = 1;
+            p = q;
+        } else if (*q == '{') {
+            const char *close = strchr(q + 1, '}');
+            size_t n = close ? (size_t)(close - (q + 1)) : 0;
+            if (close && (var_name_valid(q + 1, n) || subscript_valid(q + 1, n))) {
+                val = var_getn(q + 1, n);
+                vlen = val ? strlen(val) : 0;
+                p = close + 1;
+            } else {
+                /* malformed ${...}: keep the '$' literally */
+                val = "$";
+                vlen = 1;
+                p = q;
+            }
+        } else if (*q == '?' || *q == '$') {
+            vlen = (size_t)snprintf(num, sizeof(num), "%ld",
+                                    *q == '?' ? (long)sh->last_exit_status : (long)getpid());
+            val = num;
+            p = q + 1;
+        } else {
+            size_t n = name_span(q);
+            if (n) {
+                val = var_getn(q, n);
+                vlen = val ? strlen(val) : 0;
+                p = q + n;
+            } else {
+                val = "$";
+                vlen = 1;
+                p = q;
+            }
+        }
+
+        if (vlen && put(&len, val, vlen) != 0) return NULL;
+        dollar = strchr(p, '$');
     }
-    return 1;
+    if (put(&len, p, strlen(p)) != 0) return NULL;
+
+    char *out = malloc(len + 1);
+    if (!out) return NULL;
+    memcpy(out, scratch, len);
+    out[len] = '\0';
+    return out;
 }
 
 /* Free a NULL-terminated argv produced by these helpers.
@@ -59,11 +186,6 @@ void free_argv(char **argv) {
  * - argv_in: NULL-terminated array of strings (may be statics/literals)
  * - Returns a newly allocated NULL-terminated array of strings with expansions applied.
  *   Caller must free returned array with free_argv().
- *
- * Rules:
- * - If token is exactly "$NAME" and NAME is valid, replace with getenv(NAME) or ""
- *   if unset.
- * - Otherwise copy token unchanged.
  */
 char **expand_env_vars_dup(char **argv_in) {
     if (!argv_in) return NULL;
@@ -77,21 +199,9 @@ char **expand_env_vars_dup(char **argv_in) {
     if (!out) return NULL;
 
     for (size_t i = 0; i < n; ++i) {
-        const char *tok = argv_in[i];
-        if (tok != NULL && tok[0] == '$' && tok[1] != '\0') {
-            const char *name = tok + 1;
-            if (is_valid_env_name(name)) {
-                const char *val = getenv(name);
-                out[i] = strdup(val ? val : "");
-                if (!out[i]) {
-                    free_argv(out);
-                    return NULL;
-                }
-                continue;
-            }
-        }
-        // default: copy token as-is
-        out[i] = strdup(tok ? tok : "");
+        const char *tok = argv_in[i] ? argv_in[i] : "";
+        char *expanded = expand_word(tok);
+        out[i] = (expanded == tok) ? strdup(tok) : expanded;
         if (!out[i]) {
             free_argv(out);
             return NULL;
@@ -103,22 +213,18 @@ char **expand_env_vars_dup(char **argv_in) {
 
 /* In-place destructive expansion:
  * - Assumes caller "owns" the strings in argv (they are heap-allocated).
- * - Replaces argv[i] with newly allocated strings (from strdup) and frees old string.
+ * - Tokens that change are replaced with a new allocation and the old one freed;
+ *   tokens without a '$' are left as they are.
  * - Returns 0 on success, -1 on allocation error.
  */
 int expand_env_vars_inplace(char **argv) {
     if (!argv) return 0;
     for (size_t i = 0; argv[i] != NULL; ++i) {
-        char *tok = argv[i];
-        if (tok != NULL && tok[0] == '$' && tok[1] != '\0') {
-            const char *name = tok + 1;
-            if (is_valid_env_name(name)) {
-                const char *val = getenv(name);
-                char *replacement = strdup(val ? val : "");
-                if (!replacement) return -1; /* allocation error; caller left in inconsistent state */
-                free(argv[i]);                /* free old token (must be heap-allocated) */
-                argv[i] = replacement;
-            }
+        char *expanded = expand_word(argv[i]);
+        if (!expanded) return -1; /* allocation error; caller left in inconsistent state */
+        if (expanded != argv[i]) {
+            free(argv[i]);        /* free old token (must be heap-allocated) */
+            argv[i] = expanded;
         }
     }
     return 0;
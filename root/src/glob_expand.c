@@ -0,0 +1,563 @@
+//******************************************************************************************************
+//* Name:        glob_expand.c                                                                         *
+//* Description: Pathname expansion (*, ?, [...]) for argv words.                                      *
+//*              - Each path component of a pattern is compiled once into a small op list              *
+//*                with its literal prefix/suffix and minimum length pulled out, so most               *
+//*                directory entries are rejected with a length check or one memcmp.                   *
+//*              - Directories are read with getdents64 into a 1 MiB buffer instead of                 *
+//*                readdir, which keeps the syscall count low on very large directories.               *
+//*              - Matches are collected and sorted once per word with qsort.                          *
+//*              - Words that match nothing are passed through unchanged (POSIX default).              *
+//*              - Names starting with '.' only match a pattern that starts with '.'.                  *
+//*              - A trailing '/' ("d/*/") matches directories only and is kept on each match.         *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shell.h"
+
+#define GLOB_DENTS_BUF (1 << 20)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static char *dents_buf = NULL;
+
+/* Returns non-zero if the word contains an unescaped glob metacharacter */
+int glob_has_magic(const char *word) {
+    for (const char *p = word; *p; ++p) {
+        if (*p == '\\' && p[1]) { ++p; continue; }
+        if (*p == '*' || *p == '?' || *p == '[') return 1;
+    }
+    return 0;
+}
+
+/* ---------------- pattern compilation ---------------- */
+
+static size_t parse_class(const char *p, size_t len, glob_op *op) {
+    /* p points just past '['; returns chars consumed including ']' or 0 if unterminated */
+    size_t i = 0;
+    int negate = 0;
+    memset(op->set, 0, sizeof(op->set));
+    if (i < len && (p[i] == '!' || p[i] == '^')) { negate = 1; i++; }
+    size_t first = i;
+    while (i < len && (p[i] != ']' || i == first)) {
+        unsigned char lo = (unsigned char)p[i];
+        unsigned char hi = lo;
+        if (i + 2 < len && p[i + 1] == '-' && p[i + 2] != ']') {
+            hi = (unsigned char)p[i + 2];
+            i += 2;
+        }
+        for (unsigned c = lo; c <= hi; ++c) op->set[c >> 3] |= (unsigned char)(1u << (c & 7));
+        i++;
+    }
+    if (i >= len) return 0;
+    if (negate) {
+        for (size_t k = 0; k < sizeof(op->set); ++k) op->set[k] = (unsigned char)~op->set[k];
+    }
+    op->kind = GOP_CLASS;
+    return i + 1;
+}
+
+/* Compile one path component (pat, len). Returns 0 on success. */
+int glob_compile(glob_matcher *m, const char *pat, size_t len) {
+    memset(m, 0, sizeof(*m));
+    m->ops = calloc(len + 1, sizeof(glob_op));
+    m->text = malloc(len + 1);
+    if (!m->ops || !m->text) {
+        glob_matcher_free(m);
+        return -1;
+    }
+
+    size_t tlen = 0;
+    m->is_literal = 1;
+    m->leading_dot = (len > 0 && pat[0] == '.');
+
+    for (size_t i = 0; i < len; ) {
+        char c = pat[i];
+        glob_op *op = &m->ops[m->nops];
+
+        if (c == '*') {
+            m->is_literal = 0;
+            m->has_star = 1;
+            if (m->nops == 0 || m->ops[m->nops - 1].kind != GOP_STAR) {
+                op->kind = GOP_STAR;
+                m->nops++;
+            }
+            i++;
+            continue;
+        }
+        if (c == '?') {
+            m->is_literal = 0;
+            op->kind = GOP_ANY;
+            m->nops++;
+            m->min_len++;
+            i++;
+            continue;
+        }
+        if (c == '[') {
+            size_t used = parse_class(pat + i + 1, len - i - 1, op);
+            if (used) {
+                m->is_literal = 0;
+                m->nops++;
+                m->min_len++;
+                i += 1 + used;
+                continue;
+            }
+            /* unterminated '[' is an ordinary character */
+        }
+        if (c == '\\' && i + 1 < len) {
+            i++;
+            c = pat[i];
+        }
+
+        /* literal character: extend the previous literal op or start one */
+        if (m->nops == 0 || m->ops[m->nops - 1].kind != GOP_LIT) {
+            op->kind = GOP_LIT;
+            op->off = tlen;
+            op->len = 0;
+            m->nops++;
+        }
+        m->text[tlen++] = c;
+        m->ops[m->nops - 1].len++;
+        m->min_len++;
+        i++;
+    }
+    m->text[tlen] = '\0';
+    m->text_len = tlen;
+    m->is_globstar = (len == 2 && pat[0] == '*' && pat[1] == '*');
+
+    if (m->nops > 0 && m->ops[0].kind == GOP_LIT) {
+        m->prefix_len = m->ops[0].len;
+    }
+    if (m->nops > 0 && m->ops[m->nops - 1].kind == GOP_LIT) {
+        m->suffix_off = m->ops[m->nops - 1].off;
+        m->suffix_len = m->ops[m->nops - 1].len;
+    }
+    return 0;
+}
+
+void glob_matcher_free(glob_matcher *m) {
+    free(m->ops);
+    free(m->text);
+    m->ops = NULL;
+    m->text = NULL;
+    m->nops = 0;
+}
+
+/* Match a full name against a compiled component. */
+int glob_match(const glob_matcher *m, const char *s, size_t n) {
+    if (n < m->min_len) return 0;
+    if (!m->has_star && n != m->min_len) return 0;
+    if (s[0] == '.' && !m->leading_dot) return 0;
+    if (m->prefix_len && memcmp(s, m->text, m->prefix_len) != 0) return 0;
+    if (m->suffix_len && memcmp(s + n - m->suffix_len, m->text + m->suffix_off, m->suffix_len) != 0)
+        return 0;
+
+    const glob_op *ops = m->ops;
+    size_t nops = m->nops;
+    size_t oi = 0, si = 0;
+    size_t star_oi = SIZE_MAX, star_si = 0;
+
+    while (oi < nops || si < n) {
+        if (oi < nops) {
+            const glob_op *op = &ops[oi];
+            switch (op->kind) {
+            case GOP_STAR:
+                star_oi = oi++;
+                star_si = si;
+                continue;
+            case GOP_ANY:
+                if (si < n) { oi++; si++; continue; }
+                break;
+            case GOP_CLASS: {
+                unsigned char c = (unsigned char)s[si];
+                if (si < n && (op->set[c >> 3] & (1u << (c & 7)))) { oi++; si++; continue; }
+                break;
+            }
+            case GOP_LIT:
+                if (n - si >= op->len && memcmp(s + si, m->text + op->off, op->len) == 0) {
+                    oi++;
+                    si += op->len;
+                    continue;
+                }
+                break;
+            }
+        }
+        /* mismatch: let the last '*' swallow one more character */
+        if (star_oi != SIZE_MAX && star_si < n) {
+            si = ++star_si;
+            oi = star_oi + 1;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/* ---------------- directory reading ---------------- */
+
+/* Call fn(name, len, d_type, arg) for every entry of the directory open on fd,
+ * reading with getdents64. "." and ".." are skipped. Returns 0 or -1.
+ */
+int glob_scan_dir(int fd, glob_dent_fn fn, void *arg) {
+    if (!dents_buf) {
+        dents_buf = malloc(GLOB_DENTS_BUF);
+        if (!dents_buf) return -1;
+    }
+    return glob_scan_dir_buf(fd, dents_buf, GLOB_DENTS_BUF, fn, arg);
+}
+
+int glob_scan_dir_buf(int fd, char *buf, size_t bufsize, glob_dent_fn fn, void *arg) {
+    for (;;) {
+        long nread = syscall(SYS_getdents64, fd, buf, bufsize);
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (nread == 0) return 0;
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            fn(name, strlen(name), d->d_type, arg);
+        }
+    }
+}
+
+/* ---------------- expansion ---------------- */
+
+typedef struct {
+    char **items;
+    size_t n;
+    size_t cap;
+} str_vec;
+
+static int vec_push(str_vec *v, char *s) {
+    if (v->n == v->cap) {
+        size_t cap = v->cap ? v->cap * 2 : 16;
+        char **ni = realloc(v->items, cap * sizeof(char *));
+        if (!ni) return -1;
+        v->items = ni;
+        v->cap = cap;
+    }
+    v->items[v->n++] = s;
+    return 0;
+}
+
+/* Directory, or a link to one? type is the d_type, DT_UNKNOWN if not known */
+static int path_is_dir(const char *path, unsigned char type) {
+    if (type != DT_UNKNOWN && type != DT_LNK) return type == DT_DIR;
+    struct stat st;
+    return fstatat(sh->dir_fd, path, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* A match of a dir_only pattern: path + "/", or NULL (path is freed) */
+static char *dir_match(char *path) {
+    size_t len = strlen(path);
+    char *dir = realloc(path, len + 2);
+    if (!dir) {
+        free(path);
+        return NULL;
+    }
+    dir[len] = '/';
+    dir[len + 1] = '\0';
+    return dir;
+}
+
+static char *join_path(const char *dir, size_t dlen, const char *name, size_t nlen) {
+    char *p = malloc(dlen + nlen + 1);
+    if (!p) return NULL;
+    memcpy(p, dir, dlen);
+    memcpy(p + dlen, name, nlen);
+    p[dlen + nlen] = '\0';
+    return p;
+}
+
+typedef struct {
+    const glob_matcher *m;
+    str_vec names;
+    unsigned char *types;   /* d_type per collected name */
+    size_t types_cap;
+    int failed;
+} collect_ctx;
+
+static void collect_match(const char *name, size_t len, unsigned char type, void *arg) {
+    collect_ctx *c = arg;
+    if (c->failed || !glob_match(c->m, name, len)) return;
+    char *copy = join_path("", 0, name, len);
+    if (!copy || vec_push(&c->names, copy) != 0) {
+        free(copy);
+        c->failed = 1;
+        return;
+    }
+    if (c->names.n > c->types_cap) {
+        size_t cap = c->names.cap;
+        unsigned char *nt = realloc(c->types, cap);
+        if (!nt) { c->failed = 1; return; }
+        c->types = nt;
+        c->types_cap = cap;
+    }
+    c->types[c->names.n - 1] = type;
+}
+
+/* Expand components [ci, ncomps) below prefix (which is "" or ends in '/'). */
+static int expand_components(const char *prefix, size_t plen,
+                             glob_matcher *comps, size_t ci, size_t ncomps,
+                             str_vec *out) {
+    glob_matcher *m = &comps[ci];
+    int last = (ci + 1 == ncomps);
+
+    if (m->is_literal) {
+        char *path = join_path(prefix, plen, m->text, m->text_len);
+        if (!path) return -1;
+        if (last) {
+            struct stat st;
+            int found = m->dir_only ? path_is_dir(path, DT_UNKNOWN)
+                                    : fstatat(sh->dir_fd, path, &st, AT_SYMLINK_NOFOLLOW) == 0;
+            if (!found) {
+                free(path);
+                return 0;
+            }
+            if (m->dir_only && !(path = dir_match(path))) return -1;
+            if (vec_push(out, path) != 0) { free(path); return -1; }
+            return 0;
+        }
+        size_t len = plen + m->text_len;
+        char *dir = realloc(path, len + 2);
+        if (!dir) { free(path); return -1; }
+        dir[len] = '/';
+        dir[len + 1] = '\0';
+        int rc = expand_components(dir, len + 1, comps, ci + 1, ncomps, out);
+        free(dir);
+        return rc;
+    }
+
+    int fd = openat(sh->dir_fd, plen ? prefix : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return 0; /* unreadable or missing directory just matches nothing */
+
+    collect_ctx c = { .m = m };
+    glob_scan_dir(fd, collect_match, &c);
+    close(fd);
+
+    int rc = c.failed ? -1 : 0;
+    for (size_t i = 0; i < c.names.n; ++i) {
+        char *name = c.names.items[i];
+        if (rc != 0) { free(name); continue; }
+        size_t nlen = strlen(name);
+        char *path = join_path(prefix, plen, name, nlen);
+        free(name);
+        if (!path) { rc = -1; continue; }
+
+        if (last && !m->dir_only) {
+            if (vec_push(out, path) != 0) { free(path); rc = -1; }
+            continue;
+        }
+
+        /* more components follow, or a trailing '/': directories only */
+        int is_dir = path_is_dir(path, c.types[i]);
+        if (is_dir && last) {
+            if (!(path = dir_match(path)) || vec_push(out, path) != 0) { free(path); rc = -1; }
+        } else if (is_dir) {
+            size_t len = plen + nlen;
+            char *dir = realloc(path, len + 2);
+            if (!dir) { free(path); rc = -1; continue; }
+            dir[len] = '/';
+            dir[len + 1] = '\0';
+            rc = expand_components(dir, len + 1, comps, ci + 1, ncomps, out);
+            free(dir);
+        } else {
+            free(path);
+        }
+    }
+    free(c.names.items);
+    free(c.types);
+    return rc;
+}
+
+/* Patterns with a "**" component: resolve the components before it to
+ * directories, then hand each one to the parallel walker (glob_walk.c).
+ */
+static int expand_globstar(const char *prefix, size_t plen, glob_matcher *comps,
+                           size_t star, size_t ncomps, str_vec *out) {
+    str_vec bases = { 0 };
+    int rc = 0;
+
+    if (star == 0) {
+        char *b = join_path(prefix, plen, "", 0);
+        if (!b || vec_push(&bases, b) != 0) { free(b); return -1; }
+    } else {
+        str_vec dirs = { 0 };
+        rc = expand_components(prefix, plen, comps, 0, star, &dirs);
+        for (size_t i = 0; i < dirs.n; ++i) {
+            struct stat st;
+            char *d = dirs.items[i];
+            if (rc == 0 && fstatat(sh->dir_fd, d, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+                size_t len = strlen(d);
+                char *b = join_path(d, len, "/", 1);
+                if (!b || vec_push(&bases, b) != 0) { free(b); rc = -1; }
+            }
+            free(d);
+        }
+        free(dirs.items);
+    }
+
+    for (size_t i = 0; i < bases.n; ++i) {
+        if (rc == 0) {
+            rc = glob_walk(bases.items[i], comps + star, ncomps - star, &out->items, &out->n);
+            if (rc == 0) out->cap = out->n + 1;
+        }
+        free(bases.items[i]);
+    }
+    free(bases.items);
+    return rc;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Expand a single pattern word into out (sorted). Leaves out empty on no match. */
+static int expand_pattern(const char *word, str_vec *out) {
+    const char *p = word;
+    const char *prefix = "";
+    size_t plen = 0;
+    if (*p == '/') {
+        prefix = "/";
+        plen = 1;
+        while (*p == '/') p++;
+    }
+
+    /* split into components */
+    size_t ncomps = 0;
+    for (const char *q = p; *q; ) {
+        const char *slash = strchr(q, '/');
+        size_t len = slash ? (size_t)(slash - q) : strlen(q);
+        if (len) ncomps++;
+        q += len;
+        while (*q == '/') q++;
+    }
+    if (ncomps == 0) return 0;
+
+    glob_matcher *comps = calloc(ncomps, sizeof(glob_matcher));
+    if (!comps) return -1;
+
+    size_t ci = 0;
+    int rc = 0;
+    for (const char *q = p; *q && rc == 0; ) {
+        const char *slash = strchr(q, '/');
+        size_t len = slash ? (size_t)(slash - q) : strlen(q);
+        if (len && glob_compile(&comps[ci++], q, len) != 0) rc = -1;
+        q += len;
+        while (*q == '/') q++;
+    }
+
+    /* a trailing '/' is dropped by the split above: keep it as a flag */
+    if (rc == 0 && p[strlen(p) - 1] == '/') comps[ncomps - 1].dir_only = 1;
+
+    size_t star = 0;
+    while (star < ncomps && !comps[star].is_globstar) star++;
+
+    if (rc == 0 && star < ncomps) {
+        size_t before = out->n;
+        rc = expand_globstar(prefix, plen, comps, star, ncomps, out);
+        /* the walker knows nothing of dir_only: filter its matches here */
+        if (comps[ncomps - 1].dir_only) {
+            size_t kept = before;
+            for (size_t i = before; i < out->n; ++i) {
+                char *path = out->items[i];
+                if (rc == 0 && path_is_dir(path, DT_UNKNOWN)) {
+                    if ((path = dir_match(path))) out->items[kept++] = path;
+                    else rc = -1;
+                } else {
+                    free(path);
+                }
+            }
+            out->n = kept;
+        }
+        if (out->n - before > 1)
+            qsort(out->items + before, out->n - before, sizeof(char *), cmp_str);
+    } else if (rc == 0) {
+        size_t before = out->n;
+        rc = expand_components(prefix, plen, comps, 0, ncomps, out);
+        if (out->n - before > 1)
+            qsort(out->items + before, out->n - before, sizeof(char *), cmp_str);
+    }
+
+    for (size_t i = 0; i < ncomps; ++i) glob_matcher_free(&comps[i]);
+    free(comps);
+    return rc;
+}
+
+/* "<", "2>", "&>>" ...: the next word is a file name, not a pattern */
+static int is_redirect_op(const char *w) {
+    return redirect_width(w) == 2;
+}
+
+/* Replace *argvp (heap strings, NULL-terminated) with its pathname expansion.
+ * Returns 0 on success, -1 on allocation failure (argv left untouched).
+ */
+int glob_expand_argv(char ***argvp) {
+    char **argv = *argvp;
+    if (!argv) return 0;
+
+    size_t argc = 0;
+    int any = 0;
+    for (; argv[argc]; ++argc) {
+        if (!any && glob_has_magic(argv[argc])) any = 1;
+    }
+    if (!any) return 0;
+
+    str_vec out = { 0 };
+    unsigned char *expanded = calloc(argc, 1);
+    if (!expanded) return -1;
+
+    for (size_t i = 0; i < argc; ++i) {
+        size_t before = out.n;
+        if (glob_has_magic(argv[i]) && !(i > 0 && is_redirect_op(argv[i - 1]))) {
+            if (expand_pattern(argv[i], &out) != 0) goto fail;
+        }
+        if (out.n > before) {
+            expanded[i] = 1;
+        } else if (vec_push(&out, argv[i]) != 0) {
+            goto fail;
+        }
+    }
+    if (vec_push(&out, NULL) != 0) goto fail;
+
+    for (size_t i = 0; i < argc; ++i) {
+        if (expanded[i]) free(argv[i]);
+    }
+    free(expanded);
+    free(argv);
+    *argvp = out.items;
+    return 0;
+
+fail:
+    /* free only the match strings; the original words still belong to argv */
+    for (size_t j = 0; j < out.n; ++j) {
+        int borrowed = 0;
+        for (size_t i = 0; i < argc && !borrowed; ++i) borrowed = (out.items[j] == argv[i]);
+        if (!borrowed) free(out.items[j]);
+    }
+    free(out.items);
+    free(expanded);
+    return -1;
+}
@@ -0,0 +1,431 @@
+//******************************************************************************************************
+//* Name:        glob_walk.c                                                                           *
+//* Description: Recursive "**" expansion with a multi-threaded directory walker.                      *
+//*              - Each worker owns a deque of directories; it pops its own work LIFO and              *
+//*                steals FIFO from the other workers when it runs dry.                                *
+//*              - Child directories are opened with openat() relative to the parent's fd              *
+//*                and entries are classified from d_type, so fstatat() only runs for                  *
+//*                filesystems that report DT_UNKNOWN.                                                 *
+//*              - Every entry's path relative to the walk root is matched against the                 *
+//*                compiled components after the first "**"; matches collect per worker                *
+//*                and are merged by the caller (glob_expand.c sorts them).                            *
+//*              - $GLOB_THREADS picks the worker count; 1 walks inline on the caller's                *
+//*                thread. Symlinked and hidden directories are not descended into.                    *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define WALK_MAX_THREADS 64
+#define WALK_DEFAULT_THREADS 8
+#define WALK_DENTS_BUF (256 * 1024)
+#define WALK_MAX_HELD_FDS 512   /* queued dirs beyond this are reopened by path */
+#define WALK_MAX_DEPTH 256
+
+typedef struct {
+    int fd;             /* open dir fd, or -1 to reopen from root_fd + rel */
+    char *rel;          /* path relative to the walk root, "" for the root */
+    size_t rel_len;
+} walk_item;
+
+typedef struct {
+    pthread_mutex_t lock;
+    walk_item *items;
+    size_t head;        /* steal end */
+    size_t tail;        /* owner end */
+    size_t cap;
+} walk_deque;
+
+typedef struct {
+    char **items;
+    size_t n;
+    size_t cap;
+} walk_results;
+
+typedef struct walker walker;
+
+typedef struct {
+    walker *w;
+    int id;
+    walk_deque dq;
+    walk_results res;
+    char *dents;
+    /* per-directory scratch used while scanning */
+    walk_item cur;
+    int failed;
+} walk_worker;
+
+struct walker {
+    int root_fd;
+    const char *base;       /* prefix prepended to every result ("" or ends in '/') */
+    size_t base_len;
+    const glob_matcher *comps;
+    size_t ncomps;
+    size_t fixed_after[WALK_MAX_DEPTH + 1];   /* non-"**" comps from i onward */
+    int star_after[WALK_MAX_DEPTH + 1];       /* any "**" from i onward */
+    int nworkers;
+    walk_worker *workers;
+    long pending;           /* queued + in-progress directories */
+    long held_fds;
+};
+
+/* ---------------- matching ---------------- */
+
+typedef struct {
+    const char *p;
+    size_t len;
+} walk_seg;
+
+/* "**" never swallows hidden names */
+static int any_hidden(const walk_seg *s, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (s[i].len && s[i].p[0] == '.') return 1;
+    }
+    return 0;
+}
+
+static int match_segs(const walker *w, size_t ci, const walk_seg *s, size_t ns) {
+    while (ci < w->ncomps) {
+        const glob_matcher *m = &w->comps[ci];
+        if (m->is_globstar) {
+            if (!w->star_after[ci + 1]) {
+                /* only fixed components remain: they must line up with the tail */
+                size_t need = w->fixed_after[ci + 1];
+                if (need > ns || any_hidden(s, ns - need)) return 0;
+                s += ns - need;
+                ns = need;
+                ci++;
+                continue;
+            }
+            for (size_t skip = 0; skip <= ns; ++skip) {
+                if (skip && any_hidden(s + skip - 1, 1)) break;
+                if (match_segs(w, ci + 1, s + skip, ns - skip)) return 1;
+            }
+            return 0;
+        }
+        if (ns == 0) return 0;
+        if (m->is_literal) {
+            if (s->len != m->text_len || memcmp(s->p, m->text, s->len) != 0) return 0;
+        } else if (!glob_match(m, s->p, s->len)) {
+            return 0;
+        }
+        ci++;
+        s++;
+        ns--;
+    }
+    return ns == 0;
+}
+
+static int match_rel(const walker *w, const char *rel, size_t len) {
+    walk_seg segs[WALK_MAX_DEPTH];
+    size_t ns = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= len; ++i) {
+        if (i == len || rel[i] == '/') {
+            if (ns == WALK_MAX_DEPTH) return 0;
+            segs[ns].p = rel + start;
+            segs[ns].len = i - start;
+            ns++;
+            start = i + 1;
+        }
+    }
+    return match_segs(w, 0, segs, ns);
+}
+
+/* ---------------- deque ---------------- */
+
+static int dq_push(walk_deque *dq, walk_item it) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap) {
+        /* compact, then grow if still full */
+        if (dq->head > 0) {
+            memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(walk_item));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        if (dq->tail == dq->cap) {
+            size_t cap = dq->cap ? dq->cap * 2 : 64;
+            walk_item *ni = realloc(dq->items, cap * sizeof(walk_item));
+            if (!ni) {
+                pthread_mutex_unlock(&dq->lock);
+                return -1;
+            }
+            dq->items = ni;
+            dq->cap = cap;
+        }
+    }
+    dq->items[dq->tail++] = it;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static int dq_pop(walk_deque *dq, walk_item *out) {
+    int ok = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        *out = dq->items[--dq->tail];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static int dq_steal(walk_deque *dq, walk_item *out) {
+    int ok = 0;
+    if (pthread_mutex_trylock(&dq->lock) != 0) return 0;
+    if (dq->tail > dq->head) {
+        *out = dq->items[dq->head++];
+        ok = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+/* ---------------- walking ---------------- */
+
+static int results_push(walk_results *r, char *s) {
+    if (r->n == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 256;
+        char **ni = realloc(r->items, cap * sizeof(char *));
+        if (!ni) return -1;
+        r->items = ni;
+        r->cap = cap;
+    }
+    r->items[r->n++] = s;
+    return 0;
+}
+
+/* Write dir/name into buf (cap bytes). Returns the length or 0 if it does not fit. */
+static size_t make_rel(char *p, size_t cap, const char *dir, size_t dlen, const char *name, size_t nlen) {
+    size_t len = dlen ? dlen + 1 + nlen : nlen;
+    if (len + 1 > cap) return 0;
+    if (dlen) {
+        memcpy(p, dir, dlen);
+        p[dlen] = '/';
+        memcpy(p + dlen + 1, name, nlen);
+    } else {
+        memcpy(p, name, nlen);
+    }
+    p[len] = '\0';
+    return len;
+}
+
+static void visit_entry(const char *name, size_t nlen, unsigned char type, void *arg) {
+    walk_worker *ww = arg;
+    walker *w = ww->w;
+    if (ww->failed) return;
+
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(ww->cur.fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            if (S_ISDIR(st.st_mode)) type = DT_DIR;
+            else if (S_ISLNK(st.st_mode)) type = DT_LNK;
+            else type = DT_REG;
+        }
+    }
+
+    char rel[PATH_MAX];
+    size_t rlen = make_rel(rel, sizeof(rel), ww->cur.rel, ww->cur.rel_len, name, nlen);
+    if (!rlen) return; /* deeper than PATH_MAX: not reachable by path anyway */
+
+    if (match_rel(w, rel, rlen)) {
+        char *full = malloc(w->base_len + rlen + 1);
+        if (!full || results_push(&ww->res, full) != 0) {
+            free(full);
+            ww->failed = 1;
+        } else {
+            memcpy(full, w->base, w->base_len);
+            memcpy(full + w->base_len, rel, rlen + 1);
+        }
+    }
+
+    if (type != DT_DIR || name[0] == '.') return;
+
+    walk_item child = { .fd = -1, .rel = malloc(rlen + 1), .rel_len = rlen };
+    if (!child.rel) { ww->failed = 1; return; }
+    memcpy(child.rel, rel, rlen + 1);
+    if (__atomic_load_n(&w->held_fds, __ATOMIC_RELAXED) < WALK_MAX_HELD_FDS) {
+        child.fd = openat(ww->cur.fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child.fd < 0) { free(child.rel); return; }
+        __atomic_add_fetch(&w->held_fds, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+    if (dq_push(&ww->dq, child) != 0) {
+        if (child.fd >= 0) {
+            close(child.fd);
+            __atomic_sub_fetch(&w->held_fds, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+        free(child.rel);
+        ww->failed = 1;
+    }
+}
+
+static void process_item(walk_worker *ww, walk_item it) {
+    walker *w = ww->w;
+    if (it.fd < 0) {
+        it.fd = it.rel_len ? openat(w->root_fd, it.rel, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                           : dup(w->root_fd);
+    } else {
+        __atomic_sub_fetch(&w->held_fds, 1, __ATOMIC_RELAXED);
+    }
+    if (it.fd >= 0) {
+        ww->cur = it;
+        glob_scan_dir_buf(it.fd, ww->dents, WALK_DENTS_BUF, visit_entry, ww);
+        close(it.fd);
+    }
+    free(it.rel);
+}
+
+static int take_work(walk_worker *ww, walk_item *it) {
+    if (dq_pop(&ww->dq, it)) return 1;
+    walker *w = ww->w;
+    for (int k = 1; k < w->nworkers; ++k) {
+        walk_worker *victim = &w->workers[(ww->id + k) % w->nworkers];
+        if (dq_steal(&victim->dq, it)) return 1;
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    walk_worker *ww = arg;
+    walker *w = ww->w;
+    long backoff_ns = 0;
+
+    while (__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) > 0) {
+        walk_item it;
+        if (take_work(ww, &it)) {
+            backoff_ns = 0;
+            process_item(ww, it);
+            __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+        /* nothing to steal yet: back off briefly while others expand the tree */
+        if (backoff_ns < 1000) {
+            backoff_ns += 100;
+            sched_yield();
+        } else {
+            if (backoff_ns < 256000) backoff_ns *= 2;
+            struct timespec ts = { 0, backoff_ns };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+static int walker_threads(void) {
+    const char *v = var_get("GLOB_THREADS");
+    long n = v && *v ? strtol(v, NULL, 10) : 0;
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n > WALK_DEFAULT_THREADS) n = WALK_DEFAULT_THREADS;
+    }
+    if (n < 1) n = 1;
+    if (n > WALK_MAX_THREADS) n = WALK_MAX_THREADS;
+    return (int)n;
+}
+
+/* Walk the tree below base (a directory path, "" meaning ".") and collect every
+ * path whose part below base matches comps (which contain at least one "**").
+ * Results are full paths (base + relative path), unsorted, appended to *out.
+ * Returns 0 on success or -1 on failure.
+ */
+int glob_walk(const char *base, const glob_matcher *comps, size_t ncomps,
+              char ***out, size_t *nout) {
+    if (ncomps > WALK_MAX_DEPTH) return -1;
+
+    walker w;
+    memset(&w, 0, sizeof(w));
+    w.base = base;
+    w.base_len = strlen(base);
+    w.comps = comps;
+    w.ncomps = ncomps;
+    w.fixed_after[ncomps] = 0;
+    w.star_after[ncomps] = 0;
+    for (size_t i = ncomps; i-- > 0; ) {
+        w.fixed_after[i] = w.fixed_after[i + 1] + (comps[i].is_globstar ? 0 : 1);
+        w.star_after[i] = w.star_after[i + 1] || comps[i].is_globstar;
+    }
+
+    w.root_fd = openat(sh->dir_fd, w.base_len ? base : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (w.root_fd < 0) return 0;
+
+    w.nworkers = walker_threads();
+    w.workers = calloc((size_t)w.nworkers, sizeof(walk_worker));
+    if (!w.workers) {
+        close(w.root_fd);
+        return -1;
+    }
+
+    int rc = 0;
+    for (int i = 0; i < w.nworkers; ++i) {
+        w.workers[i].w = &w;
+        w.workers[i].id = i;
+        pthread_mutex_init(&w.workers[i].dq.lock, NULL);
+        w.workers[i].dents = malloc(WALK_DENTS_BUF);
+        if (!w.workers[i].dents) rc = -1;
+    }
+
+    walk_item root = { .fd = -1, .rel = strdup(""), .rel_len = 0 };
+    if (rc == 0 && root.rel && dq_push(&w.workers[0].dq, root) == 0) {
+        w.pending = 1;
+        if (w.nworkers == 1) {
+            worker_main(&w.workers[0]);
+        } else {
+            pthread_t tids[WALK_MAX_THREADS];
+            int started = 0;
+            for (int i = 1; i < w.nworkers; ++i) {
+                if (pthread_create(&tids[i], NULL, worker_main, &w.workers[i]) != 0) break;
+                started = i;
+            }
+            worker_main(&w.workers[0]);
+            for (int i = 1; i <= started; ++i) pthread_join(tids[i], NULL);
+        }
+    } else {
+        free(root.rel);
+        rc = -1;
+    }
+
+    /* merge per-worker results */
+    size_t total = *nout;
+    for (int i = 0; i < w.nworkers; ++i) total += w.workers[i].res.n;
+    char **merged = realloc(*out, (total + 1) * sizeof(char *));
+    if (!merged) rc = -1;
+    size_t n = *nout;
+    for (int i = 0; i < w.nworkers; ++i) {
+        walk_worker *ww = &w.workers[i];
+        if (ww->failed) rc = -1;
+        for (size_t j = 0; j < ww->res.n; ++j) {
+            if (merged) merged[n++] = ww->res.items[j];
+            else free(ww->res.items[j]);
+        }
+        free(ww->res.items);
+        free(ww->dq.items);
+        free(ww->dents);
+        pthread_mutex_destroy(&ww->dq.lock);
+    }
+    if (merged) {
+        *out = merged;
+        *nout = n;
+    }
+    free(w.workers);
+    close(w.root_fd);
+    return rc;
+}
@@ -4,52 +4,68 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <limits.h>
 #include "shell.h"
 
 // --- GLOBALS AND DEFINITIONS ---
-char* history[HISTORY_DEPTH];
-int history_count = 0;
+// history, history_count and history_held live in the current context (sh).
+// commands run by a compiled loop or if are not recorded one by one while
+// history is held; script.c records the whole construct instead
+
+void history_hold(int on) {
+    sh->history_held += on ? 1 : -1;
+}
 
 // helper to add a command to history
 // call this every time a user enters a valid command
 void add_to_history(char *cmd) {
-    if (!cmd) return;
+    if (!cmd || sh->history_held) return;
     // if history is full, remove the oldest one
-    if (history_count == HISTORY_DEPTH) {
-        free(history[0]);
+    if (sh->history_count == HISTORY_MAX) {
+        free(sh->history[0]);
         // shift everything down
-        for (int i = 0; i < HISTORY_DEPTH - 1; i++) {
-            history[i] = history[i+1];
+        for (int i = 0; i < HISTORY_MAX - 1; i++) {
+            sh->history[i] = sh->history[i+1];
         }
-        history_count--;
+        sh->history_count--;
     }
     
     // add the new one
-    history[history_count] = strdup(cmd);
-    history_count++;
+    sh->history[sh->history_count] = strdup(cmd);
+    sh->history_count++;
 }
 
 // --- BUILT-IN FUNCTIONS ---
 
 // 1. EXIT COMMAND
-void builtin_exit(void) {
+void builtin_exit(int status) {
+    /* libshell, or a forked child such as $(...): end the current run, leave
+     * the host process and its jobs be; the status is the caller's $? */
+    if (sh->embedded || sh->subshell) {
+        sh->exited = 1;
+        return;
+    }
     printf("[DEBUG] Exiting shell...\n");
 
     /* Use the background-job API to shut down/cleanup instead of touching job internals. */
     part_eight_shutdown();
 
     // print history
-    if (history_count == 0) {
+    if (sh->history_count == 0) {
         printf("No valid commands in history.\n");
     } else {
+        // the last HISTORY_DEPTH of them; the rest were for the line editor
+        int first = sh->history_count > HISTORY_DEPTH ? sh->history_count - HISTORY_DEPTH : 0;
         printf("Last commands:\n");
-        for (int i = 0; i < history_count; i++) {
-            printf("%d: %s\n", i + 1, history[i]);
-            free(history[i]); // clean up memory
+        for (int i = first; i < sh->history_count; i++) {
+            printf("%d: %s\n", i - first + 1, sh->history[i]);
+        }
+        for (int i = 0; i < sh->history_count; i++) {
+            free(sh->history[i]); // clean up memory
         }
     }
 
-    exit(0);
+    exit(status);
 }
 
 // 3. CD COMMAND
@@ -59,9 +75,9 @@ int builtin_cd(char **args) {
 
     // case 1: "cd" -> go home
     if (args[1] == NULL) {
-        target = getenv("HOME");
+        target = (char *)var_get("HOME");
         if (!target) {
-            fprintf(stderr, "Error: HOME not set.\n");
+            dprintf(sh->fd_err, "Error: HOME not set.\n");
             return 0;
         }
     } 
@@ -71,20 +87,41 @@ int builtin_cd(char **args) {
     } 
     // case 3: "cd dir1 dir2" -> error
     else {
-        fprintf(stderr, "Error: Too many arguments.\n");
+        dprintf(sh->fd_err, "Error: Too many arguments.\n");
         return 0;
     }
 
-    // try to change directory
-    if (chdir(target) != 0) {
-        perror("Error changing directory");
+    // try to change directory: the process's, or a context's own (libshell.c)
+    char cwd[PATH_MAX];
+    if (sh->dir_fd != AT_FDCWD) {
+        int fd = openat(sh->dir_fd, target, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        char link[32];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = fd >= 0 ? readlink(link, cwd, sizeof(cwd) - 1) : -1;
+        if (n < 0) {
+            shell_perror("Error changing directory");
+            if (fd >= 0) close(fd);
+            return 0;
+        }
+        cwd[n] = '\0';
+        char *copy = strdup(cwd);
+        if (!copy) {
+            close(fd);
+            return 0;
+        }
+        close(sh->dir_fd);
+        sh->dir_fd = fd;
+        free(sh->cwd);
+        sh->cwd = copy;
+    } else if (chdir(target) != 0) {
+        shell_perror("Error changing directory");
         return 0;
     }
     
     // update PWD env variable just to be safe
-    char cwd[1024];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        setenv("PWD", cwd, 1);
+    if (shell_getcwd(cwd, sizeof(cwd)) != NULL) {
+        var_set("PWD", cwd);
+        prompt_set_cwd(cwd);
     }
     return 1;
 }
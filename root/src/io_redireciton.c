@@ -1,85 +1,415 @@
+#define _GNU_SOURCE
+
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "shell.h"
 
-// function to handle the redirection
-// call this in the child process
-void handle_io_redirection(char **args) {
-    char *in_file = NULL;
-    char *out_file = NULL;
-    int i = 0;
+#define MAX_HEREDOCS 16
 
-    // loop through args to find redirection symbols
-    while (args && args[i] != NULL) {
-        if (strcmp(args[i], "<") == 0) {
-            if (args[i+1] == NULL) {
-                fprintf(stderr, "Error: No input file specified.\n");
-                exit(1);
-            }
-            in_file = args[i+1];
-        } 
-        else if (strcmp(args[i], ">") == 0) {
-            if (args[i+1] == NULL) {
-                fprintf(stderr, "Error: No output file specified.\n");
-                exit(1);
-            }
-            out_file = args[i+1];
+// memfds created for << and <<< on the current command line.
+// the parent closes them once the children have been forked.
+static int heredoc_fds[MAX_HEREDOCS];
+static int heredoc_count = 0;
+
+// one redirection word: "[n]<", "[n]>", "[n]>>", "[n]<&", "[n]>&", "&>" or
+// "&>>", followed by its file/fd in the same word or in the next one
+typedef struct {
+    int n;                      // fd redirected, -1 for both 1 and 2 ("&>")
+    int dup;                    // "<&" / ">&": word is an fd number or "-"
+    int flags;                  // open(2) flags for a file
+    int width;                  // argv words taken: 1 or 2
+    int off;                    // width 1: where the word starts in the token
+} redir_op;
+
+static int parse_op(const char *tok, redir_op *op) {
+    const char *p = tok;
+    op->n = -2;
+    op->dup = 0;
+    if (p[0] == '&' && p[1] == '>') {
+        op->n = -1;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        long n = 0;
+        while (*p >= '0' && *p <= '9' && n < 1000) n = n * 10 + (*p++ - '0');
+        op->n = (int)n;
+    }
+    if (*p == '<') {
+        if (p[1] == '<' || p[1] == '>') return 0;   // here-docs are prepare_heredocs()'s
+        if (op->n == -2) op->n = 0;
+        op->flags = O_RDONLY;
+        p++;
+    } else if (*p == '>') {
+        if (op->n == -2) op->n = 1;
+        op->flags = O_WRONLY | O_CREAT | O_TRUNC;
+        p++;
+        if (*p == '>') {
+            op->flags = O_WRONLY | O_CREAT | O_APPEND;
+            p++;
         }
-        i++;
+    } else {
+        return 0;
+    }
+    if (*p == '&' && op->n != -1 && !(op->flags & O_APPEND)) {
+        op->dup = 1;
+        p++;
     }
+    if (*p == '<' || *p == '>') return 0;
+    op->width = *p ? 1 : 2;
+    op->off = (int)(p - tok);
+    return 1;
+}
 
-    if (in_file != NULL) {
-        struct stat sb;
-        if (stat(in_file, &sb) == -1) {
-            fprintf(stderr, "Error: Input file does not exist.\n");
-            exit(1);
-        }
-        if (!S_ISREG(sb.st_mode)) {
-            fprintf(stderr, "Error: Input file is not a regular file.\n");
-            exit(1);
-        }
+// how many argv words a redirection starting at tok takes: 0 if tok is
+// not a redirection, 2 for "<" ">" "2>" ... plus a word, 1 for "<&N",
+// ">file", "2>&1" ...
+int redirect_width(const char *tok) {
+    redir_op op;
+    return parse_op(tok, &op) ? op.width : 0;
+}
+
+// parse N in "<&N" / ">&N" and make sure it is an open descriptor
+static int parse_dup_fd(const char *s) {
+    char *end;
+    long fd = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || fd < 0 || fd > 1024 || fcntl((int)fd, F_GETFD) == -1) {
+        dprintf(sh->fd_err, "Error: %s: Bad file descriptor.\n", s);
+        return -1;
+    }
+    return (int)fd;
+}
 
-        int fd0 = open(in_file, O_RDONLY);
-        if (fd0 == -1) {
-            perror("Error opening input file");
-            exit(1);
+// close whatever redirect_open() opened
+void redirect_close(redir_fds *r) {
+    for (int k = 0; k < 3; ++k) {
+        if (r->opened[k] >= 0) close(r->opened[k]);
+        r->opened[k] = -1;
+    }
+    for (int n = 0; n < 3; ++n) r->fd[n] = n;
+}
+
+// point fd n at v; an fd opened here that nothing refers to any more is closed
+static void set_fd(redir_fds *r, int n, int v) {
+    int old = r->fd[n];
+    r->fd[n] = v;
+    if (old < 3 || old == r->fd[0] || old == r->fd[1] || old == r->fd[2]) return;
+    for (int k = 0; k < 3; ++k) {
+        if (r->opened[k] == old) {
+            close(old);
+            r->opened[k] = -1;
         }
-        if (dup2(fd0, STDIN_FILENO) == -1) {
-            perror("dup2 input failed");
-            exit(1);
+    }
+}
+
+static void add_opened(redir_fds *r, int fd) {
+    for (int k = 0; k < 3; ++k) {
+        if (r->opened[k] < 0) {
+            r->opened[k] = fd;
+            return;
         }
-        close(fd0);
     }
+}
 
-    if (out_file != NULL) {
-        int fd1 = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-        if (fd1 == -1) {
-            perror("Error opening output file");
-            exit(1);
+// the redirection plan: parse and open the redirections in args, left to
+// right, in the parent and before anything is forked, so a bad path or fd
+// fails here without a process being created. the caller's own fds are not
+// touched. afterwards r->fd[n] is what the command should use as fd n:
+//   n itself, or another of 0-2 (the command's own, "2>&1"): see redirect_fd()
+//   an fd >= 3: a file opened here, a here-doc memfd, a coproc pipe ...
+//   -1: closed ("2>&-")
+// the redirection tokens are removed from args and freed (args must be
+// heap-allocated). returns 0, or -1 after printing an error (nothing is
+// left open).
+int redirect_open(char **args, redir_fds *r) {
+    for (int n = 0; n < 3; ++n) {
+        r->fd[n] = n;
+        r->opened[n] = -1;
+    }
+
+    int i = 0;
+    while (args && args[i] != NULL) {
+        redir_op op;
+        if (!parse_op(args[i], &op)) {
+            i++;
+            continue;
+        }
+        const char *word = op.width == 1 ? args[i] + op.off : args[i+1];
+        if (word == NULL) {
+            if (op.dup)
+                dprintf(sh->fd_err, "Error: No file descriptor specified.\n");
+            else if (op.flags == O_RDONLY)
+                dprintf(sh->fd_err, "Error: No input file specified.\n");
+            else
+                dprintf(sh->fd_err, "Error: No output file specified.\n");
+            redirect_close(r);
+            return -1;
+        }
+        if (op.n > 2) {
+            dprintf(sh->fd_err, "Error: %d: only fds 0, 1 and 2 can be redirected.\n", op.n);
+            redirect_close(r);
+            return -1;
         }
-        if (dup2(fd1, STDOUT_FILENO) == -1) {
-            perror("dup2 output failed");
-            exit(1);
+
+        if (op.dup && strcmp(word, "-") == 0) {
+            set_fd(r, op.n, -1);
+        } else if (op.dup) {
+            // duplicate an open fd: the command's own 0-2 as redirected so
+            // far, or one of the shell's (here-doc memfd, coproc pipe, ...)
+            int fd = parse_dup_fd(word);
+            if (fd < 0) {
+                redirect_close(r);
+                return -1;
+            }
+            set_fd(r, op.n, fd < 3 ? r->fd[fd] : fd);
+        } else {
+            int fd = openat(sh->dir_fd, word, op.flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (fd == -1) {
+                dprintf(sh->fd_err, "Error: %s: %s.\n", word, strerror(errno));
+                redirect_close(r);
+                return -1;
+            }
+            if (op.n < 0) {
+                set_fd(r, 1, fd);
+                set_fd(r, 2, fd);
+            } else {
+                set_fd(r, op.n, fd);
+            }
+            add_opened(r, fd);
         }
-        close(fd1);
+        i += op.width;
     }
 
     // clean up args array: remove redirection tokens so execv sees only real args
-    if (!args) return;
+    if (!args) return 0;
     int j = 0;
     i = 0;
     while (args[i] != NULL) {
-        if (strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0) {
-            i += 2;
+        int width = redirect_width(args[i]);
+        if (width) {
+            free(args[i]);
+            if (width == 2) free(args[i+1]);
+            i += width;
         } else {
             args[j++] = args[i++];
         }
     }
     args[j] = NULL;
+    return 0;
+}
+
+// the fd a command whose own 0, 1, 2 are base[] should use as fd n
+int redirect_fd(const redir_fds *r, int n, const int base[3]) {
+    int v = r->fd[n];
+    return v >= 0 && v < 3 ? base[v] : v;
+}
+
+// carry out the plan in a child, after fork and after any pipe ends have
+// been put on 0 and 1. fds referring to another of 0-2 are copied first,
+// so "2>&1 >file" sends stderr where stdout pointed before. returns 0, or
+// -1 after printing an error.
+int redirect_apply(const redir_fds *r) {
+    int src[3];
+    for (int n = 0; n < 3; ++n) {
+        src[n] = r->fd[n];
+        if (src[n] >= 0 && src[n] < 3 && src[n] != n) {
+            src[n] = fcntl(src[n], F_DUPFD_CLOEXEC, 3);
+            if (src[n] == -1) {
+                shell_perror("Error: dup");
+                return -1;
+            }
+        }
+    }
+    for (int n = 0; n < 3; ++n) {
+        if (src[n] == n) continue;
+        if (src[n] < 0) {
+            close(n);
+        } else if (dup2(src[n], n) == -1) {
+            shell_perror("dup2 failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// create a sealed, read-only-from-now-on memfd holding data.
+// falls back to an unlinked temp file on kernels without memfd_create.
+static int make_content_fd(const char *data, size_t len) {
+    int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    int sealable = (fd != -1);
+    if (fd == -1) {
+        char tmpl[] = "/tmp/shell-heredoc-XXXXXX";
+        fd = mkstemp(tmpl);
+        if (fd == -1) return -1;
+        unlink(tmpl);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(fd, data + off, len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        off += (size_t)w;
+    }
+    if (sealable)
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+// append s (n bytes) to a growing buffer
+static int buf_add(char **buf, size_t *len, size_t *cap, const char *s, size_t n) {
+    if (*len + n + 1 > *cap) {
+        size_t ncap = *cap ? *cap : 256;
+        while (ncap < *len + n + 1) ncap *= 2;
+        char *nb = realloc(*buf, ncap);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = ncap;
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+    return 0;
+}
+
+// read here-doc lines from the shell's input until a line equal to delim.
+// lines get variable expansion like the rest of the command line.
+static int read_heredoc(const char *delim, char **out, size_t *out_len) {
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    int interactive = isatty(STDIN_FILENO);
+
+    while (1) {
+        if (interactive) {
+            fputs("> ", stdout);
+            fflush(stdout);
+        }
+        char *line = get_input();
+        if (!line) break; // EOF ends the document, like other shells
+        if (strcmp(line, delim) == 0) {
+            free(line);
+            break;
+        }
+        char *expanded = expand_word(line);
+        int rc = -1;
+        if (expanded) {
+            rc = buf_add(&buf, &len, &cap, expanded, strlen(expanded));
+            if (rc == 0) rc = buf_add(&buf, &len, &cap, "\n", 1);
+            if (expanded != line) free(expanded);
+        }
+        free(line);
+        if (rc != 0) {
+            free(buf);
+            return -1;
+        }
+    }
+    *out = buf;
+    *out_len = len;
+    return 0;
+}
+
+// call this in the parent, before fork.
+// rewrites "<<WORD", "<< WORD", "<<<WORD" and "<<< WORD" into "<& N" where N
+// is a memfd holding the document, so the child only has to dup2 it.
+// returns 0 on success, -1 on error (message already printed).
+int prepare_heredocs(char ***argvp) {
+    char **args = *argvp;
+    for (int i = 0; args && args[i] != NULL; ++i) {
+        int here_string = (strncmp(args[i], "<<<", 3) == 0);
+        if (!here_string && strncmp(args[i], "<<", 2) != 0) continue;
+
+        const char *word = args[i] + (here_string ? 3 : 2);
+        int consumed = 1;
+        if (*word == '\0') {
+            word = args[i+1];
+            consumed = 2;
+        }
+        if (word == NULL) {
+            dprintf(sh->fd_err, "Error: No here-document delimiter specified.\n");
+            return -1;
+        }
+        if (heredoc_count == MAX_HEREDOCS) {
+            dprintf(sh->fd_err, "Error: Too many here-documents.\n");
+            return -1;
+        }
+
+        char *body = NULL;
+        size_t body_len = 0;
+        int failed = 0;
+        if (here_string) {
+            body_len = strlen(word);
+            body = malloc(body_len + 2);
+            if (body) {
+                memcpy(body, word, body_len);
+                body[body_len++] = '\n';
+            } else {
+                failed = 1;
+            }
+        } else {
+            failed = (read_heredoc(word, &body, &body_len) != 0);
+        }
+        if (failed) {
+            dprintf(sh->fd_err, "Error: Out of memory reading here-document.\n");
+            return -1;
+        }
+
+        int fd = make_content_fd(body ? body : "", body_len);
+        free(body);
+        if (fd == -1) {
+            shell_perror("Error creating here-document");
+            return -1;
+        }
+        heredoc_fds[heredoc_count++] = fd;
+
+        // replace the operator (and separate word) with "<&" "fd"
+        char num[16];
+        snprintf(num, sizeof(num), "%d", fd);
+        char *op = strdup("<&");
+        char *fdstr = strdup(num);
+        if (!op || !fdstr) {
+            free(op);
+            free(fdstr);
+            return -1;
+        }
+        if (consumed == 2) {
+            free(args[i]);
+            free(args[i+1]);
+            args[i] = op;
+            args[i+1] = fdstr;
+        } else {
+            // one token becomes two: grow argv and shift the rest right by one
+            int n = i;
+            while (args[n] != NULL) n++;
+            char **grown = realloc(args, (n + 2) * sizeof(char*));
+            if (!grown) {
+                free(op);
+                free(fdstr);
+                return -1;
+            }
+            args = grown;
+            *argvp = args;
+            memmove(&args[i+2], &args[i+1], (n - i) * sizeof(char*));
+            free(args[i]);
+            args[i] = op;
+            args[i+1] = fdstr;
+        }
+        i += 1;
+    }
+    return 0;
+}
+
+// close the parent's copies of here-document fds
+void close_heredocs(void) {
+    for (int i = 0; i < heredoc_count; ++i) close(heredoc_fds[i]);
+    heredoc_count = 0;
 }
 
 //int main() {
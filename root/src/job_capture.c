@@ -0,0 +1,250 @@
+//******************************************************************************************************
+//* Name:        job_capture.c                                                                         *
+//* Description: Bounded output capture for background jobs ("set -o capture").                        *
+//*              - A captured job's stdout and stderr go to a pipe instead of the                      *
+//*                terminal. The shell drains it whenever it would otherwise sleep                     *
+//*                (waiting for input or for a foreground command, background_proc.c).                 *
+//*              - The newest $JOB_CAPTURE_RING bytes (default 64 KiB) stay in an                      *
+//*                in-memory ring. Bytes pushed out of the ring are spilled to an                      *
+//*                unlinked temp file, up to $JOB_CAPTURE_SPILL bytes (default 16 MiB,                 *
+//*                0 = no spill); past that they are only counted.                                     *
+//*              - Memory per job is the ring, however much the job writes.                            *
+//*              - "jobs -o N" prints what was kept, "--follow" keeps streaming.                       *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "shell.h"
+
+#define CAPTURE_RING_DEFAULT (64 * 1024)
+#define CAPTURE_SPILL_DEFAULT (16 * 1024 * 1024)
+#define CAPTURE_RING_MIN 4096
+#define CAPTURE_RING_MAX (64 * 1024 * 1024)
+#define CAPTURE_READ_CHUNK (64 * 1024)
+
+struct job_capture {
+    int fd;                     /* read end of the job's output pipe, -1 at EOF */
+    char *ring;
+    size_t size;                /* ring capacity */
+    size_t head;                /* next write position */
+    size_t used;                /* bytes currently in the ring */
+    int spill_fd;               /* created on first overflow */
+    size_t spilled;
+    size_t spill_max;
+    unsigned long long dropped; /* overflow past spill_max */
+};
+
+static int pending[2] = { -1, -1 };  /* pipe for the job being started */
+
+int job_capture_enabled(void) {
+    return sh->capture_on;
+}
+
+void job_capture_set(int on) {
+    sh->capture_on = on;
+}
+
+static size_t size_var(const char *name, size_t def) {
+    const char *v = var_get(name);
+    if (!v || !*v) return def;
+    char *end;
+    unsigned long long n = strtoull(v, &end, 10);
+    if (*end == 'k' || *end == 'K') n <<= 10;
+    else if (*end == 'm' || *end == 'M') n <<= 20;
+    return (size_t)n;
+}
+
+static void close_pending(void) {
+    for (int i = 0; i < 2; ++i) {
+        if (pending[i] >= 0) close(pending[i]);
+        pending[i] = -1;
+    }
+}
+
+/* Before forking a background job: create its capture pipe when capture is
+ * on. Returns the write end for the child, or -1. */
+int job_capture_prepare(void) {
+    close_pending();
+    if (!sh->capture_on) return -1;
+    if (pipe2(pending, O_CLOEXEC) == -1) {
+        shell_perror("capture: pipe");
+        pending[0] = pending[1] = -1;
+        return -1;
+    }
+    return pending[1];
+}
+
+/* In the child: send stdout and stderr into the capture pipe. Explicit
+ * redirections applied afterwards still win. */
+void job_capture_child(void) {
+    if (pending[1] < 0) return;
+    dup2(pending[1], STDOUT_FILENO);
+    dup2(pending[1], STDERR_FILENO);
+}
+
+/* In the parent after fork: the write end belongs to the child now. */
+void job_capture_parent(void) {
+    if (pending[1] >= 0) close(pending[1]);
+    pending[1] = -1;
+}
+
+/* Hand the pending pipe to a new job record (NULL if nothing pending) */
+job_capture *job_capture_claim(void) {
+    if (pending[0] < 0) return NULL;
+    job_capture *c = calloc(1, sizeof(*c));
+    size_t size = size_var("JOB_CAPTURE_RING", CAPTURE_RING_DEFAULT);
+    if (size < CAPTURE_RING_MIN) size = CAPTURE_RING_MIN;
+    if (size > CAPTURE_RING_MAX) size = CAPTURE_RING_MAX;
+    if (c) c->ring = malloc(size);
+    if (!c || !c->ring) {
+        free(c);
+        close_pending();
+        return NULL;
+    }
+    c->size = size;
+    c->spill_max = size_var("JOB_CAPTURE_SPILL", CAPTURE_SPILL_DEFAULT);
+    c->spill_fd = -1;
+    c->fd = pending[0];
+    pending[0] = -1;
+    job_capture_parent();
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    return c;
+}
+
+int job_capture_fd(const job_capture *c) {
+    return c ? c->fd : -1;
+}
+
+static int open_spill(void) {
+    int fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        char tmpl[] = "/tmp/shell-capture-XXXXXX";
+        fd = mkstemp(tmpl);
+        if (fd < 0) return -1;
+        unlink(tmpl);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    return fd;
+}
+
+/* Bytes leaving memory go to the spill file while it has room */
+static void spill(job_capture *c, const char *data, size_t n) {
+    size_t room = c->spilled < c->spill_max ? c->spill_max - c->spilled : 0;
+    size_t take = n < room ? n : room;
+    if (take && c->spill_fd < 0) c->spill_fd = open_spill();
+    if (take && c->spill_fd >= 0) {
+        ssize_t w = pwrite(c->spill_fd, data, take, (off_t)c->spilled);
+        if (w > 0) c->spilled += (size_t)w;
+        else take = 0;
+    } else {
+        take = 0;
+    }
+    c->dropped += n - take;
+}
+
+/* Oldest byte in the ring */
+static size_t ring_tail(const job_capture *c) {
+    return (c->head + c->size - c->used) % c->size;
+}
+
+static void ring_append(job_capture *c, const char *data, size_t n) {
+    /* a chunk bigger than the ring: its head goes straight past memory */
+    if (n > c->size) {
+        size_t over = n - c->size;
+        /* flush the current ring first so the spill stays in order */
+        while (c->used) {
+            size_t tail = ring_tail(c);
+            size_t run = c->size - tail < c->used ? c->size - tail : c->used;
+            spill(c, c->ring + tail, run);
+            c->used -= run;
+        }
+        spill(c, data, over);
+        data += over;
+        n = c->size;
+    }
+    /* make room by evicting the oldest bytes */
+    while (c->used + n > c->size) {
+        size_t tail = ring_tail(c);
+        size_t need = c->used + n - c->size;
+        size_t run = c->size - tail;
+        if (run > need) run = need;
+        spill(c, c->ring + tail, run);
+        c->used -= run;
+    }
+    while (n) {
+        size_t run = c->size - c->head;
+        if (run > n) run = n;
+        memcpy(c->ring + c->head, data, run);
+        c->head = (c->head + run) % c->size;
+        c->used += run;
+        data += run;
+        n -= run;
+    }
+}
+
+static void write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+/* Read everything the pipe has right now. New bytes are also copied to
+ * echo_fd when it is >= 0 (jobs -o --follow). */
+void job_capture_drain(job_capture *c, int echo_fd) {
+    if (!c || c->fd < 0) return;
+    char buf[CAPTURE_READ_CHUNK];
+    for (;;) {
+        ssize_t n = read(c->fd, buf, sizeof(buf));
+        if (n > 0) {
+            ring_append(c, buf, (size_t)n);
+            if (echo_fd >= 0) write_all(echo_fd, buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        close(c->fd);           /* EOF: every writer is gone */
+        c->fd = -1;
+        return;
+    }
+}
+
+/* Everything kept so far, oldest first */
+void job_capture_dump(const job_capture *c, int out_fd) {
+    char buf[CAPTURE_READ_CHUNK];
+    for (size_t off = 0; off < c->spilled;) {
+        ssize_t n = pread(c->spill_fd, buf, sizeof(buf), (off_t)off);
+        if (n <= 0) break;
+        write_all(out_fd, buf, (size_t)n);
+        off += (size_t)n;
+    }
+    if (c->dropped) {
+        /* the marker gets a line of its own */
+        char last = '\n';
+        if (c->spilled && pread(c->spill_fd, &last, 1, (off_t)c->spilled - 1) != 1) last = '\n';
+        dprintf(out_fd, "%s[... %llu bytes not kept ...]\n", last == '\n' ? "" : "\n", c->dropped);
+    }
+    size_t tail = ring_tail(c);
+    size_t first = c->size - tail < c->used ? c->size - tail : c->used;
+    write_all(out_fd, c->ring + tail, first);
+    write_all(out_fd, c->ring, c->used - first);
+}
+
+void job_capture_free(job_capture *c) {
+    if (!c) return;
+    if (c->fd >= 0) close(c->fd);
+    if (c->spill_fd >= 0) close(c->spill_fd);
+    free(c->ring);
+    free(c);
+}
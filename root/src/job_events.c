@@ -0,0 +1,172 @@
+//******************************************************************************************************
+//* Name:        job_events.c                                                                          *
+//* Description: Machine-readable job lifecycle events as JSON lines.                                  *
+//*              Enabled with "--events FILE" (appended to) or "--events-fd N". One                    *
+//*              object per line, with the fields:                                                     *
+//*                {"event":"start","job":1,"pids":[..],"leader":123,"cmd":"..","ts":..}               *
+//*                {"event":"exit","job":1,"stage":0,"pid":123,"status":0,"signal":null,               *
+//*                 "ts":..,"utime":..,"stime":..,"maxrss_kb":..}                                      *
+//*                {"event":"done","job":1,"status":0,"signal":null,"stages":[0,..],                   *
+//*                 "ts":..,"elapsed":..,"timed_out":false}                                            *
+//*              ts is seconds since the epoch, elapsed/utime/stime are seconds.                       *
+//*              stages has each process's exit code (128 + signal number if killed).                  *
+//*              - Every event is formatted into one buffer of at most PIPE_BUF bytes                  *
+//*                and emitted with a single write(2), so events from concurrent jobs                  *
+//*                never interleave on a pipe or an O_APPEND file. Long command lines                  *
+//*                are truncated to fit.                                                               *
+//*              - Nothing is buffered in stdio; when disabled each hook is one branch.                *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "shell.h"
+
+#define EVENT_MAX PIPE_BUF
+#define EVENT_CMD_MAX 2048      /* bytes of the escaped command line kept */
+
+int job_events_open(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "events: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    sh->events_fd = fd;
+    return 0;
+}
+
+int job_events_set_fd(int fd) {
+    if (fd < 0 || fcntl(fd, F_GETFD) == -1) {
+        fprintf(stderr, "events: %d: bad file descriptor\n", fd);
+        return -1;
+    }
+    /* the supervisor's fd is for the shell, not for the commands it runs */
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    sh->events_fd = fd;
+    return 0;
+}
+
+int job_events_enabled(void) {
+    return sh->events_fd >= 0;
+}
+
+typedef struct {
+    char buf[EVENT_MAX];
+    size_t len;
+} event_buf;
+
+static void ev_add(event_buf *e, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void ev_add(event_buf *e, const char *fmt, ...) {
+    if (e->len >= sizeof(e->buf)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(e->buf + e->len, sizeof(e->buf) - e->len, fmt, ap);
+    va_end(ap);
+    if (n > 0) e->len += (size_t)n;
+    if (e->len > sizeof(e->buf)) e->len = sizeof(e->buf);
+}
+
+/* JSON string, cut at limit bytes of output (never inside an escape or a
+ * UTF-8 sequence). */
+static void ev_str(event_buf *e, const char *s, size_t limit) {
+    size_t start = e->len;
+    ev_add(e, "\"");
+    for (const unsigned char *p = (const unsigned char *)s; p && *p; ++p) {
+        if (e->len - start > limit) {
+            while (p > (const unsigned char *)s && (*p & 0xC0) == 0x80) {
+                /* back out of a partial UTF-8 sequence */
+                e->len--;
+                p--;
+            }
+            break;
+        }
+        if (*p == '"' || *p == '\\') ev_add(e, "\\%c", *p);
+        else if (*p < 0x20) ev_add(e, "\\u%04x", *p);
+        else ev_add(e, "%c", *p);
+    }
+    ev_add(e, "\"");
+}
+
+static void ev_time(event_buf *e, const char *key, const struct timespec *ts) {
+    ev_add(e, ",\"%s\":%lld.%06ld", key, (long long)ts->tv_sec, ts->tv_nsec / 1000);
+}
+
+static void ev_status(event_buf *e, int wstatus) {
+    if (WIFSIGNALED(wstatus))
+        ev_add(e, ",\"status\":%d,\"signal\":%d", 128 + WTERMSIG(wstatus), WTERMSIG(wstatus));
+    else
+        ev_add(e, ",\"status\":%d,\"signal\":null", WEXITSTATUS(wstatus));
+}
+
+static void ev_emit(event_buf *e) {
+    if (e->len >= sizeof(e->buf)) e->len = sizeof(e->buf) - 2;
+    e->buf[e->len++] = '}';
+    e->buf[e->len++] = '\n';
+    ssize_t w;
+    do {
+        w = write(sh->events_fd, e->buf, e->len);
+    } while (w < 0 && errno == EINTR);
+}
+
+void job_event_start(const job_t *job) {
+    if (sh->events_fd < 0) return;
+    event_buf e = { .len = 0 };
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    ev_add(&e, "{\"event\":\"start\",\"job\":%d,\"pids\":[", job->jobno);
+    for (int i = 0; i < job->nprocs; ++i)
+        ev_add(&e, "%s%ld", i ? "," : "", (long)job->pids[i]);
+    ev_add(&e, "],\"leader\":%ld,\"cmd\":", (long)job->leader_pid);
+    ev_str(&e, job->cmdline, EVENT_CMD_MAX);
+    ev_time(&e, "ts", &now);
+    ev_emit(&e);
+}
+
+void job_event_exit(const job_t *job, pid_t pid, int wstatus, const struct rusage *ru) {
+    if (sh->events_fd < 0) return;
+    int stage = 0;
+    while (stage < job->nprocs && job->pids[stage] != pid) stage++;
+    event_buf e = { .len = 0 };
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    ev_add(&e, "{\"event\":\"exit\",\"job\":%d,\"stage\":%d,\"pid\":%ld", job->jobno, stage, (long)pid);
+    ev_status(&e, wstatus);
+    ev_time(&e, "ts", &now);
+    if (ru) {
+        ev_add(&e, ",\"utime\":%ld.%06ld,\"stime\":%ld.%06ld,\"maxrss_kb\":%ld",
+               (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec,
+               (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec, ru->ru_maxrss);
+    }
+    ev_emit(&e);
+}
+
+void job_event_done(const job_t *job) {
+    if (sh->events_fd < 0) return;
+    event_buf e = { .len = 0 };
+    struct timespec now, mono;
+    clock_gettime(CLOCK_REALTIME, &now);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    long long ns = (long long)(mono.tv_sec - job->started.tv_sec) * 1000000000LL +
+                   (mono.tv_nsec - job->started.tv_nsec);
+    ev_add(&e, "{\"event\":\"done\",\"job\":%d", job->jobno);
+    ev_status(&e, job->last_status);
+    /* every stage of a pipeline: exit code, or 128 + signal number */
+    ev_add(&e, ",\"stages\":[");
+    for (int i = 0; i < job->nprocs; ++i) {
+        int ws = job->stage_status[i];
+        ev_add(&e, "%s%d", i ? "," : "", WIFSIGNALED(ws) ? 128 + WTERMSIG(ws) : WEXITSTATUS(ws));
+    }
+    ev_add(&e, "]");
+    ev_time(&e, "ts", &now);
+    ev_add(&e, ",\"elapsed\":%lld.%06lld,\"timed_out\":%s", ns / 1000000000LL, (ns % 1000000000LL) / 1000,
+           job->timed_out ? "true" : "false");
+    ev_emit(&e);
+}
@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include "shell.h"
 
 //int main()
@@ -28,25 +30,70 @@
 //	return 0;
 //}
 
+/* get_input() reads stdin through its own buffer rather than stdio so it
+ * knows when it is about to block, and can let the job table enforce
+ * background deadlines while waiting (part_eight_wait_input).
+ * On a terminal the line editor (line_edit.c) reads the line instead.
+ */
+static char inbuf[4096];
+static size_t in_pos = 0;
+static size_t in_len = 0;
+
+/* set_input_source(): lines come from a string instead (libshell runs),
+ * so here-documents in it read their bodies from the same text.
+ */
+static const char *src_text = NULL;
+static size_t src_pos = 0;
+static size_t src_len = 0;
+
+void set_input_source(const char *text, size_t len) {
+	src_text = text;
+	src_pos = 0;
+	src_len = text ? len : 0;
+}
+
 char *get_input(void) {
 	char *buffer = NULL;
-	int bufsize = 0;
-	char line[5];
-	while (fgets(line, 5, stdin) != NULL)
+	size_t bufsize = 0;
+	int got_any = 0;
+	if (src_text)
 	{
-		int addby = 0;
-		char *newln = strchr(line, '\n');
-		if (newln != NULL)
-			addby = newln - line;
-		else
-			addby = 5 - 1;
-		buffer = (char *)realloc(buffer, bufsize + addby);
-		memcpy(&buffer[bufsize], line, addby);
+		if (src_pos == src_len)
+			return NULL;
+		const char *start = src_text + src_pos;
+		const char *newln = memchr(start, '\n', src_len - src_pos);
+		size_t n = newln ? (size_t)(newln - start) : src_len - src_pos;
+		src_pos += n + (newln ? 1 : 0);
+		return strndup(start, n);
+	}
+	if (in_pos == in_len && line_edit_enabled())
+		return line_edit_read();
+	while (1)
+	{
+		if (in_pos == in_len)
+		{
+			part_eight_wait_input(STDIN_FILENO);
+			ssize_t n = read(STDIN_FILENO, inbuf, sizeof(inbuf));
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			in_pos = 0;
+			in_len = (size_t)n;
+		}
+		char *start = inbuf + in_pos;
+		char *newln = memchr(start, '\n', in_len - in_pos);
+		size_t addby = newln ? (size_t)(newln - start) : in_len - in_pos;
+		buffer = (char *)realloc(buffer, bufsize + addby + 1);
+		memcpy(&buffer[bufsize], start, addby);
 		bufsize += addby;
+		in_pos += addby + (newln ? 1 : 0);
+		got_any = 1;
 		if (newln != NULL)
 			break;
 	}
-	buffer = (char *)realloc(buffer, bufsize + 1);
+	if (!got_any)
+		return NULL; /* EOF with nothing read */
 	buffer[bufsize] = 0;
 	return buffer;
 }
@@ -70,15 +117,36 @@ void add_token(tokenlist *tokens, char *item) {
 	tokens->size += 1;
 }
 
+/* Split input on spaces. A "$( ... )" command substitution stays inside
+ * its word even when it contains spaces; nested parentheses are counted.
+ * Outside one, ';' is a token of its own (command separator, script.c).
+ */
 tokenlist *get_tokens(char *input) {
-	char *buf = (char *)malloc(strlen(input) + 1);
-	strcpy(buf, input);
+	size_t len = strlen(input);
+	char *buf = (char *)malloc(len + 1);
 	tokenlist *tokens = new_tokenlist();
-	char *tok = strtok(buf, " ");
-	while (tok != NULL)
+	size_t n = 0;
+	int depth = 0;
+	for (size_t i = 0; i <= len; i++)
 	{
-		add_token(tokens, tok);
-		tok = strtok(NULL, " ");
+		char c = input[i];
+		if (c == '\0' || ((c == ' ' || c == ';') && depth == 0))
+		{
+			if (n > 0)
+			{
+				buf[n] = 0;
+				add_token(tokens, buf);
+				n = 0;
+			}
+			if (c == ';')
+				add_token(tokens, ";");
+			continue;
+		}
+		if (c == '(' && (depth > 0 || (n > 0 && buf[n - 1] == '$')))
+			depth++;
+		else if (c == ')' && depth > 0)
+			depth--;
+		buf[n++] = c;
 	}
 	free(buf);
 	return tokens;
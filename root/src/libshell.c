@@ -0,0 +1,269 @@
+//******************************************************************************************************
+//* Name:        libshell.c                                                                            *
+//* Description: The current shell context, and the C API of the library build (libshell.h,            *
+//*              "make lib"): contexts that run command lines inside the calling process.              *
+//*              - All per-instance state (job table, history, variables, $?, pending                  *
+//*                for/while/if) lives in a shell_ctx. sh points at the current one: the               *
+//*                standalone shell's main_ctx, or for the length of an API call the                   *
+//*                context it was given.                                                               *
+//*              - One process-wide lock serializes the calls, so contexts may be used from            *
+//*                several threads but run one at a time.                                              *
+//*              - A run touches neither the process's cwd nor its fds 1 and 2: paths resolve          *
+//*                with the *at() calls against the context's directory fd, the shell's output         *
+//*                goes to sh->fd_out/fd_err (memfds during a captured run), and forked children       *
+//*                move onto both in shell_child_setup before they do anything else.                  *
+//*              - Background jobs are reaped by pid only (part_eight_check_jobs), so the              *
+//*                host's own children are never waited for.                                           *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+static shell_ctx main_ctx = {
+    .next_job_number = 1,
+    .path_generation = 1,
+    .events_fd = -1,
+    .event_read = -1,
+    .vars.envp_dirty = 1,
+    .dir_fd = AT_FDCWD,
+    .fd_out = STDOUT_FILENO,
+    .fd_err = STDERR_FILENO,
+};
+shell_ctx *sh = &main_ctx;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Take the lock and make ctx current; leave() undoes both. */
+static shell_ctx *enter(shell_ctx *ctx) {
+    pthread_mutex_lock(&lock);
+    shell_ctx *prev = sh;
+    sh = ctx;
+    return prev;
+}
+
+static void leave(shell_ctx *prev) {
+    sh = prev;
+    pthread_mutex_unlock(&lock);
+}
+
+shell_ctx *shell_ctx_new(void) {
+    shell_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx) return NULL;
+    ctx->events_fd = -1;
+    ctx->event_read = -1;
+    ctx->vars.envp_dirty = 1;
+    ctx->embedded = 1;
+    ctx->fd_out = STDOUT_FILENO;
+    ctx->fd_err = STDERR_FILENO;
+    ctx->cwd = getcwd(NULL, 0);
+    ctx->dir_fd = ctx->cwd ? open(ctx->cwd, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (ctx->dir_fd < 0) {
+        free(ctx->cwd);
+        free(ctx);
+        return NULL;
+    }
+    shell_ctx *prev = enter(ctx);
+    vars_init();
+    part_eight_init();
+    leave(prev);
+    return ctx;
+}
+
+void shell_ctx_free(shell_ctx *ctx) {
+    if (!ctx) return;
+    shell_ctx *prev = enter(ctx);
+    for (int i = 0; i < sh->next_job_index; ++i) {
+        job_t *job = &sh->job_table[i];
+        if (!job->active) continue;
+        for (int j = 0; j < job->nprocs; ++j) {
+            if (job->reaped & (1u << j)) continue;
+            kill(job->pids[j], SIGTERM);
+            while (waitpid(job->pids[j], NULL, 0) < 0 && errno == EINTR)
+                ;
+        }
+    }
+    part_eight_shutdown();
+    script_discard();
+    for (int i = 0; i < sh->history_count; ++i) free(sh->history[i]);
+    vars_free();
+    if (sh->event_read >= 0) close(sh->event_read);
+    if (sh->events_fd >= 0) close(sh->events_fd);
+    free(sh->cwd);
+    close(sh->dir_fd);
+    leave(prev);
+    free(ctx);
+}
+
+/* First thing in every forked child: the context's output and directory
+ * become the process's, so exec'd commands, relative paths and any shell code
+ * the child goes on to run all see them. It is a subshell from here on:
+ * exit ends what it runs rather than printing the history and exiting.
+ */
+void shell_child_setup(void) {
+    if (sh->fd_out != STDOUT_FILENO) dup2(sh->fd_out, STDOUT_FILENO);
+    if (sh->fd_err != STDERR_FILENO) dup2(sh->fd_err, STDERR_FILENO);
+    sh->fd_out = STDOUT_FILENO;
+    sh->fd_err = STDERR_FILENO;
+    sh->subshell = 1;
+    if (sh->dir_fd != AT_FDCWD) {
+        if (fchdir(sh->dir_fd) != 0) {
+            dprintf(STDERR_FILENO, "shell: cannot enter %s: %s\n", sh->cwd, strerror(errno));
+            _exit(126);
+        }
+        sh->dir_fd = AT_FDCWD;
+    }
+}
+
+/* getcwd() of the context */
+char *shell_getcwd(char *buf, size_t size) {
+    if (sh->dir_fd == AT_FDCWD) return getcwd(buf, size);
+    if (strlen(sh->cwd) >= size) {
+        errno = ERANGE;
+        return NULL;
+    }
+    return strcpy(buf, sh->cwd);
+}
+
+/* perror() onto the context's stderr */
+void shell_perror(const char *what) {
+    dprintf(sh->fd_err, "%s: %s\n", what, strerror(errno));
+}
+
+/* Capture of the shell's output for one run */
+typedef struct {
+    int mem[2];                 /* memfds standing in for fds 1 and 2 */
+} capture;
+
+static int capture_start(capture *c) {
+    for (int i = 0; i < 2; ++i) {
+        c->mem[i] = memfd_create(i ? "shell-err" : "shell-out", MFD_CLOEXEC);
+        if (c->mem[i] < 0) {
+            if (i) close(c->mem[0]);
+            return -1;
+        }
+    }
+    sh->fd_out = c->mem[0];
+    sh->fd_err = c->mem[1];
+    return 0;
+}
+
+static char *capture_read(int fd, size_t *len) {
+    struct stat st;
+    size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    char *buf = malloc(size + 1);
+    if (!buf) {
+        *len = 0;
+        return NULL;
+    }
+    ssize_t n = size ? pread(fd, buf, size, 0) : 0;
+    *len = n > 0 ? (size_t)n : 0;
+    buf[*len] = '\0';
+    return buf;
+}
+
+static void capture_finish(capture *c, shell_result *res) {
+    sh->fd_out = STDOUT_FILENO;
+    sh->fd_err = STDERR_FILENO;
+    res->out = capture_read(c->mem[0], &res->out_len);
+    res->err = capture_read(c->mem[1], &res->err_len);
+    close(c->mem[0]);
+    close(c->mem[1]);
+}
+
+int shell_ctx_run(shell_ctx *ctx, const char *text, shell_result *res) {
+    if (res) memset(res, 0, sizeof(*res));
+    shell_ctx *prev = enter(ctx);
+
+    capture cap;
+    if (res && capture_start(&cap) != 0) {
+        sh->last_exit_status = 126;
+        res->status = sh->last_exit_status;
+        leave(prev);
+        return res->status;
+    }
+    sh->exited = 0;
+    set_input_source(text, strlen(text));
+    char *line;
+    while (!sh->exited && (line = get_input()) != NULL) {
+        shell_feed_line(line);
+        free(line);
+        part_eight_enforce_deadlines();
+        part_eight_check_jobs();
+    }
+    set_input_source(NULL, 0);
+    if (script_pending()) {
+        script_discard();               /* reports the unfinished construct */
+        sh->last_exit_status = 2;
+    }
+    if (res) {
+        capture_finish(&cap, res);
+        res->status = sh->last_exit_status;
+    }
+    int status = sh->last_exit_status;
+    leave(prev);
+    return status;
+}
+
+void shell_result_free(shell_result *res) {
+    if (!res) return;
+    free(res->out);
+    free(res->err);
+    memset(res, 0, sizeof(*res));
+}
+
+int shell_ctx_status(shell_ctx *ctx) {
+    shell_ctx *prev = enter(ctx);
+    int status = sh->last_exit_status;
+    leave(prev);
+    return status;
+}
+
+int shell_ctx_poll(shell_ctx *ctx) {
+    shell_ctx *prev = enter(ctx);
+    part_eight_enforce_deadlines();
+    part_eight_check_jobs();
+    int n = sh->active_job_count;
+    leave(prev);
+    return n;
+}
+
+int shell_ctx_event_fd(shell_ctx *ctx) {
+    shell_ctx *prev = enter(ctx);
+    if (sh->event_read < 0) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0) {
+            sh->event_read = fds[0];
+            sh->events_fd = fds[1];
+        }
+    }
+    int fd = sh->event_read;
+    leave(prev);
+    return fd;
+}
+
+int shell_ctx_var_set(shell_ctx *ctx, const char *name, const char *value) {
+    shell_ctx *prev = enter(ctx);
+    int rc = var_set(name, value);
+    leave(prev);
+    return rc;
+}
+
+char *shell_ctx_var_get(shell_ctx *ctx, const char *name) {
+    shell_ctx *prev = enter(ctx);
+    const char *value = var_get(name);
+    char *copy = value ? strdup(value) : NULL;
+    leave(prev);
+    return copy;
+}
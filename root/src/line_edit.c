@@ -0,0 +1,804 @@
+//******************************************************************************************************
+//* Name:        line_edit.c                                                                           *
+//* Description: Interactive line editor used by get_input() when stdin and stdout are a terminal.     *
+//*              - The terminal is in raw mode only while a line is being read; commands               *
+//*                always run with the settings the shell started with.                                *
+//*              - Keys: arrows, Home/End, ^A ^E ^B ^F, Backspace/^H, Delete, ^D, ^K ^U ^W,            *
+//*                ^L, ^C (drop the line), Up/Down or ^P/^N for history.                               *
+//*              - Tab completes the word before the cursor: command names in command                  *
+//*                position, file names otherwise (or when the word has a '/'). One Tab                *
+//*                inserts the longest common prefix, a second one lists the matches.                  *
+//*              - Command names (PATH executables, builtins, keywords) are kept in one                *
+//*                sorted array. It is built on the first Tab and rebuilt only when PATH               *
+//*                changes or one of its directories has a new mtime.                                  *
+//*              - Directories are read with getdents64 (glob_scan_dir) into the same                  *
+//*                kind of sorted array and cached by inode and mtime, so repeated Tabs                *
+//*                in a large directory are two binary searches, not a rescan.                         *
+//*              - compgen -c|-f WORD prints what Tab would offer, one per line.                       *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define LE_LIST_MAX 200         /* more matches than this are counted, not listed */
+#define LE_DIR_CACHE 4
+
+/* Names sorted with strcmp. Each pool entry is a d_type byte followed by
+ * the NUL-terminated name; offs[] point at the names. */
+typedef struct {
+    char *pool;
+    size_t pool_len, pool_cap;
+    uint32_t *offs;
+    size_t n, cap;
+} name_index;
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    size_t pos;
+} le_line;
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} le_out;
+
+/* What one completion found: matches [lo, hi) of an index, minus hidden
+ * names unless the prefix asks for them. */
+typedef struct {
+    const name_index *ni;
+    size_t lo, hi;
+    size_t count;
+    size_t first;               /* index of the first visible match */
+    size_t common;              /* length all visible matches share */
+    int hidden;                 /* names starting with '.' are visible */
+} le_matches;
+
+static int enabled = -1;
+static struct termios cooked;
+
+static struct {
+    name_index ni;
+    int built;
+    unsigned long gen;          /* path_generation it was built for */
+    char *path;
+    struct timespec *mtimes;    /* per PATH directory, tv_sec -1 if missing */
+    size_t ndirs;
+} cmds;
+
+static struct {
+    name_index ni;
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    unsigned long used;
+} dirs[LE_DIR_CACHE];
+static unsigned long dir_clock = 0;
+
+static const char *const keywords[] = {
+    "break", "continue", "do", "done", "elif", "else", "fi", "for", "if", "then", "until", "while",
+};
+
+/* ---------------- sorted name index ---------------- */
+
+static void ni_clear(name_index *ni) {
+    free(ni->pool);
+    free(ni->offs);
+    memset(ni, 0, sizeof(*ni));
+}
+
+static int ni_add(name_index *ni, const char *name, size_t len, unsigned char type) {
+    if (ni->pool_len + len + 2 > ni->pool_cap) {
+        size_t cap = ni->pool_cap ? ni->pool_cap : 4096;
+        while (cap < ni->pool_len + len + 2) cap *= 2;
+        char *np = realloc(ni->pool, cap);
+        if (!np) return -1;
+        ni->pool = np;
+        ni->pool_cap = cap;
+    }
+    if (ni->n == ni->cap) {
+        size_t cap = ni->cap ? ni->cap * 2 : 256;
+        uint32_t *no = realloc(ni->offs, cap * sizeof(uint32_t));
+        if (!no) return -1;
+        ni->offs = no;
+        ni->cap = cap;
+    }
+    ni->pool[ni->pool_len++] = (char)type;
+    ni->offs[ni->n++] = (uint32_t)ni->pool_len;
+    memcpy(ni->pool + ni->pool_len, name, len);
+    ni->pool[ni->pool_len + len] = '\0';
+    ni->pool_len += len + 1;
+    return 0;
+}
+
+static const char *ni_name(const name_index *ni, size_t i) {
+    return ni->pool + ni->offs[i];
+}
+
+static unsigned char ni_type(const name_index *ni, size_t i) {
+    return (unsigned char)ni->pool[ni->offs[i] - 1];
+}
+
+static const char *sort_pool;
+
+static int cmp_off(const void *a, const void *b) {
+    return strcmp(sort_pool + *(const uint32_t *)a, sort_pool + *(const uint32_t *)b);
+}
+
+/* Sort and drop duplicate names (the same command in two PATH dirs). */
+static void ni_sort(name_index *ni) {
+    if (ni->n < 2) return;
+    sort_pool = ni->pool;
+    qsort(ni->offs, ni->n, sizeof(uint32_t), cmp_off);
+    size_t w = 1;
+    for (size_t i = 1; i < ni->n; ++i) {
+        if (strcmp(ni_name(ni, i), ni_name(ni, w - 1)) != 0) ni->offs[w++] = ni->offs[i];
+    }
+    ni->n = w;
+}
+
+/* First index whose name compares (over plen bytes) >= prefix, or > prefix
+ * when after is set. */
+static size_t ni_bound(const name_index *ni, const char *prefix, size_t plen, int after) {
+    size_t lo = 0, hi = ni->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strncmp(ni_name(ni, mid), prefix, plen);
+        if (c < 0 || (after && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static void ni_match(const name_index *ni, const char *prefix, size_t plen, le_matches *m) {
+    memset(m, 0, sizeof(*m));
+    m->ni = ni;
+    m->lo = ni_bound(ni, prefix, plen, 0);
+    m->hi = ni_bound(ni, prefix, plen, 1);
+    m->hidden = plen > 0 && prefix[0] == '.';
+    const char *first = NULL;
+    for (size_t i = m->lo; i < m->hi; ++i) {
+        const char *name = ni_name(ni, i);
+        if (name[0] == '.' && !m->hidden) continue;
+        if (!first) {
+            first = name;
+            m->first = i;
+            m->common = strlen(name);
+        } else {
+            size_t k = plen;
+            while (k < m->common && name[k] == first[k]) k++;
+            m->common = k;
+        }
+        m->count++;
+    }
+}
+
+/* ---------------- command names ---------------- */
+
+typedef struct {
+    name_index *ni;
+    int dfd;
+} scan_ctx;
+
+static void add_executable(const char *name, size_t len, unsigned char d_type, void *arg) {
+    scan_ctx *c = arg;
+    struct stat st;
+    if (name[0] == '.') return;
+    if (d_type != DT_REG && d_type != DT_LNK && d_type != DT_UNKNOWN) return;
+    if (fstatat(c->dfd, name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+        return;
+    ni_add(c->ni, name, len, DT_REG);
+}
+
+/* PATH's directories, split in place; returns how many. */
+static size_t split_path(char *path, char ***out) {
+    size_t n = 0;
+    char **v = NULL;
+    char *save = NULL;
+    for (char *d = strtok_r(path, ":", &save); d; d = strtok_r(NULL, ":", &save)) {
+        char **nv = realloc(v, (n + 1) * sizeof(char *));
+        if (!nv) break;
+        v = nv;
+        v[n++] = d;
+    }
+    *out = v;
+    return n;
+}
+
+static int same_time(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void dir_mtime(const char *dir, struct timespec *t) {
+    struct stat st;
+    if (fstatat(sh->dir_fd, dir, &st, 0) == 0) *t = st.st_mtim;
+    else t->tv_sec = -1, t->tv_nsec = 0;
+}
+
+/* Still valid: same PATH and no directory on it changed since the build. */
+static int cmds_current(void) {
+    if (!cmds.built || cmds.gen != sh->path_generation) return 0;
+    char *copy = cmds.path ? strdup(cmds.path) : NULL;
+    char **dv = NULL;
+    size_t n = copy ? split_path(copy, &dv) : 0;
+    int ok = n == cmds.ndirs;
+    for (size_t i = 0; ok && i < n; ++i) {
+        struct timespec t;
+        dir_mtime(dv[i], &t);
+        ok = same_time(&t, &cmds.mtimes[i]);
+    }
+    free(dv);
+    free(copy);
+    return ok;
+}
+
+static void cmds_build(void) {
+    ni_clear(&cmds.ni);
+    free(cmds.path);
+    free(cmds.mtimes);
+    cmds.mtimes = NULL;
+    cmds.ndirs = 0;
+    const char *path = var_get("PATH");
+    cmds.path = strdup(path ? path : "");
+    cmds.gen = sh->path_generation;
+    cmds.built = 1;
+
+    char *copy = cmds.path ? strdup(cmds.path) : NULL;
+    char **dv = NULL;
+    size_t n = copy ? split_path(copy, &dv) : 0;
+    cmds.mtimes = calloc(n ? n : 1, sizeof(struct timespec));
+    for (size_t i = 0; cmds.mtimes && i < n; ++i) {
+        struct stat st;
+        cmds.mtimes[i].tv_sec = -1;
+        int dfd = openat(sh->dir_fd, dv[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd < 0) continue;
+        if (fstat(dfd, &st) == 0) cmds.mtimes[i] = st.st_mtim;
+        scan_ctx c = { &cmds.ni, dfd };
+        glob_scan_dir(dfd, add_executable, &c);
+        close(dfd);
+    }
+    cmds.ndirs = cmds.mtimes ? n : 0;
+    free(dv);
+    free(copy);
+
+    for (int i = 0; builtin_name(i); ++i)
+        ni_add(&cmds.ni, builtin_name(i), strlen(builtin_name(i)), DT_REG);
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i)
+        ni_add(&cmds.ni, keywords[i], strlen(keywords[i]), DT_REG);
+    ni_sort(&cmds.ni);
+}
+
+static const name_index *command_names(void) {
+    if (!cmds_current()) cmds_build();
+    return &cmds.ni;
+}
+
+/* ---------------- directory listings ---------------- */
+
+static void add_entry(const char *name, size_t len, unsigned char d_type, void *arg) {
+    ni_add(arg, name, len, d_type);
+}
+
+/* The sorted listing of dir, from the cache while its inode and mtime are
+ * unchanged. NULL if it can't be read. */
+static const name_index *dir_names(const char *dir) {
+    struct stat st;
+    int dfd = openat(sh->dir_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return NULL;
+    if (fstat(dfd, &st) != 0) {
+        close(dfd);
+        return NULL;
+    }
+    int slot = 0;
+    for (int i = 0; i < LE_DIR_CACHE; ++i) {
+        if (dirs[i].path && dirs[i].dev == st.st_dev && dirs[i].ino == st.st_ino &&
+            same_time(&dirs[i].mtime, &st.st_mtim)) {
+            close(dfd);
+            dirs[i].used = ++dir_clock;
+            return &dirs[i].ni;
+        }
+        if (dirs[i].used < dirs[slot].used) slot = i;
+    }
+    ni_clear(&dirs[slot].ni);
+    free(dirs[slot].path);
+    dirs[slot].path = strdup(dir);
+    dirs[slot].dev = st.st_dev;
+    dirs[slot].ino = st.st_ino;
+    dirs[slot].mtime = st.st_mtim;
+    dirs[slot].used = ++dir_clock;
+    if (glob_scan_dir(dfd, add_entry, &dirs[slot].ni) != 0) {
+        /* don't keep a partial listing around */
+        ni_clear(&dirs[slot].ni);
+        free(dirs[slot].path);
+        dirs[slot].path = NULL;
+        dirs[slot].used = 0;
+        close(dfd);
+        return NULL;
+    }
+    close(dfd);
+    ni_sort(&dirs[slot].ni);
+    return &dirs[slot].ni;
+}
+
+/* Directory to read for word[0, dlen) (the part up to its last '/'):
+ * "." when empty, with a leading "~/" taken from $HOME. */
+static char *dir_for(const char *word, size_t dlen) {
+    if (dlen == 0) return strdup(".");
+    const char *home = var_get("HOME");
+    size_t skip = 0, hlen = 0;
+    if (word[0] == '~' && dlen >= 2 && word[1] == '/' && home) {
+        skip = 1;
+        hlen = strlen(home);
+    }
+    char *d = malloc(hlen + dlen - skip + 1);
+    if (!d) return NULL;
+    memcpy(d, home ? home : "", hlen);
+    memcpy(d + hlen, word + skip, dlen - skip);
+    d[hlen + dlen - skip] = '\0';
+    return d;
+}
+
+/* ---------------- completion ---------------- */
+
+static int is_command_word(const char *buf, size_t start) {
+    size_t e = start;
+    while (e > 0 && buf[e - 1] == ' ') e--;
+    if (e == 0) return 1;
+    char c = buf[e - 1];
+    if (c == ';' || c == '|' || c == '&' || c == '(') return 1;
+    size_t s = e;
+    while (s > 0 && buf[s - 1] != ' ' && buf[s - 1] != ';') s--;
+    static const char *const lead[] = { "if", "then", "else", "elif", "while", "until", "do", "!" };
+    for (size_t i = 0; i < sizeof(lead) / sizeof(lead[0]); ++i) {
+        if (strlen(lead[i]) == e - s && memcmp(buf + s, lead[i], e - s) == 0) return 1;
+    }
+    return 0;
+}
+
+/* Matches for word[0, len). *dlen gets the length of its directory part,
+ * *dir (file completion only) the directory read, for the caller to free. */
+static int complete_word(const char *word, size_t len, int command, le_matches *m,
+                         size_t *dlen, char **dir) {
+    *dlen = 0;
+    *dir = NULL;
+    if (command && !memchr(word, '/', len)) {
+        ni_match(command_names(), word, len, m);
+        return 0;
+    }
+    size_t d = len;
+    while (d > 0 && word[d - 1] != '/') d--;
+    *dir = dir_for(word, d);
+    const name_index *ni = *dir ? dir_names(*dir) : NULL;
+    if (!ni) return -1;
+    *dlen = d;
+    ni_match(ni, word + d, len - d, m);
+    return 0;
+}
+
+/* Directory or a link to one, for the '/' after a completed name. */
+static int match_is_dir(const le_matches *m, size_t i, const char *dir) {
+    unsigned char t = ni_type(m->ni, i);
+    if (t == DT_DIR) return 1;
+    if (!dir || (t != DT_LNK && t != DT_UNKNOWN)) return 0;
+    struct stat st;
+    char *p = malloc(strlen(dir) + strlen(ni_name(m->ni, i)) + 2);
+    if (!p) return 0;
+    sprintf(p, "%s/%s", dir, ni_name(m->ni, i));
+    int r = fstatat(sh->dir_fd, p, &st, 0) == 0 && S_ISDIR(st.st_mode);
+    free(p);
+    return r;
+}
+
+/* compgen -c WORD | compgen -f WORD */
+int builtin_compgen(char **argv, builtin_io *io) {
+    if (!argv[1] || (strcmp(argv[1], "-c") != 0 && strcmp(argv[1], "-f") != 0) ||
+        (argv[2] && argv[3])) {
+        dprintf(io->err, "compgen: usage: compgen -c|-f [WORD]\n");
+        return 2;
+    }
+    const char *word = argv[2] ? argv[2] : "";
+    size_t len = strlen(word), dlen;
+    char *dir;
+    le_matches m;
+    if (complete_word(word, len, argv[1][1] == 'c', &m, &dlen, &dir) != 0 || m.count == 0) {
+        free(dir);
+        return 1;
+    }
+    le_out ob = { 0 };
+    int rc = 0;
+    for (size_t i = m.first; i < m.hi && rc == 0; ++i) {
+        const char *name = ni_name(m.ni, i);
+        if (name[0] == '.' && !m.hidden) continue;
+        size_t nl = strlen(name);
+        if (ob.len + dlen + nl + 1 > ob.cap) {
+            size_t cap = ob.cap ? ob.cap * 2 : 4096;
+            while (cap < ob.len + dlen + nl + 1) cap *= 2;
+            char *nb = realloc(ob.buf, cap);
+            if (!nb) { rc = 1; break; }
+            ob.buf = nb;
+            ob.cap = cap;
+        }
+        memcpy(ob.buf + ob.len, word, dlen);
+        memcpy(ob.buf + ob.len + dlen, name, nl);
+        ob.len += dlen + nl;
+        ob.buf[ob.len++] = '\n';
+    }
+    if (rc == 0 && ob.len) rc = bio_write(io, ob.buf, ob.len) == 0 ? 0 : 1;
+    free(ob.buf);
+    free(dir);
+    return rc;
+}
+
+/* ---------------- terminal output ---------------- */
+
+static void out_put(le_out *o, const char *s, size_t n) {
+    if (o->len + n > o->cap) {
+        size_t cap = o->cap ? o->cap : 256;
+        while (cap < o->len + n) cap *= 2;
+        char *nb = realloc(o->buf, cap);
+        if (!nb) return;
+        o->buf = nb;
+        o->cap = cap;
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+static void out_str(le_out *o, const char *s) {
+    out_put(o, s, strlen(s));
+}
+
+static void out_flush(le_out *o) {
+    size_t off = 0;
+    while (off < o->len) {
+        ssize_t w = write(STDOUT_FILENO, o->buf + off, o->len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+    o->len = 0;
+}
+
+static size_t term_cols(void) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+    return 80;
+}
+
+/* Redraw the prompt's last line and the visible part of the buffer, which
+ * scrolls sideways when it doesn't fit. */
+static void refresh(const le_line *l) {
+    size_t plen;
+    const char *prompt = prompt_shown(&plen);
+    const char *nl = memrchr(prompt, '\n', plen);
+    if (nl) {
+        plen -= (size_t)(nl + 1 - prompt);
+        prompt = nl + 1;
+    }
+    size_t cols = term_cols();
+    const char *buf = l->buf;
+    size_t len = l->len, pos = l->pos;
+    while (plen + pos >= cols && pos > 0) {
+        buf++;
+        len--;
+        pos--;
+    }
+    while (plen + len > cols - 1 && len > pos) len--;
+
+    le_out o = { 0 };
+    char seq[32];
+    out_str(&o, "\r");
+    out_put(&o, prompt, plen);
+    out_put(&o, buf, len);
+    out_str(&o, "\x1b[0K");
+    snprintf(seq, sizeof(seq), "\r\x1b[%zuC", plen + pos);
+    out_str(&o, plen + pos ? seq : "\r");
+    out_flush(&o);
+    free(o.buf);
+}
+
+static void list_matches(const le_matches *m, const char *dir) {
+    le_out o = { 0 };
+    char msg[64];
+    out_str(&o, "\n");
+    if (m->count > LE_LIST_MAX) {
+        snprintf(msg, sizeof(msg), "(%zu matches)\n", m->count);
+        out_str(&o, msg);
+    } else {
+        size_t width = 0;
+        for (size_t i = m->first; i < m->hi; ++i) {
+            size_t n = strlen(ni_name(m->ni, i)) + 1;
+            if (n > width) width = n;
+        }
+        width += 2;
+        size_t per_row = term_cols() / width;
+        if (per_row == 0) per_row = 1;
+        size_t col = 0;
+        for (size_t i = m->first; i < m->hi; ++i) {
+            const char *name = ni_name(m->ni, i);
+            if (name[0] == '.' && !m->hidden) continue;
+            size_t n = strlen(name);
+            out_put(&o, name, n);
+            if (dir && ni_type(m->ni, i) == DT_DIR) out_str(&o, "/"), n++;
+            if (++col == per_row || i + 1 == m->hi) {
+                out_str(&o, "\n");
+                col = 0;
+            } else {
+                for (; n < width; ++n) out_str(&o, " ");
+            }
+        }
+        if (col) out_str(&o, "\n");
+    }
+    out_flush(&o);
+    free(o.buf);
+}
+
+/* ---------------- editing ---------------- */
+
+static int line_reserve(le_line *l, size_t extra) {
+    if (l->len + extra + 1 <= l->cap) return 0;
+    size_t cap = l->cap ? l->cap : 128;
+    while (cap < l->len + extra + 1) cap *= 2;
+    char *nb = realloc(l->buf, cap);
+    if (!nb) return -1;
+    l->buf = nb;
+    l->cap = cap;
+    return 0;
+}
+
+static void line_insert(le_line *l, const char *s, size_t n) {
+    if (line_reserve(l, n) != 0) return;
+    memmove(l->buf + l->pos + n, l->buf + l->pos, l->len - l->pos);
+    memcpy(l->buf + l->pos, s, n);
+    l->len += n;
+    l->pos += n;
+    l->buf[l->len] = '\0';
+}
+
+/* Remove [from, to) */
+static void line_delete(le_line *l, size_t from, size_t to) {
+    memmove(l->buf + from, l->buf + to, l->len - to);
+    l->len -= to - from;
+    if (l->pos > to) l->pos -= to - from;
+    else if (l->pos > from) l->pos = from;
+    l->buf[l->len] = '\0';
+}
+
+static void line_set(le_line *l, const char *s) {
+    size_t n = strlen(s);
+    l->len = l->pos = 0;
+    if (line_reserve(l, n) != 0) return;
+    memcpy(l->buf, s, n + 1);
+    l->len = l->pos = n;
+}
+
+/* Tab. Returns 1 if the line changed. */
+static int tab(le_line *l, int again) {
+    size_t start = l->pos;
+    while (start > 0 && l->buf[start - 1] != ' ' && l->buf[start - 1] != ';') start--;
+    const char *word = l->buf + start;
+    size_t len = l->pos - start, dlen;
+    char *dir;
+    le_matches m;
+    int command = is_command_word(l->buf, start);
+    if (complete_word(word, len, command, &m, &dlen, &dir) != 0 || m.count == 0) {
+        free(dir);
+        if (write(STDOUT_FILENO, "\a", 1) < 0) { /* nothing to report */ }
+        return 0;
+    }
+    const char *first = ni_name(m.ni, m.first);
+    size_t typed = len - dlen;
+    int changed = 0;
+    if (m.common > typed) {
+        line_insert(l, first + typed, m.common - typed);
+        changed = 1;
+    }
+    if (m.count == 1) {
+        line_insert(l, match_is_dir(&m, m.first, dir) ? "/" : " ", 1);
+        changed = 1;
+    } else if (!changed && again) {
+        list_matches(&m, dir);
+        size_t plen;
+        const char *prompt = prompt_shown(&plen);
+        le_out o = { 0 };
+        out_put(&o, prompt, plen);
+        out_flush(&o);
+        free(o.buf);
+        changed = 1;
+    } else if (!changed) {
+        if (write(STDOUT_FILENO, "\a", 1) < 0) { /* nothing to report */ }
+    }
+    free(dir);
+    return changed;
+}
+
+static int read_key(unsigned char *c) {
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, c, 1);
+        if (n == 1) return 1;
+        if (n < 0 && errno == EINTR) continue;
+        return 0;
+    }
+}
+
+enum { K_NONE = 1000, K_UP, K_DOWN, K_LEFT, K_RIGHT, K_HOME, K_END, K_DEL };
+
+/* The key after an ESC: "[A", "OH", "[3~" ... */
+static int read_escape(void) {
+    unsigned char a, b, c;
+    if (!read_key(&a) || !read_key(&b)) return K_NONE;
+    if (a == '[' && b >= '0' && b <= '9') {
+        if (!read_key(&c) || c != '~') return K_NONE;
+        switch (b) {
+        case '1': case '7': return K_HOME;
+        case '4': case '8': return K_END;
+        case '3': return K_DEL;
+        }
+        return K_NONE;
+    }
+    if (a != '[' && a != 'O') return K_NONE;
+    switch (b) {
+    case 'A': return K_UP;
+    case 'B': return K_DOWN;
+    case 'C': return K_RIGHT;
+    case 'D': return K_LEFT;
+    case 'H': return K_HOME;
+    case 'F': return K_END;
+    }
+    return K_NONE;
+}
+
+int line_edit_enabled(void) {
+    if (enabled < 0) {
+        const char *term = getenv("TERM");
+        enabled = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) &&
+                  !(term && strcmp(term, "dumb") == 0) && tcgetattr(STDIN_FILENO, &cooked) == 0;
+    }
+    return enabled;
+}
+
+/* Read one line with editing. Returns it without the newline (malloc'd),
+ * or NULL at end of input (^D on an empty line). */
+char *line_edit_read(void) {
+    tcgetattr(STDIN_FILENO, &cooked);
+    struct termios raw = cooked;
+    raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) != 0) return NULL;
+
+    le_line l = { 0 };
+    line_reserve(&l, 0);
+    l.buf[0] = '\0';
+    /* Up/Down browse the context's history (add_to_history), the same
+     * commands exit lists; hist == history_count is the line being typed */
+    const int history_len = sh->history_count;
+    int hist = history_len;
+    char *typed = NULL;         /* that line, while browsing history */
+    int last_tab = 0, eof = 0;
+
+    for (;;) {
+        unsigned char ch;
+        part_eight_wait_input(STDIN_FILENO);
+        if (!read_key(&ch)) {
+            eof = l.len == 0;
+            break;
+        }
+        int key = ch == 27 ? read_escape() : ch;
+        int was_tab = last_tab;
+        last_tab = 0;
+        switch (key) {
+        case '\r':
+        case '\n':
+            l.pos = l.len;
+            refresh(&l);
+            break;
+        case 4:         /* ^D */
+            if (l.len == 0) {
+                eof = 1;
+                break;
+            }
+            /* fall through */
+        case K_DEL:
+            if (l.pos < l.len) line_delete(&l, l.pos, l.pos + 1);
+            refresh(&l);
+            continue;
+        case 3:         /* ^C */
+            l.pos = l.len;
+            refresh(&l);
+            if (write(STDOUT_FILENO, "^C", 2) < 0) { /* nothing to report */ }
+            l.len = 0;
+            l.buf[0] = '\0';
+            script_discard();
+            break;
+        case '\t':
+            last_tab = 1;
+            if (tab(&l, was_tab)) refresh(&l);
+            continue;
+        case 127:
+        case 8:         /* ^H */
+            if (l.pos > 0) line_delete(&l, l.pos - 1, l.pos);
+            refresh(&l);
+            continue;
+        case 1: case K_HOME: l.pos = 0; refresh(&l); continue;
+        case 5: case K_END: l.pos = l.len; refresh(&l); continue;
+        case 2: case K_LEFT: if (l.pos > 0) l.pos--; refresh(&l); continue;
+        case 6: case K_RIGHT: if (l.pos < l.len) l.pos++; refresh(&l); continue;
+        case 11:        /* ^K */
+            line_delete(&l, l.pos, l.len);
+            refresh(&l);
+            continue;
+        case 21:        /* ^U */
+            line_delete(&l, 0, l.pos);
+            refresh(&l);
+            continue;
+        case 23: {      /* ^W */
+            size_t s = l.pos;
+            while (s > 0 && l.buf[s - 1] == ' ') s--;
+            while (s > 0 && l.buf[s - 1] != ' ') s--;
+            line_delete(&l, s, l.pos);
+            refresh(&l);
+            continue;
+        }
+        case 12: {      /* ^L */
+            size_t plen;
+            const char *prompt = prompt_shown(&plen);
+            le_out o = { 0 };
+            out_str(&o, "\x1b[H\x1b[2J");
+            out_put(&o, prompt, plen);
+            out_flush(&o);
+            free(o.buf);
+            refresh(&l);
+            continue;
+        }
+        case 16: case K_UP:     /* ^P */
+        case 14: case K_DOWN:   /* ^N */
+            if (key == 16 || key == K_UP) {
+                if (hist == 0) continue;
+                if (hist == history_len) {
+                    free(typed);
+                    typed = strdup(l.buf);
+                }
+                hist--;
+            } else {
+                if (hist == history_len) continue;
+                hist++;
+            }
+            line_set(&l, hist == history_len ? (typed ? typed : "") : sh->history[hist]);
+            refresh(&l);
+            continue;
+        default:
+            if (key >= 32 && key < 256) {
+                char c = (char)key;
+                line_insert(&l, &c, 1);
+                refresh(&l);
+            }
+            continue;
+        }
+        break;
+    }
+
+    free(typed);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    if (write(STDOUT_FILENO, "\n", 1) < 0) { /* nothing to report */ }
+    if (eof) {
+        free(l.buf);
+        return NULL;
+    }
+    return l.buf;
+}
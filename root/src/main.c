@@ -4,6 +4,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <time.h>
 
 /* Helper: join argv into a single command line for history/job messages.
  * Caller must free returned string.
@@ -36,10 +37,42 @@ static char **tokenlist_to_argv(tokenlist *tokens) {
     return argv;
 }
 
+/* Expansion stage shared by simple commands and pipeline stages:
+ * strdup the words, then tilde, variable and pathname expansion in that order.
+ * Returns a heap argv (free with free_argv) or NULL on allocation failure.
+ */
+char **expand_argv(char **words, int count) {
+    char **out = calloc(count + 1, sizeof(char*));
+    if (!out) return NULL;
+    for (int i = 0; i < count; ++i) {
+        out[i] = strdup(words[i]);
+        if (!out[i]) { free_argv(out); return NULL; }
+    }
+    out[count] = NULL;
+
+    /* Tilde expansion */
+    for (int i = 0; out[i]; ++i) {
+        char *expanded = expand_tilde(out[i]);
+        if (expanded && expanded != out[i]) { /* expand_tilde returns strdup when expanded */
+            free(out[i]);
+            out[i] = expanded;
+        }
+    }
+
+    /* Environment variable expansion (in-place helper) */
+    expand_env_vars_inplace(out);
+
+    /* Pathname expansion */
+    glob_expand_argv(&out);
+    return out;
+}
+
 /* Process one command (tokenized). Handles tilde/env expansion, builtins,
- * background marker &, pipelines and external execution.
+ * background marker &, pipelines and external execution. stats asks
+ * execute_pipeline() for a per-link report, timeout (seconds) for a
+ * deadline on the whole pipeline.
  */
-static void process_command(tokenlist *tokens) {
+static void run_command(tokenlist *tokens, int stats, double timeout) {
     if (!tokens || tokens->size == 0) return;
 
     /* quick detect pipeline */
@@ -48,8 +81,9 @@ static void process_command(tokenlist *tokens) {
         if (strcmp(tokens->items[i], "|") == 0) pipe_count++;
     }
 
-    /* If pipeline present, build cmds and call execute_pipeline */
-    if (pipe_count > 0) {
+    /* If pipeline present, build cmds and call execute_pipeline; a deadline
+     * is only kept there, so a single command with one goes that way too */
+    if (pipe_count > 0 || timeout > 0) {
         int num_cmds = pipe_count + 1;
         char ***cmds = calloc(num_cmds, sizeof(char**));
         if (!cmds) return;
@@ -59,20 +93,27 @@ static void process_command(tokenlist *tokens) {
         for (size_t i = 0; i <= tokens->size; ++i) {
             if (i == tokens->size || strcmp(tokens->items[i], "|") == 0) {
                 size_t count = i - start;
-                cmds[cmd_index] = calloc(count + 1, sizeof(char*));
-                if (!cmds[cmd_index]) { /* cleanup on failure */ 
-                    for (int k = 0; k < cmd_index; ++k) free(cmds[k]);
+                cmds[cmd_index] = expand_argv(tokens->items + start, (int)count);
+                if (cmds[cmd_index] && prepare_heredocs(&cmds[cmd_index]) != 0) {
+                    free_argv(cmds[cmd_index]);
+                    cmds[cmd_index] = NULL;
+                }
+                if (!cmds[cmd_index]) {
+                    close_heredocs();
+                    for (int k = 0; k < cmd_index; ++k) free_argv(cmds[k]);
                     free(cmds);
                     return;
                 }
-                for (size_t j = 0; j < count; ++j) cmds[cmd_index][j] = tokens->items[start + j];
-                cmds[cmd_index][count] = NULL;
                 cmd_index++;
                 start = i + 1;
             }
         }
-        execute_pipeline(cmds, num_cmds);
-        for (int i = 0; i < num_cmds; ++i) free(cmds[i]);
+        /* set -o pipeopt: "cat f | cmd" and the like lose a stage (pipe_plan.c) */
+        int nstages = num_cmds;
+        pipe_rewrite(cmds, &nstages);
+        execute_pipeline(cmds, nstages, stats, timeout);
+        close_heredocs();
+        for (int i = 0; i < num_cmds; ++i) free_argv(cmds[i]);
         free(cmds);
         return;
     }
@@ -91,102 +132,269 @@ static void process_command(tokenlist *tokens) {
         argc--;
     }
 
-    /* Create dup_argv with strdup for safe modification/freeing */
-    char **dup_argv = calloc(argc + 1, sizeof(char*));
-    if (!dup_argv) { free(argv); return; }
-    for (int i = 0; i < argc; ++i) dup_argv[i] = strdup(argv[i]);
-    dup_argv[argc] = NULL;
-
-    /* Tilde expansion */
-    for (int i = 0; dup_argv[i]; ++i) {
-        char *expanded = expand_tilde(dup_argv[i]);
-        if (expanded != dup_argv[i]) { /* expand_tilde returns strdup when expanded */
-            free(dup_argv[i]);
-            dup_argv[i] = expanded;
+    /* NAME=value words with no command: set shell variables */
+    int assignments = 0;
+    while (assignments < argc && var_assignment_len(argv[assignments])) assignments++;
+    if (assignments > 0 && assignments == argc) {
+        sh->last_exit_status = 0;
+        for (int i = 0; i < argc; ++i) {
+            char *value = expand_word(argv[i]);
+            if (!value || var_assign(value) != 0) sh->last_exit_status = 1;
+            if (value && value != argv[i]) free(value);
         }
+        char *cmdline = join_argv(argv);
+        if (cmdline) { add_to_history(cmdline); free(cmdline); }
+        free(argv);
+        return;
     }
 
-    /* Environment variable expansion (in-place helper) */
-    expand_env_vars_inplace(dup_argv);
+    /* Create dup_argv with strdup for safe modification/freeing, expanded */
+    char **dup_argv = expand_argv(argv, argc);
+    if (!dup_argv) { free(argv); return; }
+    if (!dup_argv[0]) { free_argv(dup_argv); free(argv); return; }
+    if (prepare_heredocs(&dup_argv) != 0) {
+        close_heredocs();
+        sh->last_exit_status = 1;
+        free_argv(dup_argv);
+        free(argv);
+        return;
+    }
 
-    /* Builtins */
-    if (strcmp(dup_argv[0], "exit") == 0) {
+    /* Builtins run in-process; see builtins.c */
+    const builtin_t *builtin = builtin_find(dup_argv);
+    if (builtin && background && strcmp(dup_argv[0], "timeout") == 0) {
+        /* "timeout D cmd &": a background job with a deadline */
         char *cmdline = join_argv(dup_argv);
         if (cmdline) add_to_history(cmdline);
-        part_eight_shutdown();
-        builtin_exit();
-    } else if (strcmp(dup_argv[0], "cd") == 0) {
-        if (builtin_cd(dup_argv)) {
-            char *cmdline = join_argv(dup_argv);
-            if (cmdline) { add_to_history(cmdline); free(cmdline); }
+        sh->last_exit_status = timeout_start_job(dup_argv, cmdline ? cmdline : "timeout");
+        free(cmdline);
+    } else if (builtin && background && !(builtin->flags & BUILTIN_SPECIAL)) {
+        /* "wc -l f &": forked and tracked like an external command */
+        char *cmdline = join_argv(dup_argv);
+        pid_t child = run_builtin_background(builtin, dup_argv);
+        if (child > 0) {
+            sh->last_exit_status = 0;
+            if (cmdline) part_eight_add_job(cmdline, &child, 1, child);
         }
-    } else if (strcmp(dup_argv[0], "jobs") == 0) {
+        add_to_history(cmdline ? cmdline : dup_argv[0]);
+        free(cmdline);
+    } else if (builtin) {
         char *cmdline = join_argv(dup_argv);
-        if (cmdline) { add_to_history(cmdline); free(cmdline); }
-        part_eight_jobs_builtin();
+        if (cmdline && !(builtin->flags & BUILTIN_HISTORY_IF_OK)) add_to_history(cmdline);
+        sh->last_exit_status = run_builtin(builtin, dup_argv, sh->fd_out);
+        if (cmdline && (builtin->flags & BUILTIN_HISTORY_IF_OK) && sh->last_exit_status == 0)
+            add_to_history(cmdline);
+        free(cmdline);
     } else {
-        /* External command: find executable and run using exec_external's API */
+        /* External command: find executable and run using exec_external's API.
+         * The command line is taken first: execute_command() strips the
+         * redirections from dup_argv. */
         char *fullpath = find_executable(dup_argv[0]);
+        char *cmdline = join_argv(dup_argv);
         pid_t child = execute_command(dup_argv, fullpath, background);
         if (child > 0 && background) {
             /* register background job with job bookkeeping */
             pid_t p = child;
-            char *cmdline = join_argv(dup_argv);
-            if (cmdline) {
-                part_eight_add_job(cmdline, &p, 1, p);
-                add_to_history(cmdline);
-                free(cmdline);
-            } else {
-                add_to_history(dup_argv[0]);
-            }
-        } else if (child > 0 && !background) {
-            char *cmdline = join_argv(dup_argv);
-            if (cmdline) { add_to_history(cmdline); free(cmdline); }
-        } else {
-            /* execution error */
-            char *cmdline = join_argv(dup_argv);
-            if (cmdline) { add_to_history(cmdline); free(cmdline); }
+            if (cmdline) part_eight_add_job(cmdline, &p, 1, p);
         }
+        add_to_history(cmdline ? cmdline : dup_argv[0]);
+        free(cmdline);
         if (fullpath) free(fullpath);
     }
 
     /* cleanup */
+    close_heredocs();
     for (int i = 0; dup_argv[i]; ++i) free(dup_argv[i]);
     free(dup_argv);
     free(argv);
 }
 
-int main(void) {
+/* "pipeline [--stats] a | b ..." asks for per-link throughput on this one
+ * pipeline; "set -o pipestats" turns it on for all of them.
+ * "pipeline --timeout D a | b ..." gives the whole pipeline a deadline
+ * ("timeout D a | b" only limits a).
+ */
+void process_command(tokenlist *tokens) {
+    if (strcmp(tokens->items[0], "pipeline") != 0) {
+        run_command(tokens, pipe_stats_enabled(), 0);
+        return;
+    }
+    size_t skip = 1;
+    int stats = pipe_stats_enabled();
+    double timeout = 0;
+    for (;;) {
+        if (skip < tokens->size && strcmp(tokens->items[skip], "--stats") == 0) {
+            stats = 1;
+            skip++;
+        } else if (skip + 1 < tokens->size && strcmp(tokens->items[skip], "--timeout") == 0) {
+            timeout = parse_duration(tokens->items[skip + 1]);
+            if (timeout < 0) {
+                dprintf(sh->fd_err, "pipeline: %s: invalid duration\n", tokens->items[skip + 1]);
+                sh->last_exit_status = 2;
+                return;
+            }
+            skip += 2;
+        } else {
+            break;
+        }
+    }
+    if (skip == tokens->size) {
+        dprintf(sh->fd_err, "pipeline: usage: pipeline [--stats] [--timeout D] cmd [| cmd]...\n");
+        sh->last_exit_status = 2;
+        return;
+    }
+    tokenlist rest = { tokens->items + skip, tokens->size - skip };
+    run_command(&rest, stats, timeout);
+}
+
+/* Trim, tokenize, then process_command(), or script_run() for ';' lists
+ * and for/while/if. more_ok: an unfinished construct may continue on the
+ * next line.
+ */
+static int run_line(char *input, int more_ok) {
+    /* trim leading/trailing whitespace/newline */
+    size_t len = strlen(input);
+    while (len > 0 && isspace((unsigned char)input[len-1])) input[--len] = '\0';
+    char *start = input;
+    while (*start && isspace((unsigned char)*start)) start++;
+    if (*start == '\0') return sh->last_exit_status;
+
+    tokenlist *tokens = get_tokens(start);
+    if (!tokens || tokens->size == 0) {
+        if (tokens) free_tokens(tokens);
+        return sh->last_exit_status;
+    }
+    if (script_needed(tokens)) script_run(tokens, more_ok);
+    else process_command(tokens);
+    free_tokens(tokens);
+    return sh->last_exit_status;
+}
+
+/* Run one complete line of input the way the interactive loop does. Used
+ * by server-mode workers (serve.c) and command substitution. Returns the
+ * resulting $?.
+ */
+int shell_run_line(char *input) {
+    return run_line(input, 0);
+}
+
+/* A line typed at the prompt: may open a for/while/if that later lines
+ * close (script_pending()).
+ */
+int shell_feed_line(char *input) {
+    return run_line(input, 1);
+}
+
+/* The library build (make lib) has no main(); libshell.c is its entry */
+#ifndef LIBSHELL
+
+static void usage(void) {
+    fprintf(stderr, "usage: shell [--events FILE | --events-fd N] [--serve SOCKET [--workers N]]\n"
+                    "             [--norc] [--no-snapshot] [--startup-profile]\n");
+}
+
+/* --startup-profile: time from main() to the first prompt, by phase */
+#define MAX_PHASES 8
+
+static struct {
+    int on;
+    struct timespec start, mark;
+    const char *name[MAX_PHASES];
+    long long ns[MAX_PHASES];
+    int n;
+} profile;
+
+static long long ns_between(const struct timespec *a, const struct timespec *b) {
+    return (long long)(b->tv_sec - a->tv_sec) * 1000000000LL + (b->tv_nsec - a->tv_nsec);
+}
+
+static void phase_done(const char *name) {
+    if (!profile.on || profile.n == MAX_PHASES) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    profile.name[profile.n] = name;
+    profile.ns[profile.n++] = ns_between(&profile.mark, &now);
+    profile.mark = now;
+}
+
+static void profile_report(void) {
+    if (!profile.on) return;
+    fprintf(stderr, "startup: %.3f ms from main() to the first prompt\n",
+            (double)ns_between(&profile.start, &profile.mark) / 1e6);
+    for (int i = 0; i < profile.n; ++i)
+        fprintf(stderr, "  %-12s %8.3f ms\n", profile.name[i], (double)profile.ns[i] / 1e6);
+    fprintf(stderr, "  rc: %s\n", rc_report());
+}
+
+int main(int argc, char **argv) {
+    clock_gettime(CLOCK_MONOTONIC, &profile.start);
+    profile.mark = profile.start;
+    const char *serve_path = NULL;
+    int workers = 0;
+    int use_rc = 1, use_snapshot = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            if (job_events_open(argv[++i]) != 0) return 2;
+        } else if (strcmp(argv[i], "--events-fd") == 0 && i + 1 < argc) {
+            if (job_events_set_fd(atoi(argv[++i])) != 0) return 2;
+        } else if (strcmp(argv[i], "--norc") == 0) {
+            use_rc = 0;
+        } else if (strcmp(argv[i], "--no-snapshot") == 0) {
+            use_snapshot = 0;
+        } else if (strcmp(argv[i], "--startup-profile") == 0) {
+            profile.on = 1;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+
+    phase_done("arguments");
+    vars_init();
+    phase_done("environment");
     part_eight_init();
+    phase_done("job table");
+    /* ~/.shellrc, or its snapshot (rc_snapshot.c) */
+    if (use_rc) rc_startup(use_snapshot);
+    phase_done("rc file");
+    prompt_init();
+    phase_done("prompt");
+    profile_report();
+
+    if (serve_path) return serve_main(serve_path, workers);
 
     while (1) {
-        print_prompt();
+        if (script_pending()) {
+            print_continuation_prompt();
+        } else {
+            print_prompt();
+        }
 
         char *input = get_input();
-        if (!input) break;
-
-        /* trim leading/trailing whitespace/newline */
-        size_t len = strlen(input);
-        while (len > 0 && isspace((unsigned char)input[len-1])) input[--len] = '\0';
-        char *start = input;
-        while (*start && isspace((unsigned char)*start)) start++;
-
-        if (*start == '\0') { free(input); part_eight_check_jobs(); continue; }
-
-        tokenlist *tokens = get_tokens(start);
-        if (!tokens || tokens->size == 0) {
-            free(input);
-            if (tokens) free_tokens(tokens);
-            part_eight_check_jobs();
-            continue;
+        if (!input) {
+            script_discard();
+            break;
         }
 
-        process_command(tokens);
-
-        free_tokens(tokens);
+        /* only pay for the clock reads when the prompt shows \T */
+        if (prompt_wants_timing()) {
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            shell_feed_line(input);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            prompt_note_elapsed((t1.tv_sec - t0.tv_sec) * 1000L +
+                                (t1.tv_nsec - t0.tv_nsec) / 1000000L);
+        } else {
+            shell_feed_line(input);
+        }
         free(input);
 
         /* periodically reap background jobs */
+        part_eight_enforce_deadlines();
         part_eight_check_jobs();
     }
 
@@ -194,3 +402,4 @@ int main(void) {
     return 0;
 }
 
+#endif // LIBSHELL
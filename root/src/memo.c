@@ -0,0 +1,608 @@
+//******************************************************************************************************
+//* Name:        memo.c                                                                                *
+//* Description: "memo [options] cmd [args...]": run cmd once, replay its result afterwards.           *
+//*              Options: --inputs F1,F2,... (files cmd reads), --env N1,N2,... (variables             *
+//*              it depends on), --content (hash input contents instead of stat data),                 *
+//*              --stats, --clear.                                                                     *
+//*              - The key covers argv, the working directory, the named variables, the                *
+//*                inode/size/mtime (or contents) of every input, and the executable                   *
+//*                find_executable() resolves (path, inode, size, mtime).                              *
+//*              - On a hit the stored stdout, stderr and exit status are replayed and                 *
+//*                nothing is spawned. On a miss cmd runs with its output passed through               *
+//*                and recorded; results of commands killed by a signal are not kept.                  *
+//*              - Entries live in $MEMO_DIR (default $XDG_CACHE_HOME/shell-memo or                    *
+//*                ~/.cache/shell-memo), one file per key named by its hash; the full key              *
+//*                is stored in the entry and compared, so a hash collision is a miss.                 *
+//*              - $MEMO_MAX (bytes, k/m/g suffix, default 64m) bounds the cache: when a               *
+//*                store goes over it, the least recently used entries are removed until               *
+//*                it is at 3/4 of the limit. Hit/miss counters are kept in <dir>/stats.               *
+//*              stdin is not part of the key.                                                         *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+#define MEMO_MAGIC "shmemo01"
+#define MEMO_DEFAULT_MAX (64LL << 20)
+#define MEMO_STATS "stats"
+
+typedef struct {
+    char magic[8];
+    uint32_t key_len;
+    int32_t status;
+    uint64_t out_len, err_len;
+} memo_header;
+
+typedef struct {
+    uint64_t hits, misses, stores, evictions;
+    uint64_t bytes;             /* entry bytes, exact after each eviction scan */
+} memo_stats;
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int failed;
+} mbuf;
+
+typedef struct {
+    char *inputs;
+    char *env;
+    int content;
+    int stats;
+    int clear;
+    int cmd;                    /* index of cmd in argv */
+} memo_opts;
+
+static void mb_put(mbuf *b, const void *p, size_t n) {
+    if (b->failed) return;
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 1024;
+        while (cap < b->len + n) cap *= 2;
+        char *nb = realloc(b->buf, cap);
+        if (!nb) {
+            b->failed = 1;
+            return;
+        }
+        b->buf = nb;
+        b->cap = cap;
+    }
+    memcpy(b->buf + b->len, p, n);
+    b->len += n;
+}
+
+/* s with its NUL, so neighbouring fields can't run together */
+static void mb_str(mbuf *b, const char *s) {
+    mb_put(b, s, strlen(s) + 1);
+}
+
+static void mb_stat(mbuf *b, const struct stat *st) {
+    char num[128];
+    snprintf(num, sizeof(num), "%llu:%llu:%lld:%lld.%09ld", (unsigned long long)st->st_dev,
+             (unsigned long long)st->st_ino, (long long)st->st_size,
+             (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+    mb_str(b, num);
+}
+
+static uint64_t fnv(const void *p, size_t n) {
+    const unsigned char *s = p;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* ---------------- cache directory ---------------- */
+
+static long long memo_max(void) {
+    const char *v = var_get("MEMO_MAX");
+    if (!v || !*v) return MEMO_DEFAULT_MAX;
+    char *end;
+    long long n = strtoll(v, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    }
+    return (*end || n <= 0) ? MEMO_DEFAULT_MAX : n;
+}
+
+/* The cache directory, created if needed; malloc'd, or NULL. */
+static char *memo_dir(void) {
+    const char *v = var_get("MEMO_DIR");
+    char *dir = NULL;
+    if (v && *v) {
+        dir = strdup(v);
+    } else if ((v = var_get("XDG_CACHE_HOME")) && *v) {
+        if (asprintf(&dir, "%s/shell-memo", v) < 0) dir = NULL;
+    } else if ((v = var_get("HOME")) && *v) {
+        if (asprintf(&dir, "%s/.cache/shell-memo", v) < 0) dir = NULL;
+    }
+    if (!dir) return NULL;
+    /* mkdir -p */
+    for (char *p = dir + 1; ; ++p) {
+        if (*p != '/' && *p != '\0') continue;
+        char c = *p;
+        *p = '\0';
+        int r = mkdirat(sh->dir_fd, dir, 0700);
+        *p = c;
+        if (r != 0 && errno != EEXIST) {
+            free(dir);
+            return NULL;
+        }
+        if (!c) break;
+    }
+    return dir;
+}
+
+/* Apply fn to the counters under an exclusive lock. */
+static void with_stats(int dfd, void (*fn)(memo_stats *, int dfd, void *), void *arg) {
+    int fd = openat(dfd, MEMO_STATS, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    memo_stats st = { 0 };
+    if (flock(fd, LOCK_EX) == 0) {
+        if (pread(fd, &st, sizeof(st), 0) != (ssize_t)sizeof(st)) memset(&st, 0, sizeof(st));
+        fn(&st, dfd, arg);
+        if (pwrite(fd, &st, sizeof(st), 0) != (ssize_t)sizeof(st)) { /* counters only */ }
+    }
+    close(fd);
+}
+
+static void count_hit(memo_stats *st, int dfd, void *arg) {
+    (void)dfd;
+    (void)arg;
+    st->hits++;
+}
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    off_t size;
+    struct timespec used;
+} memo_entry;
+
+static int cmp_used(const void *a, const void *b) {
+    const memo_entry *x = a, *y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Remove the least recently used entries (mtime, refreshed on every hit)
+ * until the cache is at keep bytes; recounts st->bytes on the way. */
+static void evict(memo_stats *st, int dfd, long long keep) {
+    int fd = openat(dfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dp = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dp) {
+        if (fd >= 0) close(fd);
+        return;
+    }
+    memo_entry *v = NULL;
+    size_t n = 0, cap = 0;
+    uint64_t total = 0;
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+        struct stat sb;
+        if (de->d_name[0] == '.' || strcmp(de->d_name, MEMO_STATS) == 0) continue;
+        if (fstatat(dfd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(sb.st_mode)) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 256;
+            memo_entry *nv = realloc(v, cap * sizeof(*v));
+            if (!nv) break;
+            v = nv;
+        }
+        snprintf(v[n].name, sizeof(v[n].name), "%s", de->d_name);
+        v[n].size = sb.st_size;
+        v[n].used = sb.st_mtim;
+        total += (uint64_t)sb.st_size;
+        n++;
+    }
+    closedir(dp);
+    qsort(v, n, sizeof(*v), cmp_used);
+    for (size_t i = 0; i < n && total > (uint64_t)keep; ++i) {
+        if (unlinkat(dfd, v[i].name, 0) != 0) continue;
+        total -= (uint64_t)v[i].size;
+        st->evictions++;
+    }
+    st->bytes = total;
+    free(v);
+}
+
+typedef struct {
+    uint64_t size;
+    long long max;
+} store_note;
+
+static void count_store(memo_stats *st, int dfd, void *arg) {
+    store_note *s = arg;
+    st->misses++;
+    if (s->size) {
+        st->stores++;
+        st->bytes += s->size;
+    }
+    if (st->bytes > (uint64_t)s->max) evict(st, dfd, s->max / 4 * 3);
+}
+
+static void clear_all(memo_stats *st, int dfd, void *arg) {
+    (void)arg;
+    evict(st, dfd, 0);
+    memset(st, 0, sizeof(*st));
+}
+
+/* ---------------- key ---------------- */
+
+/* Hash a file's contents into the key. */
+static int put_content(mbuf *key, const char *path) {
+    int fd = openat(sh->dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char buf[65536];
+    uint64_t h = 1469598103934665603ULL, size = 0;
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) != 0) {
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        /* FNV-1a over 8-byte words; the tail byte by byte */
+        ssize_t i = 0;
+        for (; i + 8 <= r; i += 8) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            h = (h ^ w) * 1099511628211ULL;
+        }
+        for (; i < r; ++i)
+            h = (h ^ (unsigned char)buf[i]) * 1099511628211ULL;
+        size += (uint64_t)r;
+    }
+    close(fd);
+    char num[64];
+    snprintf(num, sizeof(num), "%llu:%016llx", (unsigned long long)size, (unsigned long long)h);
+    mb_str(key, num);
+    return 0;
+}
+
+static int build_key(mbuf *key, char **cmd, const memo_opts *o, int errfd) {
+    char cwd[4096];
+    mb_str(key, "cwd");
+    mb_str(key, shell_getcwd(cwd, sizeof(cwd)) ? cwd : "?");
+
+    mb_str(key, "argv");
+    for (int i = 0; cmd[i]; ++i) mb_str(key, cmd[i]);
+
+    const builtin_t *b = builtin_find(cmd);
+    if (b) {
+        mb_str(key, "builtin");
+        mb_str(key, b->name);
+    } else {
+        struct stat st;
+        char *exe = find_executable(cmd[0]);
+        if (!exe || fstatat(sh->dir_fd, exe, &st, 0) != 0) {
+            dprintf(errfd, "memo: %s: command not found\n", cmd[0]);
+            free(exe);
+            return -1;
+        }
+        mb_str(key, "exe");
+        mb_str(key, exe);
+        mb_stat(key, &st);
+        free(exe);
+    }
+
+    char *save = NULL;
+    char *names = o->env ? strdup(o->env) : NULL;
+    for (char *n = names ? strtok_r(names, ",", &save) : NULL; n; n = strtok_r(NULL, ",", &save)) {
+        const char *v = var_get(n);
+        mb_str(key, v ? "env" : "unset");
+        mb_str(key, n);
+        if (v) mb_str(key, v);
+    }
+    free(names);
+
+    char *files = o->inputs ? strdup(o->inputs) : NULL;
+    int rc = 0;
+    for (char *f = files ? strtok_r(files, ",", &save) : NULL; f; f = strtok_r(NULL, ",", &save)) {
+        struct stat st;
+        mb_str(key, "input");
+        mb_str(key, f);
+        if (fstatat(sh->dir_fd, f, &st, 0) != 0 || (o->content && put_content(key, f) != 0)) {
+            dprintf(errfd, "memo: %s: %s\n", f, strerror(errno));
+            rc = -1;
+            break;
+        }
+        if (!o->content) mb_stat(key, &st);
+    }
+    free(files);
+    if (key->failed) {
+        dprintf(errfd, "memo: out of memory\n");
+        return -1;
+    }
+    return rc;
+}
+
+/* ---------------- hit ---------------- */
+
+static int read_full(int fd, void *p, size_t n) {
+    char *c = p;
+    while (n) {
+        ssize_t r = read(fd, c, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        c += r;
+        n -= (size_t)r;
+    }
+    return 0;
+}
+
+/* Replay the entry for key if there is one. Returns 1 and sets *status on
+ * a hit, 0 on a miss. */
+static int replay(int dfd, const char *name, const mbuf *key, builtin_io *io, int *status) {
+    int fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    memo_header h;
+    struct stat st;
+    char *data = NULL;
+    int hit = 0;
+    if (fstat(fd, &st) == 0 && read_full(fd, &h, sizeof(h)) == 0 &&
+        memcmp(h.magic, MEMO_MAGIC, 8) == 0 && h.key_len == key->len &&
+        (uint64_t)st.st_size == sizeof(h) + h.key_len + h.out_len + h.err_len &&
+        (data = malloc((size_t)st.st_size - sizeof(h) + 1)) &&
+        read_full(fd, data, (size_t)st.st_size - sizeof(h)) == 0 &&
+        memcmp(data, key->buf, key->len) == 0) {
+        hit = 1;
+        /* the mtime is the entry's last use, for eviction */
+        futimens(fd, NULL);
+        const char *out = data + h.key_len;
+        if (h.out_len) bio_write(io, out, (size_t)h.out_len);
+        if (h.err_len) write_all(io->err, out + h.out_len, (size_t)h.err_len);
+        *status = h.status;
+    }
+    free(data);
+    close(fd);
+    return hit;
+}
+
+/* ---------------- miss ---------------- */
+
+/* Run cmd with stdout and stderr through pipes, passing them on to io as
+ * they arrive and keeping a copy of each (until it would exceed max). */
+static int run_recorded(char **cmd, builtin_io *io, mbuf *out, mbuf *err, long long max, int *wstatus) {
+    int po[2], pe[2];
+    if (pipe2(po, O_CLOEXEC) != 0) return -1;
+    if (pipe2(pe, O_CLOEXEC) != 0) {
+        close(po[0]);
+        close(po[1]);
+        return -1;
+    }
+    fflush(stdout);
+    char **envp = var_envp();
+    pid_t pid = fork();
+    if (pid == 0) {
+        shell_child_setup();
+        int fds[3] = { io->in, po[1], pe[1] };
+        for (int n = 0; n < 3; ++n)
+            if (fds[n] != n) dup2(fds[n], n);
+        const builtin_t *builtin = builtin_find(cmd);
+        if (builtin) {
+            builtin_io cio = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+            int status = builtin->fn(cmd, &cio);
+            fflush(stdout);
+            _exit(status);
+        }
+        execute_search(cmd[0], cmd, envp);
+        _exit(127);
+    }
+    close(po[1]);
+    close(pe[1]);
+    if (pid < 0) {
+        close(po[0]);
+        close(pe[0]);
+        return -1;
+    }
+
+    struct pollfd p[2] = { { po[0], POLLIN, 0 }, { pe[0], POLLIN, 0 } };
+    mbuf *keep[2] = { out, err };
+    char buf[65536];
+    int open_fds = 2;
+    while (open_fds) {
+        if (poll(p, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (p[i].fd < 0 || !p[i].revents) continue;
+            ssize_t r = read(p[i].fd, buf, sizeof(buf));
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) {
+                close(p[i].fd);
+                p[i].fd = -1;
+                open_fds--;
+                continue;
+            }
+            if (i == 0) bio_write(io, buf, (size_t)r);
+            else write_all(io->err, buf, (size_t)r);
+            if ((long long)(out->len + err->len) + r <= max) mb_put(keep[i], buf, (size_t)r);
+            else keep[i]->failed = 1;
+        }
+    }
+    for (int i = 0; i < 2; ++i)
+        if (p[i].fd >= 0) close(p[i].fd);
+    if (part_eight_wait_pid(pid, wstatus) == -1) return -1;
+    return 0;
+}
+
+/* Write the entry through a temporary file and rename it into place.
+ * Returns its size, 0 if nothing was stored. */
+static uint64_t store(int dfd, const char *name, const mbuf *key, const mbuf *out,
+                      const mbuf *err, int status) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), ".tmp-%s-%ld", name, (long)getpid());
+    int fd = openat(dfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return 0;
+    memo_header h;
+    memcpy(h.magic, MEMO_MAGIC, 8);
+    h.key_len = (uint32_t)key->len;
+    h.status = status;
+    h.out_len = out->len;
+    h.err_len = err->len;
+    int ok = write_all(fd, (const char *)&h, sizeof(h)) == 0 &&
+             write_all(fd, key->buf, key->len) == 0 &&
+             write_all(fd, out->buf ? out->buf : "", out->len) == 0 &&
+             write_all(fd, err->buf ? err->buf : "", err->len) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || renameat(dfd, tmp, dfd, name) != 0) {
+        unlinkat(dfd, tmp, 0);
+        return 0;
+    }
+    return sizeof(h) + key->len + out->len + err->len;
+}
+
+/* ---------------- builtin ---------------- */
+
+static int parse_opts(char **argv, memo_opts *o, int errfd) {
+    memset(o, 0, sizeof(*o));
+    int i = 1;
+    for (; argv[i] && strncmp(argv[i], "--", 2) == 0; ++i) {
+        const char *a = argv[i];
+        if (strcmp(a, "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(a, "--inputs") == 0 || strcmp(a, "--env") == 0) {
+            if (!argv[i + 1]) {
+                dprintf(errfd, "memo: %s needs an argument\n", a);
+                return -1;
+            }
+            *(a[2] == 'i' ? &o->inputs : &o->env) = argv[++i];
+        } else if (strncmp(a, "--inputs=", 9) == 0) {
+            o->inputs = (char *)a + 9;
+        } else if (strncmp(a, "--env=", 6) == 0) {
+            o->env = (char *)a + 6;
+        } else if (strcmp(a, "--content") == 0) {
+            o->content = 1;
+        } else if (strcmp(a, "--stats") == 0) {
+            o->stats = 1;
+        } else if (strcmp(a, "--clear") == 0) {
+            o->clear = 1;
+        } else {
+            dprintf(errfd, "memo: %s: unknown option\n", a);
+            return -1;
+        }
+    }
+    o->cmd = i;
+    if (!argv[i] && !o->stats && !o->clear) {
+        dprintf(errfd, "memo: usage: memo [--inputs F,...] [--env N,...] [--content] cmd [args...]\n"
+                       "       memo --stats | --clear\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void read_stats(memo_stats *st, int dfd, void *arg) {
+    (void)dfd;
+    *(memo_stats *)arg = *st;
+}
+
+static int print_stats(const char *dir, int dfd, builtin_io *io) {
+    memo_stats st = { 0 };
+    with_stats(dfd, read_stats, &st);
+    uint64_t lookups = st.hits + st.misses;
+    char buf[1024];
+    int n = snprintf(buf, sizeof(buf),
+                     "cache    %s\n"
+                     "hits     %llu\n"
+                     "misses   %llu\n"
+                     "hit rate %.1f%%\n"
+                     "stored   %llu\n"
+                     "evicted  %llu\n"
+                     "size     %llu of %lld bytes\n",
+                     dir, (unsigned long long)st.hits, (unsigned long long)st.misses,
+                     lookups ? 100.0 * (double)st.hits / (double)lookups : 0.0,
+                     (unsigned long long)st.stores, (unsigned long long)st.evictions,
+                     (unsigned long long)st.bytes, memo_max());
+    return bio_write(io, buf, (size_t)n) == 0 ? 0 : 1;
+}
+
+int builtin_memo(char **argv, builtin_io *io) {
+    memo_opts o;
+    if (parse_opts(argv, &o, io->err) != 0) return 2;
+
+    char *dir = memo_dir();
+    int dfd = dir ? openat(sh->dir_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (dfd < 0) {
+        dprintf(io->err, "memo: no usable cache directory (set MEMO_DIR)\n");
+        free(dir);
+        return 1;
+    }
+    if (o.clear) with_stats(dfd, clear_all, NULL);
+    if (o.stats || o.clear) {
+        int rc = o.stats ? print_stats(dir, dfd, io) : 0;
+        close(dfd);
+        free(dir);
+        return rc;
+    }
+    free(dir);
+
+    char **cmd = argv + o.cmd;
+    mbuf key = { 0 };
+    if (build_key(&key, cmd, &o, io->err) != 0) {
+        free(key.buf);
+        close(dfd);
+        return 127;
+    }
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)fnv(key.buf, key.len));
+
+    int status = 0;
+    if (replay(dfd, name, &key, io, &status)) {
+        with_stats(dfd, count_hit, NULL);
+        free(key.buf);
+        close(dfd);
+        return status;
+    }
+
+    long long max = memo_max();
+    mbuf out = { 0 }, err = { 0 };
+    int wstatus = 0;
+    if (run_recorded(cmd, io, &out, &err, max - (long long)(sizeof(memo_header) + key.len),
+                     &wstatus) != 0) {
+        dprintf(io->err, "memo: %s: %s\n", cmd[0], strerror(errno));
+        status = 1;
+    } else {
+        store_note note = { 0, max };
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+        if (WIFEXITED(wstatus) && !out.failed && !err.failed)
+            note.size = store(dfd, name, &key, &out, &err, status);
+        with_stats(dfd, count_store, &note);
+    }
+    free(out.buf);
+    free(err.buf);
+    free(key.buf);
+    close(dfd);
+    return status;
+}
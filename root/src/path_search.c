@@ -6,13 +6,23 @@
 
 #define MAX_PATH_LEN 1024
 
-void execute_search(char *command, char **argv)
+extern char **environ;
+
+void execute_search(char *command, char **argv, char **envp)
 {
-    char *path_env = getenv("PATH");
+    const char *path_env = var_get("PATH");
     char *path_copy;
     char *dir;
     char full_path[MAX_PATH_LEN];
 
+    if (strchr(command, '/') != NULL) 
+    {
+        environ = envp;
+        execv(command, argv);
+        perror(command);
+        return;
+    }
+
     if (path_env == NULL) 
     {
         fprintf(stderr, "PATH not set\n");
@@ -33,6 +43,7 @@ void execute_search(char *command, char **argv)
 
         if (access(full_path, X_OK) == 0) 
         {
+            environ = envp;
             execv(full_path, argv);
             perror("execv");
             free(path_copy);
@@ -0,0 +1,261 @@
+//******************************************************************************************************
+//* Name:        pipe_plan.c                                                                           *
+//* Description: Planning pass over a parsed pipeline before execute_pipeline() runs it.               *
+//*              With "set -o pipeopt" (off by default) stages that only copy data are                 *
+//*              rewritten away, each saving a process and a trip of the stream through a              *
+//*              pipe:                                                                                 *
+//*                cat FILE | cmd ...         ->  cmd ... < FILE    (first stage, regular file)        *
+//*                a | cat | b                ->  a | b             (argument-less cat in between)     *
+//*                head -n A | head -n B      ->  head -n min(A,B)  (tail likewise)                    *
+//*                sort OPTS | sort OPTS      ->  sort OPTS         (uniq without options likewise)    *
+//*              Only stages made of plain words are touched: a stage with redirections,               *
+//*              or a cmd with its own "<", is left alone, and a trailing cat is kept                  *
+//*              since it is how "cmd | cat" hides the terminal from cmd.                              *
+//*              "set -o explain" prints to stderr what will run: the rewrites made and,               *
+//*              for every stage, whether it is a builtin thread, a forked builtin or a                *
+//*              program, and which links are rings instead of pipes.                                  *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define NOTES_MAX 1024
+
+/* Rewrites made by the last pipe_rewrite(), for pipe_explain() */
+static char notes[NOTES_MAX];
+static size_t notes_len;
+
+int pipe_rewrite_enabled(void) {
+    return sh->pipe_rewrite_on;
+}
+
+void pipe_rewrite_set(int on) {
+    sh->pipe_rewrite_on = on;
+}
+
+int pipe_explain_enabled(void) {
+    return sh->explain_on;
+}
+
+void pipe_explain_set(int on) {
+    sh->explain_on = on;
+}
+
+static void note(const char *fmt, const char *a, const char *b) {
+    if (!sh->explain_on || notes_len >= NOTES_MAX) return;
+    int n = snprintf(notes + notes_len, NOTES_MAX - notes_len, fmt, a, b);
+    if (n > 0) notes_len += (size_t)n;
+    if (notes_len > NOTES_MAX) notes_len = NOTES_MAX;
+}
+
+static int argc_of(char **argv) {
+    int n = 0;
+    while (argv[n]) n++;
+    return n;
+}
+
+/* Only words: no redirection, here-doc or "&" that the rewrite could lose */
+static int plain(char **argv) {
+    for (int i = 0; argv[i]; ++i) {
+        if (redirect_width(argv[i]) || argv[i][0] == '<' || argv[i][0] == '>' ||
+            strcmp(argv[i], "&") == 0) return 0;
+    }
+    return 1;
+}
+
+/* Does the stage take its stdin from a redirection of its own? */
+static int reads_redirect(char **argv) {
+    for (int i = 0; argv[i]; ++i) {
+        const char *t = argv[i];
+        if (t[0] == '0' && t[1] == '<') t++;
+        if (t[0] == '<' && (redirect_width(argv[i]) || t[1] == '<')) return 1;
+    }
+    return 0;
+}
+
+/* "head", "head -N", "head -nN", "head -n N" (tail likewise): the count */
+static int line_count(char **argv, const char *name, long *count) {
+    if (strcmp(argv[0], name) != 0) return 0;
+    const char *num = NULL;
+    int argc = argc_of(argv);
+    if (argc == 1) {
+        *count = 10;
+        return 1;
+    }
+    if (argc == 2 && strncmp(argv[1], "-n", 2) == 0) num = argv[1] + 2;
+    else if (argc == 2 && argv[1][0] == '-') num = argv[1] + 1;
+    else if (argc == 3 && strcmp(argv[1], "-n") == 0) num = argv[2];
+    if (!num || !*num) return 0;
+    char *end;
+    long n = strtol(num, &end, 10);
+    if (*end || n < 0 || num[0] < '0' || num[0] > '9') return 0;
+    *count = n;
+    return 1;
+}
+
+/* sort with options that make it idempotent: sorting its output again with
+ * the same options changes nothing */
+static int idempotent_sort(char **argv) {
+    if (strcmp(argv[0], "sort") != 0) return 0;
+    for (int i = 1; argv[i]; ++i) {
+        const char *a = argv[i];
+        if (a[0] != '-' || !a[1]) return 0;     /* a file operand */
+        if (strspn(a + 1, "bdfghinMrsuV") != strlen(a + 1)) return 0;
+    }
+    return 1;
+}
+
+static int same_argv(char **a, char **b) {
+    int i = 0;
+    for (; a[i] && b[i]; ++i)
+        if (strcmp(a[i], b[i]) != 0) return 0;
+    return !a[i] && !b[i];
+}
+
+static void drop_stage(char ***cmds, int *n, int i) {
+    free_argv(cmds[i]);
+    memmove(&cmds[i], &cmds[i + 1], (size_t)(*n - i - 1) * sizeof(char **));
+    cmds[--*n] = NULL;
+}
+
+/* Append words to a heap argv; 0, or -1 with argv unchanged */
+static int append_words(char ***argvp, const char *a, const char *b) {
+    int argc = argc_of(*argvp);
+    char **grown = realloc(*argvp, (size_t)(argc + 3) * sizeof(char *));
+    if (!grown) return -1;
+    *argvp = grown;
+    grown[argc] = strdup(a);
+    grown[argc + 1] = b ? strdup(b) : NULL;
+    grown[argc + 2] = NULL;
+    if (!grown[argc] || (b && !grown[argc + 1])) {
+        free(grown[argc]);
+        free(grown[argc + 1]);
+        grown[argc] = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* "cat FILE | cmd" -> "cmd < FILE" */
+static int rewrite_cat_file(char ***cmds, int *n) {
+    char **cat = cmds[0], **next = cmds[1];
+    if (strcmp(cat[0], "cat") != 0 || argc_of(cat) != 2 || cat[1][0] == '-' || !plain(cat) ||
+        reads_redirect(next))
+        return 0;
+    struct stat st;
+    if (fstatat(sh->dir_fd, cat[1], &st, 0) != 0 || !S_ISREG(st.st_mode) || faccessat(sh->dir_fd, cat[1], R_OK, 0) != 0) return 0;
+    if (append_words(&cmds[1], "<", cat[1]) != 0) return 0;
+    note("  rewrite: cat %s | %s ... -> stdin redirected from the file\n", cat[1], cmds[1][0]);
+    drop_stage(cmds, n, 0);
+    return 1;
+}
+
+/* Apply the rewrites to cmds[0, *n) in place (removed stages are freed,
+ * the array keeps its size). Returns how many stages were removed.
+ */
+int pipe_rewrite(char ***cmds, int *n) {
+    notes_len = 0;
+    notes[0] = '\0';
+    if (!sh->pipe_rewrite_on || *n < 2) return 0;
+    /* "| wc" or "a | | b": leave the error to execute_pipeline() */
+    for (int k = 0; k < *n; ++k)
+        if (!cmds[k] || !cmds[k][0]) return 0;
+
+    /* the background marker stays on whatever the last stage becomes */
+    char **last = cmds[*n - 1];
+    int argc = argc_of(last);
+    char *bg = argc > 1 && strcmp(last[argc - 1], "&") == 0 ? last[argc - 1] : NULL;
+    if (bg) last[argc - 1] = NULL;
+
+    int before = *n;
+    for (int i = 1; i < *n - 1; ) {
+        if (strcmp(cmds[i][0], "cat") == 0 && !cmds[i][1]) {
+            note("  rewrite: %s | cat | %s -> the cat stage is dropped\n", cmds[i - 1][0], cmds[i + 1][0]);
+            drop_stage(cmds, n, i);
+            continue;
+        }
+        i++;
+    }
+    for (int i = 0; i + 1 < *n; ) {
+        char **a = cmds[i], **b = cmds[i + 1];
+        long ca, cb;
+        const char *name = NULL;
+        if (!plain(a) || !plain(b)) {
+            i++;
+            continue;
+        }
+        if (line_count(a, "head", &ca) && line_count(b, "head", &cb)) name = "head";
+        else if (line_count(a, "tail", &ca) && line_count(b, "tail", &cb)) name = "tail";
+        if (name) {
+            char num[24];
+            snprintf(num, sizeof(num), "%ld", ca < cb ? ca : cb);
+            char **merged = calloc(4, sizeof(char *));
+            if (merged && (merged[0] = strdup(name)) && (merged[1] = strdup("-n")) &&
+                (merged[2] = strdup(num))) {
+                note("  rewrite: two %s stages -> one, -n %s\n", name, num);
+                free_argv(cmds[i]);
+                cmds[i] = merged;
+                drop_stage(cmds, n, i + 1);
+                continue;
+            }
+            free_argv(merged);
+        } else if (same_argv(a, b) && (idempotent_sort(a) || (strcmp(a[0], "uniq") == 0 && !a[1]))) {
+            note("  rewrite: %s | %s -> one stage\n", a[0], b[0]);
+            drop_stage(cmds, n, i + 1);
+            continue;
+        }
+        i++;
+    }
+    /* last, so that the merges above see plain first stages */
+    if (*n > 1) rewrite_cat_file(cmds, n);
+
+    if (bg) {
+        last = cmds[*n - 1];
+        argc = argc_of(last);
+        char **grown = realloc(last, (size_t)(argc + 2) * sizeof(char *));
+        if (grown) {
+            grown[argc] = bg;
+            grown[argc + 1] = NULL;
+            cmds[*n - 1] = grown;
+        } else {
+            free(bg);
+        }
+    }
+    return before - *n;
+}
+
+/* "set -o explain": the pipeline as it will run. text[i] is stage i as
+ * written (before its redirections were taken out of argv), builtin[i] its
+ * builtin or NULL, threaded[i] whether it runs as a thread of the shell.
+ */
+void pipe_explain(char **text, char ***cmds, const builtin_t **builtin, const int *threaded,
+                  int nstages, int background) {
+    if (!sh->explain_on) return;
+    dprintf(sh->fd_err, "explain: %d stage%s%s\n", nstages, nstages == 1 ? "" : "s",
+            background ? ", in the background" : "");
+    if (notes_len) dprintf(sh->fd_err, "%s", notes);
+    for (int i = 0; i < nstages; ++i) {
+        char *path = NULL;
+        const char *how;
+        if (threaded[i]) {
+            how = "builtin, thread";
+        } else if (builtin[i]) {
+            how = "builtin, forked";
+        } else if (!cmds[i][0]) {
+            how = "empty";
+        } else {
+            path = find_executable(cmds[i][0]);
+            how = path ? path : "not found";
+        }
+        const char *link = "";
+        if (i + 1 < nstages) link = threaded[i] && threaded[i + 1] ? "  | ring" : "  | pipe";
+        dprintf(sh->fd_err, "  %d  %-40s %s%s\n", i + 1, text[i] ? text[i] : cmds[i][0], how, link);
+        free(path);
+    }
+    notes_len = 0;
+    notes[0] = '\0';
+}
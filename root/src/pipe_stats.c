@@ -0,0 +1,203 @@
+//******************************************************************************************************
+//* Name:        pipe_stats.c                                                                          *
+//* Description: Per-link throughput for "pipeline --stats a | b | c" (or "set -o pipestats").         *
+//*              - Each inter-stage pipe becomes two: stage i writes into one, stage i+1               *
+//*                reads from the other, and a relay thread in the shell moves the bytes               *
+//*                between them with splice(2), so nothing is copied through user space.               *
+//*              - The relay only sleeps in poll(2) when splice would block, and times                 *
+//*                those waits: waiting for input means the upstream stage is the slow                 *
+//*                side, waiting for room means downstream is (backpressure).                          *
+//*              - The relays start after every stage has been forked, so no child is                  *
+//*                forked from a threaded shell.                                                       *
+//*              When the pipeline ends a per-link report goes to stderr.                              *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "shell.h"
+
+#define RELAY_CHUNK (1 << 20)
+
+typedef struct {
+    int in;                     /* read end of the pipe stage i writes */
+    int out;                    /* write end of the pipe stage i+1 reads */
+    pthread_t thread;
+    int running;
+    unsigned long long bytes;
+    long long wait_in_ns;       /* blocked on an empty upstream pipe */
+    long long wait_out_ns;      /* blocked on a full downstream pipe */
+    long long start_ns;         /* relay started */
+    long long busy_ns;          /* start to EOF */
+} relay_link;
+
+struct pipe_stats {
+    int nlinks;
+    struct timespec started;
+    relay_link links[];
+};
+
+
+int pipe_stats_enabled(void) {
+    return sh->pipe_stats_on;
+}
+
+void pipe_stats_set(int on) {
+    sh->pipe_stats_on = on;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+pipe_stats *pipe_stats_new(int num_cmds) {
+    int nlinks = num_cmds > 1 ? num_cmds - 1 : 0;
+    pipe_stats *st = calloc(1, sizeof(*st) + (size_t)nlinks * sizeof(relay_link));
+    if (!st) return NULL;
+    st->nlinks = nlinks;
+    for (int i = 0; i < nlinks; ++i) st->links[i].in = st->links[i].out = -1;
+    clock_gettime(CLOCK_MONOTONIC, &st->started);
+    return st;
+}
+
+/* Create link i. fds[1] is for stage i's stdout and fds[0] for stage i+1's
+ * stdin, like pipe(2); the relay's own ends stay in st (close-on-exec).
+ */
+int pipe_stats_link(pipe_stats *st, int i, int fds[2]) {
+    int up[2], down[2];
+    if (pipe2(up, O_CLOEXEC) == -1) return -1;
+    if (pipe2(down, O_CLOEXEC) == -1) {
+        close(up[0]);
+        close(up[1]);
+        return -1;
+    }
+    st->links[i].in = up[0];
+    st->links[i].out = down[1];
+    fds[0] = down[0];
+    fds[1] = up[1];
+    return 0;
+}
+
+/* In a stage child: drop the relay ends so EOF still reaches every stage
+ * (builtin stages never exec, so close-on-exec alone is not enough).
+ */
+void pipe_stats_child(pipe_stats *st) {
+    if (!st) return;
+    for (int i = 0; i < st->nlinks; ++i) {
+        if (st->links[i].in >= 0) close(st->links[i].in);
+        if (st->links[i].out >= 0) close(st->links[i].out);
+    }
+}
+
+/* Sleep until fd is ready for events; returns the time spent */
+static long long wait_fd(int fd, short events) {
+    long long t0 = now_ns();
+    struct pollfd p = { .fd = fd, .events = events };
+    while (poll(&p, 1, -1) == -1 && errno == EINTR)
+        ;
+    return now_ns() - t0;
+}
+
+static void *relay_main(void *arg) {
+    relay_link *l = arg;
+    for (;;) {
+        ssize_t n = splice(l->in, NULL, l->out, NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            l->bytes += (unsigned long long)n;
+            continue;
+        }
+        if (n == 0) break;                      /* upstream closed */
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) break;             /* EPIPE: downstream is gone */
+        /* splice can't tell which side would block; ask poll */
+        struct pollfd p[2] = { { .fd = l->in, .events = POLLIN }, { .fd = l->out, .events = POLLOUT } };
+        poll(p, 2, 0);
+        if (!(p[0].revents & (POLLIN | POLLHUP)))
+            l->wait_in_ns += wait_fd(l->in, POLLIN);
+        else if (!(p[1].revents & (POLLOUT | POLLERR)))
+            l->wait_out_ns += wait_fd(l->out, POLLOUT);
+    }
+    l->busy_ns = now_ns() - l->start_ns;
+    close(l->in);
+    close(l->out);
+    l->in = l->out = -1;
+    return NULL;
+}
+
+/* After every stage is forked: start one relay thread per link */
+void pipe_stats_start(pipe_stats *st) {
+    /* a downstream stage exiting early must give the relay EPIPE, not kill
+     * the shell; the signal stays blocked in the relay threads only */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (int i = 0; i < st->nlinks; ++i) {
+        relay_link *l = &st->links[i];
+        if (l->in < 0) continue;
+        l->start_ns = now_ns();
+        if (pthread_create(&l->thread, NULL, relay_main, l) == 0) {
+            l->running = 1;
+        } else {
+            /* no relay: the stages on both sides see EOF/EPIPE */
+            close(l->in);
+            close(l->out);
+            l->in = l->out = -1;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void print_secs(int fd, long long ns) {
+    dprintf(fd, "%.3fs", (double)ns / 1e9);
+}
+
+/* Join the relays and report to stderr; frees st. cmds names the stages. */
+void pipe_stats_finish(pipe_stats *st, char ***cmds) {
+    if (!st) return;
+    for (int i = 0; i < st->nlinks; ++i)
+        if (st->links[i].running) pthread_join(st->links[i].thread, NULL);
+    pipe_stats_child(st);               /* links that never started */
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long total = (long long)(end.tv_sec - st->started.tv_sec) * 1000000000LL +
+                      (end.tv_nsec - st->started.tv_nsec);
+    int err = sh->fd_err;
+    dprintf(err, "pipeline: %d stages, ", st->nlinks + 1);
+    print_secs(err, total);
+    dprintf(err, "\n");
+    for (int i = 0; i < st->nlinks; ++i) {
+        relay_link *l = &st->links[i];
+        double secs = (double)(l->busy_ns > 1000 ? l->busy_ns : 1000) / 1e9;
+        dprintf(err, "  %d: %s -> %s  %.1f MB  %.1f MB/s  waited on input ", i + 1,
+                cmds[i][0], cmds[i + 1][0], (double)l->bytes / 1e6, (double)l->bytes / 1e6 / secs);
+        print_secs(err, l->wait_in_ns);
+        dprintf(err, ", on output ");
+        print_secs(err, l->wait_out_ns);
+        if (l->wait_out_ns > l->wait_in_ns)
+            dprintf(err, "  (backpressure: %s is slower)\n", cmds[i + 1][0]);
+        else if (l->wait_in_ns > l->wait_out_ns)
+            dprintf(err, "  (starved: %s is slower)\n", cmds[i][0]);
+        else
+            dprintf(err, "\n");
+    }
+    free(st);
+}
+
+/* A pipeline refused before it started: close the relay ends, no report */
+void pipe_stats_free(pipe_stats *st) {
+    pipe_stats_child(st);
+    free(st);
+}
@@ -1,18 +1,25 @@
+#define _GNU_SOURCE /* pipe2 */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include "shell.h"
 
+#define STAGE_RING_SIZE (64 * 1024)
+
 /*
  * cmds: array of commands
  *   cmds[i] is a NULL-terminated argv array
  *   cmds[i][0] is the command name
  *
- * num_cmds: 2 or 3
+ * num_cmds: any; a background pipeline is one job of up to MAX_PROCS_PER_JOB
  */
-void execute_search(char *command, char **argv);
 
 int last_is_background(char **argv) {
     if (argv == NULL) return 0;
@@ -21,123 +28,329 @@ int last_is_background(char **argv) {
     if (i == 0) return 0;
     return (strcmp(argv[i-1], "&") == 0);
 }
+/* A builtin stage running as a thread of the shell */
+typedef struct {
+    char **argv;
+    const builtin_t *builtin;
+    const redir_fds *plan;      /* the stage's redirections, opened by the parent */
+    int in, out;                /* link fds, -1: ring or the shell's own */
+    spsc_ring *rin, *rout;
+    int status;
+    pthread_t thread_id;
+} stage_thread;
+
+static void *stage_main(void *arg) {
+    stage_thread *t = arg;
+    const redir_fds *r = t->plan;
+    /* the stage's own redirections win over the link, as in a child */
+    const int base[3] = { t->in >= 0 ? t->in : STDIN_FILENO, t->out >= 0 ? t->out : sh->fd_out,
+                          sh->fd_err };
+    builtin_io io = { redirect_fd(r, 0, base), redirect_fd(r, 1, base), redirect_fd(r, 2, base) };
+    if (r->fd[0] == STDIN_FILENO) io.rin = t->rin;
+    if (r->fd[1] == STDOUT_FILENO) io.rout = t->rout;
+    t->status = t->builtin->fn(t->argv, &io);
+    /* EOF / EPIPE for the neighbours */
+    if (t->in >= 0) close(t->in);
+    if (t->out >= 0) close(t->out);
+    if (t->rin) spsc_ring_close_read(t->rin);
+    if (t->rout) spsc_ring_close_write(t->rout);
+    return NULL;
+}
+
+static int wait_status(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+}
+
+/* "a | b | c": the job's command line */
+static char *join_pipeline(char ***cmds, int num_cmds) {
+    size_t len = 1;
+    for (int i = 0; i < num_cmds; i++)
+        for (int j = 0; cmds[i][j]; j++) len += strlen(cmds[i][j]) + 3;
+    char *out = malloc(len);
+    if (!out) return NULL;
+    size_t n = 0;
+    for (int i = 0; i < num_cmds; i++)
+    {
+        if (i) { memcpy(out + n, " | ", 3); n += 3; }
+        for (int j = 0; cmds[i][j]; j++)
+        {
+            if (j) out[n++] = ' ';
+            memcpy(out + n, cmds[i][j], strlen(cmds[i][j]));
+            n += strlen(cmds[i][j]);
+        }
+    }
+    out[n] = '\0';
+    return out;
+}
+
+/* $PIPESTATUS: every stage's status of the last foreground pipeline */
+static void set_pipestatus(const int *codes, int n) {
+    char buf[n * 4 + 1];
+    size_t len = 0;
+    for (int i = 0; i < n; i++)
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s%d", i ? " " : "", codes[i]);
+    var_set("PIPESTATUS", buf);
+}
+
+/* The pipeline was refused before anything ran: every stage gets 1 */
+static void pipeline_refused(int n) {
+    int codes[n];
+    for (int i = 0; i < n; i++) codes[i] = 1;
+    set_pipestatus(codes, n);
+    sh->last_exit_status = 1;
+}
+
 /*
  * Execute:
- *   cmd1 | cmd2
- *   cmd1 | cmd2 | cmd3
+ *   cmd1 | cmd2 | ... | cmdN
+ *
+ * Builtins flagged BUILTIN_THREADED (echo, printf, test, tee ...) run as
+ * threads of the shell instead of forked children. Two neighbouring
+ * threaded stages are joined by an spsc_ring (spsc_ring.c); every other
+ * link is a pipe. All links exist before anything starts, the external
+ * stages are forked next and the threads are only started after the last
+ * fork. $? is the last stage's status.
+ *
+ * Each stage's redirections (including here-documents prepared by the
+ * parent) are opened by the parent before anything is forked, so a bad
+ * path fails the whole pipeline without creating a process ($? and every
+ * $PIPESTATUS entry are 1). A child
+ * applies them after the pipe ends are in place, so "<" / ">" / "2>&1"
+ * on a stage override or follow the pipe like in other shells.
+ * stats: relay every link and report its throughput (pipe_stats.c);
+ * stages are all forked then.
+ * timeout: seconds, 0 for none ("pipeline --timeout"). The stages are all
+ * forked into one process group, which gets SIGTERM at the deadline; in
+ * the foreground $? is then 124 like timeout's, in the background the
+ * deadline is the job's (part_eight_set_deadline).
+ *
+ * Each forked stage is reaped by its own pid, never wait(NULL), so a
+ * coprocess or background job is not reaped by mistake. With a trailing
+ * "&" every stage is forked and the pipeline is registered as one job
+ * (part_eight_add_job) holding all of its pids; part_eight_check_jobs()
+ * reaps them as they exit and reports the job once the last one has.
+ * In the foreground $PIPESTATUS gets every stage's status.
  */
-void execute_pipeline(char ***cmds, int num_cmds) 
+void execute_pipeline(char ***cmds, int num_cmds, int stats, double timeout) 
 {
-    int pipe1[2], pipe2[2];
-    pid_t pid;
+    pid_t pids[num_cmds];
+    int link_r[num_cmds], link_w[num_cmds];
+    spsc_ring *rings[num_cmds];
+    stage_thread threads[num_cmds];
+    int threaded[num_cmds];
+    redir_fds plans[num_cmds];
+    const builtin_t *builtins[num_cmds];
+    char *text[num_cmds];       /* stages as written, for set -o explain */
     int last_bg = last_is_background(cmds[num_cmds-1]);
     
     if (last_bg) {
         int i = 0;
         while (cmds[num_cmds-1][i] != NULL) i++;
         cmds[num_cmds-1][i-1] = NULL;
-    }
-
-    if (num_cmds >= 2) 
-    {
-        if (pipe(pipe1) == -1) 
+        /* refuse before forking rather than leave untracked children */
+        if (num_cmds > MAX_PROCS_PER_JOB || part_eight_active_jobs() >= MAX_ACTIVE_JOBS)
         {
-            perror("pipe");
+            dprintf(sh->fd_err, "pipeline: %s\n", num_cmds > MAX_PROCS_PER_JOB ?
+                    "too many stages for a background job" : "too many background jobs");
+            pipeline_refused(num_cmds);
             return;
         }
     }
 
-    if (num_cmds == 3) 
+    for (int i = 0; i < num_cmds; i++)
+        text[i] = pipe_explain_enabled() ? join_pipeline(&cmds[i], 1) : NULL;
+    for (int i = 0; i < num_cmds; i++)
     {
-        if (pipe(pipe2) == -1) 
-        {
-            perror("pipe");
-            return;
-        }
+        if (redirect_open(cmds[i], &plans[i]) == 0) continue;
+        while (i-- > 0) redirect_close(&plans[i]);
+        for (int k = 0; k < num_cmds; k++) free(text[k]);
+        pipeline_refused(num_cmds);
+        return;
     }
+    /* "set -o capture": every stage's stderr, and the last one's stdout */
+    if (last_bg) job_capture_prepare();
+
+    /* "pipeline --stats": relay threads on every link (pipe_stats.c); not
+     * for background pipelines, whose links would outlive this call */
+    pipe_stats *st = (stats && !last_bg) ? pipe_stats_new(num_cmds) : NULL;
 
-    // CMD 1
-    pid = fork();
-    if (pid == 0) 
+    /* threads must be joined here, so a background pipeline forks them all */
+    for (int i = 0; i < num_cmds; i++)
     {
-        if (num_cmds >= 2) 
-        {
-            dup2(pipe1[1], STDOUT_FILENO);
-        }
+        const builtin_t *b = builtins[i] = builtin_find(cmds[i]);
+        /* a thread has no fds of its own for "2>&1" to copy: those fork */
+        int crossed = 0;
+        for (int n = 0; n < 3; n++)
+            crossed |= plans[i].fd[n] >= 0 && plans[i].fd[n] < 3 && plans[i].fd[n] != n;
+        threaded[i] = !last_bg && !st && !timeout && !crossed && b && (b->flags & BUILTIN_THREADED);
+        threads[i] = (stage_thread){ cmds[i], b, &plans[i], -1, -1, NULL, NULL, 0 };
+        pids[i] = -1;
+    }
 
-        close(pipe1[0]);
-        close(pipe1[1]);
-        if (num_cmds == 3) 
+    int nlinks = 0;
+    for (; nlinks < num_cmds - 1; nlinks++)
+    {
+        int fds[2] = { -1, -1 };
+        rings[nlinks] = NULL;
+        if (threaded[nlinks] && threaded[nlinks + 1])
+            rings[nlinks] = spsc_ring_new(STAGE_RING_SIZE);
+        if (!rings[nlinks] && (st ? pipe_stats_link(st, nlinks, fds) : pipe2(fds, O_CLOEXEC)) == -1)
         {
-            close(pipe2[0]);
-            close(pipe2[1]);
+            /* refused whole: a shortened pipeline would drop its last stages */
+            shell_perror("pipe");
+            for (int k = 0; k < nlinks; k++)
+            {
+                spsc_ring_free(rings[k]);
+                if (link_r[k] != -1) close(link_r[k]);
+                if (link_w[k] != -1) close(link_w[k]);
+            }
+            for (int k = 0; k < num_cmds; k++)
+            {
+                redirect_close(&plans[k]);
+                free(text[k]);
+            }
+            if (last_bg) job_capture_parent();
+            pipe_stats_free(st);
+            pipeline_refused(num_cmds);
+            return;
         }
-
-        execute_search(cmds[0][0], cmds[0]);
-        exit(1);
+        link_r[nlinks] = fds[0];
+        link_w[nlinks] = fds[1];
     }
+    pipe_explain(text, cmds, builtins, threaded, num_cmds, last_bg);
+    for (int i = 0; i < num_cmds; i++) free(text[i]);
 
-    // CMD 2
-    if (num_cmds >= 2) 
+    pid_t pgid = 0;             /* with a timeout: the first stage's pid */
+    char **envp = var_envp();   /* built once for every stage, not per child */
+    for (int i = 0; i < num_cmds; i++)
     {
-        pid = fork();
+        stage_thread *t = &threads[i];
+        if (i > 0) { t->in = link_r[i-1]; t->rin = rings[i-1]; }
+        if (i < nlinks) { t->out = link_w[i]; t->rout = rings[i]; }
+        if (threaded[i]) continue;
+
+        pid_t pid = fork();
         if (pid == 0) 
         {
-            dup2(pipe1[0], STDIN_FILENO);
-
-            if (num_cmds == 3) 
+            shell_child_setup();
+            if (timeout) setpgid(0, pgid);
+            pipe_stats_child(st);
+            if (last_bg) job_capture_child();
+            if (t->in != -1) dup2(t->in, STDIN_FILENO);
+            if (t->out != -1) dup2(t->out, STDOUT_FILENO);
+            /* the link fds are close-on-exec, but a forked builtin never execs */
+            for (int k = 0; k < nlinks; k++)
             {
-                dup2(pipe2[1], STDOUT_FILENO);
+                if (link_r[k] != -1) close(link_r[k]);
+                if (link_w[k] != -1) close(link_w[k]);
             }
 
-            close(pipe1[0]);
-            close(pipe1[1]);
-            if (num_cmds == 3) 
+            if (redirect_apply(&plans[i]) != 0) _exit(1);
+            /* builtins that can't be threads (read, jobs ...) run right here */
+            if (t->builtin)
             {
-                close(pipe2[0]);
-                close(pipe2[1]);
+                builtin_io io = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+                int status = t->builtin->fn(cmds[i], &io);
+                fflush(stdout);
+                _exit(status);
             }
-
-            execute_search(cmds[1][0], cmds[1]);
+            execute_search(cmds[i][0], cmds[i], envp);
             exit(1);
         }
-    }
-
-    // CMD 3
-    if (num_cmds == 3) 
-    {
-        pid = fork();
-        if (pid == 0)
+        if (pid < 0) 
         {
-            dup2(pipe2[0], STDIN_FILENO);
-
-            close(pipe2[0]);
-            close(pipe2[1]);
-            close(pipe1[0]);
-            close(pipe1[1]);
-
-            execute_search(cmds[2][0], cmds[2]);
-            exit(1);
+            shell_perror("fork");
+        } 
+        else if (timeout)
+        {
+            /* from both sides, so the deadline can't race the child's setpgid */
+            setpgid(pid, pgid ? pgid : pid);
+            if (!pgid) pgid = pid;
         }
+        pids[i] = pid;
     }
 
-    //parent
+    //parent: keep only the link ends a thread stage uses
+    for (int k = 0; k < nlinks; k++)
+    {
+        if (link_r[k] != -1 && !threaded[k + 1]) close(link_r[k]);
+        if (link_w[k] != -1 && !threaded[k]) close(link_w[k]);
+    }
+    // ... and the redirections only thread stages still need
+    for (int i = 0; i < num_cmds; i++)
+    {
+        if (!threaded[i]) redirect_close(&plans[i]);
+    }
+    if (st) pipe_stats_start(st);
 
-    if (num_cmds >= 2) 
+    /* a stage thread writing to an external stage that has exited must get
+     * EPIPE, not take the shell down with SIGPIPE */
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    for (int i = 0; i < num_cmds; i++)
+    {
+        if (!threaded[i]) continue;
+        if (pthread_create(&threads[i].thread_id, NULL, stage_main, &threads[i]) != 0)
+            threaded[i] = -1;
+    }
+    /* no thread to be had: run those stages here once the others are going */
+    for (int i = 0; i < num_cmds; i++)
     {
-        close(pipe1[0]);
-        close(pipe1[1]);
+        if (threaded[i] == -1) stage_main(&threads[i]);
     }
-    if (num_cmds == 3) 
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (last_bg)
     {
-        close(pipe2[0]);
-        close(pipe2[1]);
+        pid_t jpids[MAX_PROCS_PER_JOB];
+        int njobs = 0;
+        for (int i = 0; i < num_cmds; i++)
+            if (pids[i] > 0) jpids[njobs++] = pids[i];
+        char *cmdline = join_pipeline(cmds, num_cmds);
+        int jobno = njobs > 0 && cmdline ? part_eight_add_job(cmdline, jpids, njobs, jpids[njobs - 1]) : -1;
+        if (jobno >= 0 && pgid)
+            part_eight_set_deadline(jobno, pgid, (long long)(timeout * 1000), SIGTERM, 0);
+        if (njobs > 0 && jobno < 0)
+        {
+            /* could not be tracked: finish it here instead of leaving zombies */
+            shell_perror("pipeline: background job");
+            job_capture_parent();
+            for (int i = 0; i < njobs; i++)
+                while (waitpid(jpids[i], NULL, 0) == -1 && errno == EINTR)
+                    ;
+        }
+        free(cmdline);
+        return;
     }
 
-    // wait for all children except background
-     for (int i = 0; i < num_cmds; i++) 
+    // reap forked stages with waitpid on our own pids; wait(NULL) could
+    // reap a coproc or background job instead. Deadlines of background
+    // jobs keep being enforced meanwhile (part_eight_wait_pid).
+    if (pgid) part_eight_set_fg_deadline(pgid, (long long)(timeout * 1000));
+    int codes[num_cmds];
+    for (int i = 0; i < num_cmds; i++) 
+    {
+        codes[i] = 1;
+        if (threaded[i] == 1) pthread_join(threads[i].thread_id, NULL);
+        if (threaded[i]) {
+            codes[i] = threads[i].status;
+            redirect_close(&plans[i]);
+            continue;
+        }
+        int ws = 0;
+        if (pids[i] > 0 && part_eight_wait_pid(pids[i], &ws) == pids[i]) codes[i] = wait_status(ws);
+    }
+    for (int k = 0; k < nlinks; k++) spsc_ring_free(rings[k]);
+    sh->last_exit_status = codes[num_cmds - 1];
+    if (pgid)
     {
-        if (i == num_cmds - 1 && last_bg) continue;
-        wait(NULL);
+        if (part_eight_fg_timed_out()) sh->last_exit_status = 124;
+        part_eight_set_fg_deadline(0, 0);
     }
+    set_pipestatus(codes, num_cmds);
+    pipe_stats_finish(st, cmds);
 }
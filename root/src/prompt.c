@@ -1,20 +1,256 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
 #include "shell.h"
 
+/*
+ * Prompt templates.
+ *
+ * The PS1-style format is parsed once into a list of segments. Static
+ * segments (user, hostname) are resolved a single time per session, the
+ * cwd is only refreshed when builtin_cd() calls prompt_set_cwd(), and the
+ * optional segments (\?, \j, \T) are only evaluated when the format
+ * actually references them. The finished prompt goes out with one write(2).
+ *
+ * Supported escapes:
+ *   \u user      \h hostname   \w cwd        \W basename of cwd
+ *   \? last exit status        \j active background jobs
+ *   \T duration of the previous command   \$ '#' for root, '$' otherwise
+ *   \n newline   \\ backslash
+ */
+
+#define DEFAULT_PS1 "\\u@\\h:\\w> "
+#define PROMPT_BUF 4096
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+typedef enum {
+    SEG_LITERAL,
+    SEG_USER,
+    SEG_HOST,
+    SEG_CWD,
+    SEG_CWD_BASE,
+    SEG_STATUS,
+    SEG_JOBS,
+    SEG_ELAPSED,
+    SEG_SIGIL
+} seg_kind;
+
+typedef struct {
+    seg_kind kind;
+    size_t off;     /* SEG_LITERAL: offset into literal pool */
+    size_t len;     /* SEG_LITERAL: length */
+} prompt_seg;
+
+static struct {
+    int ready;
+    prompt_seg *segs;
+    size_t nsegs;
+    char *literals;          /* pool holding all literal text */
+    int wants_timing;        /* format references \T */
+
+    char user[256];
+    size_t user_len;
+    char host[256];
+    size_t host_len;
+    char cwd[PATH_MAX];
+    size_t cwd_len;
+
+    long last_elapsed_ms;    /* only maintained when wants_timing */
+
+    char shown[PROMPT_BUF];  /* the last prompt written, for the line editor */
+    size_t shown_len;
+} prompt;
+
+/* Parse fmt into prompt.segs / prompt.literals. Adjacent literal characters
+ * are merged into one segment so emitting is a handful of memcpy calls.
+ */
+static int compile_format(const char *fmt) {
+    size_t fmt_len = strlen(fmt);
+    prompt_seg *segs = calloc(fmt_len + 1, sizeof(prompt_seg));
+    char *lit = malloc(fmt_len + 1);
+    if (!segs || !lit) {
+        free(segs);
+        free(lit);
+        return -1;
+    }
+
+    size_t nsegs = 0, lit_len = 0;
+    int wants_timing = 0;
+
+    for (const char *p = fmt; *p; ++p) {
+        seg_kind kind = SEG_LITERAL;
+        char c = *p;
+
+        if (c == '\\' && p[1]) {
+            ++p;
+            switch (*p) {
+            case 'u': kind = SEG_USER; break;
+            case 'h': kind = SEG_HOST; break;
+            case 'w': kind = SEG_CWD; break;
+            case 'W': kind = SEG_CWD_BASE; break;
+            case '?': kind = SEG_STATUS; break;
+            case 'j': kind = SEG_JOBS; break;
+            case 'T': kind = SEG_ELAPSED; wants_timing = 1; break;
+            case '$': kind = SEG_SIGIL; break;
+            case 'n': c = '\n'; break;
+            default:  c = *p; break; /* "\\" and unknown escapes are literal */
+            }
+        }
+
+        if (kind != SEG_LITERAL) {
+            segs[nsegs++].kind = kind;
+            continue;
+        }
+
+        if (nsegs == 0 || segs[nsegs - 1].kind != SEG_LITERAL) {
+            segs[nsegs].kind = SEG_LITERAL;
+            segs[nsegs].off = lit_len;
+            segs[nsegs].len = 0;
+            nsegs++;
+        }
+        lit[lit_len++] = c;
+        segs[nsegs - 1].len++;
+    }
+
+    free(prompt.segs);
+    free(prompt.literals);
+    prompt.segs = segs;
+    prompt.nsegs = nsegs;
+    prompt.literals = lit;
+    prompt.wants_timing = wants_timing;
+    return 0;
+}
+
+static void copy_bounded(char *dst, size_t cap, size_t *len_out, const char *src) {
+    size_t n = strlen(src);
+    if (n >= cap) n = cap - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+    *len_out = n;
+}
+
+void prompt_set_cwd(const char *cwd) {
+    copy_bounded(prompt.cwd, sizeof(prompt.cwd), &prompt.cwd_len, cwd ? cwd : "/");
+}
+
+int prompt_set_format(const char *fmt) {
+    return compile_format(fmt && *fmt ? fmt : DEFAULT_PS1);
+}
+
+void prompt_init(void) {
+    const char *user = var_get("USER");
+    copy_bounded(prompt.user, sizeof(prompt.user), &prompt.user_len, user ? user : "unknown");
+
+    if (gethostname(prompt.host, sizeof(prompt.host)) != 0)
+        snprintf(prompt.host, sizeof(prompt.host), "unknown");
+    prompt.host[sizeof(prompt.host) - 1] = '\0';
+    prompt.host_len = strlen(prompt.host);
+
+    const char *pwd = var_get("PWD");
+    prompt_set_cwd(pwd ? pwd : "/");
+
+    if (prompt_set_format(var_get("PS1")) != 0) {
+        /* keep going with an empty prompt rather than failing the shell */
+        prompt.nsegs = 0;
+    }
+    prompt.last_elapsed_ms = 0;
+    prompt.ready = 1;
+}
+
+/* Returns non-zero if the main loop should time commands for \T. */
+int prompt_wants_timing(void) {
+    return prompt.ready && prompt.wants_timing;
+}
+
+void prompt_note_elapsed(long elapsed_ms) {
+    prompt.last_elapsed_ms = elapsed_ms;
+}
+
+static size_t append(char *buf, size_t len, const char *src, size_t n) {
+    if (len + n > PROMPT_BUF) n = PROMPT_BUF - len;
+    memcpy(buf + len, src, n);
+    return len + n;
+}
+
+static void emit(const char *buf, size_t len) {
+    memcpy(prompt.shown, buf, len);
+    prompt.shown_len = len;
+
+    /* anything still sitting in stdio (job messages etc.) must go first */
+    fflush(stdout);
+
+    size_t off = 0;
+    while (off < len) {
+        ssize_t w = write(STDOUT_FILENO, buf + off, len - off);
+        if (w <= 0) break;
+        off += (size_t)w;
+    }
+}
+
 void print_prompt(void)
 {
-    char hostname[256];
-    char *user = getenv("USER");
-    char *pwd = getenv("PWD");
+    char buf[PROMPT_BUF];
+    char num[32];
+    size_t len = 0;
 
-    if (gethostname(hostname, sizeof(hostname)) != 0)
-        snprintf(hostname, sizeof(hostname), "unknown");
+    if (!prompt.ready) prompt_init();
 
-    if (user == NULL) user = "unknown";
-    if (pwd == NULL) pwd = "/";
+    for (size_t i = 0; i < prompt.nsegs; ++i) {
+        const prompt_seg *seg = &prompt.segs[i];
+        int n;
+        switch (seg->kind) {
+        case SEG_LITERAL:
+            len = append(buf, len, prompt.literals + seg->off, seg->len);
+            break;
+        case SEG_USER:
+            len = append(buf, len, prompt.user, prompt.user_len);
+            break;
+        case SEG_HOST:
+            len = append(buf, len, prompt.host, prompt.host_len);
+            break;
+        case SEG_CWD:
+            len = append(buf, len, prompt.cwd, prompt.cwd_len);
+            break;
+        case SEG_CWD_BASE: {
+            const char *base = strrchr(prompt.cwd, '/');
+            base = (base && base[1]) ? base + 1 : prompt.cwd;
+            len = append(buf, len, base, strlen(base));
+            break;
+        }
+        case SEG_STATUS:
+            n = snprintf(num, sizeof(num), "%d", sh->last_exit_status);
+            len = append(buf, len, num, (size_t)n);
+            break;
+        case SEG_JOBS:
+            n = snprintf(num, sizeof(num), "%d", part_eight_active_jobs());
+            len = append(buf, len, num, (size_t)n);
+            break;
+        case SEG_ELAPSED:
+            n = snprintf(num, sizeof(num), "%ldms", prompt.last_elapsed_ms);
+            len = append(buf, len, num, (size_t)n);
+            break;
+        case SEG_SIGIL:
+            len = append(buf, len, geteuid() == 0 ? "#" : "$", 1);
+            break;
+        }
+    }
 
-    printf("%s@%s:%s> ", user, hostname, pwd);
-    fflush(stdout);
+    emit(buf, len);
+}
+
+/* The "> " shown while a for/while/if construct is still open. */
+void print_continuation_prompt(void) {
+    emit("> ", 2);
+}
+
+/* What the last prompt looked like, so the line editor can redraw it. */
+const char *prompt_shown(size_t *len) {
+    *len = prompt.shown_len;
+    return prompt.shown;
 }
@@ -0,0 +1,698 @@
+//******************************************************************************************************
+//* Name:        rc_snapshot.c                                                                         *
+//* Description: Startup file ($SHELLRC, default ~/.shellrc) and its binary snapshot.                  *
+//*              - The rc file is run line by line before the first prompt, with '#'                   *
+//*                comment lines skipped and nothing recorded in history.                              *
+//*              - When it only sets state (NAME=value lines, export, unset, set -o/+o,                *
+//*                no $(...) or $$), the result is saved next to it as <rc>.snap: the                  *
+//*                variables it changed, the option flags, and an index of every                       *
+//*                executable on the resulting PATH.                                                   *
+//*              - The snapshot is keyed by the rc file's inode, size and mtime, by the                *
+//*                values of the variables the rc file reads, and by the mtimes of the                 *
+//*                PATH directories. When all of them match, the next start maps it with               *
+//*                one mmap and applies it instead of running the rc file.                             *
+//*              - find_executable() looks commands up in the index first (checked with                *
+//*                access()); it is dropped as soon as PATH changes.                                   *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define SNAP_MAGIC "shsnap01"
+#define RC_MAX_DEPS 256
+
+enum { SNAP_SET = 0, SNAP_UNSET = 1 };
+
+/* All offsets are from the start of the file; strings are NUL-terminated. */
+typedef struct {
+    char magic[8];
+    uint64_t size;
+    uint64_t rc_dev, rc_ino, rc_size;
+    int64_t rc_mtime_sec, rc_mtime_nsec;
+    uint64_t deps_hash;                 /* values of the variables the rc file reads */
+    uint32_t ndeps, nops, nopts, ndirs, nentries, nslots;
+    uint32_t deps_off, ops_off, opts_off, dirs_off, entries_off, slots_off;
+    uint32_t path_off;                  /* PATH the index was built for */
+    uint32_t pad;
+} snap_header;
+
+typedef struct { uint32_t kind, exported, name_off, value_off; } snap_op;
+typedef struct { uint32_t name_off, value; } snap_opt;
+typedef struct { uint32_t path_off, pad; int64_t mtime_sec, mtime_nsec; } snap_dir;
+typedef struct { uint32_t hash, name_off, path_off; } snap_entry;
+
+static char report[256] = "no rc file";
+static char *map = NULL;                /* the snapshot in use, kept for the index */
+static size_t map_len = 0;
+static unsigned long index_gen = 0;     /* path_generation the index is valid for */
+
+static uint64_t fnv(uint64_t h, const void *p, size_t n) {
+    const unsigned char *s = p;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#define FNV_INIT 1469598103934665603ULL
+
+static const char *at(uint32_t off) {
+    return map + off;
+}
+
+/* ---------------- PATH index ---------------- */
+
+const char *path_index_lookup(const char *name) {
+    if (!map || index_gen != sh->path_generation) return NULL;
+    const snap_header *h = (const snap_header *)map;
+    if (!h->nslots) return NULL;
+    const uint32_t *slots = (const uint32_t *)(map + h->slots_off);
+    const snap_entry *entries = (const snap_entry *)(map + h->entries_off);
+    uint32_t hash = (uint32_t)fnv(FNV_INIT, name, strlen(name));
+    for (uint32_t i = hash & (h->nslots - 1); slots[i]; i = (i + 1) & (h->nslots - 1)) {
+        const snap_entry *e = &entries[slots[i] - 1];
+        if (e->hash == hash && strcmp(at(e->name_off), name) == 0) return at(e->path_off);
+    }
+    return NULL;
+}
+
+/* ---------------- reading the rc file ---------------- */
+
+typedef struct {
+    char *names[RC_MAX_DEPS];
+    int n;
+    char *sets[RC_MAX_DEPS];            /* variables it assigns, exports or unsets */
+    int nsets;
+    int cacheable;
+} rc_scan;
+
+static void add_name(rc_scan *sc, char **names, int *n, const char *name, size_t len) {
+    for (int i = 0; i < *n; ++i)
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) return;
+    if (*n == RC_MAX_DEPS) {
+        sc->cacheable = 0;
+        return;
+    }
+    names[(*n)++] = strndup(name, len);
+}
+
+static void add_dep(rc_scan *sc, const char *name, size_t len) {
+    add_name(sc, sc->names, &sc->n, name, len);
+}
+
+/* Variables a word reads; anything whose value is not a function of
+ * those ($(...), $$) makes the file uncacheable. */
+static void scan_word(rc_scan *sc, const char *w) {
+    if (w[0] == '~') add_dep(sc, "HOME", 4);
+    for (const char *p = strchr(w, '$'); p; p = strchr(p + 1, '$')) {
+        const char *q = p + 1;
+        if (*q == '(' || *q == '$') {
+            sc->cacheable = 0;
+            return;
+        }
+        if (*q == '{') q++;
+        size_t n = 0;
+        while (q[n] == '_' || (q[n] >= 'a' && q[n] <= 'z') || (q[n] >= 'A' && q[n] <= 'Z') ||
+               (n && q[n] >= '0' && q[n] <= '9'))
+            n++;
+        if (n) add_dep(sc, q, n);
+    }
+}
+
+/* Only commands that set state can be replayed from a snapshot */
+static void scan_line(rc_scan *sc, char *line) {
+    tokenlist *tokens = get_tokens(line);
+    size_t start = 0;
+    for (size_t i = 0; i <= tokens->size; ++i) {
+        if (i < tokens->size && strcmp(tokens->items[i], ";") != 0) {
+            scan_word(sc, tokens->items[i]);
+            continue;
+        }
+        if (i > start) {
+            char **cmd = tokens->items + start;
+            size_t n = i - start;
+            size_t assignments = 0;
+            while (assignments < n && var_assignment_len(cmd[assignments])) assignments++;
+            int ok = assignments == n || strcmp(cmd[0], "export") == 0 ||
+                     strcmp(cmd[0], "unset") == 0 || strcmp(cmd[0], "set") == 0;
+            /* the snapshot replays these even where the value did not change */
+            for (size_t k = 0; k < assignments; ++k)
+                add_name(sc, sc->sets, &sc->nsets, cmd[k], var_assignment_len(cmd[k]));
+            if (assignments != n && (strcmp(cmd[0], "export") == 0 || strcmp(cmd[0], "unset") == 0)) {
+                for (size_t k = 1; k < n; ++k) {
+                    size_t len = strcspn(cmd[k], "=");
+                    if (!var_name_valid(cmd[k], len)) continue;
+                    add_name(sc, sc->sets, &sc->nsets, cmd[k], len);
+                    /* "export NAME" keeps whatever value NAME had */
+                    if (!cmd[k][len] && cmd[0][0] == 'e') add_dep(sc, cmd[k], len);
+                }
+            }
+            for (size_t k = 1; ok && k < n && assignments != n; ++k)
+                if (glob_has_magic(cmd[k]) || cmd[k][0] == '<' || cmd[k][0] == '>' ||
+                    redirect_width(cmd[k])) ok = 0;
+            if (!ok) sc->cacheable = 0;
+        }
+        start = i + 1;
+    }
+    free_tokens(tokens);
+}
+
+static char *read_file(const char *path, struct stat *st) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    char *text = NULL;
+    if (fstat(fd, st) == 0 && S_ISREG(st->st_mode) && (text = malloc((size_t)st->st_size + 1))) {
+        size_t got = 0;
+        ssize_t n;
+        while (got < (size_t)st->st_size &&
+               ((n = read(fd, text + got, (size_t)st->st_size - got)) > 0 || (n < 0 && errno == EINTR)))
+            if (n > 0) got += (size_t)n;
+        text[got] = '\0';
+    }
+    close(fd);
+    return text;
+}
+
+/* Run the file: each line as if typed, so for/while/if may span lines */
+static void run_rc(char *text) {
+    history_hold(1);
+    for (char *line = text, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\0') continue;
+        shell_feed_line(line);
+    }
+    script_discard();
+    history_hold(0);
+}
+
+static uint64_t deps_hash(char *const *names, int n) {
+    uint64_t h = FNV_INIT;
+    for (int i = 0; i < n; ++i) {
+        const char *v = var_get(names[i]);
+        h = fnv(h, names[i], strlen(names[i]) + 1);
+        h = v ? fnv(h, v, strlen(v) + 1) : fnv(h, "", 1) ^ 0x9e3779b97f4a7c15ULL;
+    }
+    return h;
+}
+
+/* ---------------- writing a snapshot ---------------- */
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} sbuf;
+
+static uint32_t sb_add(sbuf *b, const void *p, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n) cap *= 2;
+        char *nb = realloc(b->buf, cap);
+        if (!nb) return UINT32_MAX;
+        b->buf = nb;
+        b->cap = cap;
+    }
+    uint32_t off = (uint32_t)b->len;
+    memcpy(b->buf + b->len, p, n);
+    b->len += n;
+    return off;
+}
+
+static uint32_t sb_str(sbuf *b, const char *s) {
+    return sb_add(b, s, strlen(s) + 1);
+}
+
+/* Variables before the rc file ran, to diff against */
+typedef struct {
+    char **entries;
+    size_t *name_len;
+    int *exported;
+    size_t n, cap;
+} var_list;
+
+static void collect_var(const char *entry, size_t name_len, int exported, void *arg) {
+    var_list *l = arg;
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        char **ne = realloc(l->entries, cap * sizeof(char *));
+        size_t *nl = ne ? realloc(l->name_len, cap * sizeof(size_t)) : NULL;
+        int *nx = nl ? realloc(l->exported, cap * sizeof(int)) : NULL;
+        if (ne) l->entries = ne;
+        if (nl) l->name_len = nl;
+        if (!nx) return;
+        l->exported = nx;
+        l->cap = cap;
+    }
+    l->entries[l->n] = strdup(entry);
+    l->name_len[l->n] = name_len;
+    l->exported[l->n] = exported;
+    if (l->entries[l->n]) l->n++;
+}
+
+static void free_var_list(var_list *l) {
+    for (size_t i = 0; i < l->n; ++i) free(l->entries[i]);
+    free(l->entries);
+    free(l->name_len);
+    free(l->exported);
+}
+
+static const char *find_var(const var_list *l, const char *entry, size_t name_len, int *exported) {
+    for (size_t i = 0; i < l->n; ++i) {
+        if (l->name_len[i] == name_len && memcmp(l->entries[i], entry, name_len + 1) == 0) {
+            *exported = l->exported[i];
+            return l->entries[i];
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    sbuf *recs;
+    sbuf *strs;
+    const var_list *before;
+    const rc_scan *sc;
+    uint32_t n;
+} diff_ctx;
+
+static int rc_sets(const rc_scan *sc, const char *name, size_t len) {
+    for (int i = 0; i < sc->nsets; ++i)
+        if (strlen(sc->sets[i]) == len && memcmp(sc->sets[i], name, len) == 0) return 1;
+    return 0;
+}
+
+/* Set by the rc file, or changed since before: record it (string offsets
+ * fixed up later). A value the environment already had is recorded too, or
+ * a later start with a different one would keep it. */
+static void diff_var(const char *entry, size_t name_len, int exported, void *arg) {
+    diff_ctx *d = arg;
+    int was_exported = 0;
+    const char *old = find_var(d->before, entry, name_len, &was_exported);
+    if (old && strcmp(old, entry) == 0 && was_exported == exported && !rc_sets(d->sc, entry, name_len))
+        return;
+    char *name = strndup(entry, name_len);
+    if (!name) return;
+    snap_op op = { SNAP_SET, (uint32_t)exported, sb_str(d->strs, name), sb_str(d->strs, entry + name_len + 1) };
+    free(name);
+    sb_add(d->recs, &op, sizeof(op));
+    d->n++;
+}
+
+typedef struct {
+    char *name;
+    char *path;
+    uint32_t hash;
+} index_cand;
+
+/* Executables in each PATH directory, first one found wins */
+static void build_index(const char *path, sbuf *dirs, sbuf *entries, sbuf *slots, sbuf *strs,
+                        uint32_t *ndirs, uint32_t *nentries, uint32_t *nslots) {
+    index_cand *cand = NULL;
+    size_t ncand = 0, capcand = 0;
+    char *copy = strdup(path);
+    char *save = NULL;
+    for (char *dir = copy ? strtok_r(copy, ":", &save) : NULL; dir; dir = strtok_r(NULL, ":", &save)) {
+        struct stat st;
+        snap_dir d = { sb_str(strs, dir), 0, -1, -1 };
+        int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0 && fstat(dfd, &st) == 0) {
+            d.mtime_sec = st.st_mtim.tv_sec;
+            d.mtime_nsec = st.st_mtim.tv_nsec;
+        }
+        sb_add(dirs, &d, sizeof(d));
+        (*ndirs)++;
+        DIR *dp = dfd >= 0 ? fdopendir(dfd) : NULL;
+        if (!dp) {
+            if (dfd >= 0) close(dfd);
+            continue;
+        }
+        struct dirent *de;
+        while ((de = readdir(dp))) {
+            if (de->d_name[0] == '.') continue;
+            if (de->d_type != DT_REG && de->d_type != DT_LNK && de->d_type != DT_UNKNOWN) continue;
+            if (fstatat(dfd, de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+                continue;
+            if (ncand == capcand) {
+                capcand = capcand ? capcand * 2 : 1024;
+                index_cand *nc = realloc(cand, capcand * sizeof(*cand));
+                if (!nc) break;
+                cand = nc;
+            }
+            size_t dl = strlen(dir), nl = strlen(de->d_name);
+            char *full = malloc(dl + nl + 2);
+            if (!full) break;
+            memcpy(full, dir, dl);
+            full[dl] = '/';
+            memcpy(full + dl + 1, de->d_name, nl + 1);
+            cand[ncand].name = full + dl + 1;
+            cand[ncand].path = full;
+            cand[ncand].hash = (uint32_t)fnv(FNV_INIT, de->d_name, nl);
+            ncand++;
+        }
+        closedir(dp);
+    }
+    free(copy);
+
+    uint32_t size = 16;
+    while (size < ncand * 2) size *= 2;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    for (size_t i = 0; table && i < ncand; ++i) {
+        uint32_t s = cand[i].hash & (size - 1);
+        int dup = 0;
+        for (; table[s]; s = (s + 1) & (size - 1)) {
+            const index_cand *o = &cand[table[s] - 1];
+            if (o->hash == cand[i].hash && strcmp(o->name, cand[i].name) == 0) {
+                dup = 1;
+                break;
+            }
+        }
+        if (!dup) table[s] = (uint32_t)i + 1;
+    }
+    /* renumber: entries holds only the winners, in slot order */
+    for (uint32_t s = 0; table && s < size; ++s) {
+        if (!table[s]) continue;
+        const index_cand *c = &cand[table[s] - 1];
+        snap_entry e = { c->hash, sb_str(strs, c->name), sb_str(strs, c->path) };
+        sb_add(entries, &e, sizeof(e));
+        table[s] = ++*nentries;
+    }
+    if (table) {
+        sb_add(slots, table, size * sizeof(uint32_t));
+        *nslots = size;
+    }
+    free(table);
+    for (size_t i = 0; i < ncand; ++i) free(cand[i].path);
+    free(cand);
+}
+
+/* Fix up string offsets in n records of size rec (fields at the given
+ * uint32 positions) by base */
+static void rebase(sbuf *b, size_t rec, const int *fields, int nfields, uint32_t base) {
+    for (size_t off = 0; off + rec <= b->len; off += rec) {
+        for (int f = 0; f < nfields; ++f) {
+            uint32_t *v = (uint32_t *)(b->buf + off) + fields[f];
+            *v += base;
+        }
+    }
+}
+
+static void write_snapshot(const char *snap_path, const struct stat *rc_st, rc_scan *sc,
+                           uint64_t dhash, const var_list *before) {
+    sbuf deps = { 0 }, ops = { 0 }, opts = { 0 }, dirs = { 0 }, entries = { 0 }, slots = { 0 }, strs = { 0 };
+    snap_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, 8);
+    h.rc_dev = rc_st->st_dev;
+    h.rc_ino = rc_st->st_ino;
+    h.rc_size = (uint64_t)rc_st->st_size;
+    h.rc_mtime_sec = rc_st->st_mtim.tv_sec;
+    h.rc_mtime_nsec = rc_st->st_mtim.tv_nsec;
+    h.deps_hash = dhash;
+
+    for (int i = 0; i < sc->n; ++i) {
+        uint32_t off = sb_str(&strs, sc->names[i]);
+        sb_add(&deps, &off, sizeof(off));
+    }
+    h.ndeps = (uint32_t)sc->n;
+
+    diff_ctx d = { &ops, &strs, before, sc, 0 };
+    var_foreach(diff_var, &d);
+    /* unset now: whatever it unset, including names that were not set */
+    for (int i = 0; i < sc->nsets; ++i) {
+        if (var_get(sc->sets[i])) continue;
+        uint32_t off = sb_str(&strs, sc->sets[i]);
+        snap_op op = { SNAP_UNSET, 0, off, off };
+        sb_add(&ops, &op, sizeof(op));
+        d.n++;
+    }
+    for (size_t i = 0; i < before->n; ++i) {
+        char *name = strndup(before->entries[i], before->name_len[i]);
+        if (name && !var_get(name) && !rc_sets(sc, name, strlen(name))) {
+            uint32_t off = sb_str(&strs, name);
+            snap_op op = { SNAP_UNSET, 0, off, off };
+            sb_add(&ops, &op, sizeof(op));
+            d.n++;
+        }
+        free(name);
+    }
+    h.nops = d.n;
+
+    for (int i = 0; shell_option_name(i); ++i) {
+        snap_opt o = { sb_str(&strs, shell_option_name(i)), (uint32_t)shell_option_get(i) };
+        sb_add(&opts, &o, sizeof(o));
+        h.nopts++;
+    }
+
+    const char *path = var_get("PATH");
+    h.path_off = sb_str(&strs, path ? path : "");
+    if (path) build_index(path, &dirs, &entries, &slots, &strs, &h.ndirs, &h.nentries, &h.nslots);
+
+    /* layout: header, records, strings */
+    size_t off = sizeof(h);
+    h.deps_off = (uint32_t)off;     off += deps.len;
+    h.ops_off = (uint32_t)off;      off += ops.len;
+    h.opts_off = (uint32_t)off;     off += opts.len;
+    h.dirs_off = (uint32_t)off;     off += dirs.len;
+    h.entries_off = (uint32_t)off;  off += entries.len;
+    h.slots_off = (uint32_t)off;    off += slots.len;
+    uint32_t base = (uint32_t)off;
+    h.size = off + strs.len;
+    h.path_off += base;
+    rebase(&deps, sizeof(uint32_t), (const int[]){ 0 }, 1, base);
+    rebase(&ops, sizeof(snap_op), (const int[]){ 2, 3 }, 2, base);
+    rebase(&opts, sizeof(snap_opt), (const int[]){ 0 }, 1, base);
+    rebase(&dirs, sizeof(snap_dir), (const int[]){ 0 }, 1, base);
+    rebase(&entries, sizeof(snap_entry), (const int[]){ 1, 2 }, 2, base);
+
+    /* a new file renamed over the old one: a starting shell never sees half of it */
+    size_t plen = strlen(snap_path);
+    char *tmp = malloc(plen + 8);
+    if (tmp) {
+        memcpy(tmp, snap_path, plen);
+        memcpy(tmp + plen, ".XXXXXX", 8);
+    }
+    int fd = tmp ? mkstemp(tmp) : -1;
+    if (fd >= 0) {
+        sbuf *parts[] = { &deps, &ops, &opts, &dirs, &entries, &slots, &strs };
+        int ok = write(fd, &h, sizeof(h)) == (ssize_t)sizeof(h);
+        for (size_t i = 0; ok && i < sizeof(parts) / sizeof(parts[0]); ++i)
+            ok = parts[i]->len == 0 || write(fd, parts[i]->buf, parts[i]->len) == (ssize_t)parts[i]->len;
+        close(fd);
+        if (!ok || rename(tmp, snap_path) != 0) unlink(tmp);
+    }
+    free(tmp);
+    free(deps.buf);
+    free(ops.buf);
+    free(opts.buf);
+    free(dirs.buf);
+    free(entries.buf);
+    free(slots.buf);
+    free(strs.buf);
+}
+
+/* ---------------- loading a snapshot ---------------- */
+
+/* Every section inside the file */
+static int sections_fit(const snap_header *h, size_t len) {
+    const struct { uint32_t off, n; size_t size; } sec[] = {
+        { h->deps_off, h->ndeps, sizeof(uint32_t) }, { h->ops_off, h->nops, sizeof(snap_op) },
+        { h->opts_off, h->nopts, sizeof(snap_opt) }, { h->dirs_off, h->ndirs, sizeof(snap_dir) },
+        { h->entries_off, h->nentries, sizeof(snap_entry) }, { h->slots_off, h->nslots, sizeof(uint32_t) },
+    };
+    for (size_t i = 0; i < sizeof(sec) / sizeof(sec[0]); ++i)
+        if (sec[i].off > len || sec[i].off % sizeof(uint32_t) ||
+            (len - sec[i].off) / sec[i].size < sec[i].n) return 0;
+    return h->path_off < len && len > 0 && ((const char *)h)[len - 1] == '\0' &&
+           (h->nslots & (h->nslots - 1)) == 0;
+}
+
+/* Every string offset inside the file and every slot naming an entry.
+ * Strings need no other check: the file ends with a NUL (sections_fit). */
+static int records_valid(const char *m, size_t len) {
+    const snap_header *h = (const snap_header *)m;
+    const uint32_t *deps = (const uint32_t *)(m + h->deps_off);
+    for (uint32_t i = 0; i < h->ndeps; ++i)
+        if (deps[i] >= len) return 0;
+    const snap_op *ops = (const snap_op *)(m + h->ops_off);
+    for (uint32_t i = 0; i < h->nops; ++i)
+        if (ops[i].kind > SNAP_UNSET || ops[i].name_off >= len || ops[i].value_off >= len) return 0;
+    const snap_opt *opts = (const snap_opt *)(m + h->opts_off);
+    for (uint32_t i = 0; i < h->nopts; ++i)
+        if (opts[i].name_off >= len) return 0;
+    const snap_dir *dirs = (const snap_dir *)(m + h->dirs_off);
+    for (uint32_t i = 0; i < h->ndirs; ++i)
+        if (dirs[i].path_off >= len) return 0;
+    const snap_entry *entries = (const snap_entry *)(m + h->entries_off);
+    for (uint32_t i = 0; i < h->nentries; ++i)
+        if (entries[i].name_off >= len || entries[i].path_off >= len) return 0;
+    /* path_index_lookup() probes until an empty slot: there must be one */
+    const uint32_t *slots = (const uint32_t *)(m + h->slots_off);
+    uint32_t empty = 0;
+    for (uint32_t i = 0; i < h->nslots; ++i) {
+        if (slots[i] > h->nentries) return 0;
+        empty += !slots[i];
+    }
+    return !h->nslots || empty;
+}
+
+/* Map snap_path if it is a snapshot of this rc file for these inputs */
+static char *map_snapshot(const char *snap_path, const struct stat *rc_st, size_t *len) {
+    int fd = open(snap_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    char *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(snap_header))
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+    *len = (size_t)st.st_size;
+
+    const snap_header *h = (const snap_header *)m;
+    int ok = memcmp(h->magic, SNAP_MAGIC, 8) == 0 && h->size == *len && sections_fit(h, *len) &&
+             records_valid(m, *len) &&
+             h->rc_dev == (uint64_t)rc_st->st_dev && h->rc_ino == (uint64_t)rc_st->st_ino &&
+             h->rc_size == (uint64_t)rc_st->st_size && h->rc_mtime_sec == rc_st->st_mtim.tv_sec &&
+             h->rc_mtime_nsec == rc_st->st_mtim.tv_nsec;
+    if (ok) {
+        char *names[RC_MAX_DEPS];
+        const uint32_t *deps = (const uint32_t *)(m + h->deps_off);
+        for (uint32_t i = 0; i < h->ndeps && i < RC_MAX_DEPS; ++i) names[i] = m + deps[i];
+        ok = h->ndeps <= RC_MAX_DEPS && deps_hash(names, (int)h->ndeps) == h->deps_hash;
+    }
+    /* a PATH directory changed: the index may be missing new programs */
+    const snap_dir *dirs = (const snap_dir *)(m + h->dirs_off);
+    for (uint32_t i = 0; ok && i < h->ndirs; ++i) {
+        struct stat ds;
+        int64_t sec = -1, nsec = -1;
+        if (stat(m + dirs[i].path_off, &ds) == 0) {
+            sec = ds.st_mtim.tv_sec;
+            nsec = ds.st_mtim.tv_nsec;
+        }
+        ok = sec == dirs[i].mtime_sec && nsec == dirs[i].mtime_nsec;
+    }
+    if (!ok) {
+        munmap(m, *len);
+        return NULL;
+    }
+    return m;
+}
+
+static void apply_snapshot(void) {
+    const snap_header *h = (const snap_header *)map;
+    const snap_op *ops = (const snap_op *)(map + h->ops_off);
+    for (uint32_t i = 0; i < h->nops; ++i) {
+        if (ops[i].kind == SNAP_UNSET) {
+            var_unset(at(ops[i].name_off));
+            continue;
+        }
+        var_set(at(ops[i].name_off), at(ops[i].value_off));
+        if (ops[i].exported) var_export(at(ops[i].name_off));
+    }
+    const snap_opt *opts = (const snap_opt *)(map + h->opts_off);
+    for (uint32_t i = 0; i < h->nopts; ++i)
+        for (int k = 0; shell_option_name(k); ++k)
+            if (strcmp(shell_option_name(k), at(opts[i].name_off)) == 0) shell_option_set(k, (int)opts[i].value);
+
+    /* the index only holds for the PATH it was built from */
+    const char *path = var_get("PATH");
+    if (path && strcmp(path, at(h->path_off)) == 0) index_gen = sh->path_generation;
+}
+
+/* ---------------- entry points ---------------- */
+
+static char *rc_file_path(void) {
+    const char *rc = var_get("SHELLRC");
+    if (rc && *rc) return strdup(rc);
+    const char *home = var_get("HOME");
+    if (!home) return NULL;
+    size_t n = strlen(home) + sizeof("/.shellrc");
+    char *path = malloc(n);
+    if (path) snprintf(path, n, "%s/.shellrc", home);
+    return path;
+}
+
+/* Run the rc file, or apply its snapshot. use_snapshot 0: always run it
+ * and leave any snapshot alone. */
+void rc_startup(int use_snapshot) {
+    char *rc = rc_file_path();
+    struct stat st;
+    if (!rc || stat(rc, &st) != 0) {
+        free(rc);
+        return;
+    }
+    size_t plen = strlen(rc);
+    char *snap = malloc(plen + sizeof(".snap"));
+    if (!snap) {
+        free(rc);
+        return;
+    }
+    memcpy(snap, rc, plen);
+    memcpy(snap + plen, ".snap", sizeof(".snap"));
+
+    if (use_snapshot && (map = map_snapshot(snap, &st, &map_len))) {
+        apply_snapshot();
+        const snap_header *h = (const snap_header *)map;
+        snprintf(report, sizeof(report), "%s: snapshot %s (%u variable changes, %u programs indexed)",
+                 rc, snap, h->nops, h->nentries);
+        free(rc);
+        free(snap);
+        return;
+    }
+
+    char *text = read_file(rc, &st);
+    if (!text) {
+        snprintf(report, sizeof(report), "%s: %s", rc, strerror(errno));
+        free(rc);
+        free(snap);
+        return;
+    }
+    rc_scan sc = { .n = 0, .cacheable = 1 };
+    char *copy = strdup(text);
+    for (char *line = copy, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != '#' && *p != '\0') scan_line(&sc, p);
+    }
+    free(copy);
+
+    var_list before = { 0 };
+    uint64_t dhash = 0;
+    if (sc.cacheable && use_snapshot) {
+        var_foreach(collect_var, &before);
+        dhash = deps_hash(sc.names, sc.n);
+    }
+    run_rc(text);
+    if (sc.cacheable && use_snapshot) {
+        write_snapshot(snap, &st, &sc, dhash, &before);
+        snprintf(report, sizeof(report), "%s: evaluated, snapshot written to %s", rc, snap);
+    } else {
+        snprintf(report, sizeof(report), "%s: evaluated (%s)", rc,
+                 use_snapshot ? "runs commands, not cacheable" : "--no-snapshot");
+    }
+    free_var_list(&before);
+    for (int i = 0; i < sc.n; ++i) free(sc.names[i]);
+    for (int i = 0; i < sc.nsets; ++i) free(sc.sets[i]);
+    free(text);
+    free(rc);
+    free(snap);
+}
+
+/* What rc_startup() did, for --startup-profile */
+const char *rc_report(void) {
+    return report;
+}
@@ -0,0 +1,639 @@
+//******************************************************************************************************
+//* Name:        script.c                                                                              *
+//* Description: for/while/until/if and ';' lists, parsed once into bytecode and then run.             *
+//*              - A line that holds a ';' or starts with one of these keywords comes                  *
+//*                here instead of straight to process_command(). An open construct keeps              *
+//*                reading lines (prompt "> ") until it is closed, then the whole thing                *
+//*                is compiled and run.                                                                *
+//*              - Each simple command becomes an argv template. Words without ~, $ or                 *
+//*                glob characters are used as they are on every run; only the others                  *
+//*                are expanded again. The builtin (for an all-static argv) and the                    *
+//*                executable path are looked up once, the path again only after PATH                  *
+//*                changes (path_generation).                                                          *
+//*              - Commands with pipes, '&' or redirections keep their words but go                    *
+//*                through process_command() each time.                                                *
+//*              - The word list of a for loop is split at blanks and newlines after                   *
+//*                expansion, so "for i in $(seq 1 5)" runs five times.                                *
+//*              Only the construct as a whole goes into history.                                      *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+
+#define SCRIPT_MAX_DEPTH 64
+
+typedef enum {
+    OP_RUN,             /* a: command */
+    OP_JUMP,            /* a: target (-1 until a break/continue is patched) */
+    OP_JUMP_FAIL,       /* a: target, taken when $? != 0 */
+    OP_JUMP_OK,         /* a: target, taken when $? == 0 */
+    OP_STATUS,          /* $? = a */
+    OP_FOR_INIT,        /* a: loop; expand its word list */
+    OP_FOR_NEXT,        /* a: loop; next word into the variable, else jump to b */
+    OP_SAVE,            /* a: loop; remember $? as the loop's status */
+    OP_RESTORE,         /* a: loop; $? = the remembered status */
+} op_code;
+
+typedef struct {
+    int op;
+    int a, b;
+    int levels;         /* unpatched break/continue: loops still to leave */
+} insn;
+
+enum { JUMP_BREAK = 1, JUMP_CONTINUE = 2 };
+
+typedef enum {
+    CMD_SIMPLE,         /* builtin or external, run from the template */
+    CMD_ASSIGN,         /* NAME=value words only */
+    CMD_LINE,           /* anything else: process_command() */
+} cmd_kind;
+
+typedef struct {
+    cmd_kind kind;
+    char **words;               /* NULL-terminated; the strings belong to the program */
+    int nwords;
+    unsigned char *dynamic;     /* words[i] has ~, $ or glob characters */
+    int ndynamic;
+    const builtin_t *builtin;   /* all-static argv: looked up once */
+    int builtin_known;
+    char *path;                 /* static words[0]: resolved executable or NULL */
+    unsigned long path_gen;     /* path_generation when path was found, 0: never */
+} script_cmd;
+
+typedef struct {
+    const char *name;           /* for: the variable */
+    char **list;                /* for: the words after "in" */
+    int nlist;
+    char **items;               /* for: this run's expanded list */
+    int nitems, next;
+    int status;                 /* while/until: $? of the last body */
+} script_loop;
+
+typedef struct {
+    insn *code;
+    int ncode, capcode;
+    script_cmd *cmds;
+    int ncmds, capcmds;
+    script_loop *loops;
+    int nloops, caploops;
+} program;
+
+enum { PARSE_OK = 0, PARSE_ERROR = -1, PARSE_MORE = -2 };
+
+typedef struct {
+    program *pg;
+    char **tok;
+    size_t ntok, pos;
+    int depth;                  /* loops around the current command */
+    int nesting;                /* constructs of any kind */
+} parser;
+
+/* Lines of an open construct, each followed by a ";" token, are kept in
+ * sh->script_pending */
+
+static const char *const openers[] = { "for", "while", "until", "if", NULL };
+static const char *const closers[] = { "do", "done", "then", "elif", "else", "fi", NULL };
+
+static int in_set(const char *w, const char *const *set) {
+    for (int i = 0; set && set[i]; ++i)
+        if (strcmp(w, set[i]) == 0) return 1;
+    return 0;
+}
+
+static int is_sep(const char *w) {
+    return w[0] == ';' && w[1] == '\0';
+}
+
+/* ---------------- building the program ---------------- */
+
+static int emit(program *pg, int op, int a, int b) {
+    if (pg->ncode == pg->capcode) {
+        int cap = pg->capcode ? pg->capcode * 2 : 32;
+        insn *nc = realloc(pg->code, (size_t)cap * sizeof(insn));
+        if (!nc) return -1;
+        pg->code = nc;
+        pg->capcode = cap;
+    }
+    pg->code[pg->ncode] = (insn){ op, a, b, 0 };
+    return pg->ncode++;
+}
+
+static int new_loop(program *pg) {
+    if (pg->nloops == pg->caploops) {
+        int cap = pg->caploops ? pg->caploops * 2 : 4;
+        script_loop *nl = realloc(pg->loops, (size_t)cap * sizeof(script_loop));
+        if (!nl) return -1;
+        pg->loops = nl;
+        pg->caploops = cap;
+    }
+    memset(&pg->loops[pg->nloops], 0, sizeof(script_loop));
+    return pg->nloops++;
+}
+
+static int word_dynamic(const char *w) {
+    return w[0] == '~' || strchr(w, '$') || glob_has_magic(w);
+}
+
+/* The command in tok[0, n) */
+static int add_command(program *pg, char **tok, int n) {
+    if (pg->ncmds == pg->capcmds) {
+        int cap = pg->capcmds ? pg->capcmds * 2 : 16;
+        script_cmd *nc = realloc(pg->cmds, (size_t)cap * sizeof(script_cmd));
+        if (!nc) return -1;
+        pg->cmds = nc;
+        pg->capcmds = cap;
+    }
+    script_cmd *c = &pg->cmds[pg->ncmds];
+    memset(c, 0, sizeof(*c));
+    c->words = calloc((size_t)n + 1, sizeof(char *));
+    c->dynamic = calloc((size_t)n, 1);
+    if (!c->words || !c->dynamic) {
+        free(c->words);
+        free(c->dynamic);
+        return -1;
+    }
+    c->nwords = n;
+    int assignments = 0;
+    c->kind = CMD_SIMPLE;
+    for (int i = 0; i < n; ++i) {
+        const char *w = tok[i];
+        c->words[i] = tok[i];
+        c->dynamic[i] = (unsigned char)word_dynamic(w);
+        c->ndynamic += c->dynamic[i];
+        if (assignments == i && var_assignment_len(w)) assignments++;
+        if (strcmp(w, "|") == 0 || strcmp(w, "&") == 0 || w[0] == '<' || w[0] == '>' ||
+            redirect_width(w))
+            c->kind = CMD_LINE;
+    }
+    if (strcmp(tok[0], "pipeline") == 0) c->kind = CMD_LINE;
+    else if (c->kind == CMD_SIMPLE && assignments == n) c->kind = CMD_ASSIGN;
+    return pg->ncmds++;
+}
+
+static void syntax_error(parser *ps) {
+    dprintf(sh->fd_err, "syntax error near unexpected token `%s'\n",
+            ps->pos < ps->ntok ? ps->tok[ps->pos] : "newline");
+}
+
+static void skip_seps(parser *ps) {
+    while (ps->pos < ps->ntok && is_sep(ps->tok[ps->pos])) ps->pos++;
+}
+
+/* Expect keyword kw at the current position */
+static int expect(parser *ps, const char *kw) {
+    skip_seps(ps);
+    if (ps->pos == ps->ntok) return PARSE_MORE;
+    if (strcmp(ps->tok[ps->pos], kw) != 0) {
+        syntax_error(ps);
+        return PARSE_ERROR;
+    }
+    ps->pos++;
+    return PARSE_OK;
+}
+
+/* After done/fi only a separator may follow ("done | wc" is not supported) */
+static int construct_end(parser *ps) {
+    if (ps->pos < ps->ntok && !is_sep(ps->tok[ps->pos])) {
+        syntax_error(ps);
+        return PARSE_ERROR;
+    }
+    return PARSE_OK;
+}
+
+/* Point the break/continue jumps in code[from, ncode) left for this loop
+ * at its exit and continue targets. */
+static void patch_jumps(program *pg, int from, int exit_pc, int cont_pc) {
+    for (int i = from; i < pg->ncode; ++i) {
+        insn *in = &pg->code[i];
+        if (in->op != OP_JUMP || in->a != -1) continue;
+        if (--in->levels > 0) continue;             /* "break 2": the next loop out */
+        in->a = in->b == JUMP_BREAK ? exit_pc : cont_pc;
+    }
+}
+
+static int parse_list(parser *ps, const char *const *stops);
+
+static int parse_for(parser *ps) {
+    program *pg = ps->pg;
+    ps->pos++;
+    if (ps->pos == ps->ntok) return PARSE_MORE;
+    const char *name = ps->tok[ps->pos];
+    if (is_sep(name) || !var_name_valid(name, strlen(name))) {
+        if (is_sep(name)) syntax_error(ps);
+        else dprintf(sh->fd_err, "for: `%s': not a valid identifier\n", name);
+        return PARSE_ERROR;
+    }
+    ps->pos++;
+    int r = expect(ps, "in");
+    if (r != PARSE_OK) return r;
+    size_t list = ps->pos;
+    while (ps->pos < ps->ntok && !is_sep(ps->tok[ps->pos])) ps->pos++;
+    if (ps->pos == ps->ntok) return PARSE_MORE;
+
+    int slot = new_loop(pg);
+    if (slot < 0) return PARSE_ERROR;
+    pg->loops[slot].name = name;
+    pg->loops[slot].list = ps->tok + list;
+    pg->loops[slot].nlist = (int)(ps->pos - list);
+    if ((r = expect(ps, "do")) != PARSE_OK) return r;
+
+    emit(pg, OP_FOR_INIT, slot, 0);
+    int top = emit(pg, OP_FOR_NEXT, slot, -1);
+    ps->depth++;
+    r = parse_list(ps, (const char *const[]){ "done", NULL });
+    ps->depth--;
+    if (r != PARSE_OK) return r;
+    if ((r = expect(ps, "done")) != PARSE_OK) return r;
+    emit(pg, OP_JUMP, top, 0);
+    pg->code[top].b = pg->ncode;
+    patch_jumps(pg, top + 1, pg->ncode, top);
+    return construct_end(ps);
+}
+
+/* while/until COND; do BODY; done */
+static int parse_while(parser *ps) {
+    program *pg = ps->pg;
+    int until = strcmp(ps->tok[ps->pos], "until") == 0;
+    ps->pos++;
+    int slot = new_loop(pg);
+    if (slot < 0) return PARSE_ERROR;
+
+    emit(pg, OP_STATUS, 0, 0);
+    emit(pg, OP_SAVE, slot, 0);
+    int top = pg->ncode;
+    int r = parse_list(ps, (const char *const[]){ "do", NULL });
+    if (r != PARSE_OK) return r;
+    if ((r = expect(ps, "do")) != PARSE_OK) return r;
+    int test = emit(pg, until ? OP_JUMP_OK : OP_JUMP_FAIL, -1, 0);
+    ps->depth++;
+    r = parse_list(ps, (const char *const[]){ "done", NULL });
+    ps->depth--;
+    if (r != PARSE_OK) return r;
+    if ((r = expect(ps, "done")) != PARSE_OK) return r;
+    int save = emit(pg, OP_SAVE, slot, 0);
+    emit(pg, OP_JUMP, top, 0);
+    pg->code[test].a = emit(pg, OP_RESTORE, slot, 0);
+    patch_jumps(pg, test + 1, pg->ncode, save);
+    return construct_end(ps);
+}
+
+/* if COND; then BODY; [elif COND; then BODY;]... [else BODY;] fi */
+static int parse_if(parser *ps) {
+    program *pg = ps->pg;
+    int ends[SCRIPT_MAX_DEPTH], nends = 0;
+    const char *const body_stops[] = { "elif", "else", "fi", NULL };
+    int r;
+    do {
+        ps->pos++;                                  /* "if" or "elif" */
+        if ((r = parse_list(ps, (const char *const[]){ "then", NULL })) != PARSE_OK) return r;
+        if ((r = expect(ps, "then")) != PARSE_OK) return r;
+        int test = emit(pg, OP_JUMP_FAIL, -1, 0);
+        if ((r = parse_list(ps, body_stops)) != PARSE_OK) return r;
+        if (nends == SCRIPT_MAX_DEPTH) {
+            dprintf(sh->fd_err, "if: too many elif branches\n");
+            return PARSE_ERROR;
+        }
+        ends[nends++] = emit(pg, OP_JUMP, -2, 0);
+        pg->code[test].a = pg->ncode;
+    } while (strcmp(ps->tok[ps->pos], "elif") == 0);
+
+    if (strcmp(ps->tok[ps->pos], "else") == 0) {
+        ps->pos++;
+        if ((r = parse_list(ps, (const char *const[]){ "fi", NULL })) != PARSE_OK) return r;
+    } else {
+        emit(pg, OP_STATUS, 0, 0);                  /* no branch taken */
+    }
+    if ((r = expect(ps, "fi")) != PARSE_OK) return r;
+    for (int i = 0; i < nends; ++i) pg->code[ends[i]].a = pg->ncode;
+    return construct_end(ps);
+}
+
+/* break [N] / continue [N] */
+static int parse_jump(parser *ps, size_t end) {
+    const char *w = ps->tok[ps->pos];
+    int kind = strcmp(w, "break") == 0 ? JUMP_BREAK : JUMP_CONTINUE;
+    int levels = 1;
+    if (end - ps->pos > 2 || (end - ps->pos == 2 && (levels = atoi(ps->tok[ps->pos + 1])) < 1)) {
+        dprintf(sh->fd_err, "%s: usage: %s [N]\n", w, w);
+        return PARSE_ERROR;
+    }
+    ps->pos = end;
+    if (ps->depth == 0) {
+        dprintf(sh->fd_err, "%s: only meaningful in a loop\n", w);
+        emit(ps->pg, OP_STATUS, 0, 0);
+        return PARSE_OK;
+    }
+    emit(ps->pg, OP_STATUS, 0, 0);
+    int j = emit(ps->pg, OP_JUMP, -1, kind);
+    ps->pg->code[j].levels = levels < ps->depth ? levels : ps->depth;
+    return PARSE_OK;
+}
+
+/* Commands up to one of stops (at the start of a command). An empty list
+ * is an error, as in sh. */
+static int parse_list(parser *ps, const char *const *stops) {
+    int count = 0;
+    if (++ps->nesting > SCRIPT_MAX_DEPTH) {
+        dprintf(sh->fd_err, "syntax error: nested too deeply\n");
+        return PARSE_ERROR;
+    }
+    for (;;) {
+        skip_seps(ps);
+        if (ps->pos == ps->ntok) {
+            ps->nesting--;
+            if (!stops) return PARSE_OK;
+            return PARSE_MORE;
+        }
+        const char *w = ps->tok[ps->pos];
+        if (in_set(w, stops)) {
+            ps->nesting--;
+            if (count == 0) {
+                syntax_error(ps);
+                return PARSE_ERROR;
+            }
+            return PARSE_OK;
+        }
+        if (in_set(w, closers)) {
+            syntax_error(ps);
+            return PARSE_ERROR;
+        }
+        int r;
+        if (strcmp(w, "for") == 0) {
+            r = parse_for(ps);
+        } else if (strcmp(w, "while") == 0 || strcmp(w, "until") == 0) {
+            r = parse_while(ps);
+        } else if (strcmp(w, "if") == 0) {
+            r = parse_if(ps);
+        } else {
+            size_t end = ps->pos;
+            while (end < ps->ntok && !is_sep(ps->tok[end])) end++;
+            if (strcmp(w, "break") == 0 || strcmp(w, "continue") == 0) {
+                r = parse_jump(ps, end);
+            } else {
+                int c = add_command(ps->pg, ps->tok + ps->pos, (int)(end - ps->pos));
+                r = c < 0 ? PARSE_ERROR : PARSE_OK;
+                if (c >= 0) emit(ps->pg, OP_RUN, c, 0);
+                ps->pos = end;
+            }
+        }
+        if (r != PARSE_OK) return r;
+        count++;
+    }
+}
+
+static void program_free(program *pg) {
+    for (int i = 0; i < pg->ncmds; ++i) {
+        free(pg->cmds[i].words);
+        free(pg->cmds[i].dynamic);
+        free(pg->cmds[i].path);
+    }
+    for (int i = 0; i < pg->nloops; ++i) free_argv(pg->loops[i].items);
+    free(pg->cmds);
+    free(pg->loops);
+    free(pg->code);
+}
+
+/* ---------------- running it ---------------- */
+
+/* Expand a for loop's words and split them at blanks and newlines */
+static void for_init(script_loop *l) {
+    free_argv(l->items);
+    l->items = NULL;
+    l->nitems = l->next = 0;
+    char **words = l->nlist ? expand_argv(l->list, l->nlist) : NULL;
+    int cap = 0;
+    for (int i = 0; words && words[i]; ++i) {
+        char *save = NULL;
+        for (char *f = strtok_r(words[i], " \t\n", &save); f; f = strtok_r(NULL, " \t\n", &save)) {
+            if (l->nitems + 1 >= cap) {
+                char **ni = realloc(l->items, (size_t)(cap ? cap * 2 : 16) * sizeof(char *));
+                if (!ni) goto out;
+                l->items = ni;
+                cap = cap ? cap * 2 : 16;
+            }
+            l->items[l->nitems] = strdup(f);
+            if (l->items[l->nitems]) l->nitems++;
+            l->items[l->nitems] = NULL;
+        }
+    }
+out:
+    free_argv(words);
+    sh->last_exit_status = 0;
+}
+
+static void run_line_cmd(script_cmd *c) {
+    tokenlist tokens = { c->words, (size_t)c->nwords };
+    process_command(&tokens);
+}
+
+static void run_assign(script_cmd *c) {
+    sh->last_exit_status = 0;
+    for (int i = 0; i < c->nwords; ++i) {
+        char *value = expand_word(c->words[i]);
+        if (!value || var_assign(value) != 0) sh->last_exit_status = 1;
+        if (value && value != c->words[i]) free(value);
+    }
+}
+
+/* Template words as they are, the dynamic ones expanded afresh */
+static void run_simple(script_cmd *c) {
+    char **argv = c->words;
+    char **owned[c->ndynamic ? c->ndynamic : 1];
+    int nowned = 0;
+    if (c->ndynamic) {
+        int n = 0, cap = c->nwords + 1;
+        argv = malloc((size_t)cap * sizeof(char *));
+        if (!argv) return;
+        for (int i = 0; i < c->nwords; ++i) {
+            if (!c->dynamic[i]) {
+                argv[n++] = c->words[i];
+                continue;
+            }
+            char **e = expand_argv(&c->words[i], 1);
+            if (!e) continue;
+            owned[nowned++] = e;
+            for (int k = 0; e[k]; ++k) {
+                if (e[k][0] == '<' || e[k][0] == '>' || redirect_width(e[k])) {
+                    /* expanded into a redirection: take the long way */
+                    for (int j = 0; j < nowned; ++j) free_argv(owned[j]);
+                    free(argv);
+                    run_line_cmd(c);
+                    return;
+                }
+                if (n + 1 >= cap) {
+                    char **na = realloc(argv, (size_t)(cap *= 2) * sizeof(char *));
+                    if (!na) break;
+                    argv = na;
+                }
+                argv[n++] = e[k];
+            }
+        }
+        argv[n] = NULL;
+    }
+
+    const builtin_t *b;
+    if (c->builtin_known) {
+        b = c->builtin;
+    } else {
+        b = builtin_find(argv);
+        if (!c->ndynamic) {
+            c->builtin = b;
+            c->builtin_known = 1;
+        }
+    }
+    if (!argv[0]) {
+        sh->last_exit_status = 0;
+    } else if (b) {
+        sh->last_exit_status = run_builtin(b, argv, sh->fd_out);
+    } else if (!c->dynamic[0]) {
+        if (c->path_gen != sh->path_generation) {
+            free(c->path);
+            c->path = find_executable(argv[0]);
+            c->path_gen = sh->path_generation;
+        }
+        execute_command(argv, c->path, 0);
+    } else {
+        char *path = find_executable(argv[0]);
+        execute_command(argv, path, 0);
+        free(path);
+    }
+
+    if (argv != c->words) free(argv);
+    for (int j = 0; j < nowned; ++j) free_argv(owned[j]);
+}
+
+static void run_program(program *pg) {
+    int pc = 0;
+    while (pc < pg->ncode && !sh->exited) { /* libshell: exit ends the run */
+        const insn *in = &pg->code[pc++];
+        switch (in->op) {
+        case OP_RUN: {
+            script_cmd *c = &pg->cmds[in->a];
+            if (c->kind == CMD_SIMPLE) run_simple(c);
+            else if (c->kind == CMD_ASSIGN) run_assign(c);
+            else run_line_cmd(c);
+            break;
+        }
+        case OP_JUMP:
+            pc = in->a;
+            break;
+        case OP_JUMP_FAIL:
+            if (sh->last_exit_status != 0) pc = in->a;
+            break;
+        case OP_JUMP_OK:
+            if (sh->last_exit_status == 0) pc = in->a;
+            break;
+        case OP_STATUS:
+            sh->last_exit_status = in->a;
+            break;
+        case OP_FOR_INIT:
+            for_init(&pg->loops[in->a]);
+            break;
+        case OP_FOR_NEXT: {
+            script_loop *l = &pg->loops[in->a];
+            if (l->next < l->nitems) var_set(l->name, l->items[l->next++]);
+            else pc = in->b;
+            break;
+        }
+        case OP_SAVE:
+            pg->loops[in->a].status = sh->last_exit_status;
+            break;
+        case OP_RESTORE:
+            sh->last_exit_status = pg->loops[in->a].status;
+            break;
+        }
+    }
+}
+
+/* The construct on one line for history: "for x in a b; do echo $x; done" */
+static char *join_source(tokenlist *tokens) {
+    size_t len = 1;
+    for (size_t i = 0; i < tokens->size; ++i) len += strlen(tokens->items[i]) + 2;
+    char *out = malloc(len);
+    if (!out) return NULL;
+    size_t n = 0;
+    const char *prev = NULL;
+    for (size_t i = 0; i < tokens->size; ++i) {
+        const char *w = tokens->items[i];
+        if (is_sep(w)) {
+            /* "do;" "then;" and doubled or trailing separators are dropped */
+            if (!prev || is_sep(prev) || in_set(prev, (const char *const[]){ "do", "then", "else", NULL }) ||
+                i + 1 == tokens->size)
+                continue;
+            out[n++] = ';';
+        } else {
+            if (n) out[n++] = ' ';
+            memcpy(out + n, w, strlen(w));
+            n += strlen(w);
+        }
+        prev = w;
+    }
+    out[n] = '\0';
+    return out;
+}
+
+/* ---------------- entry points ---------------- */
+
+/* True if the line needs the compiler, or continues an open construct */
+int script_needed(tokenlist *tokens) {
+    if (sh->script_pending) return 1;
+    const char *w = tokens->items[0];
+    if (in_set(w, openers) || in_set(w, closers) || strcmp(w, "break") == 0 || strcmp(w, "continue") == 0)
+        return 1;
+    for (size_t i = 0; i < tokens->size; ++i)
+        if (is_sep(tokens->items[i])) return 1;
+    return 0;
+}
+
+int script_pending(void) {
+    return sh->script_pending != NULL;
+}
+
+/* End of input inside a construct */
+void script_discard(void) {
+    if (!sh->script_pending) return;
+    dprintf(sh->fd_err, "syntax error: unexpected end of file\n");
+    free_tokens(sh->script_pending);
+    sh->script_pending = NULL;
+    sh->last_exit_status = 2;
+}
+
+/* Compile and run tokens (one line). With more_ok an unfinished construct
+ * waits for the next line (script_pending()); otherwise it is an error. */
+void script_run(tokenlist *tokens, int more_ok) {
+    tokenlist *all = new_tokenlist();
+    if (more_ok && sh->script_pending) {
+        free_tokens(all);
+        all = sh->script_pending;
+        sh->script_pending = NULL;
+    }
+    for (size_t i = 0; i < tokens->size; ++i) add_token(all, tokens->items[i]);
+    add_token(all, ";");
+
+    program pg = { 0 };
+    parser ps = { &pg, all->items, all->size, 0, 0, 0 };
+    int r = parse_list(&ps, NULL);
+    if (r == PARSE_MORE && more_ok) {
+        program_free(&pg);
+        sh->script_pending = all;
+        return;
+    }
+    if (r == PARSE_MORE) {
+        dprintf(sh->fd_err, "syntax error: unexpected end of file\n");
+        r = PARSE_ERROR;
+    }
+    if (r == PARSE_ERROR) {
+        sh->last_exit_status = 2;
+    } else {
+        char *src = join_source(all);
+        if (src && *src) add_to_history(src);
+        free(src);
+        history_hold(1);
+        run_program(&pg);
+        history_hold(0);
+    }
+    program_free(&pg);
+    free_tokens(all);
+}
@@ -0,0 +1,451 @@
+//******************************************************************************************************
+//* Name:        serve.c                                                                               *
+//* Description: "bin/shell --serve PATH [--workers N]": run command lines sent over a                 *
+//*              Unix-domain stream socket instead of starting one shell per request.                  *
+//*              - One epoll loop owns the listening socket, every client connection                   *
+//*                and a signalfd for SIGCHLD; idle connections cost a buffer and an                   *
+//*                epoll entry.                                                                        *
+//*              - Each request runs in a forked worker through shell_run_line(), the                  *
+//*                same path as interactive input, so cd/export in one request never                   *
+//*                leak into the next. At most N workers run at once (default: online                  *
+//*                CPUs); further requests wait in a FIFO.                                             *
+//*              - A connection has one request in flight; later frames on the same                    *
+//*                connection are answered in order.                                                   *
+//*                                                                                                    *
+//*              Framing (all integers big-endian):                                                    *
+//*                request   u32 len | u8 flags | command line (len - 1 bytes)                         *
+//*                          flags bit 0: capture stdout/stderr (otherwise /dev/null)                  *
+//*                response  u32 len | u32 status | u64 elapsed_us | u32 out_len |                     *
+//*                          u32 err_len | stdout bytes | stderr bytes                                 *
+//*              status follows $?: exit code, or 128 + signal number.                                 *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+#define SERVE_MAX_REQUEST (1 << 20)   /* largest accepted command frame */
+#define SERVE_MAX_EVENTS 256
+#define SERVE_FLAG_CAPTURE 0x1
+
+typedef struct client {
+    int fd;
+    char *in;                   /* unparsed bytes read from the peer */
+    size_t in_len, in_cap;
+    char *out;                  /* response bytes not yet written */
+    size_t out_len, out_off, out_cap;
+    int busy;                   /* a request is queued or running */
+    int closed;                 /* peer went away while busy */
+    int want_out;               /* EPOLLOUT currently registered */
+    char *line;                 /* queued request */
+    int flags;
+    struct client *next;        /* pending FIFO link */
+} client;
+
+typedef struct {
+    pid_t pid;                  /* 0 when the slot is free */
+    client *c;
+    int out_fd, err_fd;         /* capture memfds, or -1 */
+    struct timespec start;
+} worker;
+
+static int epfd = -1, listen_fd = -1, sig_fd = -1;
+static worker *workers;
+static int max_workers, running;
+static client *pending_head, *pending_tail;
+static client *graveyard;       /* closed clients, freed after the event batch */
+
+/* epoll tags for the two non-client fds */
+static int listen_tag, signal_tag;
+
+static int buf_reserve(char **buf, size_t len, size_t *cap, size_t n) {
+    if (len + n <= *cap) return 0;
+    size_t ncap = *cap ? *cap : 4096;
+    while (ncap < len + n) ncap *= 2;
+    char *nb = realloc(*buf, ncap);
+    if (!nb) return -1;
+    *buf = nb;
+    *cap = ncap;
+    return 0;
+}
+
+static int buf_append(char **buf, size_t *len, size_t *cap, const void *data, size_t n) {
+    if (buf_reserve(buf, *len, cap, n) != 0) return -1;
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t get_u32(const char *s) {
+    const unsigned char *p = (const unsigned char *)s;
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Close the connection now; the struct may still be referenced by the
+ * current epoll batch, so it is only freed by free_graveyard(). */
+static void client_free(client *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->next = graveyard;
+    graveyard = c;
+}
+
+static void free_graveyard(void) {
+    while (graveyard) {
+        client *c = graveyard;
+        graveyard = c->next;
+        free(c->in);
+        free(c->out);
+        free(c->line);
+        free(c);
+    }
+}
+
+static void set_events(client *c, int want_out) {
+    if (c->want_out == want_out) return;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0), .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->want_out = want_out;
+}
+
+/* Write as much of the pending response as the socket takes. Returns -1 if
+ * the peer is gone. */
+static int client_flush(client *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                set_events(c, 1);
+                return 0;
+            }
+            return -1;
+        }
+        c->out_off += (size_t)w;
+    }
+    c->out_len = c->out_off = 0;
+    set_events(c, 0);
+    return 0;
+}
+
+static void dispatch(void);
+
+/* Take the next complete frame off c->in, if c is idle. Returns -1 on a
+ * protocol error (the connection is then dropped). */
+static int client_parse(client *c) {
+    if (c->busy || c->in_len < 4) return 0;
+    uint32_t len = get_u32(c->in);
+    if (len < 1 || len > SERVE_MAX_REQUEST) return -1;
+    if (c->in_len < 4 + (size_t)len) return 0;
+
+    c->flags = (unsigned char)c->in[4];
+    c->line = malloc(len);
+    if (!c->line) return -1;
+    memcpy(c->line, c->in + 5, len - 1);
+    c->line[len - 1] = '\0';
+    c->in_len -= 4 + (size_t)len;
+    memmove(c->in, c->in + 4 + len, c->in_len);
+
+    c->busy = 1;
+    c->next = NULL;
+    if (pending_tail) pending_tail->next = c;
+    else pending_head = c;
+    pending_tail = c;
+    dispatch();
+    return 0;
+}
+
+static void client_readable(client *c) {
+    char buf[16384];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            if (buf_append(&c->in, &c->in_len, &c->in_cap, buf, (size_t)n) != 0) n = 0;
+            else continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        /* EOF or error: keep the struct until its running request finishes */
+        if (c->busy) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+            c->closed = 1;
+        } else {
+            client_free(c);
+        }
+        return;
+    }
+    if (client_parse(c) != 0) {
+        if (c->busy) c->closed = 1;
+        else client_free(c);
+    }
+}
+
+/* Child side of a request: plain stdio on /dev/null or the capture memfds. */
+static void run_worker(client *c, int out_fd, int err_fd) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    close(epfd);
+    close(listen_fd);
+    close(sig_fd);
+
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(out_fd >= 0 ? out_fd : null_fd, STDOUT_FILENO);
+    dup2(err_fd >= 0 ? err_fd : null_fd, STDERR_FILENO);
+    if (null_fd > STDERR_FILENO) close(null_fd);
+
+    int status = shell_run_line(c->line);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status & 0xff);
+}
+
+static void dispatch(void) {
+    while (pending_head && running < max_workers) {
+        client *c = pending_head;
+        pending_head = c->next;
+        if (!pending_head) pending_tail = NULL;
+
+        worker *w = NULL;
+        for (int i = 0; i < max_workers; ++i) {
+            if (workers[i].pid == 0) {
+                w = &workers[i];
+                break;
+            }
+        }
+        w->c = c;
+        w->out_fd = w->err_fd = -1;
+        if (c->flags & SERVE_FLAG_CAPTURE) {
+            w->out_fd = memfd_create("serve-out", MFD_CLOEXEC);
+            w->err_fd = memfd_create("serve-err", MFD_CLOEXEC);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &w->start);
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) run_worker(c, w->out_fd, w->err_fd);
+        if (pid < 0) {
+            perror("serve: fork");
+            /* requeue at the front and retry when a worker exits */
+            if (w->out_fd >= 0) close(w->out_fd);
+            if (w->err_fd >= 0) close(w->err_fd);
+            c->next = pending_head;
+            pending_head = c;
+            if (!pending_tail) pending_tail = c;
+            return;
+        }
+        w->pid = pid;
+        running++;
+        free(c->line);
+        c->line = NULL;
+    }
+}
+
+static int append_capture(client *c, int fd) {
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) return 0;
+    size_t size = (size_t)st.st_size;
+    if (buf_reserve(&c->out, c->out_len, &c->out_cap, size) != 0) return -1;
+    ssize_t n = pread(fd, c->out + c->out_len, size, 0);
+    if (n != (ssize_t)size) return -1;
+    c->out_len += size;
+    return 0;
+}
+
+static uint32_t capture_size(int fd) {
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) return 0;
+    return (uint32_t)st.st_size;
+}
+
+static void finish_request(worker *w, int wstatus) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t us = (uint64_t)(end.tv_sec - w->start.tv_sec) * 1000000u +
+                  (uint64_t)((end.tv_nsec - w->start.tv_nsec) / 1000);
+    uint32_t status = WIFEXITED(wstatus) ? (uint32_t)WEXITSTATUS(wstatus)
+                                         : 128u + (uint32_t)WTERMSIG(wstatus);
+    client *c = w->c;
+
+    if (!c->closed) {
+        uint32_t out_len = capture_size(w->out_fd), err_len = capture_size(w->err_fd);
+        unsigned char hdr[24];
+        put_u32(hdr, 20 + out_len + err_len);
+        put_u32(hdr + 4, status);
+        put_u32(hdr + 8, (uint32_t)(us >> 32));
+        put_u32(hdr + 12, (uint32_t)us);
+        put_u32(hdr + 16, out_len);
+        put_u32(hdr + 20, err_len);
+        if (buf_append(&c->out, &c->out_len, &c->out_cap, hdr, sizeof(hdr)) != 0 ||
+            append_capture(c, w->out_fd) != 0 || append_capture(c, w->err_fd) != 0 ||
+            client_flush(c) != 0) {
+            c->closed = 1;
+        }
+    }
+    if (w->out_fd >= 0) close(w->out_fd);
+    if (w->err_fd >= 0) close(w->err_fd);
+    w->pid = 0;
+    w->c = NULL;
+    running--;
+
+    c->busy = 0;
+    if (c->closed) client_free(c);
+    else if (client_parse(c) != 0 && !c->busy) client_free(c);
+}
+
+static void reap_workers(void) {
+    int wstatus;
+    pid_t pid;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+        for (int i = 0; i < max_workers; ++i) {
+            if (workers[i].pid == pid) {
+                finish_request(&workers[i], wstatus);
+                break;
+            }
+        }
+    }
+    dispatch();
+}
+
+static void accept_clients(void) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("serve: accept");
+            return;
+        }
+        client *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = c };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+int serve_main(const char *path, int nworkers) {
+    if (nworkers <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = n > 0 ? (int)n : 1;
+    }
+    max_workers = nworkers;
+    workers = calloc((size_t)max_workers, sizeof(worker));
+    if (!workers) return 1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "serve: socket path too long: %s\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("serve: socket");
+        return 1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "serve: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    /* SIGCHLD drives worker completion; SIGINT/SIGTERM stop the server */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sig_fd < 0 || epfd < 0) {
+        perror("serve: setup");
+        return 1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listen_tag };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &signal_tag;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sig_fd, &ev);
+
+    fprintf(stderr, "serve: listening on %s with %d workers\n", path, max_workers);
+
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    int stop = 0;
+    while (!stop) {
+        int n = epoll_wait(epfd, events, SERVE_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("serve: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_clients();
+            } else if (tag == &signal_tag) {
+                struct signalfd_siginfo si;
+                while (read(sig_fd, &si, sizeof(si)) == sizeof(si))
+                    if (si.ssi_signo != SIGCHLD) stop = 1;
+                reap_workers();
+            } else {
+                client *c = tag;
+                if (c->fd < 0) continue;
+                if ((events[i].events & EPOLLOUT) && client_flush(c) != 0) {
+                    if (c->busy) {
+                        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                        c->closed = 1;
+                    } else {
+                        client_free(c);
+                    }
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    client_readable(c);
+            }
+        }
+        free_graveyard();
+    }
+
+    for (int i = 0; i < max_workers; ++i)
+        if (workers[i].pid > 0) kill(workers[i].pid, SIGTERM);
+    while (running > 0 && waitpid(-1, NULL, 0) > 0) running--;
+    close(listen_fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,167 @@
+//******************************************************************************************************
+//* Name:        spsc_ring.c                                                                           *
+//* Description: Single-producer/single-consumer byte ring joining two threaded builtin                *
+//*              stages of a pipeline (see execute_pipeline in piping.c), and the                      *
+//*              bio_read()/bio_write() calls builtins use so the same code runs on fds                *
+//*              or on rings.                                                                          *
+//*              - head and tail are free-running byte counters; each side only writes                 *
+//*                its own and reads the other's with acquire/release atomics, so while               *
+//*                the ring is neither full nor empty no lock is taken and no system                   *
+//*                call is made.                                                                       *
+//*              - A side that has to wait sets its waiting flag and sleeps on a condition             *
+//*                variable; the other side only touches the mutex when that flag is set.              *
+//*              - Closing the write side is EOF for the reader; closing the read side                 *
+//*                makes further writes fail with EPIPE, like a pipe.                                  *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "shell.h"
+
+struct spsc_ring {
+    char *buf;
+    size_t cap;                 /* power of two */
+    size_t head;                /* bytes ever written (producer) */
+    size_t tail;                /* bytes ever read (consumer) */
+    int write_closed;
+    int read_closed;
+    int reader_waiting;
+    int writer_waiting;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+spsc_ring *spsc_ring_new(size_t cap) {
+    size_t size = 4096;
+    while (size < cap) size *= 2;
+    spsc_ring *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->buf = malloc(size);
+    if (!r->buf) {
+        free(r);
+        return NULL;
+    }
+    r->cap = size;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    return r;
+}
+
+void spsc_ring_free(spsc_ring *r) {
+    if (!r) return;
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->buf);
+    free(r);
+}
+
+/* Wake the other side if it is (about to be) asleep. The fence pairs with
+ * the one in ring_wait: either the sleeper sees our update or we see its
+ * flag. */
+static void ring_wake(spsc_ring *r, int *their_flag) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(their_flag, __ATOMIC_RELAXED)) return;
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Sleep until ready(r) is true */
+static void ring_wait(spsc_ring *r, int *my_flag, int (*ready)(spsc_ring *)) {
+    pthread_mutex_lock(&r->lock);
+    __atomic_store_n(my_flag, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (!ready(r)) pthread_cond_wait(&r->cond, &r->lock);
+    __atomic_store_n(my_flag, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&r->lock);
+}
+
+static int readable(spsc_ring *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != r->tail ||
+           __atomic_load_n(&r->write_closed, __ATOMIC_ACQUIRE);
+}
+
+static int writable(spsc_ring *r) {
+    return r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) < r->cap ||
+           __atomic_load_n(&r->read_closed, __ATOMIC_ACQUIRE);
+}
+
+/* Up to n bytes; blocks while the ring is empty. 0 at EOF. */
+ssize_t spsc_ring_read(spsc_ring *r, void *buf, size_t n) {
+    if (n == 0) return 0;
+    if (!readable(r)) ring_wait(r, &r->reader_waiting, readable);
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t avail = head - r->tail;
+    if (avail == 0) return 0; /* closed and drained */
+    if (n > avail) n = avail;
+    size_t at = r->tail & (r->cap - 1);
+    size_t first = r->cap - at < n ? r->cap - at : n;
+    memcpy(buf, r->buf + at, first);
+    memcpy((char *)buf + first, r->buf, n - first);
+    __atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+    ring_wake(r, &r->writer_waiting);
+    return (ssize_t)n;
+}
+
+/* All n bytes, blocking while the ring is full. -1 (EPIPE) once the reader
+ * has gone. */
+int spsc_ring_write(spsc_ring *r, const void *buf, size_t n) {
+    const char *p = buf;
+    while (n > 0) {
+        if (!writable(r)) ring_wait(r, &r->writer_waiting, writable);
+        if (__atomic_load_n(&r->read_closed, __ATOMIC_ACQUIRE)) {
+            errno = EPIPE;
+            return -1;
+        }
+        size_t room = r->cap - (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+        size_t k = n < room ? n : room;
+        size_t at = r->head & (r->cap - 1);
+        size_t first = r->cap - at < k ? r->cap - at : k;
+        memcpy(r->buf + at, p, first);
+        memcpy(r->buf, p + first, k - first);
+        __atomic_store_n(&r->head, r->head + k, __ATOMIC_RELEASE);
+        ring_wake(r, &r->reader_waiting);
+        p += k;
+        n -= k;
+    }
+    return 0;
+}
+
+void spsc_ring_close_write(spsc_ring *r) {
+    __atomic_store_n(&r->write_closed, 1, __ATOMIC_RELEASE);
+    ring_wake(r, &r->reader_waiting);
+}
+
+void spsc_ring_close_read(spsc_ring *r) {
+    __atomic_store_n(&r->read_closed, 1, __ATOMIC_RELEASE);
+    ring_wake(r, &r->writer_waiting);
+}
+
+/* read(2) on the builtin's input, whichever kind it is */
+ssize_t bio_read(builtin_io *io, void *buf, size_t n) {
+    if (io->rin) return spsc_ring_read(io->rin, buf, n);
+    ssize_t got;
+    while ((got = read(io->in, buf, n)) < 0 && errno == EINTR)
+        ;
+    return got;
+}
+
+/* Write all of buf to the builtin's output. Returns 0 or -1. */
+int bio_write(builtin_io *io, const void *buf, size_t n) {
+    if (io->rout) return spsc_ring_write(io->rout, buf, n);
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t w = write(io->out, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
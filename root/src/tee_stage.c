@@ -0,0 +1,219 @@
+//******************************************************************************************************
+//* Name:        tee_stage.c                                                                           *
+//* Description: In-shell "tee" for pipeline stages.                                                   *
+//*              - When stdin and stdout are both pipes and every output file is a                     *
+//*                regular file, data is duplicated with tee(2) and drained to the files               *
+//*                with splice(2), so it never passes through user space.                              *
+//*              - Otherwise (terminal, socket, device, ring between threaded stages                   *
+//*                ...) falls back to a 1 MiB read/write copy loop.                                    *
+//*              - Supports "-a" to append instead of truncating.                                      *
+//*              Runs as a pipeline thread or in a forked child in place of execve(), see              *
+//*              piping.c.                                                                             *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#define TEE_COPY_BUF (1 << 20)
+#define TEE_CHUNK (1 << 20)
+#define TEE_MAX_FILES 64
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Move exactly len bytes from pipe in to fd out with splice. */
+static int splice_all(int in, int out, size_t len) {
+    while (len > 0) {
+        ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_exact(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int copy_loop(builtin_io *io, const int *files, int nfiles) {
+    char *buf = malloc(TEE_COPY_BUF);
+    if (!buf) return 1;
+    int status = 0;
+    for (;;) {
+        ssize_t n = bio_read(io, buf, TEE_COPY_BUF);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            shell_perror("tee: read");
+            status = 1;
+            break;
+        }
+        if (n == 0) break;
+        if (bio_write(io, buf, (size_t)n) != 0) {
+            shell_perror("tee: write");
+            status = 1;
+            break;
+        }
+        for (int i = 0; i < nfiles; ++i) {
+            if (files[i] >= 0 && write_all(files[i], buf, (size_t)n) != 0) {
+                shell_perror("tee: write");
+                status = 1;
+            }
+        }
+    }
+    free(buf);
+    return status;
+}
+
+/* Zero-copy path: in and out are pipes, files are regular files.
+ * Returns 0, 1 on I/O error, or -1 if the kernel refused before any data
+ * moved (caller falls back to copying).
+ */
+static int splice_loop(int in, int out, const int *files, int nfiles) {
+    int scratch[2] = { -1, -1 };
+    char *buf = NULL;
+    int status = 0;
+    int moved = 0;
+
+    if (nfiles > 1) {
+        if (pipe2(scratch, O_CLOEXEC) == -1) return -1;
+        /* the scratch pipe must hold a whole tee'd chunk */
+        int size = fcntl(in, F_GETPIPE_SZ);
+        if (size > 0) fcntl(scratch[1], F_SETPIPE_SZ, size);
+    }
+    int sink = nfiles > 0 ? files[nfiles - 1] : open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    for (;;) {
+        ssize_t k = tee(in, out, TEE_CHUNK, 0);
+        if (k < 0) {
+            if (errno == EINTR) continue;
+            if (!moved && errno == EINVAL) { status = -1; break; }
+            shell_perror("tee: tee");
+            status = 1;
+            break;
+        }
+        if (k == 0) break; /* EOF */
+        moved = 1;
+
+        /* every file but the last gets its own tee'd copy via the scratch pipe */
+        int j = 0;
+        for (; j < nfiles - 1; ++j) {
+            ssize_t m = tee(in, scratch[1], (size_t)k, 0);
+            if (m != k) {
+                /* scratch too small: drop the partial copy, finish this chunk by copying */
+                if (!buf && !(buf = malloc(TEE_CHUNK))) { status = 1; break; }
+                if (m > 0) read_exact(scratch[0], buf, (size_t)m);
+                break;
+            }
+            if (splice_all(scratch[0], files[j], (size_t)k) != 0) {
+                shell_perror("tee: splice");
+                status = 1;
+            }
+        }
+
+        if (status == 1) break;
+        if (j < nfiles - 1) {
+            if (read_exact(in, buf, (size_t)k) != 0) { status = 1; break; }
+            for (int f = j; f < nfiles; ++f) {
+                if (write_all(files[f], buf, (size_t)k) != 0) status = 1;
+            }
+            continue;
+        }
+
+        /* consume the chunk from the input: into the last file, or /dev/null */
+        if (sink < 0 || splice_all(in, sink, (size_t)k) != 0) {
+            if (!buf && !(buf = malloc(TEE_CHUNK))) { status = 1; break; }
+            if (read_exact(in, buf, (size_t)k) != 0) { status = 1; break; }
+            if (nfiles > 0 && write_all(files[nfiles - 1], buf, (size_t)k) != 0) status = 1;
+        }
+    }
+
+    if (nfiles == 0 && sink >= 0) close(sink);
+    if (scratch[0] >= 0) {
+        close(scratch[0]);
+        close(scratch[1]);
+    }
+    free(buf);
+    return status;
+}
+
+/* tee [-a] [FILE...]: copy io->in to io->out and every FILE. */
+int tee_stage(char **argv, builtin_io *io) {
+    int append = 0;
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "-a") == 0) append = 1;
+        else if (strcmp(argv[i], "--") == 0) { i++; break; }
+        else {
+            dprintf(io->err, "tee: unsupported option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    int files[TEE_MAX_FILES];
+    int nfiles = 0;
+    int status = 0;
+    int all_regular = 1;
+    for (; argv[i]; ++i) {
+        if (nfiles == TEE_MAX_FILES) {
+            dprintf(io->err, "tee: too many files\n");
+            return 1;
+        }
+        int fd = openat(sh->dir_fd, argv[i], O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0) {
+            dprintf(io->err, "tee: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) all_regular = 0;
+        files[nfiles++] = fd;
+    }
+
+    struct stat in_st, out_st;
+    /* splice into O_APPEND files is refused by older kernels */
+    if (append) all_regular = 0;
+
+    int pipes = !io->rin && !io->rout &&
+                fstat(io->in, &in_st) == 0 && S_ISFIFO(in_st.st_mode) &&
+                fstat(io->out, &out_st) == 0 && S_ISFIFO(out_st.st_mode);
+
+    int rc = -1;
+    if (pipes && all_regular) rc = splice_loop(io->in, io->out, files, nfiles);
+    if (rc < 0) rc = copy_loop(io, files, nfiles);
+    if (rc) status = 1;
+
+    for (int f = 0; f < nfiles; ++f) close(files[f]);
+    return status;
+}
@@ -0,0 +1,936 @@
+//******************************************************************************************************
+//* Name:        text_filters.c                                                                        *
+//* Description: In-shell text filters for pipeline stages: wc -l/-c, grep (fixed strings),            *
+//*              head -n and cut -d/-f.                                                                *
+//*              - Newline, delimiter and substring scanning compare 32 bytes at a time                *
+//*                with AVX2 when the CPU has it (checked once at run time), 16 with SSE2              *
+//*                otherwise, and fall back to plain loops off x86.                                    *
+//*              - Regular files are mmap'd and scanned in place. Pipes, rings and                     *
+//*                terminals are read 1 MiB at a time. Whole runs of output lines go out               *
+//*                with one write.                                                                     *
+//*              - head stops reading after line N. A thread stage then closes its input,              *
+//*                so upstream gets EPIPE/SIGPIPE right away. A seekable stdin is                      *
+//*                rewound to just after the last line used.                                           *
+//*              - grep handles fixed strings: -F, or a pattern with no BRE                            *
+//*                metacharacters. Several -e patterns are scanned in a single pass.                   *
+//*              Anything else (other options, regexes) is refused by the *_accepts()                  *
+//*              checks, and the command runs as the external program (builtin_find).                  *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TF_X86 1
+#endif
+
+#define TF_READ_CHUNK (1 << 20)
+#define TF_OUT_BUF (64 * 1024)
+#define TF_MAX_PATTERNS 64
+#define TF_MAX_FIELDS 1024
+
+/* ---------------- SIMD scanning ---------------- */
+
+typedef struct {
+    size_t (*count)(const char *p, size_t n, char c);
+    const char *(*find2)(const char *p, size_t n, char a, char b);
+    const char *(*find)(const char *h, size_t n, const char *needle, size_t m);
+} scan_ops;
+
+static size_t count_scalar(const char *p, size_t n, char c) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) k += p[i] == c;
+    return k;
+}
+
+static const char *find2_scalar(const char *p, size_t n, char a, char b) {
+    for (size_t i = 0; i < n; ++i)
+        if (p[i] == a || p[i] == b) return p + i;
+    return NULL;
+}
+
+static const char *find_scalar(const char *h, size_t n, const char *needle, size_t m) {
+    if (m == 0) return h;
+    return memmem(h, n, needle, m);
+}
+
+#ifdef TF_X86
+/* Matches count into byte lanes (cmpeq is -1, so subtract) and are summed
+ * with psadbw every 255 blocks, before a lane can wrap. */
+static size_t count_sse2(const char *p, size_t n, char c) {
+    const __m128i needle = _mm_set1_epi8(c), zero = _mm_setzero_si128();
+    size_t total = 0, i = 0;
+    while (i + 16 <= n) {
+        __m128i acc = zero;
+        for (int k = 0; k < 255 && i + 16 <= n; ++k, i += 16)
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), needle));
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        total += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return total + count_scalar(p + i, n - i, c);
+}
+
+static const char *find2_sse2(const char *p, size_t n, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask) return p + i + __builtin_ctz((unsigned)mask);
+    }
+    return find2_scalar(p + i, n - i, a, b);
+}
+
+/* Candidates are positions where both the first and the last byte of the
+ * needle match; only those are compared in full. */
+static const char *find_sse2(const char *h, size_t n, const char *needle, size_t m) {
+    if (m < 2 || n < m) return find_scalar(h, n, needle, m);
+    const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i f = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i)), first);
+        __m128i l = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i + m - 1)), last);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(f, l));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(h + i + bit + 1, needle + 1, m - 2) == 0) return h + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(h + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *p, size_t n, char c) {
+    const __m256i needle = _mm256_set1_epi8(c), zero = _mm256_setzero_si256();
+    size_t total = 0, i = 0;
+    while (i + 32 <= n) {
+        __m256i acc = zero;
+        for (int k = 0; k < 255 && i + 32 <= n; ++k, i += 32)
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), needle));
+        __m256i sums = _mm256_sad_epu8(acc, zero);
+        total += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1) +
+                 (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    return total + count_sse2(p + i, n - i, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find2_avx2(const char *p, size_t n, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                                       _mm256_cmpeq_epi8(v, vb)));
+        if (mask) return p + i + __builtin_ctz(mask);
+    }
+    return find2_sse2(p + i, n - i, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *h, size_t n, const char *needle, size_t m) {
+    if (m < 2 || n < m) return find_scalar(h, n, needle, m);
+    const __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i f = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + i)), first);
+        __m256i l = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(h + i + m - 1)), last);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(f, l));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(h + i + bit + 1, needle + 1, m - 2) == 0) return h + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(h + i, n - i, needle, m);
+}
+#endif
+
+static scan_ops scan = { count_scalar, find2_scalar, find_scalar };
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_init(void) {
+#ifdef TF_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan = (scan_ops){ count_avx2, find2_avx2, find_avx2 };
+    else
+        scan = (scan_ops){ count_sse2, find2_sse2, find_sse2 };
+#endif
+}
+
+/* Pointer just past the k-th c in p[0, n), or NULL after subtracting the
+ * number seen from *k. Whole 4 KiB blocks are skipped by count alone. */
+static const char *after_nth(const char *p, size_t n, char c, size_t *k) {
+    size_t off = 0;
+    while (*k > 0 && off < n) {
+        size_t len = n - off < 4096 ? n - off : 4096;
+        size_t here = scan.count(p + off, len, c);
+        if (here < *k) {
+            *k -= here;
+            off += len;
+            continue;
+        }
+        const char *q = p + off;
+        for (;;) {
+            q = memchr(q, c, (size_t)(p + n - q)) + 1;
+            if (--*k == 0) return q;
+        }
+    }
+    return NULL;
+}
+
+/* ---------------- input ---------------- */
+
+typedef struct {
+    builtin_io *io;             /* stdin of the builtin when fd < 0 */
+    int fd;
+    char *map;                  /* whole regular file, when mmap worked */
+    size_t map_len;
+    int map_done;
+    char *buf;                  /* read buffer otherwise */
+    size_t cap, len, keep;      /* keep: bytes of an unfinished line at the front */
+    int eof;
+} tf_input;
+
+/* path NULL or "-": the builtin's stdin. Returns 0 or -1 (reported). */
+static int in_open(tf_input *in, builtin_io *io, const char *path, const char *who) {
+    memset(in, 0, sizeof(*in));
+    in->io = io;
+    in->fd = -1;
+    int fd = -1;
+    if (path && strcmp(path, "-") != 0) {
+        fd = openat(sh->dir_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            dprintf(io->err, "%s: %s: %s\n", who, path, strerror(errno));
+            return -1;
+        }
+        in->fd = fd;
+    } else if (!io->rin) {
+        fd = io->in;
+    }
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && in->fd >= 0) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+            in->map = m;
+            in->map_len = (size_t)st.st_size;
+        }
+    }
+    return 0;
+}
+
+static ssize_t in_read(tf_input *in, char *buf, size_t n) {
+    if (in->fd < 0) return bio_read(in->io, buf, n);
+    ssize_t got;
+    while ((got = read(in->fd, buf, n)) < 0 && errno == EINTR)
+        ;
+    return got;
+}
+
+/* Next piece of input in *p and *n; 0 at EOF, -1 on a read error. With lines,
+ * a piece always ends at a newline (except the last one). */
+static int in_next(tf_input *in, const char **p, size_t *n, int lines) {
+    if (in->map) {
+        if (in->map_done) return 0;
+        in->map_done = 1;
+        *p = in->map;
+        *n = in->map_len;
+        return 1;
+    }
+    if (!in->buf) {
+        in->cap = TF_READ_CHUNK;
+        if (!(in->buf = malloc(in->cap))) return -1;
+    }
+    /* the unfinished line handed out last time moves to the front */
+    memmove(in->buf, in->buf + in->len - in->keep, in->keep);
+    in->len = in->keep;
+    in->keep = 0;
+    for (;;) {
+        if (in->eof) {
+            if (in->len == 0) return 0;
+            *p = in->buf;
+            *n = in->len;
+            in->len = 0;
+            return 1;
+        }
+        if (in->len == in->cap) {
+            char *nb = realloc(in->buf, in->cap * 2);
+            if (!nb) return -1;
+            in->buf = nb;
+            in->cap *= 2;
+        }
+        ssize_t got = in_read(in, in->buf + in->len, in->cap - in->len);
+        if (got < 0) return -1;
+        if (got == 0) {
+            in->eof = 1;
+            continue;
+        }
+        size_t old = in->len;
+        in->len += (size_t)got;
+        if (!lines) {
+            *p = in->buf;
+            *n = in->len;
+            in->len = 0;
+            return 1;
+        }
+        const char *nl = memrchr(in->buf + old, '\n', (size_t)got);
+        if (!nl) continue;
+        *n = (size_t)(nl + 1 - in->buf);
+        *p = in->buf;
+        in->keep = in->len - *n;
+        return 1;
+    }
+}
+
+/* Done early: give a seekable stdin back the bytes read but not used */
+static void in_unread(tf_input *in, size_t unused) {
+    if (in->map || in->fd >= 0 || in->io->rin || unused == 0) return;
+    lseek(in->io->in, -(off_t)unused, SEEK_CUR);
+}
+
+static void in_close(tf_input *in) {
+    if (in->map) munmap(in->map, in->map_len);
+    if (in->fd >= 0) close(in->fd);
+    free(in->buf);
+}
+
+/* ---------------- output ---------------- */
+
+typedef struct {
+    builtin_io *io;
+    char buf[TF_OUT_BUF];
+    size_t len;
+    int failed;                 /* write error */
+    int broken;                 /* ... because the reader went away (EPIPE) */
+} tf_output;
+
+static void out_init(tf_output *o, builtin_io *io) {
+    o->io = io;
+    o->len = 0;
+    o->failed = o->broken = 0;
+}
+
+static void out_error(tf_output *o) {
+    o->failed = 1;
+    if (errno == EPIPE) o->broken = 1;
+    else dprintf(o->io->err, "write error: %s\n", strerror(errno));
+}
+
+static int out_flush(tf_output *o) {
+    if (o->failed) return -1;
+    if (o->len && bio_write(o->io, o->buf, o->len) != 0) out_error(o);
+    o->len = 0;
+    return o->failed ? -1 : 0;
+}
+
+static int out_put(tf_output *o, const char *p, size_t n) {
+    if (o->failed) return -1;
+    if (o->len + n > sizeof(o->buf)) {
+        if (out_flush(o) != 0) return -1;
+        if (n >= sizeof(o->buf) / 2) {
+            /* big runs go straight out of the input buffer or mapping */
+            if (bio_write(o->io, p, n) != 0) {
+                out_error(o);
+                return -1;
+            }
+            return 0;
+        }
+    }
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+    return 0;
+}
+
+/* A line from the input, with the newline the last line may lack */
+static int out_line(tf_output *o, const char *p, size_t n) {
+    if (out_put(o, p, n) != 0) return -1;
+    return (n == 0 || p[n - 1] != '\n') ? out_put(o, "\n", 1) : 0;
+}
+
+/* Options of the form -x, -xVALUE or -x VALUE; *i is advanced past them */
+static const char *opt_value(char **argv, int *i, int at) {
+    if (argv[*i][at]) return argv[*i] + at;
+    return argv[*i + 1] ? argv[++*i] : NULL;
+}
+
+/* Options must all come first: an operand that looks like one (GNU tools
+ * accept "grep foo -c") is left to the real program. */
+static int operands_plain(char **argv, int first) {
+    for (int i = first; argv[i]; ++i)
+        if (argv[i][0] == '-' && argv[i][1]) return 0;
+    return 1;
+}
+
+/* ---------------- wc -l / -c ---------------- */
+
+static int wc_flags(char **argv, int *lines, int *bytes, int *first) {
+    int i = 1;
+    *lines = *bytes = 0;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *c = argv[i] + 1; *c; ++c) {
+            if (*c == 'l') *lines = 1;
+            else if (*c == 'c') *bytes = 1;
+            else return -1;
+        }
+    }
+    *first = i;
+    /* plain wc counts words too */
+    return (*lines || *bytes) && operands_plain(argv, i) ? 0 : -1;
+}
+
+int wc_accepts(char **argv) {
+    int l, c, first;
+    return wc_flags(argv, &l, &c, &first) == 0;
+}
+
+static int count_digits(unsigned long long v) {
+    int d = 1;
+    while (v >= 10) {
+        v /= 10;
+        d++;
+    }
+    return d;
+}
+
+static void wc_print(tf_output *o, int width, int lines, int bytes,
+                     unsigned long long nl, unsigned long long nb, const char *name) {
+    char line[128];
+    int len = 0;
+    if (lines) len += snprintf(line + len, sizeof(line) - (size_t)len, "%*llu", width, nl);
+    if (bytes) len += snprintf(line + len, sizeof(line) - (size_t)len, "%s%*llu", lines ? " " : "", width, nb);
+    out_put(o, line, (size_t)len);
+    if (name) {
+        out_put(o, " ", 1);
+        out_put(o, name, strlen(name));
+    }
+    out_put(o, "\n", 1);
+}
+
+int builtin_wc(char **argv, builtin_io *io) {
+    int lines, bytes, first;
+    if (wc_flags(argv, &lines, &bytes, &first) != 0) {
+        dprintf(io->err, "wc: usage: wc [-l] [-c] [FILE]...\n");
+        return 2;
+    }
+    pthread_once(&scan_once, scan_init);
+    int nfiles = 0;
+    while (argv[first + nfiles]) nfiles++;
+
+    /* coreutils pads every column to the width of the files' byte
+     * total, at least 7 when any input is not a regular file */
+    unsigned long long size = 0;
+    int width = 1;
+    struct stat st;
+    for (int f = 0; f < (nfiles ? nfiles : 1); ++f) {
+        const char *name = nfiles ? argv[first + f] : NULL;
+        if (name && strcmp(name, "-") != 0 && fstatat(sh->dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode))
+            size += (unsigned long long)st.st_size;
+        else
+            width = 7;
+    }
+    if (count_digits(size) > width) width = count_digits(size);
+    if (nfiles <= 1 && !(lines && bytes)) width = 1;
+
+    tf_output *o = malloc(sizeof(*o));
+    if (!o) return 1;
+    out_init(o, io);
+    int status = 0;
+    unsigned long long tl = 0, tb = 0;
+    for (int f = 0; f < (nfiles ? nfiles : 1); ++f) {
+        const char *name = nfiles ? argv[first + f] : NULL;
+        tf_input in;
+        if (in_open(&in, io, name, "wc") != 0) {
+            status = 1;
+            continue;
+        }
+        unsigned long long nl = 0, nb = 0;
+        if (!lines && in.map) {
+            nb = in.map_len;            /* -c on a file: no need to look */
+        } else {
+            const char *p;
+            size_t n;
+            int r;
+            while ((r = in_next(&in, &p, &n, 0)) > 0) {
+                nb += n;
+                if (lines) nl += scan.count(p, n, '\n');
+            }
+            if (r < 0) {
+                dprintf(io->err, "wc: %s: %s\n", name ? name : "-", strerror(errno));
+                status = 1;
+            }
+        }
+        in_close(&in);
+        tl += nl;
+        tb += nb;
+        wc_print(o, width, lines, bytes, nl, nb, name);
+    }
+    if (nfiles > 1) wc_print(o, width, lines, bytes, tl, tb, "total");
+    if (out_flush(o) != 0 && !o->broken) status = 1;
+    free(o);
+    return status;
+}
+
+/* ---------------- grep (fixed strings) ---------------- */
+
+typedef struct {
+    const char *pat[TF_MAX_PATTERNS];
+    size_t len[TF_MAX_PATTERNS];
+    int npat;
+    int invert, count, quiet;
+    int first;                  /* argv index of the first file */
+} grep_opts;
+
+/* Basic regular expressions treat only these specially; a pattern without
+ * them is a fixed string. */
+static int is_fixed(const char *p) {
+    return strpbrk(p, "\\.[]*^$") == NULL;
+}
+
+static int add_patterns(grep_opts *g, const char *arg) {
+    /* one -e argument may hold several newline-separated patterns */
+    for (;;) {
+        if (g->npat == TF_MAX_PATTERNS) return -1;
+        const char *nl = strchr(arg, '\n');
+        g->pat[g->npat] = arg;
+        g->len[g->npat] = nl ? (size_t)(nl - arg) : strlen(arg);
+        g->npat++;
+        if (!nl) return 0;
+        arg = nl + 1;
+    }
+}
+
+static int grep_parse(char **argv, grep_opts *g) {
+    memset(g, 0, sizeof(*g));
+    int fixed = 0, i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (int at = 1; argv[i][at]; ++at) {
+            char c = argv[i][at];
+            if (c == 'F') fixed = 1;
+            else if (c == 'v') g->invert = 1;
+            else if (c == 'c') g->count = 1;
+            else if (c == 'q') g->quiet = 1;
+            else if (c == 'e') {
+                const char *v = opt_value(argv, &i, at + 1);
+                if (!v || add_patterns(g, v) != 0) return -1;
+                break;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (g->npat == 0) {
+        if (!argv[i] || add_patterns(g, argv[i]) != 0) return -1;
+        i++;
+    }
+    for (int k = 0; k < g->npat && !fixed; ++k) {
+        char *one = strndup(g->pat[k], g->len[k]);
+        int ok = one && is_fixed(one);
+        free(one);
+        if (!ok) return -1;
+    }
+    g->first = i;
+    return operands_plain(argv, i) ? 0 : -1;
+}
+
+int grep_accepts(char **argv) {
+    grep_opts g;
+    return grep_parse(argv, &g) == 0;
+}
+
+/* Earliest match of any pattern in [p, end). next[] caches each pattern's
+ * next match at or after the previous p (end: none left), so every pattern
+ * scans the piece once. */
+static const char *grep_next(const grep_opts *g, const char **next, const char *p, const char *end) {
+    const char *best = NULL;
+    for (int k = 0; k < g->npat; ++k) {
+        if (next[k] == end) continue;
+        if (!next[k] || next[k] < p) {
+            const char *m = scan.find(p, (size_t)(end - p), g->pat[k], g->len[k]);
+            next[k] = m ? m : end;
+            if (!m) continue;
+        }
+        if (!best || next[k] < best) best = next[k];
+    }
+    return best;
+}
+
+/* Write [p, q) line by line with "name:" in front, or as one block */
+static int grep_emit(tf_output *o, const char *name, const char *p, const char *q) {
+    if (!name) return p < q ? out_line(o, p, (size_t)(q - p)) : 0;
+    while (p < q) {
+        const char *nl = memchr(p, '\n', (size_t)(q - p));
+        const char *e = nl ? nl + 1 : q;
+        if (out_put(o, name, strlen(name)) != 0 || out_put(o, ":", 1) != 0 ||
+            out_line(o, p, (size_t)(e - p)) != 0) return -1;
+        p = e;
+    }
+    return 0;
+}
+
+static size_t grep_lines(const char *p, const char *q) {
+    if (p >= q) return 0;
+    return scan.count(p, (size_t)(q - p), '\n') + (q[-1] != '\n');
+}
+
+/* Selected lines of one input; returns their number, -1 on error. */
+static long long grep_input(const grep_opts *g, tf_input *in, tf_output *o, const char *name) {
+    long long selected = 0;
+    const char *piece;
+    size_t n;
+    int r;
+    while ((r = in_next(in, &piece, &n, 1)) > 0) {
+        const char *next[TF_MAX_PATTERNS] = { NULL };
+        const char *p = piece, *end = piece + n;
+        while (p < end) {
+            const char *m = grep_next(g, next, p, end);
+            const char *ls = end, *le = end;
+            if (m) {
+                const char *nl = memrchr(p, '\n', (size_t)(m - p));
+                ls = nl ? nl + 1 : p;
+                nl = memchr(m, '\n', (size_t)(end - m));
+                le = nl ? nl + 1 : end;
+            }
+            if (g->invert) {
+                /* everything before the matching line is selected */
+                selected += (long long)grep_lines(p, ls);
+                if (!g->count && !g->quiet && grep_emit(o, name, p, ls) != 0) return -1;
+            } else if (m) {
+                selected++;
+                if (!g->count && !g->quiet && grep_emit(o, name, ls, le) != 0) return -1;
+            }
+            if (g->quiet && selected) return selected;
+            if (!m) break;
+            p = le;
+        }
+    }
+    if (r < 0) {
+        dprintf(o->io->err, "grep: %s: %s\n", name ? name : "(standard input)", strerror(errno));
+        return -1;
+    }
+    return selected;
+}
+
+int builtin_grep(char **argv, builtin_io *io) {
+    grep_opts g;
+    if (grep_parse(argv, &g) != 0) {
+        dprintf(io->err, "grep: usage: grep [-Fvcq] [-e PATTERN]... [PATTERN] [FILE]...\n");
+        return 2;
+    }
+    pthread_once(&scan_once, scan_init);
+    int nfiles = 0;
+    while (argv[g.first + nfiles]) nfiles++;
+
+    tf_output *o = malloc(sizeof(*o));
+    if (!o) return 2;
+    out_init(o, io);
+    int status = 1, errors = 0;
+    for (int f = 0; f < (nfiles ? nfiles : 1); ++f) {
+        const char *name = nfiles ? argv[g.first + f] : NULL;
+        tf_input in;
+        if (in_open(&in, io, name, "grep") != 0) {
+            errors = 1;
+            continue;
+        }
+        long long sel = grep_input(&g, &in, o, nfiles > 1 ? name : NULL);
+        in_close(&in);
+        if (sel < 0) {
+            errors = !o->failed;
+            break;
+        }
+        if (sel > 0) status = 0;
+        if (g.count && !g.quiet) {
+            char num[32];
+            int len = snprintf(num, sizeof(num), "%lld\n", sel);
+            if (nfiles > 1) {
+                out_put(o, name, strlen(name));
+                out_put(o, ":", 1);
+            }
+            out_put(o, num, (size_t)len);
+        }
+        if (g.quiet && status == 0) break;
+    }
+    out_flush(o);
+    free(o);
+    return (errors && !(g.quiet && status == 0)) ? 2 : status;
+}
+
+/* ---------------- head -n ---------------- */
+
+static int head_parse(char **argv, long long *count, int *first) {
+    *count = 10;
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        const char *v;
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (argv[i][1] == 'n') v = opt_value(argv, &i, 2);
+        else if (argv[i][1] >= '0' && argv[i][1] <= '9') v = argv[i] + 1;
+        else return -1;
+        char *end;
+        if (!v || *v < '0' || *v > '9') return -1; /* "-n -N" is not supported */
+        *count = strtoll(v, &end, 10);
+        if (*end) return -1;
+    }
+    *first = i;
+    return operands_plain(argv, i) ? 0 : -1;
+}
+
+int head_accepts(char **argv) {
+    long long n;
+    int first;
+    return head_parse(argv, &n, &first) == 0;
+}
+
+int builtin_head(char **argv, builtin_io *io) {
+    long long count;
+    int first;
+    if (head_parse(argv, &count, &first) != 0) {
+        dprintf(io->err, "head: usage: head [-n N] [FILE]...\n");
+        return 2;
+    }
+    pthread_once(&scan_once, scan_init);
+    int nfiles = 0;
+    while (argv[first + nfiles]) nfiles++;
+
+    tf_output *o = malloc(sizeof(*o));
+    if (!o) return 1;
+    out_init(o, io);
+    int status = 0;
+    for (int f = 0; f < (nfiles ? nfiles : 1) && !o->failed; ++f) {
+        const char *name = nfiles ? argv[first + f] : NULL;
+        tf_input in;
+        if (in_open(&in, io, name, "head") != 0) {
+            status = 1;
+            continue;
+        }
+        if (nfiles > 1) {
+            char hdr[PATH_MAX + 16];
+            int len = snprintf(hdr, sizeof(hdr), "%s==> %s <==\n", f ? "\n" : "", name);
+            out_put(o, hdr, (size_t)len);
+        }
+        size_t want = (size_t)count;
+        const char *p;
+        size_t n;
+        int r = 1;
+        while (want > 0 && (r = in_next(&in, &p, &n, 0)) > 0) {
+            const char *stop = after_nth(p, n, '\n', &want);
+            size_t used = stop ? (size_t)(stop - p) : n;
+            if (out_put(o, p, used) != 0) break;
+            if (stop) in_unread(&in, n - used);
+        }
+        if (r < 0) {
+            dprintf(io->err, "head: %s: %s\n", name ? name : "standard input", strerror(errno));
+            status = 1;
+        }
+        /* the caller closes our input (thread stage) or we exit (child), so
+         * upstream learns right away that nobody is reading */
+        in_close(&in);
+    }
+    if (out_flush(o) != 0 && !o->broken) status = 1;
+    free(o);
+    return status;
+}
+
+/* ---------------- cut -d -f ---------------- */
+
+typedef struct {
+    char delim;
+    int only_delimited;         /* -s */
+    unsigned char sel[TF_MAX_FIELDS + 1];
+    int max;                    /* highest field listed */
+    int open_from;              /* "N-": every field from N on, 0 if none */
+    int first;
+} cut_opts;
+
+static int cut_list(cut_opts *c, const char *list) {
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long lo = 1, hi;
+        if (*p != '-') {
+            lo = strtol(p, &end, 10);
+            if (end == p || lo < 1) return -1;
+            p = end;
+        }
+        hi = lo;
+        if (*p == '-') {
+            p++;
+            if (*p >= '0' && *p <= '9') {
+                hi = strtol(p, &end, 10);
+                p = end;
+            } else {
+                hi = -1;
+            }
+        }
+        if (hi == -1) {
+            if (!c->open_from || lo < c->open_from) c->open_from = (int)lo;
+        } else {
+            if (hi < lo || hi > TF_MAX_FIELDS) return -1;
+            for (long f = lo; f <= hi; ++f) c->sel[f] = 1;
+            if (hi > c->max) c->max = (int)hi;
+        }
+        if (*p == ',') p++;
+        else if (*p) return -1;
+    }
+    return 0;
+}
+
+static int cut_parse(char **argv, cut_opts *c) {
+    memset(c, 0, sizeof(*c));
+    c->delim = '\t';
+    int fields = 0, i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *v;
+        switch (argv[i][1]) {
+        case 'd':
+            v = opt_value(argv, &i, 2);
+            if (!v || strlen(v) != 1) return -1;
+            c->delim = v[0];
+            break;
+        case 'f':
+            v = opt_value(argv, &i, 2);
+            if (!v || cut_list(c, v) != 0) return -1;
+            fields = 1;
+            break;
+        case 's':
+            if (argv[i][2]) return -1;
+            c->only_delimited = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    c->first = i;
+    return fields && (c->max || c->open_from) && operands_plain(argv, i) ? 0 : -1;
+}
+
+int cut_accepts(char **argv) {
+    cut_opts c;
+    return cut_parse(argv, &c) == 0;
+}
+
+static int cut_selected(const cut_opts *c, int f) {
+    return (c->open_from && f >= c->open_from) || (f <= c->max && c->sel[f]);
+}
+
+/* One piece of whole lines */
+static int cut_piece(const cut_opts *c, tf_output *o, const char *p, const char *end) {
+    while (p < end) {
+        const char *ls = p;
+        int field = 1, printed = 0;
+        const char *fs = p;
+        for (;;) {
+            /* past the last listed field: skip straight to the newline */
+            if (!c->open_from && field > c->max) {
+                const char *nl = memchr(fs, '\n', (size_t)(end - fs));
+                p = nl ? nl + 1 : end;
+                break;
+            }
+            /* inside "N-" past field 1: the rest of the line goes out as is */
+            if (c->open_from && field >= c->open_from && field > 1) {
+                const char *nl = memchr(fs, '\n', (size_t)(end - fs));
+                const char *fe = nl ? nl : end;
+                if (printed && out_put(o, &c->delim, 1) != 0) return -1;
+                if (out_put(o, fs, (size_t)(fe - fs)) != 0) return -1;
+                p = nl ? nl + 1 : end;
+                printed = 1;
+                break;
+            }
+            const char *d = scan.find2(fs, (size_t)(end - fs), c->delim, '\n');
+            const char *fe = d ? d : end;
+            int eol = !d || *d == '\n';
+            if (eol && field == 1) {
+                /* no delimiter on this line */
+                if (!c->only_delimited && out_line(o, ls, (size_t)(fe - ls)) != 0) return -1;
+                p = d ? d + 1 : end;
+                printed = -1;
+                break;
+            }
+            if (cut_selected(c, field)) {
+                if (printed && out_put(o, &c->delim, 1) != 0) return -1;
+                if (out_put(o, fs, (size_t)(fe - fs)) != 0) return -1;
+                printed = 1;
+            }
+            if (eol) {
+                p = d ? d + 1 : end;
+                break;
+            }
+            fs = d + 1;
+            field++;
+        }
+        if (printed != -1 && out_put(o, "\n", 1) != 0) return -1;
+    }
+    return 0;
+}
+
+int builtin_cut(char **argv, builtin_io *io) {
+    cut_opts *c = malloc(sizeof(*c));
+    if (!c) return 1;
+    if (cut_parse(argv, c) != 0) {
+        dprintf(io->err, "cut: usage: cut -f LIST [-d DELIM] [-s] [FILE]...\n");
+        free(c);
+        return 2;
+    }
+    pthread_once(&scan_once, scan_init);
+    int nfiles = 0;
+    while (argv[c->first + nfiles]) nfiles++;
+
+    tf_output *o = malloc(sizeof(*o));
+    if (!o) {
+        free(c);
+        return 1;
+    }
+    out_init(o, io);
+    int status = 0;
+    for (int f = 0; f < (nfiles ? nfiles : 1) && !o->failed; ++f) {
+        const char *name = nfiles ? argv[c->first + f] : NULL;
+        tf_input in;
+        if (in_open(&in, io, name, "cut") != 0) {
+            status = 1;
+            continue;
+        }
+        const char *p;
+        size_t n;
+        int r;
+        while ((r = in_next(&in, &p, &n, 1)) > 0)
+            if (cut_piece(c, o, p, p + n) != 0) break;
+        if (r < 0) {
+            dprintf(io->err, "cut: %s: %s\n", name ? name : "-", strerror(errno));
+            status = 1;
+        }
+        in_close(&in);
+    }
+    if (out_flush(o) != 0 && !o->broken) status = 1;
+    free(o);
+    free(c);
+    return status;
+}
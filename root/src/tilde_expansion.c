@@ -9,7 +9,7 @@ char* expand_tilde(char* token){
 		return token;
 	}
 
-	char* home = getenv("HOME");
+	const char* home = var_get("HOME");
 	if(home == NULL) {
 		return token;
 	}
@@ -0,0 +1,280 @@
+//******************************************************************************************************
+//* Name:        timeout.c                                                                             *
+//* Description: "timeout [options] DURATION [options] cmd [args...]" builtin.                         *
+//*              Options: -s/--signal SIG, -k/--kill-after D, --foreground,                            *
+//*              --preserve-status. DURATION is a number with an optional s/m/h/d                      *
+//*              suffix; 0 disables the limit.                                                         *
+//*              - cmd runs in its own process group and the whole group is signalled,                 *
+//*                so everything it started goes too (--foreground: only cmd itself).                  *
+//*              - Foreground: the shell sleeps in poll(2) on a pidfd for the child                    *
+//*                with the remaining time as the timeout; no watchdog process or                      *
+//*                SIGALRM. Without pidfd support it falls back to short waitid polls.                 *
+//*              - "timeout D cmd &" becomes a background job whose deadline is kept in                *
+//*                the job table and enforced while the shell waits for input (see                     *
+//*                part_eight_wait_input in background_proc.c).                                        *
+//*              - "timeout D a | b" limits a only; "pipeline --timeout D a | b" puts all              *
+//*                the stages in one process group under one deadline (piping.c).                      *
+//*              Exit status follows GNU timeout: 124 when the time ran out, 137 if                    *
+//*              SIGKILL was needed, otherwise the command's own status.                               *
+//******************************************************************************************************
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+#define TIMEOUT_EXPIRED 124
+
+typedef struct {
+    double secs;
+    double kill_after;
+    int sig;
+    int foreground;
+    int preserve;
+    int cmd;                    /* index of the command word in argv */
+} timeout_opts;
+
+static const struct { const char *name; int sig; } signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+    { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+};
+
+int parse_signal(const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (*s && *end == '\0') return (n > 0 && n < NSIG) ? (int)n : -1;
+    if (strncasecmp(s, "SIG", 3) == 0) s += 3;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); ++i)
+        if (strcasecmp(s, signal_names[i].name) == 0) return signal_names[i].sig;
+    return -1;
+}
+
+/* "1.5", "30s", "2m", "1h", "1d" -> seconds, or -1 */
+double parse_duration(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    switch (*end) {
+    case '\0':
+    case 's': break;
+    case 'm': v *= 60; break;
+    case 'h': v *= 3600; break;
+    case 'd': v *= 86400; break;
+    default: return -1;
+    }
+    if (*end && end[1]) return -1;
+    return v;
+}
+
+/* Options may come before and after DURATION. Returns 0 or -1 (message
+ * printed). */
+static int parse_opts(char **argv, timeout_opts *o, int errfd) {
+    o->secs = -1;
+    o->kill_after = 0;
+    o->sig = SIGTERM;
+    o->foreground = 0;
+    o->preserve = 0;
+    int i = 1;
+    for (; argv[i]; ++i) {
+        const char *a = argv[i];
+        const char *val = NULL;
+        int sig_opt = (a[0] == '-' && (a[1] == 's' || (a[1] == '-' && a[2] == 's')));
+        if (strcmp(a, "-s") == 0 || strcmp(a, "--signal") == 0 ||
+            strcmp(a, "-k") == 0 || strcmp(a, "--kill-after") == 0) {
+            val = argv[++i];
+            if (!val) {
+                dprintf(errfd, "timeout: %s needs an argument\n", a);
+                return -1;
+            }
+        } else if (strncmp(a, "--signal=", 9) == 0) {
+            val = a + 9;
+        } else if (strncmp(a, "--kill-after=", 13) == 0) {
+            val = a + 13;
+        }
+
+        if (val && sig_opt) {
+            if ((o->sig = parse_signal(val)) < 0) {
+                dprintf(errfd, "timeout: %s: invalid signal\n", val);
+                return -1;
+            }
+        } else if (val) {
+            if ((o->kill_after = parse_duration(val)) < 0) {
+                dprintf(errfd, "timeout: %s: invalid duration\n", val);
+                return -1;
+            }
+        } else if (strcmp(a, "--foreground") == 0) {
+            o->foreground = 1;
+        } else if (strcmp(a, "--preserve-status") == 0) {
+            o->preserve = 1;
+        } else if (o->secs < 0) {
+            if ((o->secs = parse_duration(a)) < 0) {
+                dprintf(errfd, "timeout: %s: invalid duration\n", a);
+                return -1;
+            }
+        } else {
+            break;
+        }
+    }
+    if (o->secs < 0 || !argv[i]) {
+        dprintf(errfd, "timeout: usage: timeout [-s SIG] [-k DURATION] DURATION command [args...]\n");
+        return -1;
+    }
+    o->cmd = i;
+    return 0;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Fork cmd with io as its stdio, in a new process group unless foreground. */
+static pid_t spawn(char **cmd, builtin_io *io, int new_group) {
+    fflush(stdout);
+    char **envp = var_envp();
+    pid_t pid = fork();
+    if (pid == 0) {
+        shell_child_setup();
+        if (new_group) setpgid(0, 0);
+        redir_fds r = { { io->in, io->out, io->err }, { -1, -1, -1 } };
+        if (redirect_apply(&r) != 0) _exit(1);
+        const builtin_t *builtin = builtin_find(cmd);
+        if (builtin) {
+            builtin_io cio = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+            int status = builtin->fn(cmd, &cio);
+            fflush(stdout);
+            _exit(status);
+        }
+        execute_search(cmd[0], cmd, envp);
+        _exit(127);
+    }
+    /* set it from both sides so a signal can't race the child's setpgid */
+    if (pid > 0 && new_group) setpgid(pid, pid);
+    return pid;
+}
+
+/* Send sig to the group (or just the process); a stopped group is woken
+ * so it can act on it. */
+void timeout_signal(pid_t pid, int group, int sig) {
+    if (group) {
+        killpg(pid, sig);
+        if (sig != SIGKILL && sig != SIGCONT) killpg(pid, SIGCONT);
+    } else {
+        kill(pid, sig);
+        if (sig != SIGKILL && sig != SIGCONT) kill(pid, SIGCONT);
+    }
+}
+
+/* pidfd_open(2), or -1 on kernels/libcs without it */
+int pidfd_for(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Block until pid exits or ms elapses (ms < 0: no limit). Returns 1 when it
+ * has exited (not yet reaped), 0 on timeout. */
+static int wait_exit(pid_t pid, int pfd, long long ms) {
+    if (pfd >= 0) {
+        struct pollfd p = { .fd = pfd, .events = POLLIN };
+        for (;;) {
+            int n = poll(&p, 1, ms < 0 ? -1 : (int)(ms > 0x7fffffff ? 0x7fffffff : ms));
+            if (n > 0) return 1;
+            if (n == 0) return 0;
+            if (errno != EINTR) return 1;
+        }
+    }
+    /* no pidfd: peek with waitid(WNOWAIT) every 10ms */
+    long long end = ms < 0 ? -1 : now_ms() + ms;
+    for (;;) {
+        siginfo_t si;
+        si.si_pid = 0;
+        if (waitid(P_PID, (id_t)pid, &si, WEXITED | WNOHANG | WNOWAIT) == 0 && si.si_pid == pid) return 1;
+        if (end >= 0 && now_ms() >= end) return 0;
+        struct timespec nap = { 0, 10 * 1000000L };
+        nanosleep(&nap, NULL);
+    }
+}
+
+int builtin_timeout(char **argv, builtin_io *io) {
+    timeout_opts o;
+    if (parse_opts(argv, &o, io->err) != 0) return 125;
+
+    pid_t pid = spawn(argv + o.cmd, io, !o.foreground);
+    if (pid < 0) {
+        dprintf(io->err, "timeout: fork: %s\n", strerror(errno));
+        return 125;
+    }
+
+    int pfd = pidfd_for(pid);
+    int timed_out = 0;
+    long long limit = o.secs > 0 ? (long long)(o.secs * 1000) : -1;
+    if (!wait_exit(pid, pfd, limit)) {
+        timed_out = 1;
+        timeout_signal(pid, !o.foreground, o.sig);
+        long long grace = o.kill_after > 0 ? (long long)(o.kill_after * 1000) : -1;
+        if (!wait_exit(pid, pfd, grace)) timeout_signal(pid, !o.foreground, SIGKILL);
+    }
+    if (pfd >= 0) close(pfd);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (timed_out && !o.preserve)
+        return (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) ? 128 + SIGKILL : TIMEOUT_EXPIRED;
+    return code;
+}
+
+/* "timeout D cmd &": start cmd as a background job with a deadline instead
+ * of waiting for it. Returns 0 or 1 like a builtin. */
+int timeout_start_job(char **argv, const char *cmdline) {
+    redir_fds r;
+    if (redirect_open(argv, &r) != 0) return 1;
+    const int shell_fds[3] = { STDIN_FILENO, sh->fd_out, sh->fd_err };
+    timeout_opts o;
+    if (parse_opts(argv, &o, redirect_fd(&r, 2, shell_fds)) != 0) {
+        redirect_close(&r);
+        return 1;
+    }
+    /* "set -o capture": output that isn't redirected goes to the capture pipe */
+    int capture = job_capture_prepare();
+    const int base[3] = { STDIN_FILENO, capture >= 0 ? capture : sh->fd_out,
+                          capture >= 0 ? capture : sh->fd_err };
+    builtin_io io = { redirect_fd(&r, 0, base), redirect_fd(&r, 1, base), redirect_fd(&r, 2, base) };
+    pid_t pid = spawn(argv + o.cmd, &io, !o.foreground);
+    job_capture_parent();
+    redirect_close(&r);
+    if (pid < 0) {
+        shell_perror("fork");
+        return 1;
+    }
+    int jobno = part_eight_add_job(cmdline, &pid, 1, pid);
+    if (jobno < 0) {
+        /* nobody would enforce the deadline: don't leave it running */
+        timeout_signal(pid, !o.foreground, SIGKILL);
+        waitpid(pid, NULL, 0);
+        dprintf(sh->fd_err, "timeout: too many jobs\n");
+        return 1;
+    }
+    if (o.secs > 0)
+        part_eight_set_deadline(jobno, o.foreground ? 0 : pid, (long long)(o.secs * 1000),
+                                o.sig, (long long)(o.kill_after * 1000));
+    return 0;
+}
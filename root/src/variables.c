@@ -0,0 +1,288 @@
+//******************************************************************************************************
+//* Name:        variables.c                                                                           *
+//* Description: Shell variable store.                                                                 *
+//*              - Chained hash table of NAME -> value, each entry either local to the                 *
+//*                shell or exported to children.                                                      *
+//*              - Seeded from environ at startup (everything inherited is exported).                  *
+//*              - var_envp() returns a cached NULL-terminated "NAME=value" array for                  *
+//*                execve(); it is only rebuilt after an exported variable changes.                    *
+//*              - Lookups by (pointer, length) let the expander resolve names straight                *
+//*                out of a token without copying them first.                                          *
+//******************************************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "shell.h"
+
+extern char **environ;
+
+#define VARS_INITIAL_BUCKETS 64
+
+struct shell_var {
+    struct shell_var *next;
+    unsigned long hash;
+    int exported;
+    size_t name_len;
+    char *entry;            /* "NAME=value" in one allocation */
+    char *value;            /* points into entry after the '=' */
+};
+
+/* The store itself is sh->vars, one per context (see libshell.c).
+ * sh->path_generation changes whenever PATH does, so cached lookups can
+ * tell they are stale; values come from one process-wide counter, so no
+ * two contexts (or two PATHs) ever share one. */
+static unsigned long generations = 1;
+
+/* FNV-1a */
+static unsigned long hash_name(const char *name, size_t len) {
+    unsigned long h = 1469598103934665603UL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+static shell_var *lookup(const char *name, size_t len, unsigned long h) {
+    if (!sh->vars.buckets) return NULL;
+    for (shell_var *v = sh->vars.buckets[h & (sh->vars.nbuckets - 1)]; v; v = v->next) {
+        if (v->hash == h && v->name_len == len && memcmp(v->entry, name, len) == 0)
+            return v;
+    }
+    return NULL;
+}
+
+static int grow(void) {
+    size_t nsize = sh->vars.nbuckets ? sh->vars.nbuckets * 2 : VARS_INITIAL_BUCKETS;
+    shell_var **nb = calloc(nsize, sizeof(shell_var *));
+    if (!nb) return -1;
+    for (size_t i = 0; i < sh->vars.nbuckets; ++i) {
+        shell_var *v = sh->vars.buckets[i];
+        while (v) {
+            shell_var *next = v->next;
+            v->next = nb[v->hash & (nsize - 1)];
+            nb[v->hash & (nsize - 1)] = v;
+            v = next;
+        }
+    }
+    free(sh->vars.buckets);
+    sh->vars.buckets = nb;
+    sh->vars.nbuckets = nsize;
+    return 0;
+}
+
+/* Validate NAME: first char alpha or '_', the rest alnum or '_'. */
+int var_name_valid(const char *name, size_t len) {
+    if (len == 0) return 0;
+    if (!(isalpha((unsigned char)name[0]) || name[0] == '_')) return 0;
+    for (size_t i = 1; i < len; ++i) {
+        if (!(isalnum((unsigned char)name[i]) || name[i] == '_')) return 0;
+    }
+    return 1;
+}
+
+/* If tok looks like NAME=value return the length of NAME, otherwise 0. */
+size_t var_assignment_len(const char *tok) {
+    const char *eq = strchr(tok, '=');
+    if (!eq || eq == tok) return 0;
+    size_t len = (size_t)(eq - tok);
+    return var_name_valid(tok, len) ? len : 0;
+}
+
+static void on_change(shell_var *v) {
+    if (v->exported) sh->vars.envp_dirty = 1;
+    if (v->name_len == 4 && memcmp(v->entry, "PATH", 4) == 0) sh->path_generation = ++generations;
+    else if (v->name_len == 3 && memcmp(v->entry, "PS1", 3) == 0) prompt_set_format(v->value);
+}
+
+static int set_entry(const char *name, size_t len, const char *value, int exported) {
+    unsigned long h = hash_name(name, len);
+    shell_var *v = lookup(name, len, h);
+
+    size_t vlen = strlen(value);
+    char *entry = malloc(len + 1 + vlen + 1);
+    if (!entry) return -1;
+    memcpy(entry, name, len);
+    entry[len] = '=';
+    memcpy(entry + len + 1, value, vlen + 1);
+
+    if (!v) {
+        if (sh->vars.nvars + 1 > sh->vars.nbuckets * 3 / 4 && grow() != 0) {
+            free(entry);
+            return -1;
+        }
+        v = calloc(1, sizeof(shell_var));
+        if (!v) {
+            free(entry);
+            return -1;
+        }
+        v->hash = h;
+        v->name_len = len;
+        v->next = sh->vars.buckets[h & (sh->vars.nbuckets - 1)];
+        sh->vars.buckets[h & (sh->vars.nbuckets - 1)] = v;
+        sh->vars.nvars++;
+    } else {
+        /* the envp cache may still point at the old entry until rebuilt */
+        if (v->exported) sh->vars.envp_dirty = 1;
+        free(v->entry);
+    }
+    v->entry = entry;
+    v->value = entry + len + 1;
+    if (exported) v->exported = 1;
+    on_change(v);
+    return 0;
+}
+
+void vars_init(void) {
+    sh->path_generation = ++generations;
+    if (!sh->vars.buckets && grow() != 0) return;
+    for (char **e = environ; e && *e; ++e) {
+        const char *eq = strchr(*e, '=');
+        if (!eq || eq == *e) continue;
+        set_entry(*e, (size_t)(eq - *e), eq + 1, 1);
+    }
+    sh->vars.envp_dirty = 1;
+}
+
+/* Release the current context's store. */
+void vars_free(void) {
+    for (size_t i = 0; i < sh->vars.nbuckets; ++i) {
+        shell_var *v = sh->vars.buckets[i];
+        while (v) {
+            shell_var *next = v->next;
+            free(v->entry);
+            free(v);
+            v = next;
+        }
+    }
+    free(sh->vars.buckets);
+    free(sh->vars.envp_cache);
+    memset(&sh->vars, 0, sizeof(sh->vars));
+}
+
+const char *var_getn(const char *name, size_t len) {
+    shell_var *v = lookup(name, len, hash_name(name, len));
+    return v ? v->value : NULL;
+}
+
+const char *var_get(const char *name) {
+    return var_getn(name, strlen(name));
+}
+
+/* Set NAME to value. New variables are local; an already exported variable
+ * stays exported.
+ */
+int var_set(const char *name, const char *value) {
+    if (!sh->vars.buckets && grow() != 0) return -1;
+    return set_entry(name, strlen(name), value ? value : "", 0);
+}
+
+/* Mark NAME exported, creating it empty if it does not exist yet. */
+int var_export(const char *name) {
+    size_t len = strlen(name);
+    shell_var *v = lookup(name, len, hash_name(name, len));
+    if (!v) {
+        if (!sh->vars.buckets && grow() != 0) return -1;
+        return set_entry(name, len, "", 1);
+    }
+    if (!v->exported) {
+        v->exported = 1;
+        sh->vars.envp_dirty = 1;
+    }
+    return 0;
+}
+
+void var_unset(const char *name) {
+    size_t len = strlen(name);
+    unsigned long h = hash_name(name, len);
+    if (!sh->vars.buckets) return;
+    shell_var **pp = &sh->vars.buckets[h & (sh->vars.nbuckets - 1)];
+    while (*pp) {
+        shell_var *v = *pp;
+        if (v->hash == h && v->name_len == len && memcmp(v->entry, name, len) == 0) {
+            *pp = v->next;
+            if (v->exported) sh->vars.envp_dirty = 1;
+            if (len == 4 && memcmp(name, "PATH", 4) == 0) sh->path_generation = ++generations;
+            free(v->entry);
+            free(v);
+            sh->vars.nvars--;
+            return;
+        }
+        pp = &v->next;
+    }
+}
+
+/* Environment for execve(). The array is owned by the store and stays valid
+ * until the next change to an exported variable. Call it in the parent
+ * before fork(): built in a child, the cache is lost with it.
+ */
+char **var_envp(void) {
+    if (!sh->vars.envp_dirty && sh->vars.envp_cache) return sh->vars.envp_cache;
+
+    size_t count = 0;
+    for (size_t i = 0; i < sh->vars.nbuckets; ++i)
+        for (shell_var *v = sh->vars.buckets[i]; v; v = v->next)
+            if (v->exported) count++;
+
+    char **envp = malloc((count + 1) * sizeof(char *));
+    if (!envp) return environ;
+
+    size_t n = 0;
+    for (size_t i = 0; i < sh->vars.nbuckets; ++i)
+        for (shell_var *v = sh->vars.buckets[i]; v; v = v->next)
+            if (v->exported) envp[n++] = v->entry;
+    envp[n] = NULL;
+
+    free(sh->vars.envp_cache);
+    sh->vars.envp_cache = envp;
+    sh->vars.envp_dirty = 0;
+    return sh->vars.envp_cache;
+}
+
+/* Call fn for every variable; entry is "NAME=value". */
+void var_foreach(void (*fn)(const char *entry, size_t name_len, int exported, void *arg), void *arg) {
+    for (size_t i = 0; i < sh->vars.nbuckets; ++i)
+        for (shell_var *v = sh->vars.buckets[i]; v; v = v->next)
+            fn(v->entry, v->name_len, v->exported, arg);
+}
+
+/* Handle a word of the form NAME=value; value has already been expanded. */
+int var_assign(const char *word) {
+    size_t len = var_assignment_len(word);
+    if (!len) return -1;
+    if (!sh->vars.buckets && grow() != 0) return -1;
+    return set_entry(word, len, word + len + 1, 0);
+}
+
+/* Builtin: export NAME[=value] ... */
+int builtin_export(char **args, builtin_io *io) {
+    int status = 0;
+    if (!args[1]) {
+        for (size_t i = 0; i < sh->vars.nbuckets; ++i)
+            for (shell_var *v = sh->vars.buckets[i]; v; v = v->next)
+                if (v->exported) dprintf(io->out, "export %s\n", v->entry);
+        return 0;
+    }
+    for (int i = 1; args[i]; ++i) {
+        size_t len = var_assignment_len(args[i]);
+        if (len) {
+            if (!sh->vars.buckets && grow() != 0) return 1;
+            if (set_entry(args[i], len, args[i] + len + 1, 1) != 0) status = 1;
+        } else if (var_name_valid(args[i], strlen(args[i]))) {
+            if (var_export(args[i]) != 0) status = 1;
+        } else {
+            dprintf(io->err, "export: `%s': not a valid identifier\n", args[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* Builtin: unset NAME ... */
+int builtin_unset(char **args, builtin_io *io) {
+    (void)io;
+    for (int i = 1; args[i]; ++i) var_unset(args[i]);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Regression checks for command substitution (command_subst.c): "exit" in
+# $(...) ends only the substitution, quietly, and its status becomes $?
+# (it once printed the exit banner and history into the result and left
+# $? at 0).
+#
+# usage: tests/command_subst.sh
+#
+# SHELL_BIN picks the binary (default bin/shell). Exit status 0 when all
+# pass.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+
+fail=0
+# $1: one line of shell input, $2: the output expected from it
+check() {
+    got=$(printf '%s\n' "$1" | "$SHELL_BIN" --norc 2>&1 | sed 's/^[^>]*> //' | sed '/^$/d')
+    if [ "$got" != "$2" ]; then
+        echo "FAIL: $1"
+        echo "    expected: $2"
+        echo "    got:      $got"
+        fail=1
+    fi
+}
+
+check 'echo [$(exit 3)] st=$?' '[] st=3'
+check 'echo [$(exit 4; echo no)] st=$?' '[] st=4'
+check 'echo [$(false; exit)] st=$?' '[] st=1'
+check 'echo [$(echo out; exit 0)] st=$?' '[out] st=0'
+
+[ "$fail" -eq 0 ] && echo "command_subst: all passed"
+exit "$fail"
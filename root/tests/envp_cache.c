@@ -0,0 +1,55 @@
+/* Checks that the exec environment (var_envp) is built in the shell, not in
+ * each child: execs with no export in between reuse one array, and an
+ * export makes the next exec rebuild it. Built and run by
+ * tests/envp_cache.sh against the library build.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "shell.h"
+
+static int fail;
+
+static void expect(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        fail = 1;
+    }
+}
+
+static void run(shell_ctx *ctx, const char *text, const char *want_out) {
+    shell_result res;
+    shell_ctx_run(ctx, text, &res);
+    if (want_out && strcmp(res.out, want_out) != 0) {
+        printf("FAIL: %s: got \"%s\"\n", text, res.out);
+        fail = 1;
+    }
+    shell_result_free(&res);
+}
+
+static int has_entry(char **envp, const char *entry) {
+    for (; envp && *envp; ++envp)
+        if (strcmp(*envp, entry) == 0) return 1;
+    return 0;
+}
+
+int main(void) {
+    shell_ctx *ctx = shell_ctx_new();
+    if (!ctx) return 1;
+
+    run(ctx, "/bin/true\n", "");
+    char **first = ctx->vars.envp_cache;
+    expect(first && !ctx->vars.envp_dirty, "an exec leaves a clean cache in the shell");
+    run(ctx, "/bin/true\n/bin/true | /bin/true\n", "");
+    expect(ctx->vars.envp_cache == first && !ctx->vars.envp_dirty,
+           "execs with no export in between reuse the array");
+
+    run(ctx, "export ENVP_CACHE_TEST=1\n", "");
+    expect(ctx->vars.envp_dirty, "export marks the cache stale");
+    run(ctx, "env | grep ENVP_CACHE_TEST\n", "ENVP_CACHE_TEST=1\n");
+    expect(!ctx->vars.envp_dirty && has_entry(ctx->vars.envp_cache, "ENVP_CACHE_TEST=1"),
+           "the exec after an export rebuilds the array");
+
+    shell_ctx_free(ctx);
+    if (!fail) printf("envp_cache: all passed\n");
+    return fail;
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Regression check for the exec environment cache (variables.c var_envp):
+# builds tests/envp_cache.c against the library build and runs it.
+#
+# usage: tests/envp_cache.sh
+#
+# Exit status 0 when all pass.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+DIR=$(mktemp -d /tmp/shell-test.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+make -s -C "$ROOT" lib > /dev/null || exit 1
+gcc -std=c99 -D_POSIX_C_SOURCE=200809L -I"$ROOT/include" "$ROOT/tests/envp_cache.c" \
+    "$ROOT/bin/libshell.a" -lpthread -o "$DIR/envp_cache" || exit 1
+"$DIR/envp_cache"
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Regression checks for pathname expansion (glob_expand.c), run in a
+# scratch directory: a pattern ending in '/' matches directories only and
+# each match keeps the '/' ("d/*/" once gave "d/a d/c d/x.c").
+#
+# usage: tests/glob_expand.sh
+#
+# SHELL_BIN picks the binary (default bin/shell). Exit status 0 when all
+# pass.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-test.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+mkdir -p "$DIR/d/a/sub" "$DIR/d/c"
+touch "$DIR/d/x.c" "$DIR/d/a/f"
+ln -s a "$DIR/d/la"
+ln -s x.c "$DIR/d/lx"
+cd "$DIR" || exit 1
+
+fail=0
+# $1: one line of shell input, $2: the output expected from it
+check() {
+    got=$(printf '%s\n' "$1" | "$SHELL_BIN" --norc 2>&1 | sed 's/^[^>]*> //' | sed '/^$/d')
+    if [ "$got" != "$2" ]; then
+        echo "FAIL: $1"
+        echo "    expected: $2"
+        echo "    got:      $got"
+        fail=1
+    fi
+}
+
+check 'echo d/*' 'd/a d/c d/la d/lx d/x.c'
+check 'echo d/*/' 'd/a/ d/c/ d/la/'
+check 'echo d/[ac]/' 'd/a/ d/c/'
+check 'echo d/*/sub/' 'd/a/sub/ d/la/sub/'
+check 'echo d/*/f/' 'd/*/f/'
+check 'echo d/x*/' 'd/x*/'
+
+[ "$fail" -eq 0 ] && echo "glob_expand: all passed"
+exit "$fail"
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Regression checks for the pipeline rewrite pass (pipe_plan.c): every
+# pipeline below must give the same output with "set -o pipeopt" as with
+# "set +o pipeopt", and the shell must survive them (empty stages such as
+# "| wc -l" once crashed it).
+#
+# usage: tests/pipe_plan.sh
+#
+# SHELL_BIN picks the binary (default bin/shell). Exit status 0 when all
+# pass.
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SHELL_BIN=${SHELL_BIN:-$ROOT/bin/shell}
+DIR=$(mktemp -d /tmp/shell-test.XXXXXX)
+trap 'rm -rf "$DIR"' EXIT
+
+seq 1 40 > "$DIR/f"
+printf 'b\na\nb\nc\n' > "$DIR/g"
+cd "$DIR" || exit 1
+
+fail=0
+# $1: one line of shell input; the prompt is stripped from the output
+check() {
+    for opt in +o -o; do
+        printf 'set %s pipeopt\n%s\necho status $?\n' "$opt" "$1" \
+            | "$SHELL_BIN" --norc 2>&1 | sed 's/^[^>]*> //' > "$DIR/out$opt"
+        rc=$(printf 'set %s pipeopt\n%s\n' "$opt" "$1" | "$SHELL_BIN" --norc > /dev/null 2>&1; echo $?)
+        if [ "$rc" -ge 128 ]; then
+            echo "FAIL (signal $((rc - 128)), set $opt pipeopt): $1"
+            fail=1
+            return
+        fi
+    done
+    if ! cmp -s "$DIR/out+o" "$DIR/out-o"; then
+        echo "FAIL (output differs): $1"
+        diff "$DIR/out+o" "$DIR/out-o" | sed 's/^/    /'
+        fail=1
+    fi
+}
+
+check "| wc -l"
+check "ls | | wc -l"
+check "cat f | wc -l"
+check "cat f | grep 1 | head -n 3"
+check "seq 1 20 | cat | head -n 5 | head -n 3"
+check "seq 1 50 | tail -5 | tail -n 2"
+check "cat g | sort | sort | uniq | uniq"
+check "cat missing | wc -l"
+check "cat f | wc -l < g"
+
+[ "$fail" -eq 0 ] && echo "pipe_plan: all passed"
+exit "$fail"